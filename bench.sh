@@ -0,0 +1,46 @@
+#!/bin/bash
+
+# Builds one of the programs in bench/ and runs it, e.g. "./bench.sh bench --seconds 10 > bench_output.txt",
+# "./bench.sh soak --seconds 14400 > soak_output.txt" or "./bench.sh pwm_check > pwm_check_output.txt".
+# Arguments after the name are passed on to the program, which prints its results as JSON on stdout.
+# 'soak' and 'pwm_check' also print a pass/fail verdict and exit with 1 if any check failed.
+
+NAME=$1
+if [ -z "$NAME" ] || [ "$NAME" = "bench_util" ] || [ ! -f "bench/$NAME.c" ]
+then
+    echo "Usage: $0 NAME [options], NAME is one of: $(ls bench/*.c | xargs -n 1 basename -s .c | grep -v '^bench_util$' | paste -s -d ' ')" >&2
+    exit 1
+fi
+shift
+
+mkdir -p build
+
+pushd lib/tco_libd > /dev/null
+./build.sh > /dev/null
+mv -f build/tco_libd.a ../../build
+popd > /dev/null
+
+pushd build > /dev/null
+clang \
+    -Wall \
+    -std=c11 \
+    -D _DEFAULT_SOURCE \
+    -I /usr/include \
+    -I ../lib/tco_shmem \
+    -I ../lib/tco_libd/include \
+    -I ../code \
+    -l pthread \
+    -l rt \
+    -l m \
+    -l i2c \
+    -l ncurses \
+    -l gpiod \
+    $(ls ../code/*.c | grep -v '/main\.c$') \
+    ../bench/bench_util.c \
+    ../bench/$NAME.c \
+    tco_libd.a \
+    -o tco_actuationd_$NAME.bin \
+    -O2 || exit 1
+popd > /dev/null
+
+./build/tco_actuationd_$NAME.bin "$@"
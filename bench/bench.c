@@ -0,0 +1,652 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <signal.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <time.h>
+
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "tco_libd.h"
+
+#include "actuator.h"
+#include "pca9685.h"
+#include "bus_sim.h"
+#include "ch_cfg.h"
+#include "ctrl.h"
+#include "loop.h"
+#include "pipeline.h"
+#include "bench_util.h"
+
+#define BENCH_VERSION 8
+#define BENCH_HOT_ITERS_DEFAULT 20000U
+#define BENCH_SECONDS_DEFAULT 5U
+#define BENCH_PRODUCER_HZ_DEFAULT 50U
+#define BENCH_LATENCY_MAX 100000U
+#define BENCH_COMMIT_TIMEOUT_NS 100000000U
+#define BENCH_ESTOP_TRIALS_DEFAULT 50U
+#define BENCH_BROWNOUT_MAX 1000U
+#define BENCH_RECOVER_TIMEOUT_NS 1000000000U
+
+int log_level = LOG_ERROR;
+
+typedef struct
+{
+    uint32_t hot_iters;
+    uint32_t seconds;
+    uint32_t rate_hz;
+    uint32_t producer_hz;
+    uint32_t clock_hz;
+    uint32_t estop_trials;
+    uint8_t estop_off;
+    uint8_t pwm_sync;
+    uint8_t no_bell;
+    uint32_t pwm_hz;
+    uint32_t fault_ppm; /* Simulated transfers out of a million that fail. */
+    uint32_t brownouts; /* Times the chip loses power after the e-stop trials. */
+    uint32_t check_ms;
+    uint32_t traj_lead_us; /* If >0, frames are published as trajectory points due this much later. */
+    uint32_t aux_num;      /* Low priority channels the producer changes in every frame. */
+} bench_cfg_t;
+
+/* Cost of one kind of frame commit on the hot path. */
+typedef struct
+{
+    double ingest_ns; /* Time the control loop spends handing a frame to the writers. */
+    double cpu_ns;    /* CPU time per commit of all threads excluding bus time. */
+    double bus_ns;    /* Modeled bus time per commit. */
+    double bytes;     /* Bytes on the wire per commit. */
+    double xfers;     /* Combined transfers per commit. */
+    double max_hz;    /* Commit rate the CPU and bus can sustain back to back. */
+} bench_commit_t;
+
+static bench_cfg_t cfg = {
+    .hot_iters = BENCH_HOT_ITERS_DEFAULT,
+    .seconds = BENCH_SECONDS_DEFAULT,
+    .rate_hz = LOOP_TICK_HZ_DEFAULT,
+    .producer_hz = BENCH_PRODUCER_HZ_DEFAULT,
+    .pwm_hz = PCA9685_PWM_FREQ_DEFAULT,
+    .clock_hz = BUS_SIM_CLOCK_HZ_DEFAULT,
+    .estop_trials = BENCH_ESTOP_TRIALS_DEFAULT,
+    .check_ms = ACTR_CHECK_MS_DEFAULT,
+};
+
+static uint64_t latency_ns[BENCH_LATENCY_MAX];
+static uint64_t pulse_latency_ns[BENCH_LATENCY_MAX];
+static uint32_t latency_num = 0;
+static uint32_t frames_lost = 0;
+static struct ctrl_shmem_seq *seq_seg = NULL;
+static struct ctrl_shmem_traj *traj_seg = NULL;
+static uint64_t estop_latency_ns[BENCH_ESTOP_TRIALS_DEFAULT * 100U];
+static uint32_t estop_latency_num = 0;
+static uint32_t estop_lost = 0;
+static uint64_t outage_ns[BENCH_BROWNOUT_MAX];
+static uint32_t outage_num = 0;
+static uint32_t outage_lost = 0;
+static uint8_t conv_failed = 0; /* Set by the producer if a pulse fraction did not convert. */
+
+static int u64_cmp(void const *a, void const *b)
+{
+    uint64_t const x = *(uint64_t const *)a, y = *(uint64_t const *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Time "actr_frame_set" for frames that change @p ch_changed channels on every commit. Each
+ * frame is flushed so the writer does the full work for every one of them.
+ */
+static int bench_commit(uint8_t const ch_changed, bench_commit_t *const res)
+{
+    float frame[2][PCA9685_REG_CH_NUM];
+    for (uint8_t ch_i = 0; ch_i < PCA9685_REG_CH_NUM; ch_i++)
+    {
+        frame[0][ch_i] = 0.25f;
+        frame[1][ch_i] = ch_i < ch_changed ? 0.75f : 0.25f;
+    }
+    actr_frame_set(frame[0], PCA9685_REG_CH_NUM);
+    actr_flush();
+
+    bus_sim_stats_t before, after;
+    bus_sim_stats_get(actr_bus_get(0), &before);
+    uint64_t ingest_ns = 0;
+    uint64_t const cpu_start = clock_ns(CLOCK_PROCESS_CPUTIME_ID);
+    for (uint32_t iter_i = 0; iter_i < cfg.hot_iters; iter_i++)
+    {
+        uint64_t const ingest_start = clock_ns(CLOCK_MONOTONIC);
+        if (actr_frame_set(frame[(iter_i + 1) & 1U], PCA9685_REG_CH_NUM) != 0)
+        {
+            return -1;
+        }
+        ingest_ns += clock_ns(CLOCK_MONOTONIC) - ingest_start;
+        if (actr_flush() != 0)
+        {
+            return -1;
+        }
+    }
+    uint64_t const cpu_ns = clock_ns(CLOCK_PROCESS_CPUTIME_ID) - cpu_start;
+    bus_sim_stats_get(actr_bus_get(0), &after);
+
+    res->ingest_ns = (double)ingest_ns / cfg.hot_iters;
+    res->cpu_ns = (double)cpu_ns / cfg.hot_iters;
+    res->bus_ns = (double)(after.busy_ns - before.busy_ns) / cfg.hot_iters;
+    res->bytes = (double)(after.bytes - before.bytes) / cfg.hot_iters;
+    res->xfers = (double)(after.xfer - before.xfer) / cfg.hot_iters;
+    res->max_hz = 1e9 / (res->cpu_ns + res->bus_ns);
+    return 0;
+}
+
+static void bench_commit_print(char const *const name, bench_commit_t const *const res, char const *const sep)
+{
+    printf("    \"%s\": {\"ingest_ns\": %.1f, \"cpu_ns\": %.1f, \"bus_ns\": %.1f, \"bytes\": %.2f, \"xfers\": %.3f, \"max_hz\": %.1f}%s\n",
+           name, res->ingest_ns, res->cpu_ns, res->bus_ns, res->bytes, res->xfers, res->max_hz, sep);
+}
+
+/**
+ * @brief Measure the hot path against a simulated bus that does not take real time.
+ */
+static int bench_hot(void)
+{
+    actr_cfg_t const actr_cfg = {.sim = 1, .sim_clock_hz = cfg.clock_hz, .sim_fast = 1, .pwm_hz = cfg.pwm_hz};
+    if (actr_init(&actr_cfg) != 0)
+    {
+        return -1;
+    }
+
+    float fracs[256];
+    for (uint32_t frac_i = 0; frac_i < 256U; frac_i++)
+    {
+        fracs[frac_i] = frac_i / 255.0f;
+    }
+    uint16_t duty = 0;
+    int conv_status = 0;
+    volatile uint32_t duty_sum = 0; /* Keeps the conversions from being optimized out. */
+    ch_cfg_t const *const ch_cfg = ch_cfg_get();
+    uint64_t const conv_start = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+    for (uint32_t iter_i = 0; iter_i < cfg.hot_iters; iter_i++)
+    {
+        conv_status |= ch_cfg_frac_to_raw(ch_cfg, iter_i % PCA9685_REG_CH_NUM, fracs[iter_i & 0xffU], &duty);
+        duty_sum += duty;
+    }
+    double const conv_ns = (double)(clock_ns(CLOCK_THREAD_CPUTIME_ID) - conv_start) / cfg.hot_iters;
+    if (conv_status != 0)
+    {
+        fprintf(stderr, "Pulse fraction conversion failed\n");
+        actr_deinit();
+        return -1;
+    }
+
+    bench_commit_t all, one, same;
+    if (bench_commit(PCA9685_REG_CH_NUM, &all) != 0 || bench_commit(1, &one) != 0 || bench_commit(0, &same) != 0)
+    {
+        return -1;
+    }
+    actr_deinit();
+
+    printf("  \"hot_path\": {\n");
+    printf("    \"frac_to_raw_ns\": %.1f,\n", conv_ns);
+    bench_commit_print("frame_all_changed", &all, ",");
+    bench_commit_print("frame_one_changed", &one, ",");
+    bench_commit_print("frame_unchanged", &same, "");
+    printf("  },\n");
+    return 0;
+}
+
+/**
+ * @brief Publish a frame through the seqlock segment, or as a trajectory point due 'traj_lead_us'
+ * from now, and wake the daemon, unless the producer is configured to be polled and it is not an
+ * emergency. Emergencies in trajectory mode go through the header and are due right away.
+ * @return Time the frame was published or the point is due.
+ */
+static uint64_t bench_publish(float const frac[PCA9685_REG_CH_NUM], uint8_t const emergency)
+{
+    uint64_t const publish = clock_ns(CLOCK_MONOTONIC);
+    uint32_t *wake_word;
+    uint64_t due = publish;
+    if (traj_seg != NULL)
+    {
+        __atomic_store_n(&(traj_seg->emergency), emergency, __ATOMIC_RELAXED);
+        if (!emergency)
+        {
+            uint64_t const head = traj_seg->head;
+            struct ctrl_traj_point *const pt = &(traj_seg->pt[head % CTRL_TRAJ_LEN]);
+            due = publish + ((uint64_t)cfg.traj_lead_us * 1000U);
+            pt->time_ns = due;
+            pt->ramp = 0;
+            pt->data.emergency = 0;
+            for (uint8_t ch_i = 0; ch_i < PCA9685_REG_CH_NUM; ch_i++)
+            {
+                pt->data.ch[ch_i].active = 1;
+                pt->data.ch[ch_i].pulse_frac = frac[ch_i];
+            }
+            __atomic_store_n(&(traj_seg->head), head + 1, __ATOMIC_RELEASE);
+        }
+        __atomic_add_fetch(&(traj_seg->seq), 1, __ATOMIC_RELEASE);
+        wake_word = &(traj_seg->seq);
+    }
+    else
+    {
+        __atomic_add_fetch(&(seq_seg->seq), 1, __ATOMIC_ACQ_REL);
+        seq_seg->data.emergency = emergency;
+        for (uint8_t ch_i = 0; ch_i < PCA9685_REG_CH_NUM; ch_i++)
+        {
+            seq_seg->data.ch[ch_i].active = 1;
+            seq_seg->data.ch[ch_i].pulse_frac = frac[ch_i];
+        }
+        __atomic_add_fetch(&(seq_seg->seq), 1, __ATOMIC_RELEASE);
+        wake_word = &(seq_seg->seq);
+    }
+    if (!cfg.no_bell || emergency)
+    {
+        syscall(SYS_futex, wake_word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+    }
+    return due;
+}
+
+/**
+ * @brief Convert a pulse fraction for channel 0 and fail the run if it is out of range.
+ * @return Duty cycle count, 0 if the conversion failed.
+ */
+static uint16_t bench_duty(float const frac)
+{
+    uint16_t duty = 0;
+    if (ch_cfg_frac_to_raw(ch_cfg_get(), 0, frac, &duty) != 0)
+    {
+        conv_failed = 1;
+    }
+    return duty;
+}
+
+/**
+ * @brief Wait until the simulated chip latched @p duty on channel 0 after @p publish, which may lie
+ * ahead for trajectory points.
+ * @param pulse If not NULL, where the time from @p publish to the start of the first PWM period
+ * with the new value gets written.
+ * @return Time from @p publish to the latch or 0 on timeout.
+ */
+static uint64_t bench_latch_wait(uint64_t const publish, uint16_t const duty, uint64_t *const pulse)
+{
+    bus_sim_out_t out;
+    while (clock_ns(CLOCK_MONOTONIC) <= publish + BENCH_COMMIT_TIMEOUT_NS)
+    {
+        bus_sim_out_get(actr_bus_get(0), PCA9685_ADDR, &out);
+        if (out.led[0][2] == (duty & 0xffU) && out.led[0][3] == ((duty >> 8) & 0x1fU) && out.latch_time >= publish)
+        {
+            if (pulse != NULL)
+            {
+                *pulse = out.pulse_time - publish;
+            }
+            return out.latch_time - publish;
+        }
+        usleep(20);
+    }
+    return 0;
+}
+
+/**
+ * @brief Raise the emergency flag while a frame that changes every channel is being written and
+ * measure the time until the neutral (or full off) of channel 0 is latched.
+ */
+static void bench_estop(void)
+{
+    uint64_t const frame_ns = (1 + (PCA9685_REG_CH_NUM * PCA9685_REG_CH_LEN)) * 9ULL * 1000000000U / cfg.clock_hz;
+    uint16_t const neutral = cfg.estop_off ? 0x1000U : ch_cfg_get()->ch[0].neutral; /* Full OFF bit. */
+    float frac[PCA9685_REG_CH_NUM];
+    for (uint32_t trial_i = 0; trial_i < cfg.estop_trials; trial_i++)
+    {
+        for (uint8_t ch_i = 0; ch_i < PCA9685_REG_CH_NUM; ch_i++)
+        {
+            frac[ch_i] = (trial_i & 1U) ? 0.2f : 0.8f;
+        }
+        bench_publish(frac, 0);
+        /* Land the emergency anywhere within the frame write. */
+        usleep((rand() % frame_ns) / 1000U);
+        uint64_t const lat = bench_latch_wait(bench_publish(frac, 1), neutral, NULL);
+        if (lat > 0)
+        {
+            estop_latency_ns[estop_latency_num++] = lat;
+        }
+        else
+        {
+            estop_lost++;
+        }
+        /* Leave the outputs away from neutral so the next e-stop has something to write. */
+        bench_latch_wait(bench_publish(frac, 0), bench_duty(frac[0]), NULL);
+    }
+}
+
+/**
+ * @brief Make the chip lose power while it outputs a frame and measure the time until it outputs
+ * that frame again, which includes the time until the writer finds out.
+ */
+static void bench_brownout(void)
+{
+    float frac[PCA9685_REG_CH_NUM];
+    for (uint32_t trial_i = 0; trial_i < cfg.brownouts; trial_i++)
+    {
+        for (uint8_t ch_i = 0; ch_i < PCA9685_REG_CH_NUM; ch_i++)
+        {
+            frac[ch_i] = (trial_i & 1U) ? 0.3f : 0.7f;
+        }
+        uint16_t const duty = bench_duty(frac[0]);
+        bench_latch_wait(bench_publish(frac, 0), duty, NULL);
+
+        uint64_t const cycle = clock_ns(CLOCK_MONOTONIC);
+        bus_sim_chip_power_cycle(actr_bus_get(0), PCA9685_ADDR);
+        bus_sim_out_t out;
+        uint64_t outage = 0;
+        while (outage == 0 && clock_ns(CLOCK_MONOTONIC) - cycle <= BENCH_RECOVER_TIMEOUT_NS)
+        {
+            usleep(50);
+            bus_sim_out_get(actr_bus_get(0), PCA9685_ADDR, &out);
+            if (out.running && out.latch_time >= cycle && out.led[0][2] == (duty & 0xffU) && out.led[0][3] == ((duty >> 8) & 0x1fU))
+            {
+                outage = out.latch_time - cycle;
+            }
+        }
+        if (outage > 0)
+        {
+            outage_ns[outage_num++] = outage;
+        }
+        else
+        {
+            outage_lost++;
+        }
+    }
+}
+
+/**
+ * @brief Synthetic control producer. Publishes frames through the seqlock or trajectory segment and
+ * measures the time until the simulated chip latches each one, then runs the e-stop trials.
+ */
+static void *bench_producer(void *arg)
+{
+    (void)arg;
+    uint8_t mapped;
+    if (cfg.traj_lead_us > 0)
+    {
+        mapped = (traj_seg = seg_map(CTRL_SHMEM_NAME_TRAJ, CTRL_SHMEM_SIZE_TRAJ)) != NULL;
+    }
+    else
+    {
+        mapped = (seq_seg = seg_map(CTRL_SHMEM_NAME_SEQ, CTRL_SHMEM_SIZE_SEQ)) != NULL;
+    }
+
+    uint64_t const period_ns = 1000000000U / cfg.producer_hz;
+    uint64_t const end = clock_ns(CLOCK_MONOTONIC) + ((uint64_t)cfg.seconds * 1000000000U);
+    uint64_t next = clock_ns(CLOCK_MONOTONIC);
+    uint32_t frame_i = 0;
+    float frac[PCA9685_REG_CH_NUM];
+    while (mapped && !conv_failed && next < end && latency_num < BENCH_LATENCY_MAX)
+    {
+        /* Jitter the publish time so it lands at every phase of the tick. */
+        next += period_ns / 2 + (rand() % period_ns);
+        struct timespec const until = {.tv_sec = next / 1000000000U, .tv_nsec = next % 1000000000U};
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL);
+
+        for (uint8_t ch_i = 0; ch_i < PCA9685_REG_CH_NUM; ch_i++)
+        {
+            frac[ch_i] = ch_i == 0 ? 0.1f + ((frame_i % 80U) / 100.0f) : 0.5f;
+            /* Channels 0 and 1 are the high priority ones of the built-in configuration. */
+            if (ch_i >= 2 && ch_i < 2 + cfg.aux_num)
+            {
+                frac[ch_i] = (frame_i & 1U) ? 0.3f : 0.7f;
+            }
+        }
+        uint16_t const duty = bench_duty(frac[0]);
+        frame_i++;
+
+        uint64_t pulse = 0;
+        uint64_t const lat = bench_latch_wait(bench_publish(frac, 0), duty, &pulse);
+        if (lat > 0)
+        {
+            pulse_latency_ns[latency_num] = pulse;
+            latency_ns[latency_num++] = lat;
+        }
+        else
+        {
+            frames_lost++;
+        }
+    }
+    if (mapped)
+    {
+        bench_estop();
+        bench_brownout();
+    }
+    kill(getpid(), SIGTERM); /* Stops the event loop. */
+    return NULL;
+}
+
+/**
+ * @brief Run the daemon event loop against a real-time simulated bus and a synthetic producer.
+ */
+static int bench_loop(void)
+{
+    actr_cfg_t const actr_cfg = {.sim = 1, .sim_clock_hz = cfg.clock_hz, .sim_fast = 0, .estop_off = cfg.estop_off,
+                                 .pwm_hz = cfg.pwm_hz, .pwm_sync = cfg.pwm_sync, .sync_guard_us = ACTR_SYNC_GUARD_US_DEFAULT,
+                                 .check_ms = cfg.check_ms};
+    loop_cfg_t const loop_cfg = {.tick_hz = cfg.rate_hz, .quiet = 1};
+    ctrl_emergency_cb_set(actr_estop_request);
+    if (loop_init(&loop_cfg) != 0 || ctrl_init(cfg.traj_lead_us > 0 ? CTRL_MODE_TRAJ : CTRL_MODE_SEQLOCK, 0) != 0 ||
+        actr_init(&actr_cfg) != 0 || loop_fd_add(ctrl_wake_fd(), pipeline_wake, NULL) != 0 ||
+        (ctrl_deadline_fd() != -1 && loop_fd_add(ctrl_deadline_fd(), pipeline_deadline, NULL) != 0) ||
+        (actr_sync_fd() != -1 && loop_fd_add(actr_sync_fd(), pipeline_sync, NULL) != 0) ||
+        bus_sim_fault_set(actr_bus_get(0), cfg.fault_ppm) != ERR_OK)
+    {
+        return -1;
+    }
+
+    pthread_t producer;
+    if (pthread_create(&producer, NULL, bench_producer, NULL) != 0)
+    {
+        return -1;
+    }
+    bus_sim_stats_t before, after;
+    bus_sim_stats_get(actr_bus_get(0), &before);
+    uint64_t const cpu_start = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+    int const run_status = loop_run(pipeline_tick, NULL);
+    uint64_t const cpu_ns = clock_ns(CLOCK_THREAD_CPUTIME_ID) - cpu_start;
+    bus_sim_stats_get(actr_bus_get(0), &after);
+    pthread_join(producer, NULL);
+
+    loop_stats_t const *const stats = loop_stats_get();
+    double const passes = (double)(stats->ticks + stats->events);
+    qsort(latency_ns, latency_num, sizeof(latency_ns[0]), u64_cmp);
+    qsort(pulse_latency_ns, latency_num, sizeof(pulse_latency_ns[0]), u64_cmp);
+
+    printf("  \"loop\": {\n");
+    printf("    \"ticks\": %llu, \"overruns\": %llu, \"wakeups\": %llu,\n",
+           (unsigned long long)stats->ticks, (unsigned long long)stats->overruns, (unsigned long long)stats->events);
+    printf("    \"frames\": %u, \"frames_lost\": %u,\n", latency_num, frames_lost);
+    printf("    \"wake_latency_us\": {\"mean\": %.1f, \"max\": %.1f},\n",
+           stats->ticks > 0 ? (stats->wake_lat_sum_ns / 1000.0) / stats->ticks : 0, stats->wake_lat_max_ns / 1000.0);
+    printf("    \"latency_us\": {\"p50\": %.1f, \"p90\": %.1f, \"p99\": %.1f, \"max\": %.1f},\n",
+           percentile_us(latency_ns, latency_num, 50), percentile_us(latency_ns, latency_num, 90),
+           percentile_us(latency_ns, latency_num, 99), percentile_us(latency_ns, latency_num, 100));
+    printf("    \"pulse_latency_us\": {\"p50\": %.1f, \"p90\": %.1f, \"p99\": %.1f, \"max\": %.1f},\n",
+           percentile_us(pulse_latency_ns, latency_num, 50), percentile_us(pulse_latency_ns, latency_num, 90),
+           percentile_us(pulse_latency_ns, latency_num, 99), percentile_us(pulse_latency_ns, latency_num, 100));
+    printf("    \"sync_late\": %llu,\n", (unsigned long long)actr_io_stats_get()->sync_late);
+    printf("    \"cpu_us_per_pass\": %.2f,\n", passes > 0 ? cpu_ns / passes / 1000.0 : 0);
+    printf("    \"bytes_per_pass\": %.2f, \"xfers_per_pass\": %.3f\n",
+           passes > 0 ? (after.bytes - before.bytes) / passes : 0, passes > 0 ? (after.xfer - before.xfer) / passes : 0);
+    printf("  },\n");
+
+    printf("  \"prio\": {\n");
+    for (uint8_t prio = 0; prio < ACTR_PRIO_NUM; prio++)
+    {
+        actr_prio_stats_t const *const prio_stats = actr_prio_stats_get(prio);
+        printf("    \"%s\": {\"ch_written\": %llu, \"bus_us_per_pass\": %.1f, \"deferred\": %llu, \"yielded\": %llu}%s\n",
+               prio == ACTR_PRIO_HIGH ? "high" : "low", (unsigned long long)prio_stats->ch_written,
+               passes > 0 ? prio_stats->busy_ns / passes / 1000.0 : 0, (unsigned long long)prio_stats->deferred,
+               (unsigned long long)prio_stats->yielded, prio + 1U < ACTR_PRIO_NUM ? "," : "");
+    }
+    printf("  },\n");
+
+    /* Measured by the producer from raising the flag to the latch and by the daemon from the request. */
+    actr_estop_stats_t const *const estop_stats = actr_estop_stats_get();
+    qsort(estop_latency_ns, estop_latency_num, sizeof(estop_latency_ns[0]), u64_cmp);
+    printf("  \"estop\": {\n");
+    printf("    \"trials\": %u, \"lost\": %u, \"preempted\": %llu,\n",
+           estop_latency_num, estop_lost, (unsigned long long)estop_stats->preempted);
+    printf("    \"latency_us\": {\"p50\": %.1f, \"p99\": %.1f, \"max\": %.1f},\n",
+           percentile_us(estop_latency_ns, estop_latency_num, 50), percentile_us(estop_latency_ns, estop_latency_num, 99),
+           percentile_us(estop_latency_ns, estop_latency_num, 100));
+    printf("    \"daemon_latency_us\": {\"mean\": %.1f, \"max\": %.1f}\n",
+           estop_stats->count > 0 ? (estop_stats->lat_sum_ns / 1000.0) / estop_stats->count : 0, estop_stats->lat_max_ns / 1000.0);
+    printf("  },\n");
+
+    /* Outage is measured by the producer from the power loss, recovery by the daemon from finding it. */
+    actr_fault_stats_t const *const fault_stats = actr_fault_stats_get();
+    qsort(outage_ns, outage_num, sizeof(outage_ns[0]), u64_cmp);
+    printf("  \"faults\": {\n");
+    printf("    \"injected\": %llu, \"retries\": %llu, \"errors\": %llu, \"reopens\": %llu,\n",
+           (unsigned long long)(after.fault - before.fault), (unsigned long long)fault_stats->retries,
+           (unsigned long long)actr_io_stats_get()->errors, (unsigned long long)fault_stats->reopens);
+    printf("    \"brownouts\": %u, \"lost\": %u, \"resets\": %llu, \"recoveries\": %llu, \"failed\": %llu,\n",
+           outage_num, outage_lost, (unsigned long long)fault_stats->resets, (unsigned long long)fault_stats->recoveries,
+           (unsigned long long)fault_stats->failed);
+    printf("    \"outage_us\": {\"p50\": %.1f, \"max\": %.1f}, \"recover_us\": {\"max\": %.1f}\n",
+           percentile_us(outage_ns, outage_num, 50), percentile_us(outage_ns, outage_num, 100), fault_stats->recover_max_ns / 1000.0);
+    printf("  }\n");
+
+    actr_deinit();
+    loop_deinit();
+    if (conv_failed)
+    {
+        fprintf(stderr, "Pulse fraction conversion failed\n");
+        return -1;
+    }
+    return run_status;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: tco_actuationd_bench.bin [options]\n"
+                    "-i, --iters N        Commits per hot path measurement (default %u).\n"
+                    "-s, --seconds N      Duration of the event loop run (default %u).\n"
+                    "-r, --rate HZ        Event loop tick rate (default %u).\n"
+                    "-p, --producer HZ    Mean synthetic producer rate (default %u).\n"
+                    "-b, --bus-clock HZ   Simulated I2C clock (default %u).\n"
+                    "-e, --estop N        E-stop trials after the event loop run, at most %u (default %u).\n"
+                    "-o, --estop-off      E-stops turn outputs fully off instead of making them neutral.\n"
+                    "-y, --pwm-sync       Write once per PWM period, just before it starts.\n"
+                    "-n, --no-bell        Producer does not ring the doorbell, frames are picked up by the loop.\n"
+                    "-w, --pwm-hz HZ      PWM frequency of the simulated chip, %u to %u (default %u).\n"
+                    "-f, --fault-ppm N    Make N out of a million simulated transfers fail (default 0).\n"
+                    "-B, --brownouts N    Power cycles of the chip after the e-stop trials, at most %u (default 0).\n"
+                    "-c, --check-ms MS    Period of the chip configuration readback, 0 for none (default %u).\n"
+                    "-j, --traj US        Publish frames as trajectory points due US microseconds later. Latency\n"
+                    "                     is then measured from when a point is due.\n"
+                    "-a, --aux N          Also change N low priority channels in every frame, at most %u (default 0).\n",
+            BENCH_HOT_ITERS_DEFAULT, BENCH_SECONDS_DEFAULT, LOOP_TICK_HZ_DEFAULT, BENCH_PRODUCER_HZ_DEFAULT, BUS_SIM_CLOCK_HZ_DEFAULT,
+            (unsigned)(sizeof(estop_latency_ns) / sizeof(estop_latency_ns[0])), BENCH_ESTOP_TRIALS_DEFAULT, PCA9685_PWM_FREQ_MIN,
+            PCA9685_PWM_FREQ_MAX, PCA9685_PWM_FREQ_DEFAULT, BENCH_BROWNOUT_MAX, ACTR_CHECK_MS_DEFAULT, PCA9685_REG_CH_NUM - 2U);
+}
+
+int main(int argc, char *const argv[])
+{
+    static struct option const long_opts[] = {
+        {"iters", required_argument, NULL, 'i'},
+        {"seconds", required_argument, NULL, 's'},
+        {"rate", required_argument, NULL, 'r'},
+        {"producer", required_argument, NULL, 'p'},
+        {"bus-clock", required_argument, NULL, 'b'},
+        {"estop", required_argument, NULL, 'e'},
+        {"estop-off", no_argument, NULL, 'o'},
+        {"pwm-sync", no_argument, NULL, 'y'},
+        {"no-bell", no_argument, NULL, 'n'},
+        {"pwm-hz", required_argument, NULL, 'w'},
+        {"fault-ppm", required_argument, NULL, 'f'},
+        {"brownouts", required_argument, NULL, 'B'},
+        {"check-ms", required_argument, NULL, 'c'},
+        {"traj", required_argument, NULL, 'j'},
+        {"aux", required_argument, NULL, 'a'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+    int parse_status = 0;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "i:s:r:p:b:e:oynw:f:B:c:j:a:h", long_opts, NULL)) != -1)
+    {
+        switch (opt)
+        {
+        case 'i':
+            parse_status = num_parse(optarg, 1, UINT32_MAX, &cfg.hot_iters);
+            break;
+        case 's':
+            parse_status = num_parse(optarg, 0, UINT32_MAX, &cfg.seconds);
+            break;
+        case 'r':
+            parse_status = num_parse(optarg, 1, LOOP_TICK_HZ_MAX, &cfg.rate_hz);
+            break;
+        case 'p':
+            parse_status = num_parse(optarg, 1, UINT32_MAX, &cfg.producer_hz);
+            break;
+        case 'b':
+            parse_status = num_parse(optarg, 1, UINT32_MAX, &cfg.clock_hz);
+            break;
+        case 'e':
+            parse_status = num_parse(optarg, 0, sizeof(estop_latency_ns) / sizeof(estop_latency_ns[0]), &cfg.estop_trials);
+            break;
+        case 'o':
+            cfg.estop_off = 1;
+            break;
+        case 'y':
+            cfg.pwm_sync = 1;
+            break;
+        case 'n':
+            cfg.no_bell = 1;
+            break;
+        case 'w':
+            parse_status = num_parse(optarg, PCA9685_PWM_FREQ_MIN, PCA9685_PWM_FREQ_MAX, &cfg.pwm_hz);
+            break;
+        case 'f':
+            parse_status = num_parse(optarg, 0, 1000000U, &cfg.fault_ppm);
+            break;
+        case 'B':
+            parse_status = num_parse(optarg, 0, BENCH_BROWNOUT_MAX, &cfg.brownouts);
+            break;
+        case 'c':
+            parse_status = num_parse(optarg, 0, UINT32_MAX, &cfg.check_ms);
+            break;
+        case 'j':
+            parse_status = num_parse(optarg, 0, UINT32_MAX, &cfg.traj_lead_us);
+            break;
+        case 'a':
+            parse_status = num_parse(optarg, 0, PCA9685_REG_CH_NUM - 2U, &cfg.aux_num);
+            break;
+        default:
+            usage();
+            return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+        if (parse_status != 0)
+        {
+            fprintf(stderr, "Invalid value '%s' for -%c\n\n", optarg, opt);
+            usage();
+            return EXIT_FAILURE;
+        }
+    }
+    if (log_init("actuationd_bench", "./bench_log.txt") != 0)
+    {
+        fprintf(stderr, "Failed to initialize the logger\n");
+        return EXIT_FAILURE;
+    }
+    ch_cfg_timebase_set(pca9685_count_ps(PCA9685_OSC_FREQ, pca9685_prescale_calc(PCA9685_OSC_FREQ, cfg.pwm_hz)));
+
+    printf("{\n");
+    printf("  \"version\": %u,\n", BENCH_VERSION);
+    printf("  \"config\": {\"hot_iters\": %u, \"seconds\": %u, \"rate_hz\": %u, \"producer_hz\": %u, \"bus_clock_hz\": %u, \"estop_trials\": %u, \"estop_off\": %u, \"pwm_sync\": %u, \"no_bell\": %u, \"pwm_hz\": %u, \"fault_ppm\": %u, \"brownouts\": %u, \"check_ms\": %u, \"traj_lead_us\": %u, \"aux_num\": %u},\n",
+           cfg.hot_iters, cfg.seconds, cfg.rate_hz, cfg.producer_hz, cfg.clock_hz, cfg.estop_trials, cfg.estop_off, cfg.pwm_sync, cfg.no_bell, cfg.pwm_hz,
+           cfg.fault_ppm, cfg.brownouts, cfg.check_ms, cfg.traj_lead_us, cfg.aux_num);
+    if (bench_hot() != 0 || bench_loop() != 0)
+    {
+        fprintf(stderr, "Benchmark failed, see ./bench_log.txt\n");
+        return EXIT_FAILURE;
+    }
+    printf("}\n");
+    return EXIT_SUCCESS;
+}
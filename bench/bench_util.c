@@ -0,0 +1,56 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include <sys/mman.h>
+
+#include "tco_libd.h"
+
+#include "bench_util.h"
+#include "telem.h"
+
+uint64_t clock_ns(clockid_t const clock)
+{
+    struct timespec now;
+    clock_gettime(clock, &now);
+    return ((uint64_t)now.tv_sec * 1000000000U) + now.tv_nsec;
+}
+
+void *seg_map(char const *const name, size_t const size)
+{
+    int const fd = shm_open(name, O_RDWR, 0666);
+    void *const seg = fd == -1 ? MAP_FAILED : mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (fd != -1)
+    {
+        close(fd);
+    }
+    if (seg == MAP_FAILED)
+    {
+        log_error("Failed to map %s", name);
+        return NULL;
+    }
+    return seg;
+}
+
+double percentile_us(uint64_t const *const sorted, uint32_t const num, double const pct)
+{
+    if (num == 0)
+    {
+        return 0;
+    }
+    return sorted[telem_pct_rank(num, pct) - 1] / 1000.0;
+}
+
+int num_parse(char const *const arg, uint32_t const min, uint32_t const max, uint32_t *const val)
+{
+    char *end = NULL;
+    errno = 0;
+    long long const num = strtoll(arg, &end, 10);
+    if (end == arg || *end != '\0' || errno != 0 || num < min || num > max)
+    {
+        return -1;
+    }
+    *val = (uint32_t)num;
+    return 0;
+}
@@ -0,0 +1,36 @@
+#ifndef _BENCH_UTIL_H_
+#define _BENCH_UTIL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+/*
+Helpers shared by the programs in bench/, which './bench.sh NAME' builds and runs.
+*/
+
+/**
+ * @brief Read @p clock in nanoseconds.
+ */
+uint64_t clock_ns(clockid_t const clock);
+
+/**
+ * @brief Map a control segment the daemon created.
+ * @return Pointer to the segment or NULL on failure.
+ */
+void *seg_map(char const *const name, size_t const size);
+
+/**
+ * @brief Get a percentile of sorted samples, by the same nearest rank as the daemon's telemetry.
+ * @param sorted Samples in nanoseconds, in ascending order.
+ * @return Percentile in microseconds or 0 if there are no samples.
+ */
+double percentile_us(uint64_t const *const sorted, uint32_t const num, double const pct);
+
+/**
+ * @brief Parse a whole decimal option value and check its range.
+ * @return 0 on success and -1 if @p arg is not a number or out of range.
+ */
+int num_parse(char const *const arg, uint32_t const min, uint32_t const max, uint32_t *const val);
+
+#endif /* _BENCH_UTIL_H_ */
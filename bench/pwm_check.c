@@ -0,0 +1,468 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <poll.h>
+#include <time.h>
+
+#include <sys/stat.h>
+#include <sys/inotify.h>
+
+#include "tco_libd.h"
+
+#include "actuator.h"
+#include "pca9685.h"
+#include "bus_sim.h"
+#include "ch_cfg.h"
+#include "pwm_sysfs.h"
+
+#define PWM_CHECK_VERSION 1
+#define PWM_CHECK_CHIP 0U        /* pwmchipN of the fake tree. */
+#define PWM_CHECK_NPWM 4U        /* Channels of the fake PWM chip. */
+#define PWM_CHECK_POLL_MS 10U    /* How often the fake kernel looks whether it should stop. */
+#define PWM_CHECK_GONE_MS 200U   /* How long an unexported channel may take to disappear. */
+#define PWM_CHECK_PREEXISTING 3U /* Channel of the fake chip that is exported before the daemon starts. */
+
+int log_level = LOG_ERROR;
+
+/*
+Drives the kernel PWM backend through "actr_*" against a fake sysfs tree under a temporary
+directory. A thread stands in for the kernel and creates or removes 'pwmN' whenever a number is
+written to 'export' or 'unexport', which are FIFOs so every write is seen on its own. Writes to 'duty_cycle' are counted with inotify, every write
+syscall gives one IN_MODIFY event.
+*/
+
+static char root[PATH_MAX - 64]; /* Leaves room for the attribute paths below it. */
+static uint8_t keep = 0;
+static uint8_t stopping = 0;
+static uint32_t enable_at_unexport[PWM_CHECK_NPWM]; /* What 'enable' held when the channel was unexported. */
+static uint8_t pass = 1;
+static uint32_t check_num = 0;
+
+/**
+ * @brief Write a whole file, creating it if needed.
+ * @return 0 on success and -1 on failure.
+ */
+static int file_write(char const *const path, char const *const val)
+{
+    int const fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1)
+    {
+        return -1;
+    }
+    ssize_t const written = write(fd, val, strlen(val));
+    close(fd);
+    return written == (ssize_t)strlen(val) ? 0 : -1;
+}
+
+/**
+ * @brief Read the number at the start of a file. Attributes are written at offset 0 without
+ * truncating, like sysfs takes them, so anything after the first line is left over.
+ * @return The number or UINT32_MAX if the file could not be read.
+ */
+static uint32_t file_read_u32(char const *const path)
+{
+    int const fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        return UINT32_MAX;
+    }
+    char buf[32];
+    ssize_t const len = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (len <= 0)
+    {
+        return UINT32_MAX;
+    }
+    buf[len] = '\0';
+    char *end = NULL;
+    unsigned long const val = strtoul(buf, &end, 10);
+    return end == buf ? UINT32_MAX : (uint32_t)val;
+}
+
+static void attr_path(char *const path, size_t const size, uint32_t const channel, char const *const attr)
+{
+    if (channel == UINT32_MAX)
+    {
+        snprintf(path, size, "%s/pwmchip%u/%s", root, PWM_CHECK_CHIP, attr);
+    }
+    else
+    {
+        snprintf(path, size, "%s/pwmchip%u/pwm%u/%s", root, PWM_CHECK_CHIP, channel, attr);
+    }
+}
+
+static uint8_t channel_exists(uint32_t const channel)
+{
+    char path[PATH_MAX];
+    attr_path(path, sizeof(path), channel, "");
+    return access(path, F_OK) == 0;
+}
+
+/**
+ * @brief Create the directory of a channel the way the kernel does on export.
+ */
+static int channel_create(uint32_t const channel, uint32_t const period_ns, uint8_t const enable)
+{
+    char path[PATH_MAX];
+    char val[16];
+    attr_path(path, sizeof(path), channel, "");
+    if (mkdir(path, 0755) != 0)
+    {
+        return -1;
+    }
+    snprintf(val, sizeof(val), "%u\n", period_ns);
+    attr_path(path, sizeof(path), channel, "period");
+    int status = file_write(path, val);
+    attr_path(path, sizeof(path), channel, "duty_cycle");
+    status |= file_write(path, "0\n");
+    snprintf(val, sizeof(val), "%u\n", enable);
+    attr_path(path, sizeof(path), channel, "enable");
+    status |= file_write(path, val);
+    return status;
+}
+
+/**
+ * @brief Remove the directory of a channel the way the kernel does on unexport.
+ */
+static void channel_remove(uint32_t const channel)
+{
+    char path[PATH_MAX];
+    attr_path(path, sizeof(path), channel, "enable");
+    enable_at_unexport[channel] = file_read_u32(path);
+    char const *const attrs[] = {"period", "duty_cycle", "enable"};
+    for (uint8_t attr_i = 0; attr_i < sizeof(attrs) / sizeof(attrs[0]); attr_i++)
+    {
+        attr_path(path, sizeof(path), channel, attrs[attr_i]);
+        unlink(path);
+    }
+    attr_path(path, sizeof(path), channel, "");
+    rmdir(path);
+}
+
+/**
+ * @brief Stand in for the kernel side of 'export' and 'unexport'.
+ * @param arg Descriptors of the two FIFOs, export first.
+ */
+static void *fake_kernel(void *arg)
+{
+    int const *const fds = arg;
+    struct pollfd pfds[2] = {{.fd = fds[0], .events = POLLIN}, {.fd = fds[1], .events = POLLIN}};
+    while (!__atomic_load_n(&stopping, __ATOMIC_ACQUIRE))
+    {
+        if (poll(pfds, 2, PWM_CHECK_POLL_MS) <= 0)
+        {
+            continue;
+        }
+        for (uint8_t fd_i = 0; fd_i < 2; fd_i++)
+        {
+            char buf[64];
+            ssize_t const len = (pfds[fd_i].revents & POLLIN) ? read(fds[fd_i], buf, sizeof(buf) - 1) : 0;
+            buf[len > 0 ? len : 0] = '\0';
+            /* Each write is one number and a newline, several may have queued up. */
+            for (char *pos = buf, *end = NULL; *pos != '\0'; pos = end + (*end != '\0'))
+            {
+                unsigned long const channel = strtoul(pos, &end, 10);
+                if (end == pos)
+                {
+                    break;
+                }
+                if (fd_i == 0 && channel < PWM_CHECK_NPWM && !channel_exists(channel))
+                {
+                    channel_create(channel, 0, 0);
+                }
+                else if (fd_i == 1 && channel < PWM_CHECK_NPWM && channel_exists(channel))
+                {
+                    channel_remove(channel);
+                }
+            }
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Wait until the fake kernel removed an unexported channel.
+ * @return 1 if it is gone and 0 if it is still there.
+ */
+static uint8_t channel_gone_wait(uint32_t const channel)
+{
+    for (uint32_t wait_ms = 0; channel_exists(channel); wait_ms++)
+    {
+        if (wait_ms >= PWM_CHECK_GONE_MS)
+        {
+            return 0;
+        }
+        usleep(1000);
+    }
+    return 1;
+}
+
+/**
+ * @brief Print one check.
+ */
+static void check(char const *const name, long long const value, long long const expected)
+{
+    uint8_t const ok = value == expected;
+    printf("%s    {\"name\": \"%s\", \"value\": %lld, \"expected\": %lld, \"pass\": %s}", check_num > 0 ? ",\n" : "", name, value,
+           expected, ok ? "true" : "false");
+    pass &= ok;
+    check_num++;
+}
+
+/**
+ * @brief Count the writes to 'duty_cycle' files seen since the last call.
+ * @param fd inotify descriptor.
+ * @param wd Watch of each channel, -1 for none.
+ * @param writes Where the count of each channel gets written.
+ */
+static void duty_writes_get(int const fd, int const wd[PWM_CHECK_NPWM], uint32_t writes[PWM_CHECK_NPWM])
+{
+    memset(writes, 0, PWM_CHECK_NPWM * sizeof(writes[0]));
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t len;
+    while ((len = read(fd, buf, sizeof(buf))) > 0)
+    {
+        for (char const *pos = buf; pos < buf + len; pos += sizeof(struct inotify_event) + ((struct inotify_event const *)pos)->len)
+        {
+            struct inotify_event const *const event = (struct inotify_event const *)pos;
+            for (uint8_t pwm_i = 0; pwm_i < PWM_CHECK_NPWM; pwm_i++)
+            {
+                writes[pwm_i] += wd[pwm_i] == event->wd && (event->mask & IN_MODIFY) != 0;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Duty cycle in nanoseconds the backend should write for a pulse fraction of a channel.
+ */
+static uint32_t duty_ns_expected(uint8_t const channel, float const frac, uint32_t const count_ps)
+{
+    uint16_t duty = 0;
+    if (ch_cfg_frac_to_raw(ch_cfg_get(), channel, frac, &duty) != 0)
+    {
+        pass = 0;
+    }
+    return (uint32_t)(((uint64_t)(duty & 0x0fffU) * count_ps) / 1000U);
+}
+
+/**
+ * @brief Start with two kernel PWM channels, one taking the place of a PCA9685 channel and one past
+ * the last chip, then update them and stop.
+ */
+static void check_run(uint32_t const count_ps)
+{
+    uint32_t const period_ns = (uint32_t)(((uint64_t)count_ps * 4096U) / 1000U);
+    actr_cfg_t const actr_cfg = {.sim = 1, .sim_clock_hz = BUS_SIM_CLOCK_HZ_DEFAULT, .sim_fast = 1, .pwm_root = root, .pwm_num = 2,
+                                 .pwm = {{.channel = 3, .chip = PWM_CHECK_CHIP, .pwm = 0}, {.channel = 16, .chip = PWM_CHECK_CHIP, .pwm = 1}}};
+    check("init", actr_init(&actr_cfg), 0);
+    char path[PATH_MAX];
+    for (uint32_t pwm_i = 0; pwm_i < 2; pwm_i++)
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "pwm%u_exported", pwm_i);
+        check(name, channel_exists(pwm_i), 1);
+        attr_path(path, sizeof(path), pwm_i, "period");
+        snprintf(name, sizeof(name), "pwm%u_period_ns", pwm_i);
+        check(name, file_read_u32(path), period_ns);
+        attr_path(path, sizeof(path), pwm_i, "enable");
+        snprintf(name, sizeof(name), "pwm%u_enable", pwm_i);
+        check(name, file_read_u32(path), 1);
+    }
+
+    int const fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    int wd[PWM_CHECK_NPWM] = {-1, -1, -1, -1};
+    for (uint32_t pwm_i = 0; pwm_i < 2 && fd != -1; pwm_i++)
+    {
+        attr_path(path, sizeof(path), pwm_i, "duty_cycle");
+        wd[pwm_i] = inotify_add_watch(fd, path, IN_MODIFY);
+    }
+    check("inotify", fd != -1 && wd[0] != -1 && wd[1] != -1, 1);
+    uint32_t writes[PWM_CHECK_NPWM];
+
+    /* Both channels change, then nothing does, then only the one past the chips. */
+    float frac[17];
+    for (uint8_t ch_i = 0; ch_i < 17; ch_i++)
+    {
+        frac[ch_i] = 0.5f;
+    }
+    frac[3] = 0.25f;
+    frac[16] = 0.75f;
+    actr_frame_set(frac, 17);
+    duty_writes_get(fd, wd, writes);
+    attr_path(path, sizeof(path), 0, "duty_cycle");
+    check("pwm0_duty_ns", file_read_u32(path), duty_ns_expected(3, frac[3], count_ps));
+    attr_path(path, sizeof(path), 1, "duty_cycle");
+    check("pwm1_duty_ns", file_read_u32(path), duty_ns_expected(16, frac[16], count_ps));
+    check("pwm0_writes_changed", writes[0], 1);
+    check("pwm1_writes_changed", writes[1], 1);
+
+    actr_frame_set(frac, 17);
+    duty_writes_get(fd, wd, writes);
+    check("pwm0_writes_same", writes[0], 0);
+    check("pwm1_writes_same", writes[1], 0);
+
+    frac[16] = 0.6f;
+    actr_ch_set(16, frac[16]);
+    duty_writes_get(fd, wd, writes);
+    attr_path(path, sizeof(path), 1, "duty_cycle");
+    check("pwm1_duty_ns_set", file_read_u32(path), duty_ns_expected(16, frac[16], count_ps));
+    check("pwm0_writes_other", writes[0], 0);
+    check("pwm1_writes_set", writes[1], 1);
+    if (fd != -1)
+    {
+        close(fd);
+    }
+
+    check("deinit", actr_deinit(), 0);
+    for (uint32_t pwm_i = 0; pwm_i < 2; pwm_i++)
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "pwm%u_unexported", pwm_i);
+        check(name, channel_gone_wait(pwm_i), 1);
+        snprintf(name, sizeof(name), "pwm%u_enable_at_unexport", pwm_i);
+        check(name, enable_at_unexport[pwm_i], 0);
+    }
+}
+
+/**
+ * @brief Fail the start after a kernel PWM channel was set up and check it is put back, while one
+ * that was exported before the start stays exported.
+ */
+static void check_unwind(uint32_t const count_ps)
+{
+    uint32_t const period_ns = (uint32_t)(((uint64_t)count_ps * 4096U) / 1000U);
+    check("preexisting_create", channel_create(PWM_CHECK_PREEXISTING, period_ns, 1), 0);
+    /* Channel 3 is given twice, the second one fails after the first two were set up. */
+    actr_cfg_t const dup_cfg = {.sim = 1, .sim_clock_hz = BUS_SIM_CLOCK_HZ_DEFAULT, .sim_fast = 1, .pwm_root = root, .pwm_num = 3,
+                                .pwm = {{.channel = 3, .chip = PWM_CHECK_CHIP, .pwm = 0},
+                                        {.channel = 4, .chip = PWM_CHECK_CHIP, .pwm = PWM_CHECK_PREEXISTING},
+                                        {.channel = 3, .chip = PWM_CHECK_CHIP, .pwm = 1}}};
+    check("init_dup_fails", actr_init(&dup_cfg), -1);
+    check("dup_pwm0_unexported", channel_gone_wait(0), 1);
+    check("dup_preexisting_kept", channel_exists(PWM_CHECK_PREEXISTING), 1);
+
+    /* The second chip does not exist. */
+    actr_cfg_t const missing_cfg = {.sim = 1, .sim_clock_hz = BUS_SIM_CLOCK_HZ_DEFAULT, .sim_fast = 1, .pwm_root = root, .pwm_num = 2,
+                                    .pwm = {{.channel = 3, .chip = PWM_CHECK_CHIP, .pwm = 0}, {.channel = 4, .chip = PWM_CHECK_CHIP + 1U, .pwm = 0}}};
+    check("init_missing_fails", actr_init(&missing_cfg), -1);
+    check("missing_pwm0_unexported", channel_gone_wait(0), 1);
+
+    /* The start works again after the failed ones. */
+    actr_cfg_t const ok_cfg = {.sim = 1, .sim_clock_hz = BUS_SIM_CLOCK_HZ_DEFAULT, .sim_fast = 1, .pwm_root = root, .pwm_num = 1,
+                               .pwm = {{.channel = 3, .chip = PWM_CHECK_CHIP, .pwm = 0}}};
+    check("init_after_unwind", actr_init(&ok_cfg), 0);
+    check("deinit_after_unwind", actr_deinit(), 0);
+    check("after_unwind_pwm0_unexported", channel_gone_wait(0), 1);
+}
+
+/**
+ * @brief Remove the fake tree.
+ */
+static void tree_remove(void)
+{
+    for (uint32_t pwm_i = 0; pwm_i < PWM_CHECK_NPWM; pwm_i++)
+    {
+        if (channel_exists(pwm_i))
+        {
+            channel_remove(pwm_i);
+        }
+    }
+    char path[PATH_MAX];
+    char const *const attrs[] = {"export", "unexport", "npwm"};
+    for (uint8_t attr_i = 0; attr_i < sizeof(attrs) / sizeof(attrs[0]); attr_i++)
+    {
+        attr_path(path, sizeof(path), UINT32_MAX, attrs[attr_i]);
+        unlink(path);
+    }
+    snprintf(path, sizeof(path), "%s/pwmchip%u", root, PWM_CHECK_CHIP);
+    rmdir(path);
+    rmdir(root);
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: tco_actuationd_pwm_check.bin [options]\n"
+                    "-k, --keep   Leave the fake sysfs tree in place to look at.\n"
+                    "-h, --help   Print this message.\n");
+}
+
+int main(int argc, char *const argv[])
+{
+    static struct option const long_opts[] = {
+        {"keep", no_argument, NULL, 'k'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "kh", long_opts, NULL)) != -1)
+    {
+        switch (opt)
+        {
+        case 'k':
+            keep = 1;
+            break;
+        default:
+            usage();
+            return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+    if (log_init("actuationd_pwm_check", "./pwm_check_log.txt") != 0)
+    {
+        fprintf(stderr, "Failed to initialize the logger\n");
+        return EXIT_FAILURE;
+    }
+    char const *const tmp = getenv("TMPDIR");
+    snprintf(root, sizeof(root), "%s/tco_pwm_check.XXXXXX", tmp != NULL ? tmp : "/tmp");
+    char path[PATH_MAX];
+    char val[16];
+    snprintf(val, sizeof(val), "%u\n", PWM_CHECK_NPWM);
+    if (mkdtemp(root) == NULL || (snprintf(path, sizeof(path), "%s/pwmchip%u", root, PWM_CHECK_CHIP), mkdir(path, 0755)) != 0 ||
+        (attr_path(path, sizeof(path), UINT32_MAX, "export"), mkfifo(path, 0644)) != 0 ||
+        (attr_path(path, sizeof(path), UINT32_MAX, "unexport"), mkfifo(path, 0644)) != 0 ||
+        (attr_path(path, sizeof(path), UINT32_MAX, "npwm"), file_write(path, val)) != 0)
+    {
+        fprintf(stderr, "Failed to create the fake sysfs tree: %s\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+    /* Held open for writing too, so opening them never blocks and reading never sees an end. */
+    int kernel_fds[2];
+    attr_path(path, sizeof(path), UINT32_MAX, "export");
+    kernel_fds[0] = open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    attr_path(path, sizeof(path), UINT32_MAX, "unexport");
+    kernel_fds[1] = open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    pthread_t kernel;
+    if (kernel_fds[0] == -1 || kernel_fds[1] == -1 || pthread_create(&kernel, NULL, fake_kernel, kernel_fds) != 0)
+    {
+        fprintf(stderr, "Failed to start the fake kernel\n");
+        return EXIT_FAILURE;
+    }
+    uint32_t const count_ps = pca9685_count_ps(PCA9685_OSC_FREQ, pca9685_prescale_calc(PCA9685_OSC_FREQ, PCA9685_PWM_FREQ_DEFAULT));
+    ch_cfg_timebase_set(count_ps);
+
+    printf("{\n");
+    printf("  \"version\": %u,\n", PWM_CHECK_VERSION);
+    printf("  \"root\": \"%s\",\n", root);
+    printf("  \"checks\": [\n");
+    check_run(count_ps);
+    check_unwind(count_ps);
+    printf("\n  ],\n");
+    printf("  \"pass\": %s\n", pass ? "true" : "false");
+    printf("}\n");
+
+    __atomic_store_n(&stopping, 1, __ATOMIC_RELEASE);
+    pthread_join(kernel, NULL);
+    close(kernel_fds[0]);
+    close(kernel_fds[1]);
+    if (!keep)
+    {
+        tree_remove();
+    }
+    return pass ? EXIT_SUCCESS : 1;
+}
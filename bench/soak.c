@@ -0,0 +1,985 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <time.h>
+
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "tco_libd.h"
+
+#include "actuator.h"
+#include "pca9685.h"
+#include "bus_sim.h"
+#include "ch_cfg.h"
+#include "ctrl.h"
+#include "loop.h"
+#include "pipeline.h"
+#include "telem.h"
+#include "bench_util.h"
+
+#define SOAK_VERSION 2
+#define SOAK_SECONDS_DEFAULT 600U
+#define SOAK_PHASE_S_DEFAULT 30U
+#define SOAK_SCRIPT_DEFAULT "clean,nack,clean,stall,clean,stuck,clean,burst,clean,hog"
+#define SOAK_SCRIPT_MAX 64U
+#define SOAK_PRODUCER_HZ_DEFAULT 50U
+#define SOAK_NACK_PPM_DEFAULT 20000U
+#define SOAK_STALL_PPM_DEFAULT 20000U
+#define SOAK_STALL_US_DEFAULT 2000U
+#define SOAK_BURST_LEN_DEFAULT 20U
+#define SOAK_BURST_HZ_DEFAULT 2000U
+#define SOAK_BURST_GAP_MS_DEFAULT 100U
+#define SOAK_HOG_MAX 256U
+#define SOAK_DEADLINE_US_DEFAULT 10000U
+#define SOAK_MISS_PPM_DEFAULT 1000U
+#define SOAK_OVERRUN_PPM_DEFAULT 1000U
+#define SOAK_LATENCY_MAX_US_DEFAULT 50000U
+#define SOAK_RECOVER_MS_DEFAULT 100U
+#define SOAK_LATCH_TIMEOUT_NS 1000000000U
+#define SOAK_HIST_BUCKET_NS 10000U
+#define SOAK_HIST_LEN 10000U /* Up to 100 ms, the last bucket also counts everything later. */
+#define SOAK_SOURCE_NAME "tco_soak_source_low" /* Lower priority control source of '--sources'. */
+#define SOAK_SOURCE_PRIO_HIGH 2U
+#define SOAK_SOURCE_PRIO_LOW 1U
+#define SOAK_SOURCE_FRAC 0.05f /* What the lower source outputs, below anything the sweep of channel 0 gives. */
+
+int log_level = LOG_INFO;
+
+/* Faults a phase of the script runs under. */
+typedef enum
+{
+    SOAK_CLEAN = 0, /* No fault. */
+    SOAK_NACK,      /* Random transfers are not acknowledged. */
+    SOAK_STALL,     /* Random transfers are stretched by a device holding the clock. */
+    SOAK_STUCK,     /* The producer seizes the control input and does not let go. */
+    SOAK_BURST,     /* The producer publishes in bursts with gaps between them. */
+    SOAK_HOG,       /* Busy threads compete with the daemon for every CPU. */
+    SOAK_SOURCES,   /* Two control sources hand channels over and raise emergencies. */
+    SOAK_FAULT_NUM
+} soak_fault_t;
+
+static char const *const SOAK_FAULT_NAME[SOAK_FAULT_NUM] = {"clean", "nack", "stall", "stuck", "burst", "hog", "sources"};
+
+typedef struct
+{
+    uint32_t seconds;
+    uint32_t phase_s; /* Length of script entries that do not give their own. */
+    uint32_t producer_hz;
+    uint32_t rate_hz;
+    uint32_t clock_hz;
+    uint8_t seqlock; /* Read control input through the seqlock segment instead of the semaphore one. */
+    uint8_t sources; /* Read the seqlock segment and SOAK_SOURCE_NAME below it as control sources. */
+    uint32_t stale_ms;
+    uint32_t check_ms;
+    uint32_t nack_ppm;
+    uint32_t stall_ppm;
+    uint32_t stall_us;
+    uint32_t burst_len;
+    uint32_t burst_hz;
+    uint32_t burst_gap_ms;
+    uint32_t hogs;
+    uint32_t seed;
+
+    /* Pass criteria. */
+    uint32_t deadline_us; /* Frames latched later than this after publishing are deadline misses. */
+    uint32_t miss_ppm;
+    uint32_t latency_max_us;
+    uint32_t recover_ms;
+    uint32_t overrun_ppm;
+} soak_cfg_t;
+
+/* One entry of the fault script. */
+typedef struct
+{
+    soak_fault_t fault;
+    uint32_t seconds;
+} soak_step_t;
+
+/* What was seen during the phases that ran under one kind of fault. */
+typedef struct
+{
+    uint32_t phases;
+    uint64_t frames;   /* Frames whose latch was waited for. */
+    uint64_t misses;   /* Frames latched after the deadline or never. */
+    uint64_t lost;     /* Frames never latched. */
+    uint64_t overruns; /* Ticks the event loop missed. */
+    uint64_t lat_max_ns;
+    uint32_t lat_hist[SOAK_HIST_LEN];
+    uint64_t recover_max_ns; /* From lifting the fault until a new frame was latched. */
+    uint32_t recover_lost;
+    uint64_t neutral_max_ns; /* From seizing the control input until the outputs went neutral. */
+    uint32_t neutral_lost;
+    uint32_t source_runs;        /* Rounds of the control source checks. */
+    uint32_t source_fails;       /* Control source checks that did not hold. */
+    uint64_t fallthrough_max_ns; /* From the last frame of the higher source until the lower one took over. */
+} soak_stats_t;
+
+static soak_cfg_t cfg = {
+    .seconds = SOAK_SECONDS_DEFAULT,
+    .phase_s = SOAK_PHASE_S_DEFAULT,
+    .producer_hz = SOAK_PRODUCER_HZ_DEFAULT,
+    .rate_hz = LOOP_TICK_HZ_DEFAULT,
+    .clock_hz = BUS_SIM_CLOCK_HZ_DEFAULT,
+    .stale_ms = CTRL_STALE_MS_DEFAULT,
+    .check_ms = ACTR_CHECK_MS_DEFAULT,
+    .nack_ppm = SOAK_NACK_PPM_DEFAULT,
+    .stall_ppm = SOAK_STALL_PPM_DEFAULT,
+    .stall_us = SOAK_STALL_US_DEFAULT,
+    .burst_len = SOAK_BURST_LEN_DEFAULT,
+    .burst_hz = SOAK_BURST_HZ_DEFAULT,
+    .burst_gap_ms = SOAK_BURST_GAP_MS_DEFAULT,
+    .seed = 1,
+    .deadline_us = SOAK_DEADLINE_US_DEFAULT,
+    .miss_ppm = SOAK_MISS_PPM_DEFAULT,
+    .latency_max_us = SOAK_LATENCY_MAX_US_DEFAULT,
+    .recover_ms = SOAK_RECOVER_MS_DEFAULT,
+    .overrun_ppm = SOAK_OVERRUN_PPM_DEFAULT,
+};
+
+static char script_str[1024] = SOAK_SCRIPT_DEFAULT;
+static soak_step_t script[SOAK_SCRIPT_MAX];
+static uint32_t script_len = 0;
+static soak_stats_t stats[SOAK_FAULT_NUM];
+
+static struct tco_shmem_data_control *ctrl_data = NULL;
+static sem_t *ctrl_sem = NULL;
+static struct ctrl_shmem_bell *bell = NULL;
+static struct ctrl_shmem_seq *seq_seg = NULL;
+static struct ctrl_shmem_seq *low_seg = NULL; /* Lower priority source with '--sources'. */
+static uint32_t frame_i = 0;
+static uint16_t duty_out = UINT16_MAX; /* What channel 0 was last seen latching. */
+static uint8_t hog_on = 0;
+static pthread_t hog_thread[SOAK_HOG_MAX];
+static uint32_t hog_num = 0; /* Busy threads that actually started. */
+static uint8_t stopping = 0; /* Set once the event loop stopped, e.g. on SIGINT. */
+
+static void sleep_until(uint64_t const until_ns)
+{
+    struct timespec const until = {.tv_sec = until_ns / 1000000000U, .tv_nsec = until_ns % 1000000000U};
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL);
+}
+
+static double hist_percentile_us(uint32_t const hist[SOAK_HIST_LEN], uint64_t const num, double const pct)
+{
+    uint64_t const rank = telem_pct_rank(num, pct);
+    uint64_t seen = 0;
+    for (uint32_t bucket_i = 0; bucket_i < SOAK_HIST_LEN && rank > 0; bucket_i++)
+    {
+        seen += hist[bucket_i];
+        if (seen >= rank)
+        {
+            return ((bucket_i + 1U) * (uint64_t)SOAK_HIST_BUCKET_NS) / 1000.0; /* Upper edge of the bucket. */
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Parse the fault script, a comma separated list of phases each optionally followed by
+ * ':SECONDS', e.g. "clean,nack:60,clean:10".
+ * @return 0 on success and -1 on failure.
+ */
+static int soak_script_parse(char const *const str)
+{
+    char buf[sizeof(script_str)];
+    snprintf(buf, sizeof(buf), "%s", str);
+    char *save = NULL;
+    script_len = 0;
+    for (char *tok = strtok_r(buf, ",", &save); tok != NULL; tok = strtok_r(NULL, ",", &save))
+    {
+        if (script_len >= SOAK_SCRIPT_MAX)
+        {
+            return -1;
+        }
+        soak_step_t *const step = &(script[script_len]);
+        step->seconds = cfg.phase_s;
+        char *const colon = strchr(tok, ':');
+        if (colon != NULL)
+        {
+            *colon = '\0';
+            if (num_parse(colon + 1, 1, UINT32_MAX, &(step->seconds)) != 0)
+            {
+                return -1;
+            }
+        }
+        uint8_t fault_i = 0;
+        while (fault_i < SOAK_FAULT_NUM && strcmp(tok, SOAK_FAULT_NAME[fault_i]) != 0)
+        {
+            fault_i++;
+        }
+        if (fault_i == SOAK_FAULT_NUM || (fault_i == SOAK_SOURCES && !cfg.sources))
+        {
+            return -1;
+        }
+        step->fault = fault_i;
+        script_len++;
+    }
+    return script_len > 0 ? 0 : -1;
+}
+
+/**
+ * @brief Make up the next frame. Channel 0 sweeps and always changes from what it outputs now so
+ * its latch can be told apart, the other channels stay put.
+ * @param duty Where the duty cycle of channel 0 gets written.
+ */
+static void soak_frame(float frac[PCA9685_REG_CH_NUM], uint16_t *const duty)
+{
+    do
+    {
+        frac[0] = 0.1f + ((frame_i++ % 80U) / 100.0f);
+        ch_cfg_frac_to_raw(ch_cfg_get(), 0, frac[0], duty);
+    } while (*duty == duty_out);
+    for (uint8_t ch_i = 1; ch_i < PCA9685_REG_CH_NUM; ch_i++)
+    {
+        frac[ch_i] = 0.5f;
+    }
+}
+
+/**
+ * @brief Publish a frame to a seqlock segment and ring its doorbell.
+ * @param frac Pulse fractions, channels given a negative one are left inactive.
+ * @return Time the frame was published.
+ */
+static uint64_t soak_seq_publish(struct ctrl_shmem_seq *const seg, float const frac[PCA9685_REG_CH_NUM], uint8_t const emergency)
+{
+    uint64_t const publish = clock_ns(CLOCK_MONOTONIC);
+    __atomic_add_fetch(&(seg->seq), 1, __ATOMIC_ACQ_REL);
+    seg->data.emergency = emergency;
+    for (uint8_t ch_i = 0; ch_i < PCA9685_REG_CH_NUM; ch_i++)
+    {
+        seg->data.ch[ch_i].active = frac[ch_i] >= 0;
+        seg->data.ch[ch_i].pulse_frac = frac[ch_i];
+    }
+    __atomic_add_fetch(&(seg->seq), 1, __ATOMIC_RELEASE);
+    syscall(SYS_futex, &(seg->seq), FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+    return publish;
+}
+
+/**
+ * @brief Publish a frame through the control input and ring the doorbell.
+ * @return Time the frame was published.
+ */
+static uint64_t soak_publish(float const frac[PCA9685_REG_CH_NUM])
+{
+    if (seq_seg != NULL)
+    {
+        return soak_seq_publish(seq_seg, frac, 0);
+    }
+    uint64_t const publish = clock_ns(CLOCK_MONOTONIC);
+    sem_wait(ctrl_sem);
+    ctrl_data->emergency = 0;
+    for (uint8_t ch_i = 0; ch_i < PCA9685_REG_CH_NUM; ch_i++)
+    {
+        ctrl_data->ch[ch_i].active = 1;
+        ctrl_data->ch[ch_i].pulse_frac = frac[ch_i];
+    }
+    sem_post(ctrl_sem);
+    __atomic_add_fetch(&(bell->seq), 1, __ATOMIC_RELEASE);
+    syscall(SYS_futex, &(bell->seq), FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+    return publish;
+}
+
+/**
+ * @brief Wait until the simulated chip latches @p duty on channel 0 at or after @p since.
+ * @return Time of the latch or 0 if it did not happen within @p timeout_ns.
+ */
+static uint64_t soak_latch_wait(uint64_t const since, uint16_t const duty, uint64_t const timeout_ns)
+{
+    bus_sim_out_t out;
+    while (clock_ns(CLOCK_MONOTONIC) <= since + timeout_ns)
+    {
+        bus_sim_out_get(actr_bus_get(0), PCA9685_ADDR, &out);
+        if (out.led[0][2] == (duty & 0xffU) && out.led[0][3] == ((duty >> 8) & 0x1fU) && out.latch_time >= since)
+        {
+            duty_out = duty;
+            return out.latch_time;
+        }
+        usleep(20);
+    }
+    return 0;
+}
+
+/**
+ * @brief Wait for a published frame to be latched and count its latency against the deadline.
+ */
+static void soak_latch_record(soak_stats_t *const st, uint64_t const publish, uint16_t const duty)
+{
+    uint64_t const latch = soak_latch_wait(publish, duty, SOAK_LATCH_TIMEOUT_NS);
+    if (latch == 0 && stopping)
+    {
+        return; /* The daemon is gone, not late. */
+    }
+    st->frames++;
+    if (latch == 0)
+    {
+        st->lost++;
+        st->misses++;
+        return;
+    }
+    uint64_t const lat = latch - publish;
+    st->misses += lat > (uint64_t)cfg.deadline_us * 1000U;
+    st->lat_max_ns = lat > st->lat_max_ns ? lat : st->lat_max_ns;
+    uint64_t const bucket = lat / SOAK_HIST_BUCKET_NS;
+    st->lat_hist[bucket < SOAK_HIST_LEN ? bucket : SOAK_HIST_LEN - 1U]++;
+}
+
+static void *soak_hog(void *arg)
+{
+    (void)arg;
+    volatile uint64_t spins = 0;
+    while (__atomic_load_n(&hog_on, __ATOMIC_RELAXED))
+    {
+        spins++;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Turn the fault of a phase on or off. Stuck input and bursts are made by the producer itself.
+ */
+static void soak_fault_apply(soak_fault_t const fault, uint8_t const on)
+{
+    switch (fault)
+    {
+    case SOAK_NACK:
+        bus_sim_fault_set(actr_bus_get(0), on ? cfg.nack_ppm : 0);
+        break;
+    case SOAK_STALL:
+        bus_sim_stall_set(actr_bus_get(0), on ? cfg.stall_ppm : 0, cfg.stall_us);
+        break;
+    case SOAK_HOG:
+        __atomic_store_n(&hog_on, on, __ATOMIC_RELAXED);
+        if (on)
+        {
+            while (hog_num < cfg.hogs && pthread_create(&(hog_thread[hog_num]), NULL, soak_hog, NULL) == 0)
+            {
+                hog_num++;
+            }
+            if (hog_num < cfg.hogs)
+            {
+                log_error("Started only %u of %u busy threads", hog_num, cfg.hogs);
+            }
+            break;
+        }
+        for (; hog_num > 0; hog_num--)
+        {
+            pthread_join(hog_thread[hog_num - 1U], NULL);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+/**
+ * @brief Publish frames until @p end, at the producer rate with the publish time jittered over the
+ * tick, or in bursts with gaps in between.
+ */
+static void soak_produce(soak_fault_t const fault, soak_stats_t *const st, uint64_t const end)
+{
+    uint64_t const period_ns = 1000000000U / cfg.producer_hz;
+    uint64_t next = clock_ns(CLOCK_MONOTONIC);
+    float frac[PCA9685_REG_CH_NUM];
+    uint16_t duty;
+    while (next < end && !__atomic_load_n(&stopping, __ATOMIC_RELAXED))
+    {
+        if (fault != SOAK_BURST)
+        {
+            next += period_ns / 2 + (rand() % period_ns);
+            sleep_until(next);
+            soak_frame(frac, &duty);
+            soak_latch_record(st, soak_publish(frac), duty);
+            continue;
+        }
+        /* Frames of a burst overwrite each other, only the last one has to come out. */
+        uint64_t publish = 0;
+        for (uint32_t burst_i = 0; burst_i < cfg.burst_len; burst_i++)
+        {
+            if (burst_i > 0)
+            {
+                sleep_until(publish + (1000000000U / cfg.burst_hz));
+            }
+            soak_frame(frac, &duty);
+            publish = soak_publish(frac);
+        }
+        soak_latch_record(st, publish, duty);
+        next = clock_ns(CLOCK_MONOTONIC) + ((rand() % (2U * cfg.burst_gap_ms + 1U)) * 1000000ULL);
+        sleep_until(next);
+    }
+}
+
+/**
+ * @brief Seize the control input until @p end like a producer that hangs in the middle of
+ * publishing, and measure the time until the daemon gives up on it and goes neutral.
+ */
+static void soak_stuck(soak_stats_t *const st, uint64_t const end)
+{
+    /* Give the outputs something other than neutral to leave. */
+    float frac[PCA9685_REG_CH_NUM];
+    uint16_t duty;
+    soak_frame(frac, &duty);
+    soak_latch_record(st, soak_publish(frac), duty);
+
+    uint64_t const seize = clock_ns(CLOCK_MONOTONIC);
+    if (seq_seg != NULL)
+    {
+        __atomic_add_fetch(&(seq_seg->seq), 1, __ATOMIC_ACQ_REL); /* Odd, i.e. mid-write. */
+    }
+    else
+    {
+        sem_wait(ctrl_sem);
+    }
+    uint64_t const neutral = cfg.stale_ms > 0 && end > seize ? soak_latch_wait(seize, ch_cfg_get()->ch[0].neutral, end - seize) : 0;
+    if (neutral > 0)
+    {
+        st->neutral_max_ns = neutral - seize > st->neutral_max_ns ? neutral - seize : st->neutral_max_ns;
+    }
+    else if (cfg.stale_ms > 0 && !__atomic_load_n(&stopping, __ATOMIC_RELAXED))
+    {
+        st->neutral_lost++;
+    }
+    while (clock_ns(CLOCK_MONOTONIC) < end && !__atomic_load_n(&stopping, __ATOMIC_RELAXED))
+    {
+        usleep(10000);
+    }
+    if (seq_seg != NULL)
+    {
+        __atomic_add_fetch(&(seq_seg->seq), 1, __ATOMIC_RELEASE);
+    }
+    else
+    {
+        sem_post(ctrl_sem);
+    }
+}
+
+/**
+ * @brief Duty cycle channel @p ch_i of the simulated chip outputs now.
+ */
+static uint16_t soak_ch_out(uint8_t const ch_i)
+{
+    bus_sim_out_t out;
+    bus_sim_out_get(actr_bus_get(0), PCA9685_ADDR, &out);
+    return out.led[ch_i][2] | ((out.led[ch_i][3] & 0x1fU) << 8);
+}
+
+/**
+ * @brief Keep the lower control source fresh by publishing @p frac to it at the producer rate until
+ * channel @p ch_i of the chip outputs @p duty, or stops doing so if @p hold is set.
+ * @return Time that was seen or 0 if it did not happen before @p until.
+ */
+static uint64_t soak_source_feed(float const frac[PCA9685_REG_CH_NUM], uint8_t const emergency, uint64_t const until,
+                                 uint8_t const ch_i, uint16_t const duty, uint8_t const hold)
+{
+    uint64_t const period_ns = 1000000000U / cfg.producer_hz;
+    for (uint64_t next = clock_ns(CLOCK_MONOTONIC); next < until && !__atomic_load_n(&stopping, __ATOMIC_RELAXED); next += period_ns)
+    {
+        soak_seq_publish(low_seg, frac, emergency);
+        for (uint64_t now = clock_ns(CLOCK_MONOTONIC); now < next + period_ns && now < until; now = clock_ns(CLOCK_MONOTONIC))
+        {
+            if ((soak_ch_out(ch_i) == duty) != hold)
+            {
+                return now;
+            }
+            usleep(20);
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Drive the control input from two sources until @p end, the regular seqlock segment above
+ * SOAK_SOURCE_NAME, and check that the higher one keeps the channels it has active while it
+ * publishes, that the lower one takes them over within the stale timeout once it goes quiet and
+ * that an emergency from either holds every output neutral, even once its source went stale.
+ */
+static void soak_sources(soak_stats_t *const st, uint64_t const end)
+{
+    uint64_t const stale_ns = (uint64_t)cfg.stale_ms * 1000000U;
+    uint64_t const recover_ns = (uint64_t)cfg.recover_ms * 1000000U;
+    uint16_t const neutral = ch_cfg_get()->ch[0].neutral;
+    float low[PCA9685_REG_CH_NUM];
+    float high[PCA9685_REG_CH_NUM];
+    uint16_t low_duty[2];
+    uint16_t high_duty;
+    for (uint8_t ch_i = 0; ch_i < PCA9685_REG_CH_NUM; ch_i++)
+    {
+        low[ch_i] = SOAK_SOURCE_FRAC;
+    }
+    ch_cfg_frac_to_raw(ch_cfg_get(), 0, low[0], &(low_duty[0]));
+    ch_cfg_frac_to_raw(ch_cfg_get(), 1, low[1], &(low_duty[1]));
+    while (clock_ns(CLOCK_MONOTONIC) < end && !__atomic_load_n(&stopping, __ATOMIC_RELAXED))
+    {
+        st->source_runs++;
+        uint32_t const fails = st->source_fails;
+
+        /* The higher source wins channel 0, the only one it has active, the lower one fills in the rest. */
+        soak_frame(high, &high_duty);
+        for (uint8_t ch_i = 1; ch_i < PCA9685_REG_CH_NUM; ch_i++)
+        {
+            high[ch_i] = -1.0f;
+        }
+        soak_seq_publish(low_seg, low, 0);
+        uint64_t const quiet = soak_seq_publish(seq_seg, high, 0);
+        st->source_fails += soak_source_feed(low, 0, quiet + recover_ns, 0, high_duty, 0) == 0 ||
+                            soak_source_feed(low, 0, quiet + recover_ns, 1, low_duty[1], 0) == 0;
+
+        /* Once it is quiet for the stale timeout, the lower source takes channel 0 over. */
+        uint64_t const taken = soak_source_feed(low, 0, quiet + stale_ns + recover_ns, 0, low_duty[0], 0);
+        st->source_fails += taken == 0 || taken < quiet + stale_ns;
+        if (taken > quiet)
+        {
+            st->fallthrough_max_ns = taken - quiet > st->fallthrough_max_ns ? taken - quiet : st->fallthrough_max_ns;
+        }
+
+        /* An emergency from the lower source stops the channel the higher one drives. */
+        soak_frame(high, &high_duty);
+        for (uint8_t ch_i = 1; ch_i < PCA9685_REG_CH_NUM; ch_i++)
+        {
+            high[ch_i] = -1.0f;
+        }
+        uint64_t const publish = soak_seq_publish(seq_seg, high, 0);
+        st->source_fails += soak_source_feed(low, 0, publish + recover_ns, 0, high_duty, 0) == 0 ||
+                            soak_source_feed(low, 1, clock_ns(CLOCK_MONOTONIC) + recover_ns, 0, neutral, 0) == 0;
+
+        /* An emergency from the higher source holds after it went stale and the lower one is fresh. */
+        uint64_t const raise = soak_seq_publish(seq_seg, high, 1);
+        st->source_fails += soak_source_feed(low, 0, raise + stale_ns + recover_ns, 0, neutral, 1) != 0 ||
+                            soak_ch_out(1) != ch_cfg_get()->ch[1].neutral;
+        duty_out = neutral;
+        if (st->source_fails != fails && !__atomic_load_n(&stopping, __ATOMIC_RELAXED))
+        {
+            log_error("Control source checks failed in round %u", st->source_runs);
+        }
+    }
+    /* Leave the outputs to the higher source again. */
+    for (uint8_t ch_i = 0; ch_i < PCA9685_REG_CH_NUM; ch_i++)
+    {
+        low[ch_i] = -1.0f;
+    }
+    soak_seq_publish(low_seg, low, 0);
+}
+
+/**
+ * @brief Run one phase of the script, then lift its fault and measure the time until a new frame
+ * makes it to the outputs.
+ */
+static void soak_phase(soak_step_t const *const step)
+{
+    soak_stats_t *const st = &(stats[step->fault]);
+    uint64_t const overruns = __atomic_load_n(&(loop_stats_get()->overruns), __ATOMIC_RELAXED);
+    uint64_t const end = clock_ns(CLOCK_MONOTONIC) + ((uint64_t)step->seconds * 1000000000U);
+    log_info("Soak phase '%s' for %u s", SOAK_FAULT_NAME[step->fault], step->seconds);
+    st->phases++;
+
+    soak_fault_apply(step->fault, 1);
+    if (step->fault == SOAK_STUCK)
+    {
+        soak_stuck(st, end);
+    }
+    else if (step->fault == SOAK_SOURCES)
+    {
+        soak_sources(st, end);
+    }
+    else
+    {
+        soak_produce(step->fault, st, end);
+    }
+    soak_fault_apply(step->fault, 0);
+
+    if (step->fault != SOAK_CLEAN && !__atomic_load_n(&stopping, __ATOMIC_RELAXED))
+    {
+        uint64_t const lift = clock_ns(CLOCK_MONOTONIC);
+        float frac[PCA9685_REG_CH_NUM];
+        uint16_t duty;
+        soak_frame(frac, &duty);
+        uint64_t const latch = soak_latch_wait(soak_publish(frac), duty, SOAK_LATCH_TIMEOUT_NS);
+        if (latch > 0)
+        {
+            st->recover_max_ns = latch - lift > st->recover_max_ns ? latch - lift : st->recover_max_ns;
+        }
+        else if (!__atomic_load_n(&stopping, __ATOMIC_RELAXED))
+        {
+            st->recover_lost++;
+        }
+    }
+    st->overruns += __atomic_load_n(&(loop_stats_get()->overruns), __ATOMIC_RELAXED) - overruns;
+}
+
+/**
+ * @brief Synthetic control producer. Runs the fault script over and over until the time is up.
+ */
+static void *soak_producer(void *arg)
+{
+    (void)arg;
+    uint64_t const end = clock_ns(CLOCK_MONOTONIC) + ((uint64_t)cfg.seconds * 1000000000U);
+    for (uint32_t step_i = 0; clock_ns(CLOCK_MONOTONIC) < end && !__atomic_load_n(&stopping, __ATOMIC_RELAXED); step_i++)
+    {
+        soak_step_t step = script[step_i % script_len];
+        uint64_t const left_s = (end - clock_ns(CLOCK_MONOTONIC) + 999999999U) / 1000000000U;
+        step.seconds = step.seconds < left_s ? step.seconds : left_s;
+        soak_phase(&step);
+    }
+    kill(getpid(), SIGTERM); /* Stops the event loop. */
+    return NULL;
+}
+
+/**
+ * @brief Print one pass criterion.
+ * @return 1 if it holds and 0 otherwise.
+ */
+static uint8_t soak_check(char const *const name, double const value, double const limit, char const *const sep)
+{
+    uint8_t const pass = value <= limit;
+    printf("    {\"name\": \"%s\", \"value\": %.1f, \"limit\": %.1f, \"pass\": %s}%s\n", name, value, limit, pass ? "true" : "false", sep);
+    return pass;
+}
+
+/**
+ * @brief Print what was seen under every kind of fault and whether the run passed.
+ * @return 1 if every criterion holds and 0 otherwise.
+ */
+static uint8_t soak_report(uint64_t const cpu_ns)
+{
+    soak_stats_t total = {0};
+    printf("  \"phases\": {\n");
+    for (uint8_t fault_i = 0; fault_i < SOAK_FAULT_NUM; fault_i++)
+    {
+        soak_stats_t const *const st = &(stats[fault_i]);
+        printf("    \"%s\": {\"phases\": %u, \"frames\": %llu, \"misses\": %llu, \"lost\": %llu, \"overruns\": %llu,\n",
+               SOAK_FAULT_NAME[fault_i], st->phases, (unsigned long long)st->frames, (unsigned long long)st->misses,
+               (unsigned long long)st->lost, (unsigned long long)st->overruns);
+        printf("      \"latency_us\": {\"p50\": %.1f, \"p99\": %.1f, \"p99.9\": %.1f, \"max\": %.1f},\n",
+               hist_percentile_us(st->lat_hist, st->frames - st->lost, 50), hist_percentile_us(st->lat_hist, st->frames - st->lost, 99),
+               hist_percentile_us(st->lat_hist, st->frames - st->lost, 99.9), st->lat_max_ns / 1000.0);
+        printf("      \"recover_us\": {\"max\": %.1f, \"lost\": %u}, \"neutral_us\": {\"max\": %.1f, \"lost\": %u},\n",
+               st->recover_max_ns / 1000.0, st->recover_lost, st->neutral_max_ns / 1000.0, st->neutral_lost);
+        printf("      \"sources\": {\"runs\": %u, \"fails\": %u, \"fallthrough_us\": {\"max\": %.1f}}}%s\n", st->source_runs,
+               st->source_fails, st->fallthrough_max_ns / 1000.0, fault_i + 1U < SOAK_FAULT_NUM ? "," : "");
+        total.frames += st->frames;
+        total.misses += st->misses;
+        total.lost += st->lost;
+        total.overruns += st->overruns;
+        total.lat_max_ns = st->lat_max_ns > total.lat_max_ns ? st->lat_max_ns : total.lat_max_ns;
+        total.recover_max_ns = st->recover_max_ns > total.recover_max_ns ? st->recover_max_ns : total.recover_max_ns;
+        total.recover_lost += st->recover_lost;
+        total.neutral_max_ns = st->neutral_max_ns > total.neutral_max_ns ? st->neutral_max_ns : total.neutral_max_ns;
+        total.neutral_lost += st->neutral_lost;
+        total.source_fails += st->source_fails;
+        total.fallthrough_max_ns = st->fallthrough_max_ns > total.fallthrough_max_ns ? st->fallthrough_max_ns : total.fallthrough_max_ns;
+    }
+    printf("  },\n");
+
+    loop_stats_t const *const loop_stats = loop_stats_get();
+    ctrl_stats_t const *const ctrl_stats = ctrl_stats_get();
+    actr_fault_stats_t const *const fault_stats = actr_fault_stats_get();
+    bus_sim_stats_t sim_stats;
+    bus_sim_stats_get(actr_bus_get(0), &sim_stats);
+    printf("  \"daemon\": {\n");
+    printf("    \"ticks\": %llu, \"wakeups\": %llu, \"wake_latency_us\": {\"max\": %.1f}, \"cpu_us_per_pass\": %.2f,\n",
+           (unsigned long long)loop_stats->ticks, (unsigned long long)loop_stats->events, loop_stats->wake_lat_max_ns / 1000.0,
+           loop_stats->ticks + loop_stats->events > 0 ? cpu_ns / 1000.0 / (loop_stats->ticks + loop_stats->events) : 0);
+    printf("    \"ctrl_busy\": %llu, \"ctrl_stale\": %llu, \"nacks\": %llu, \"stalls\": %llu,\n",
+           (unsigned long long)ctrl_stats->busy, (unsigned long long)ctrl_stats->stale, (unsigned long long)sim_stats.fault,
+           (unsigned long long)sim_stats.stall);
+    printf("    \"retries\": %llu, \"errors\": %llu, \"reopens\": %llu, \"recoveries\": %llu, \"failed\": %llu\n",
+           (unsigned long long)fault_stats->retries, (unsigned long long)actr_io_stats_get()->errors,
+           (unsigned long long)fault_stats->reopens, (unsigned long long)fault_stats->recoveries, (unsigned long long)fault_stats->failed);
+    printf("  },\n");
+
+    /* Frames that never came out, recoveries that never happened, stale input never noticed and
+    channels taken from the wrong control source. */
+    uint8_t pass = 1;
+    printf("  \"checks\": [\n");
+    pass &= soak_check("deadline_miss_ppm", total.frames > 0 ? (1e6 * total.misses) / total.frames : 0, cfg.miss_ppm, ",");
+    pass &= soak_check("lost", total.lost + total.recover_lost + total.neutral_lost, 0, ",");
+    pass &= soak_check("latency_max_us", total.lat_max_ns / 1000.0, cfg.latency_max_us, ",");
+    pass &= soak_check("recover_max_ms", total.recover_max_ns / 1e6, cfg.recover_ms, ",");
+    pass &= soak_check("neutral_max_ms", total.neutral_max_ns / 1e6, cfg.stale_ms + cfg.recover_ms, ",");
+    pass &= soak_check("source_fails", total.source_fails, 0, ",");
+    pass &= soak_check("fallthrough_max_ms", total.fallthrough_max_ns / 1e6, cfg.stale_ms + cfg.recover_ms, ",");
+    /* The loop does not run real-time here, so it may miss the odd tick on a busy machine. */
+    pass &= soak_check("overrun_ppm", loop_stats->ticks > 0 ? (1e6 * total.overruns) / loop_stats->ticks : 0, cfg.overrun_ppm, "");
+    printf("  ],\n");
+    printf("  \"pass\": %s\n", pass ? "true" : "false");
+    return pass;
+}
+
+/**
+ * @brief Run the daemon event loop against a real-time simulated bus while the producer works
+ * through the fault script.
+ * @return 0 if the run passed, 1 if it failed and -1 if it could not be run.
+ */
+static int soak_loop(void)
+{
+    actr_cfg_t const actr_cfg = {.sim = 1, .sim_clock_hz = cfg.clock_hz, .sim_fast = 0, .pwm_hz = PCA9685_PWM_FREQ_DEFAULT,
+                                 .check_ms = cfg.check_ms};
+    loop_cfg_t const loop_cfg = {.tick_hz = cfg.rate_hz, .quiet = 0};
+    if (!cfg.seqlock)
+    {
+        /* The producer side creates the segment, like the controller does. */
+        if (shmem_map(TCO_SHMEM_NAME_CONTROL, TCO_SHMEM_SIZE_CONTROL, TCO_SHMEM_NAME_SEM_CONTROL, O_RDWR, (void **)&ctrl_data, &ctrl_sem) != 0)
+        {
+            log_error("Failed to map the control segment");
+            return -1;
+        }
+        if (sem_trywait(ctrl_sem) == -1)
+        {
+            log_error("Control semaphore is held by another process");
+            return -1;
+        }
+        sem_post(ctrl_sem);
+    }
+    if (cfg.sources)
+    {
+        ctrl_source_cfg_t const high = {.name = CTRL_SHMEM_NAME_SEQ, .prio = SOAK_SOURCE_PRIO_HIGH, .stale_ms = CTRL_SOURCE_STALE_DEFAULT};
+        ctrl_source_cfg_t const low = {.name = SOAK_SOURCE_NAME, .prio = SOAK_SOURCE_PRIO_LOW, .stale_ms = CTRL_SOURCE_STALE_DEFAULT};
+        if (ctrl_source_add(&high) != 0 || ctrl_source_add(&low) != 0)
+        {
+            return -1;
+        }
+    }
+    ctrl_emergency_cb_set(actr_estop_request);
+    if (loop_init(&loop_cfg) != 0 || ctrl_init(cfg.seqlock ? CTRL_MODE_SEQLOCK : CTRL_MODE_SEM, cfg.stale_ms) != 0 ||
+        actr_init(&actr_cfg) != 0 || loop_fd_add(ctrl_wake_fd(), pipeline_wake, NULL) != 0)
+    {
+        return -1;
+    }
+    void *const seg = cfg.seqlock ? seg_map(CTRL_SHMEM_NAME_SEQ, CTRL_SHMEM_SIZE_SEQ) : seg_map(CTRL_SHMEM_NAME_BELL, CTRL_SHMEM_SIZE_BELL);
+    if (seg == NULL || (cfg.sources && (low_seg = seg_map(SOAK_SOURCE_NAME, CTRL_SHMEM_SIZE_SEQ)) == NULL))
+    {
+        return -1;
+    }
+    if (cfg.seqlock)
+    {
+        seq_seg = seg;
+    }
+    else
+    {
+        bell = seg;
+    }
+    if (low_seg != NULL)
+    {
+        /* Whatever an earlier run left in there. */
+        float frac[PCA9685_REG_CH_NUM];
+        for (uint8_t ch_i = 0; ch_i < PCA9685_REG_CH_NUM; ch_i++)
+        {
+            frac[ch_i] = -1.0f;
+        }
+        soak_seq_publish(low_seg, frac, 0);
+    }
+
+    pthread_t producer;
+    if (pthread_create(&producer, NULL, soak_producer, NULL) != 0)
+    {
+        return -1;
+    }
+    uint64_t const cpu_start = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+    int const run_status = loop_run(pipeline_tick, NULL);
+    uint64_t const cpu_ns = clock_ns(CLOCK_THREAD_CPUTIME_ID) - cpu_start;
+    __atomic_store_n(&stopping, 1, __ATOMIC_RELAXED);
+    pthread_join(producer, NULL);
+
+    uint8_t const pass = soak_report(cpu_ns);
+    actr_deinit();
+    loop_deinit();
+    if (run_status != 0)
+    {
+        return -1;
+    }
+    return pass ? 0 : 1;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: tco_actuationd_soak.bin [options]\n"
+                    "-s, --seconds N          Duration of the run (default %u).\n"
+                    "-x, --script LIST        Phases to run in order and over again, from clean, nack, stall,\n"
+                    "                         stuck, burst, hog and, with --sources, sources, each optionally\n"
+                    "                         followed by :SECONDS (default %s).\n"
+                    "-P, --phase-s N          Length of phases that do not give one (default %u).\n"
+                    "-p, --producer HZ        Mean synthetic producer rate (default %u).\n"
+                    "-r, --rate HZ            Event loop tick rate (default %u).\n"
+                    "-b, --bus-clock HZ       Simulated I2C clock (default %u).\n"
+                    "-q, --seqlock            Read control input through the seqlock segment instead of the\n"
+                    "                         semaphore protected one.\n"
+                    "-S, --sources            Read the seqlock segment and %s below it as two control\n"
+                    "                         sources, for the 'sources' phase. Implies --seqlock.\n"
+                    "-t, --stale-ms MS        Stale timeout of the control input, 0 for none (default %u).\n"
+                    "-c, --check-ms MS        Period of the chip configuration readback, 0 for none (default %u).\n"
+                    "-f, --nack-ppm N         Transfers out of a million not acknowledged in 'nack' (default %u).\n"
+                    "-g, --stall-ppm N        Transfers out of a million stretched in 'stall' (default %u).\n"
+                    "-G, --stall-us US        How long a stretched transfer holds the bus (default %u).\n"
+                    "-n, --burst-len N        Frames per burst in 'burst' (default %u).\n"
+                    "-z, --burst-hz HZ        Rate of the frames within a burst (default %u).\n"
+                    "-Z, --burst-gap-ms MS    Mean gap between bursts (default %u).\n"
+                    "-H, --hogs N             Busy threads in 'hog' (default one per CPU).\n"
+                    "-e, --seed N             Seed of the producer timing (default 1).\n"
+                    "-d, --deadline-us US     Frames latched later than this after publishing miss their\n"
+                    "                         deadline (default %u).\n"
+                    "-m, --max-miss-ppm N     Most deadline misses out of a million frames to pass (default %u).\n"
+                    "-l, --max-latency-us US  Worst latency to pass (default %u).\n"
+                    "-R, --max-recover-ms MS  Worst time to pass from lifting a fault until a new frame is out, and\n"
+                    "                         from the stale timeout until the outputs are neutral (default %u).\n"
+                    "-O, --max-overrun-ppm N  Most missed ticks out of a million to pass (default %u).\n",
+            SOAK_SECONDS_DEFAULT, SOAK_SCRIPT_DEFAULT, SOAK_PHASE_S_DEFAULT, SOAK_PRODUCER_HZ_DEFAULT, LOOP_TICK_HZ_DEFAULT,
+            BUS_SIM_CLOCK_HZ_DEFAULT, SOAK_SOURCE_NAME, CTRL_STALE_MS_DEFAULT, ACTR_CHECK_MS_DEFAULT, SOAK_NACK_PPM_DEFAULT, SOAK_STALL_PPM_DEFAULT,
+            SOAK_STALL_US_DEFAULT, SOAK_BURST_LEN_DEFAULT, SOAK_BURST_HZ_DEFAULT, SOAK_BURST_GAP_MS_DEFAULT, SOAK_DEADLINE_US_DEFAULT,
+            SOAK_MISS_PPM_DEFAULT, SOAK_LATENCY_MAX_US_DEFAULT, SOAK_RECOVER_MS_DEFAULT, SOAK_OVERRUN_PPM_DEFAULT);
+}
+
+int main(int argc, char *const argv[])
+{
+    static struct option const long_opts[] = {
+        {"seconds", required_argument, NULL, 's'},
+        {"script", required_argument, NULL, 'x'},
+        {"phase-s", required_argument, NULL, 'P'},
+        {"producer", required_argument, NULL, 'p'},
+        {"rate", required_argument, NULL, 'r'},
+        {"bus-clock", required_argument, NULL, 'b'},
+        {"seqlock", no_argument, NULL, 'q'},
+        {"sources", no_argument, NULL, 'S'},
+        {"stale-ms", required_argument, NULL, 't'},
+        {"check-ms", required_argument, NULL, 'c'},
+        {"nack-ppm", required_argument, NULL, 'f'},
+        {"stall-ppm", required_argument, NULL, 'g'},
+        {"stall-us", required_argument, NULL, 'G'},
+        {"burst-len", required_argument, NULL, 'n'},
+        {"burst-hz", required_argument, NULL, 'z'},
+        {"burst-gap-ms", required_argument, NULL, 'Z'},
+        {"hogs", required_argument, NULL, 'H'},
+        {"seed", required_argument, NULL, 'e'},
+        {"deadline-us", required_argument, NULL, 'd'},
+        {"max-miss-ppm", required_argument, NULL, 'm'},
+        {"max-latency-us", required_argument, NULL, 'l'},
+        {"max-recover-ms", required_argument, NULL, 'R'},
+        {"max-overrun-ppm", required_argument, NULL, 'O'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+    long const cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    cfg.hogs = cpus > 0 ? (uint32_t)cpus : 1U;
+    int parse_status = 0;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "s:x:P:p:r:b:qSt:c:f:g:G:n:z:Z:H:e:d:m:l:R:O:h", long_opts, NULL)) != -1)
+    {
+        switch (opt)
+        {
+        case 's':
+            parse_status = num_parse(optarg, 1, UINT32_MAX, &cfg.seconds);
+            break;
+        case 'x':
+            snprintf(script_str, sizeof(script_str), "%s", optarg);
+            break;
+        case 'P':
+            parse_status = num_parse(optarg, 1, UINT32_MAX, &cfg.phase_s);
+            break;
+        case 'p':
+            parse_status = num_parse(optarg, 1, UINT32_MAX, &cfg.producer_hz);
+            break;
+        case 'r':
+            parse_status = num_parse(optarg, 1, LOOP_TICK_HZ_MAX, &cfg.rate_hz);
+            break;
+        case 'b':
+            parse_status = num_parse(optarg, 1, UINT32_MAX, &cfg.clock_hz);
+            break;
+        case 'q':
+            cfg.seqlock = 1;
+            break;
+        case 'S':
+            cfg.sources = 1;
+            cfg.seqlock = 1;
+            break;
+        case 't':
+            parse_status = num_parse(optarg, 0, UINT32_MAX, &cfg.stale_ms);
+            break;
+        case 'c':
+            parse_status = num_parse(optarg, 0, UINT32_MAX, &cfg.check_ms);
+            break;
+        case 'f':
+            parse_status = num_parse(optarg, 0, 1000000U, &cfg.nack_ppm);
+            break;
+        case 'g':
+            parse_status = num_parse(optarg, 0, 1000000U, &cfg.stall_ppm);
+            break;
+        case 'G':
+            parse_status = num_parse(optarg, 0, UINT32_MAX, &cfg.stall_us);
+            break;
+        case 'n':
+            parse_status = num_parse(optarg, 1, UINT32_MAX, &cfg.burst_len);
+            break;
+        case 'z':
+            parse_status = num_parse(optarg, 1, UINT32_MAX, &cfg.burst_hz);
+            break;
+        case 'Z':
+            parse_status = num_parse(optarg, 0, UINT32_MAX, &cfg.burst_gap_ms);
+            break;
+        case 'H':
+            parse_status = num_parse(optarg, 0, SOAK_HOG_MAX, &cfg.hogs);
+            break;
+        case 'e':
+            parse_status = num_parse(optarg, 0, UINT32_MAX, &cfg.seed);
+            break;
+        case 'd':
+            parse_status = num_parse(optarg, 0, UINT32_MAX, &cfg.deadline_us);
+            break;
+        case 'm':
+            parse_status = num_parse(optarg, 0, 1000000U, &cfg.miss_ppm);
+            break;
+        case 'l':
+            parse_status = num_parse(optarg, 0, UINT32_MAX, &cfg.latency_max_us);
+            break;
+        case 'R':
+            parse_status = num_parse(optarg, 0, UINT32_MAX, &cfg.recover_ms);
+            break;
+        case 'O':
+            parse_status = num_parse(optarg, 0, 1000000U, &cfg.overrun_ppm);
+            break;
+        default:
+            usage();
+            return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+        if (parse_status != 0)
+        {
+            fprintf(stderr, "Invalid value '%s' for -%c\n\n", optarg, opt);
+            usage();
+            return EXIT_FAILURE;
+        }
+    }
+    if ((cfg.sources && cfg.stale_ms == 0) || soak_script_parse(script_str) != 0)
+    {
+        usage();
+        return EXIT_FAILURE;
+    }
+    if (log_init("actuationd_soak", "./soak_log.txt") != 0)
+    {
+        fprintf(stderr, "Failed to initialize the logger\n");
+        return EXIT_FAILURE;
+    }
+    srand(cfg.seed);
+    ch_cfg_timebase_set(pca9685_count_ps(PCA9685_OSC_FREQ, pca9685_prescale_calc(PCA9685_OSC_FREQ, PCA9685_PWM_FREQ_DEFAULT)));
+
+    printf("{\n");
+    printf("  \"version\": %u,\n", SOAK_VERSION);
+    printf("  \"config\": {\"seconds\": %u, \"script\": \"%s\", \"phase_s\": %u, \"producer_hz\": %u, \"rate_hz\": %u, \"bus_clock_hz\": %u, \"seqlock\": %u, \"sources\": %u, \"stale_ms\": %u, \"check_ms\": %u, "
+           "\"nack_ppm\": %u, \"stall_ppm\": %u, \"stall_us\": %u, \"burst_len\": %u, \"burst_hz\": %u, \"burst_gap_ms\": %u, \"hogs\": %u, \"seed\": %u, "
+           "\"deadline_us\": %u, \"max_miss_ppm\": %u, \"max_latency_us\": %u, \"max_recover_ms\": %u, \"max_overrun_ppm\": %u},\n",
+           cfg.seconds, script_str, cfg.phase_s, cfg.producer_hz, cfg.rate_hz, cfg.clock_hz, cfg.seqlock, cfg.sources, cfg.stale_ms, cfg.check_ms,
+           cfg.nack_ppm, cfg.stall_ppm, cfg.stall_us, cfg.burst_len, cfg.burst_hz, cfg.burst_gap_ms, cfg.hogs, cfg.seed,
+           cfg.deadline_us, cfg.miss_ppm, cfg.latency_max_us, cfg.recover_ms, cfg.overrun_ppm);
+    int const status = soak_loop();
+    if (status < 0)
+    {
+        fprintf(stderr, "Soak test failed to run, see ./soak_log.txt\n");
+        return EXIT_FAILURE;
+    }
+    printf("}\n");
+    return status == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -1,5 +1,8 @@
 #!/bin/bash
 
+# Sources of the actuation library, everything else in code/ is the daemon around it.
+LIB_SRC="actuator pca9685 bus_i2c bus_sim pwm_sysfs ch_cfg alog"
+
 mkdir -p build
 
 pushd lib/tco_libd
@@ -8,6 +11,32 @@ mv -f build/tco_libd.a ../../build
 popd
 
 pushd build
+mkdir -p lib_obj
+for src in $LIB_SRC
+do
+    clang \
+        -Wall \
+        -std=c11 \
+        -D _DEFAULT_SOURCE \
+        -fPIC \
+        -I /usr/include \
+        -I ../lib/tco_libd/include \
+        -c ../code/$src.c \
+        -o lib_obj/$src.o \
+        -O || exit 1
+done
+ar rcs libtco_actuation.a lib_obj/*.o || exit 1
+# Logging and the I2C port helper come from tco_libd, which the program linking this provides along with 'log_level'.
+clang \
+    -shared \
+    lib_obj/*.o \
+    -l pthread \
+    -l rt \
+    -l m \
+    -l i2c \
+    -l gpiod \
+    -o libtco_actuation.so || exit 1
+
 clang \
     -Wall \
     -std=c11 \
@@ -15,13 +44,15 @@ clang \
     -I /usr/include \
     -I ../lib/tco_shmem \
     -I ../lib/tco_libd/include \
+    $(ls ../code/*.c | grep -v -E "/($(echo $LIB_SRC | tr ' ' '|'))\.c$") \
+    libtco_actuation.a \
+    tco_libd.a \
     -l pthread \
     -l rt \
+    -l m \
     -l i2c \
     -l ncurses \
     -l gpiod \
-    ../code/*.c \
-    tco_libd.a \
     -o tco_actuationd.bin \
     -O 
 popd
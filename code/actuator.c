@@ -1,12 +1,104 @@
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <time.h>
+
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include <linux/futex.h>
 
 #include "tco_libd.h"
 
 #include "actuator.h"
 #include "pca9685.h"
+#include "bus_sim.h"
+#include "ch_cfg.h"
+#include "alog.h"
+
+/*
+The control loop (ingest) converts frames to duty cycles and deposits them in a per-channel mailbox
+where a newer value replaces one that was not written yet. Every bus has a writer thread that drains
+the mailbox and commits to its chips, so a slow bus never holds up ingest. A frame is deposited
+between two increments of 'mbox_seq' (odd while depositing) so writers can take a consistent copy
+without locking.
+*/
+#define ACTR_MBOX_PENDING 0x10000U /* Set in a mailbox slot until a writer takes the value. */
+#define ACTR_MBOX_RETRY_MAX 16U
+
+/* A bus with the chips on it and the writer thread that drives them. */
+typedef struct
+{
+    bus_t bus;
+    uint8_t adapter;
+    pca9685_handle_t *chip[ACTR_CHIP_MAX];                /* Chips on this bus in configuration order. */
+    uint8_t chip_ch[ACTR_CHIP_MAX];                       /* First logical channel of each chip. */
+    uint16_t chip_frame[ACTR_CHIP_MAX][PCA9685_REG_CH_NUM]; /* Copy of the mailbox taken by the writer. */
+    uint8_t chip_num;
+    pthread_t writer;
+    uint8_t writer_started;
+    uint8_t all_off;   /* Set by the e-stop to make the next pass turn all outputs off. */
+    uint32_t all_duty; /* Duty cycle and ACTR_MBOX_PENDING, set by the e-stop to make the next pass write it to all outputs. */
+    uint32_t done_seq; /* Mailbox sequence of the last finished pass. Also used as a futex word. */
+    uint8_t flush_wait;
+    int status; /* Result of the last pass. */
+    uint64_t commit_est_ns; /* Expected duration of a pass, the slowest recent one. */
+    uint8_t off;            /* Set while outputs are turned off by an e-stop, so a recovery keeps them off. */
+    uint64_t check_next;    /* When the chip configuration is read back next. */
+    uint64_t recover_next;  /* Earliest time for another recovery after one failed. */
+    uint64_t first_commit_ns; /* When the first successful pass finished, 0 until then. */
+    uint64_t ch_next_ns[ACTR_CHIP_MAX][PCA9685_REG_CH_NUM]; /* Earliest time each rate limited channel may be written again. */
+    uint64_t defer_ns;        /* When the first channel held back by its rate limit is due, 0 if none is. */
+    uint8_t asleep;           /* Set while the chips on this bus are asleep. */
+    actr_prio_stats_t prio[ACTR_PRIO_NUM];
+    actr_io_stats_t stats;
+    actr_fault_stats_t fault;
+    actr_sleep_stats_t sleep; /* Only the wake latency is counted here. */
+} actr_bus_t;
+
+static pca9685_handle_t chips[ACTR_CHIP_MAX] = {0};
+static uint8_t chip_num = 0;
+static actr_bus_t buses[ACTR_CHIP_MAX] = {0};
+static uint8_t bus_num = 0;
+static pwm_sysfs_t pwms[ACTR_PWM_MAX];
+static uint8_t pwm_ch[ACTR_PWM_MAX]; /* Logical channel of each kernel PWM channel. */
+static uint8_t pwm_num = 0;
+static uint8_t ch_pwm[ACTR_CH_MAX];  /* Index into 'pwms' plus 1 for each logical channel, 0 if on a PCA9685. */
+static uint32_t pwm_count_ps = 0;    /* Length of a duty cycle count on kernel PWM channels. */
+static uint16_t ch_num = 0;          /* Logical channels that exist. */
+
+static uint32_t mbox[ACTR_CH_MAX];   /* Duty cycle and ACTR_MBOX_PENDING per logical channel. */
+static uint32_t mbox_seq = 0;        /* Odd while a frame is deposited. Also used as a futex word. */
+static uint8_t mbox_stop = 0;
+static uint16_t applied[ACTR_CH_MAX]; /* Duty cycle each channel was last written with. */
+static uint8_t ch_prio[ACTR_CH_MAX];     /* Priority class of each channel, kept up to date by ingest. */
+static uint16_t ch_rate_hz[ACTR_CH_MAX]; /* Rate limit of each channel, 0 for none. */
+static uint64_t run_start_ns = 0;        /* When the writers started, for the share of bus time in use. */
+static uint16_t override_duty[ACTR_CH_MAX]; /* Raw duty cycle replacing the input of each overridden channel. */
+static uint8_t override_on[ACTR_CH_MAX];    /* Set for channels that are overridden. Both only used by ingest. */
+static pthread_mutex_t ingest_lock = PTHREAD_MUTEX_INITIALIZER; /* Serializes the functions that set frames. */
+static actr_io_stats_t ingest_stats = {0};
+
+static uint8_t estop_off = 0;
+static uint64_t estop_req_time = 0; /* When an e-stop was requested or 0 if none is pending. */
+static uint32_t estop_seq = 1;      /* Mailbox sequence of the e-stop frame, which is never preempted. */
+static actr_estop_stats_t estop_stats = {0};
+
+static uint8_t sleep_req = 0;      /* Set while the chips are to sleep, cleared by the next frame. */
+static uint64_t wake_req_ns = 0;   /* When the frame that woke the chips was set. */
+static uint64_t sleep_since_ns = 0;
+static actr_sleep_stats_t sleep_stats = {0};
+
+static uint64_t check_period_ns = 0;
+static uint8_t warm = 0;
+static actr_start_stats_t start_stats = {0};
+
+static uint8_t pwm_sync = 0;
+static uint64_t sync_guard_ns = 0;
+static int sync_fd = -1;
 
-static pca9685_handle_t pca9685_handle = {0};
 static uint8_t motor_init_done = 0;         /* 0 if needs initialization and >0 if initialized.*/
 static const uint8_t MOTOR_CH = 0;          /* Motor must always be plugged into this channel */
 static const uint8_t MOTOR_GPIO_CALIB = 24; /* For motor calibration */
@@ -25,18 +117,1075 @@ static int motor_init()
     return 0;
 }
 
-int actr_init()
+static uint64_t actr_now_ns(void)
 {
-    if (i2c_port_open(PCA9685_I2C_ADAPTER_ID, &(pca9685_handle.fd)) != ERR_OK)
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((uint64_t)now.tv_sec * 1000000000U) + now.tv_nsec;
+}
+
+static uint8_t actr_estop_pending(void)
+{
+    return __atomic_load_n(&estop_req_time, __ATOMIC_ACQUIRE) != 0;
+}
+
+/**
+ * @brief Map a pulse fraction to a duty cycle, including ACTR_FRAC_NEUTRAL.
+ * @return 0 on success and -1 if the fraction is out of range.
+ */
+static int actr_frac_to_raw(ch_cfg_t const *const cfg, uint8_t const channel, float const pulse_frac, uint16_t *const duty_cycle)
+{
+    if (pulse_frac == ACTR_FRAC_NEUTRAL)
+    {
+        *duty_cycle = cfg->ch[channel].neutral;
+        return 0;
+    }
+    return ch_cfg_frac_to_raw(cfg, channel, pulse_frac, duty_cycle);
+}
+
+/**
+ * @brief Hand the priority class and rate limit of a channel to the bus writers if they changed.
+ */
+static void actr_ch_sched_set(ch_cfg_t const *const cfg, uint8_t const channel)
+{
+    ch_cfg_ch_t const *const ch = &(cfg->ch[channel]);
+    if (__atomic_load_n(&(ch_prio[channel]), __ATOMIC_RELAXED) != ch->prio)
+    {
+        __atomic_store_n(&(ch_prio[channel]), ch->prio, __ATOMIC_RELAXED);
+    }
+    if (__atomic_load_n(&(ch_rate_hz[channel]), __ATOMIC_RELAXED) != ch->rate_hz)
     {
-        log_error("Failed to open I2C adapter with ID %u", PCA9685_I2C_ADAPTER_ID);
+        __atomic_store_n(&(ch_rate_hz[channel]), ch->rate_hz, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * @brief Start depositing a frame in the mailbox.
+ */
+static void actr_mbox_begin(void)
+{
+    __atomic_store_n(&mbox_seq, mbox_seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Have the frame about to be deposited wake the chips if they sleep. The writers wake them
+ * before writing it.
+ */
+static void actr_wake_req(void)
+{
+    if (!__atomic_load_n(&sleep_req, __ATOMIC_RELAXED))
+    {
+        return;
+    }
+    uint64_t const now = actr_now_ns();
+    __atomic_store_n(&wake_req_ns, now, __ATOMIC_RELAXED);
+    __atomic_store_n(&sleep_req, 0, __ATOMIC_RELAXED); /* Published by posting the frame. */
+    sleep_stats.wakes++;
+    sleep_stats.asleep_ns += now - sleep_since_ns;
+}
+
+/**
+ * @brief Deposit the duty cycle of one channel, replacing a value no writer took yet.
+ */
+static void actr_mbox_put(uint8_t const channel, uint16_t const duty_cycle)
+{
+    uint32_t const prev = __atomic_exchange_n(&(mbox[channel]), duty_cycle | ACTR_MBOX_PENDING, __ATOMIC_RELAXED);
+    if ((prev & ACTR_MBOX_PENDING) && (uint16_t)prev != duty_cycle)
+    {
+        ingest_stats.overwrites++;
+    }
+}
+
+/**
+ * @brief Finish depositing a frame and wake the writers.
+ * @return Mailbox sequence of the frame.
+ */
+static uint32_t actr_mbox_post(void)
+{
+    uint32_t const seq = mbox_seq + 1;
+    __atomic_store_n(&mbox_seq, seq, __ATOMIC_RELEASE);
+    ingest_stats.posts++;
+    syscall(SYS_futex, &mbox_seq, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+    return seq;
+}
+
+/**
+ * @brief Copy the channels of all chips on a bus out of the mailbox, retrying while a frame is
+ * being deposited.
+ * @return Mailbox sequence of the last complete frame the copy holds, which is the one of the
+ * previous pass if every try found a frame being deposited.
+ */
+static uint32_t actr_mbox_take(actr_bus_t *const bus)
+{
+    uint32_t seq_taken = __atomic_load_n(&(bus->done_seq), __ATOMIC_RELAXED);
+    uint32_t depth = 0;
+    uint8_t torn = 1;
+    for (uint8_t retry_i = 0; retry_i < ACTR_MBOX_RETRY_MAX && torn; retry_i++)
+    {
+        uint32_t const seq_begin = __atomic_load_n(&mbox_seq, __ATOMIC_ACQUIRE);
+        if (seq_begin & 1U)
+        {
+            continue;
+        }
+        depth = 0;
+        for (uint8_t chip_i = 0; chip_i < bus->chip_num; chip_i++)
+        {
+            for (uint8_t ch_i = 0; ch_i < PCA9685_REG_CH_NUM; ch_i++)
+            {
+                uint8_t const channel = bus->chip_ch[chip_i] + ch_i;
+                uint32_t const slot = __atomic_fetch_and(&(mbox[channel]), ~ACTR_MBOX_PENDING, __ATOMIC_RELAXED);
+                bus->chip_frame[chip_i][ch_i] = ch_pwm[channel] == 0 ? (uint16_t)slot : 0;
+                depth += (slot & ACTR_MBOX_PENDING) != 0;
+            }
+        }
+        /* A torn copy still holds every value of the frame it started on, or newer ones. */
+        seq_taken = seq_begin;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        torn = __atomic_load_n(&mbox_seq, __ATOMIC_RELAXED) != seq_begin;
+    }
+    bus->stats.mbox_busy += torn;
+    bus->stats.depth_sum += depth;
+    if (depth > bus->stats.depth_max)
+    {
+        bus->stats.depth_max = depth;
+    }
+    return seq_taken;
+}
+
+/**
+ * @brief Check if the pass for mailbox sequence @p seq should stop because an e-stop is coming.
+ */
+static uint8_t actr_preempted(uint32_t const seq)
+{
+    if (actr_estop_pending() && seq != __atomic_load_n(&estop_seq, __ATOMIC_ACQUIRE))
+    {
+        __atomic_add_fetch(&(estop_stats.preempted), 1, __ATOMIC_RELAXED);
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Record that the channels in @p ch_mask of a chip on a bus were written with @p duty_cycle,
+ * or turned off if NULL.
+ */
+static void actr_applied_set(actr_bus_t const *const bus, uint8_t const chip_i, uint16_t const *const duty_cycle, uint16_t const ch_mask)
+{
+    for (uint8_t ch_i = 0; ch_i < PCA9685_REG_CH_NUM; ch_i++)
+    {
+        uint8_t const channel = bus->chip_ch[chip_i] + ch_i;
+        if (ch_pwm[channel] == 0 && (ch_mask & (1U << ch_i)))
+        {
+            __atomic_store_n(&(applied[channel]), duty_cycle != NULL ? duty_cycle[ch_i] : 0, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+/**
+ * @brief Set a logical channel. Channels on a PCA9685 get deposited in the mailbox, which must be
+ * open, and kernel PWM channels get written right away. Those also go in the mailbox, without
+ * ACTR_MBOX_PENDING, so "actr_frame_get" sees every channel.
+ * @return 0 on success and -1 if a kernel PWM write failed.
+ */
+static int actr_ch_put(uint8_t const channel, uint16_t const duty_cycle)
+{
+    if (ch_pwm[channel] == 0)
+    {
+        actr_mbox_put(channel, duty_cycle);
+        return 0;
+    }
+    __atomic_store_n(&(mbox[channel]), duty_cycle, __ATOMIC_RELAXED);
+    /* Only the 12 bits the chips take count, like in "pca9685_ch_regs_fill". */
+    uint16_t const counts = duty_cycle & 0x0fffU;
+    uint32_t const duty_ns = (uint32_t)(((uint64_t)counts * pwm_count_ps) / 1000U);
+    pwm_sysfs_t *const pwm = &(pwms[ch_pwm[channel] - 1]);
+    uint8_t const changed = !pwm->duty_valid || pwm->duty_ns != duty_ns;
+    if (pwm_sysfs_duty_set(pwm, duty_ns) != ERR_OK)
+    {
+        ingest_stats.pwm_errors++;
         return -1;
     }
-    if (pca9685_init(&pca9685_handle) != ERR_OK)
+    ingest_stats.pwm_writes += changed;
+    __atomic_store_n(&(applied[channel]), counts, __ATOMIC_RELAXED);
+    return 0;
+}
+
+/**
+ * @brief Write the channels in @p ch_mask of the copied frame to all chips on a bus. If every chip on
+ * the bus gets the same duty cycles, they are written with one transfer to their group address. A
+ * pending e-stop request stops the write before the next transfer.
+ * @param bus Bus to write.
+ * @param seq Mailbox sequence of the copied frame.
+ * @param ch_mask Channels to write of each chip.
+ * @return 0 on success and -1 on failure.
+ */
+static int actr_bus_commit_mask(actr_bus_t *const bus, uint32_t const seq, uint16_t const ch_mask[ACTR_CHIP_MAX])
+{
+    uint8_t same = bus->chip_num > 1;
+    for (uint8_t chip_i = 1; chip_i < bus->chip_num && same; chip_i++)
+    {
+        same = ch_mask[0] == ch_mask[chip_i] && memcmp(bus->chip_frame[0], bus->chip_frame[chip_i], sizeof(bus->chip_frame[0])) == 0;
+    }
+    if (same)
+    {
+        if (pca9685_group_frame_commit_mask(bus->chip, bus->chip_num, ACTR_GROUP_ADDR, bus->chip_frame[0], ch_mask[0]) != ERR_OK)
+        {
+            alog_error("Failed to commit a new frame to the chips on adapter %u", bus->adapter);
+            return -1;
+        }
+        for (uint8_t chip_i = 0; chip_i < bus->chip_num; chip_i++)
+        {
+            actr_applied_set(bus, chip_i, bus->chip_frame[0], ch_mask[0]);
+        }
+        return 0;
+    }
+    int status = 0;
+    for (uint8_t chip_i = 0; chip_i < bus->chip_num; chip_i++)
+    {
+        if (ch_mask[chip_i] == 0)
+        {
+            continue;
+        }
+        if (chip_i > 0 && actr_preempted(seq))
+        {
+            break;
+        }
+        if (pca9685_frame_commit_mask(bus->chip[chip_i], bus->chip_frame[chip_i], ch_mask[chip_i]) != ERR_OK)
+        {
+            alog_error("Failed to commit a new frame to the chip at 0x%02x on adapter %u", bus->chip[chip_i]->addr, bus->adapter);
+            status = -1;
+            continue;
+        }
+        actr_applied_set(bus, chip_i, bus->chip_frame[chip_i], ch_mask[chip_i]);
+    }
+    return status;
+}
+
+/**
+ * @brief Get the priority class of a logical channel.
+ */
+static uint8_t actr_ch_prio(uint8_t const channel)
+{
+    return __atomic_load_n(&(ch_prio[channel]), __ATOMIC_RELAXED) == ACTR_PRIO_HIGH ? ACTR_PRIO_HIGH : ACTR_PRIO_LOW;
+}
+
+/**
+ * @brief Split the channels of a bus into what each priority class writes in this pass. Channels
+ * whose rate limit does not let them be written yet are left out and 'defer_ns' is set to when the
+ * first of them is due.
+ * @param bus Bus to schedule.
+ * @param now_ns Current time.
+ * @param full If >0, every channel is written regardless of its rate limit, e.g. for an e-stop.
+ * @param ch_mask Where the channels each class writes of each chip get written.
+ * @param changed Where the channels with a new value that get written go, for "actr_bus_sched_done".
+ */
+static void actr_bus_sched(actr_bus_t *const bus, uint64_t const now_ns, uint8_t const full,
+                               uint16_t ch_mask[ACTR_PRIO_NUM][ACTR_CHIP_MAX], uint16_t changed[ACTR_CHIP_MAX])
+{
+    bus->defer_ns = 0;
+    for (uint8_t chip_i = 0; chip_i < bus->chip_num; chip_i++)
+    {
+        ch_mask[ACTR_PRIO_LOW][chip_i] = 0;
+        ch_mask[ACTR_PRIO_HIGH][chip_i] = 0;
+        changed[chip_i] = 0;
+        for (uint8_t ch_i = 0; ch_i < PCA9685_REG_CH_NUM; ch_i++)
+        {
+            uint8_t const channel = bus->chip_ch[chip_i] + ch_i;
+            uint8_t const prio = actr_ch_prio(channel);
+            uint16_t committed;
+            if (pca9685_ch_committed_get(bus->chip[chip_i], ch_i, &committed) == 0 && committed == (bus->chip_frame[chip_i][ch_i] & 0x0fffU))
+            {
+                /* Nothing to write, kept in the mask so chips with the same frame still share a transfer. */
+                ch_mask[prio][chip_i] |= 1U << ch_i;
+                continue;
+            }
+            uint64_t const next_ns = bus->ch_next_ns[chip_i][ch_i];
+            if (!full && now_ns < next_ns)
+            {
+                bus->prio[prio].deferred++;
+                if (bus->defer_ns == 0 || next_ns < bus->defer_ns)
+                {
+                    bus->defer_ns = next_ns;
+                }
+                continue;
+            }
+            ch_mask[prio][chip_i] |= 1U << ch_i;
+            changed[chip_i] |= 1U << ch_i;
+        }
+    }
+}
+
+/**
+ * @brief Start the rate limit interval of the channels in @p changed that were just written.
+ * @param bus Bus that was written.
+ * @param changed Channels of each chip, as given by "actr_bus_sched".
+ * @param ch_mask Channels of each chip that were written.
+ * @param now_ns When they were written.
+ */
+static void actr_bus_sched_done(actr_bus_t *const bus, uint16_t const changed[ACTR_CHIP_MAX], uint16_t const ch_mask[ACTR_CHIP_MAX], uint64_t const now_ns)
+{
+    for (uint8_t chip_i = 0; chip_i < bus->chip_num; chip_i++)
+    {
+        uint16_t const done = changed[chip_i] & ch_mask[chip_i];
+        for (uint8_t ch_i = 0; done != 0 && ch_i < PCA9685_REG_CH_NUM; ch_i++)
+        {
+            if ((done & (1U << ch_i)) == 0)
+            {
+                continue;
+            }
+            uint8_t const channel = bus->chip_ch[chip_i] + ch_i;
+            uint16_t const rate_hz = __atomic_load_n(&(ch_rate_hz[channel]), __ATOMIC_RELAXED);
+            bus->ch_next_ns[chip_i][ch_i] = rate_hz > 0 ? now_ns + (1000000000U / rate_hz) : 0;
+            bus->prio[actr_ch_prio(channel)].ch_written++;
+        }
+    }
+}
+
+/**
+ * @brief Write the copied frame to all chips on a bus, high priority channels first. Low priority
+ * channels yield to a frame posted meanwhile and go out with it instead, unless @p full.
+ * @param bus Bus to write.
+ * @param seq Mailbox sequence of the copied frame.
+ * @param full If >0, every channel is written in this pass, e.g. for an e-stop or a recovery.
+ * @return 0 on success and -1 on failure.
+ */
+static int actr_bus_commit(actr_bus_t *const bus, uint32_t const seq, uint8_t const full)
+{
+    if (__atomic_exchange_n(&(bus->all_off), 0, __ATOMIC_ACQ_REL))
+    {
+        /* Every chip responds to the all-call address so one short write covers a whole bus. */
+        if (pca9685_group_all_off(bus->chip, bus->chip_num, PCA9685_ALLCALL_ADDR) != ERR_OK)
+        {
+            __atomic_store_n(&(bus->all_off), 1, __ATOMIC_RELEASE); /* Still owed, whatever frame comes next. */
+            return -1;
+        }
+        for (uint8_t chip_i = 0; chip_i < bus->chip_num; chip_i++)
+        {
+            actr_applied_set(bus, chip_i, NULL, PCA9685_REG_CH_MASK_ALL);
+        }
+        bus->off = 1;
+        return 0;
+    }
+    uint32_t const all_duty = __atomic_exchange_n(&(bus->all_duty), 0, __ATOMIC_ACQ_REL);
+    if (all_duty & ACTR_MBOX_PENDING)
+    {
+        /* Same for every output, so again one short write to the all-call address covers the bus. */
+        if (pca9685_group_all_set(bus->chip, bus->chip_num, PCA9685_ALLCALL_ADDR, (uint16_t)all_duty) != ERR_OK)
+        {
+            __atomic_store_n(&(bus->all_duty), all_duty, __ATOMIC_RELEASE);
+            return -1;
+        }
+        uint16_t frame[PCA9685_REG_CH_NUM];
+        for (uint8_t ch_i = 0; ch_i < PCA9685_REG_CH_NUM; ch_i++)
+        {
+            frame[ch_i] = (uint16_t)all_duty;
+        }
+        for (uint8_t chip_i = 0; chip_i < bus->chip_num; chip_i++)
+        {
+            actr_applied_set(bus, chip_i, frame, PCA9685_REG_CH_MASK_ALL);
+        }
+        /* The frame itself then only has the channels to write that differ, none for the e-stop frame. */
+    }
+    if (actr_preempted(seq))
+    {
+        return 0;
+    }
+    uint64_t const start = actr_now_ns();
+    uint16_t ch_mask[ACTR_PRIO_NUM][ACTR_CHIP_MAX];
+    uint16_t changed[ACTR_CHIP_MAX];
+    actr_bus_sched(bus, start, full, ch_mask, changed);
+    if (full)
     {
-        log_error("Failed to initialize PCA9685");
+        /* One transfer per chip is quickest when everything has to go out. */
+        for (uint8_t chip_i = 0; chip_i < bus->chip_num; chip_i++)
+        {
+            ch_mask[ACTR_PRIO_HIGH][chip_i] |= ch_mask[ACTR_PRIO_LOW][chip_i];
+            ch_mask[ACTR_PRIO_LOW][chip_i] = 0;
+        }
+    }
+    int status = actr_bus_commit_mask(bus, seq, ch_mask[ACTR_PRIO_HIGH]);
+    uint64_t const high_end = actr_now_ns();
+    actr_bus_sched_done(bus, changed, ch_mask[ACTR_PRIO_HIGH], high_end);
+    bus->prio[ACTR_PRIO_HIGH].busy_ns += high_end - start;
+    uint16_t low_changed = 0;
+    for (uint8_t chip_i = 0; chip_i < bus->chip_num; chip_i++)
+    {
+        low_changed |= changed[chip_i] & ch_mask[ACTR_PRIO_LOW][chip_i];
+    }
+    if (low_changed != 0 && !full && __atomic_load_n(&mbox_seq, __ATOMIC_ACQUIRE) != seq)
+    {
+        /* The low priority channels stay changed, the pass for the newer frame writes them. */
+        bus->prio[ACTR_PRIO_LOW].yielded++;
+    }
+    else if (low_changed != 0 && !actr_preempted(seq))
+    {
+        status |= actr_bus_commit_mask(bus, seq, ch_mask[ACTR_PRIO_LOW]);
+        uint64_t const low_end = actr_now_ns();
+        actr_bus_sched_done(bus, changed, ch_mask[ACTR_PRIO_LOW], low_end);
+        bus->prio[ACTR_PRIO_LOW].busy_ns += low_end - high_end;
+    }
+    bus->off = bus->off && status != 0;
+    return status;
+}
+
+/**
+ * @brief Configure a chip that is in its power-on state and have it join the group of the bus.
+ * Afterwards its outputs are off and nothing is known to be written to it.
+ * @return 0 on success and -1 on failure.
+ */
+static int actr_chip_setup(actr_bus_t *const bus, uint8_t const chip_i)
+{
+    bus->chip[chip_i]->shadow_valid = 0;
+    if (pca9685_configure(bus->chip[chip_i]) != ERR_OK ||
+        (bus->chip_num > 1 && pca9685_group_join(bus->chip[chip_i], PCA9685_REG_SUBADDR1, ACTR_GROUP_ADDR) != ERR_OK))
+    {
+        log_error("Failed to initialize PCA9685 at 0x%02x on adapter %u", bus->chip[chip_i]->addr, bus->adapter);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Reset every chip on a bus and configure them. The reset goes to every chip on the bus so
+ * it is only sent once. Afterwards all outputs are off and nothing is known to be written.
+ * @return 0 on success and -1 on failure.
+ */
+static int actr_bus_setup(actr_bus_t *const bus)
+{
+    if (pca9685_reset(bus->chip[0]) != ERR_OK)
+    {
+        log_error("Failed to reset the chips on adapter %u", bus->adapter);
+        return -1;
+    }
+    bus->asleep = 0; /* Configured chips run, whether or not they were put to sleep before. */
+    for (uint8_t chip_i = 0; chip_i < bus->chip_num; chip_i++)
+    {
+        if (actr_chip_setup(bus, chip_i) != 0)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Take over the chips on a bus with their outputs if all of them already run with the
+ * configuration "actr_bus_setup" gives, so nothing changes on the outputs.
+ * @return 1 if the chips were taken over, 0 if they need "actr_bus_setup" and -1 on failure.
+ */
+static int actr_bus_adopt(actr_bus_t *const bus)
+{
+    for (uint8_t chip_i = 0; chip_i < bus->chip_num; chip_i++)
+    {
+        uint8_t adopted;
+        if (pca9685_adopt(bus->chip[chip_i], &adopted) != ERR_OK)
+        {
+            log_error("Failed to read back PCA9685 at 0x%02x on adapter %u", bus->chip[chip_i]->addr, bus->adapter);
+            return -1;
+        }
+        if (!adopted)
+        {
+            log_info("PCA9685 at 0x%02x on adapter %u is not running with this configuration, resetting the chips on the bus",
+                     bus->chip[chip_i]->addr, bus->adapter);
+            return 0;
+        }
+    }
+    for (uint8_t chip_i = 0; chip_i < bus->chip_num; chip_i++)
+    {
+        if (bus->chip_num > 1 && pca9685_group_join(bus->chip[chip_i], PCA9685_REG_SUBADDR1, ACTR_GROUP_ADDR) != ERR_OK)
+        {
+            return -1;
+        }
+        uint16_t duty[PCA9685_REG_CH_NUM];
+        for (uint8_t ch_i = 0; ch_i < PCA9685_REG_CH_NUM; ch_i++)
+        {
+            duty[ch_i] = 0;
+            pca9685_ch_committed_get(bus->chip[chip_i], ch_i, &(duty[ch_i]));
+        }
+        actr_applied_set(bus, chip_i, duty, PCA9685_REG_CH_MASK_ALL);
+    }
+    log_info("Took over %u running PCA9685 on adapter %u with their outputs", bus->chip_num, bus->adapter);
+    return 1;
+}
+
+/**
+ * @brief Read back the configuration of every chip on a bus.
+ * @param lost Set to the mask of the chips (bit N for chip N) that lost their configuration.
+ * @return 0 on success and -1 if a readback failed.
+ */
+static int actr_bus_check(actr_bus_t *const bus, uint8_t *const lost)
+{
+    *lost = 0;
+    for (uint8_t chip_i = 0; chip_i < bus->chip_num; chip_i++)
+    {
+        uint8_t chip_lost;
+        bus->fault.checks++;
+        if (pca9685_config_check(bus->chip[chip_i], &chip_lost) != ERR_OK)
+        {
+            return -1;
+        }
+        *lost |= chip_lost ? 1U << chip_i : 0U;
+    }
+    return 0;
+}
+
+/**
+ * @brief Check the chips on a bus and bring back any that lost their configuration or stopped
+ * responding. The bus is reopened if even the readback fails. Chips found without configuration
+ * are at their power-on state and get initialized again without a reset, which would go to every
+ * chip on the bus, so the others keep their outputs. Then the frame of mailbox sequence @p seq is
+ * restored, or the outputs stay off if an e-stop turned them off.
+ * @param bus Bus to check.
+ * @param seq Mailbox sequence of the frame copied last.
+ * @return 0 if the chips are fine or were brought back and -1 otherwise.
+ */
+static int actr_bus_recover(actr_bus_t *const bus, uint32_t const seq)
+{
+    uint64_t const start = actr_now_ns();
+    uint8_t lost = 0;
+    int status = actr_bus_check(bus, &lost);
+    if (status != 0)
+    {
+        bus->fault.reopens++;
+        if (bus_recover(&(bus->bus)) != ERR_OK || actr_bus_check(bus, &lost) != 0)
+        {
+            alog_error("Chips on adapter %u do not respond", bus->adapter);
+            bus->fault.failed++;
+            bus->recover_next = start + (ACTR_RECOVER_HOLDOFF_MS * 1000000ULL);
+            return -1;
+        }
+        alog_info("Adapter %u responds again after reopening it", bus->adapter);
+        /* Writes were lost when the bus failed, the shadow copies no longer say what the chips have. */
+        for (uint8_t chip_i = 0; chip_i < bus->chip_num; chip_i++)
+        {
+            bus->chip[chip_i]->shadow_valid = 0;
+        }
+    }
+    for (uint8_t chip_i = 0; chip_i < bus->chip_num; chip_i++)
+    {
+        if (!(lost & (1U << chip_i)))
+        {
+            continue;
+        }
+        bus->fault.resets++;
+        alog_error("PCA9685 at 0x%02x on adapter %u lost its configuration, initializing it again", bus->chip[chip_i]->addr, bus->adapter);
+        /* A sleeping bus stays asleep, the chip wakes with the others. */
+        if (actr_chip_setup(bus, chip_i) != 0 || (bus->asleep && pca9685_sleep(bus->chip[chip_i]) != ERR_OK))
+        {
+            bus->fault.failed++;
+            bus->recover_next = start + (ACTR_RECOVER_HOLDOFF_MS * 1000000ULL);
+            return -1;
+        }
+    }
+    if (status == 0 && !lost)
+    {
+        return 0;
+    }
+
+    /* Outputs are only restored from what the writer already took, newer frames come on the next pass. */
+    if (bus->off)
+    {
+        __atomic_store_n(&(bus->all_off), 1, __ATOMIC_RELEASE);
+    }
+    if (actr_bus_commit(bus, seq, 1) != 0)
+    {
+        bus->fault.failed++;
+        bus->recover_next = start + (ACTR_RECOVER_HOLDOFF_MS * 1000000ULL);
         return -1;
     }
+    uint64_t const recover_ns = actr_now_ns() - start;
+    bus->fault.recoveries++;
+    bus->fault.recover_last_ns = recover_ns;
+    if (recover_ns > bus->fault.recover_max_ns)
+    {
+        bus->fault.recover_max_ns = recover_ns;
+    }
+    bus->recover_next = 0;
+    return 0;
+}
+
+/**
+ * @brief Put every chip on a bus to sleep.
+ * @return 0 on success and -1 on failure.
+ */
+static int actr_bus_sleep(actr_bus_t *const bus)
+{
+    int status = 0;
+    for (uint8_t chip_i = 0; chip_i < bus->chip_num; chip_i++)
+    {
+        status |= pca9685_sleep(bus->chip[chip_i]) != ERR_OK ? -1 : 0;
+    }
+    /* Chips that did not get to sleep take the wake up without harm. */
+    bus->asleep = 1;
+    return status;
+}
+
+/**
+ * @brief Wake every chip on a bus and restart their PWM with the values they had. A single wait for
+ * the oscillators covers all chips.
+ * @return 0 on success and -1 on failure, in which case the next pass tries again.
+ */
+static int actr_bus_wake(actr_bus_t *const bus)
+{
+    int status = 0;
+    for (uint8_t chip_i = 0; chip_i < bus->chip_num; chip_i++)
+    {
+        status |= pca9685_wake(bus->chip[chip_i]) != ERR_OK ? -1 : 0;
+    }
+    usleep(PCA9685_WAKE_US);
+    for (uint8_t chip_i = 0; chip_i < bus->chip_num && status == 0; chip_i++)
+    {
+        status |= pca9685_restart(bus->chip[chip_i]) != ERR_OK ? -1 : 0;
+    }
+    bus->asleep = status != 0;
+    return status;
+}
+
+/**
+ * @brief Take the newest frame out of the mailbox, write it and let flushes waiting for it go. Chips
+ * that sleep are woken before and chips that are to sleep are put to sleep after.
+ * @return Mailbox sequence of the frame.
+ */
+static uint32_t actr_bus_pass(actr_bus_t *const bus)
+{
+    uint32_t const seq = actr_mbox_take(bus);
+    uint8_t const sleep = __atomic_load_n(&sleep_req, __ATOMIC_ACQUIRE);
+    uint8_t const wake = !sleep && bus->asleep;
+    uint64_t const commit_start = actr_now_ns();
+    bus->status = wake ? actr_bus_wake(bus) : 0;
+    if (bus->status == 0)
+    {
+        bus->status = actr_bus_commit(bus, seq, seq == __atomic_load_n(&estop_seq, __ATOMIC_ACQUIRE));
+    }
+    uint64_t const commit_ns = actr_now_ns() - commit_start;
+    if (wake && bus->status == 0)
+    {
+        uint64_t const wake_lat_ns = commit_start + commit_ns - __atomic_load_n(&wake_req_ns, __ATOMIC_RELAXED);
+        bus->sleep.wake_lat_num++;
+        bus->sleep.wake_lat_last_ns = wake_lat_ns;
+        bus->sleep.wake_lat_sum_ns += wake_lat_ns;
+        if (wake_lat_ns > bus->sleep.wake_lat_max_ns)
+        {
+            bus->sleep.wake_lat_max_ns = wake_lat_ns;
+        }
+    }
+    if (sleep && !bus->asleep && bus->status == 0)
+    {
+        bus->status = actr_bus_sleep(bus);
+    }
+    if (bus->status != 0 && commit_start >= bus->recover_next)
+    {
+        /* Before letting flushes go so an e-stop waiting for this pass gets the outcome of the recovery. */
+        bus->status = actr_bus_recover(bus, seq);
+        bus->check_next = actr_now_ns() + check_period_ns;
+    }
+    if (bus->status == 0 && bus->first_commit_ns == 0)
+    {
+        __atomic_store_n(&(bus->first_commit_ns), commit_start + commit_ns, __ATOMIC_RELAXED);
+    }
+    /* Follow a slower pass at once but a faster one only slowly. */
+    bus->commit_est_ns = commit_ns > bus->commit_est_ns ? commit_ns : bus->commit_est_ns - ((bus->commit_est_ns - commit_ns) / 16U);
+    bus->stats.busy_ns += commit_ns;
+    bus->stats.drains++;
+    bus->stats.errors += bus->status != 0;
+    /* Sequentially consistent with "actr_mbox_wait" so either it sees the new sequence or we see it waiting. */
+    __atomic_store_n(&(bus->done_seq), seq, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&(bus->flush_wait), __ATOMIC_SEQ_CST))
+    {
+        syscall(SYS_futex, &(bus->done_seq), FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+    }
+    /* Routine checks come after the pass was reported so they never delay one. */
+    if (check_period_ns > 0 && commit_start >= bus->check_next)
+    {
+        actr_bus_recover(bus, seq);
+        bus->check_next = actr_now_ns() + check_period_ns;
+    }
+    return seq;
+}
+
+/**
+ * @brief Writer of one bus. Sleeps until a frame is posted, then commits the newest one. Channels
+ * held back by their rate limit also end the sleep once they are due.
+ */
+static void *actr_bus_writer(void *const arg)
+{
+    actr_bus_t *const bus = arg;
+    uint32_t seq_done = __atomic_load_n(&(bus->done_seq), __ATOMIC_ACQUIRE);
+    while (1)
+    {
+        uint32_t const seq = __atomic_load_n(&mbox_seq, __ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&mbox_stop, __ATOMIC_ACQUIRE))
+        {
+            break;
+        }
+        if (seq == seq_done || (seq & 1U))
+        {
+            uint64_t const now = actr_now_ns();
+            if (bus->defer_ns == 0)
+            {
+                syscall(SYS_futex, &mbox_seq, FUTEX_WAIT_PRIVATE, seq, NULL, NULL, 0);
+            }
+            else if (now < bus->defer_ns)
+            {
+                uint64_t const wait_ns = bus->defer_ns - now;
+                struct timespec const timeout = {.tv_sec = wait_ns / 1000000000U, .tv_nsec = wait_ns % 1000000000U};
+                syscall(SYS_futex, &mbox_seq, FUTEX_WAIT_PRIVATE, seq, &timeout, NULL, 0);
+            }
+            else if (!(seq & 1U))
+            {
+                seq_done = actr_bus_pass(bus);
+            }
+            continue;
+        }
+        seq_done = actr_bus_pass(bus);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Check if the e-stop frame was posted and a writer that finished mailbox sequence
+ * @p seq_done did not write it yet.
+ */
+static uint8_t actr_estop_posted(uint32_t const seq, uint32_t const seq_done)
+{
+    uint32_t const seq_estop = __atomic_load_n(&estop_seq, __ATOMIC_ACQUIRE);
+    return (int32_t)(seq - seq_estop) >= 0 && (int32_t)(seq_estop - seq_done) > 0;
+}
+
+/**
+ * @brief Sleep until @p deadline_ns. Posts of normal frames do not end the sleep, only stopping and
+ * an e-stop frame newer than @p seq_done do.
+ */
+static void actr_sync_sleep(uint64_t const deadline_ns, uint32_t const seq_done)
+{
+    struct timespec const until = {.tv_sec = deadline_ns / 1000000000U, .tv_nsec = deadline_ns % 1000000000U};
+    while (1)
+    {
+        uint32_t const seq = __atomic_load_n(&mbox_seq, __ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&mbox_stop, __ATOMIC_ACQUIRE) || actr_estop_posted(seq, seq_done) ||
+            actr_now_ns() >= deadline_ns)
+        {
+            return;
+        }
+        syscall(SYS_futex, &mbox_seq, FUTEX_WAIT_BITSET_PRIVATE, seq, &until, NULL, FUTEX_BITSET_MATCH_ANY);
+    }
+}
+
+/**
+ * @brief Writer of one bus in PWM synchronized mode. Commits the newest frame once per period of
+ * the first chip on the bus, as late as the expected write time allows. The writer of bus 0 also
+ * signals "sync_fd" ahead of that so the control loop can set a fresh frame.
+ */
+static void *actr_bus_writer_sync(void *const arg)
+{
+    actr_bus_t *const bus = arg;
+    uint8_t const ring = bus == &(buses[0]) && sync_fd != -1;
+    uint32_t seq_done = __atomic_load_n(&(bus->done_seq), __ATOMIC_ACQUIRE);
+    while (!__atomic_load_n(&mbox_stop, __ATOMIC_ACQUIRE))
+    {
+        uint64_t const lead_ns = bus->commit_est_ns + sync_guard_ns;
+        uint64_t const now = actr_now_ns();
+        uint64_t boundary = pca9685_period_next(bus->chip[0], now + lead_ns + (ring ? sync_guard_ns : 0));
+        if (boundary == 0)
+        {
+            boundary = now + lead_ns; /* Phase unknown, write at once. */
+        }
+        if (ring)
+        {
+            actr_sync_sleep(boundary - lead_ns - sync_guard_ns, seq_done);
+            eventfd_write(sync_fd, 1);
+        }
+        actr_sync_sleep(boundary - lead_ns, seq_done);
+        uint32_t const seq = __atomic_load_n(&mbox_seq, __ATOMIC_ACQUIRE);
+        if (seq == seq_done)
+        {
+            continue; /* Nothing new for this period. */
+        }
+        uint8_t const estop = actr_estop_posted(seq, seq_done);
+        seq_done = actr_bus_pass(bus);
+        if (!estop && actr_now_ns() > boundary)
+        {
+            bus->stats.sync_late++;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Wait until every writer finished a pass for mailbox sequence @p seq or a later one.
+ * @param timeout_ns Longest wait for all of them, 0 for no limit.
+ * @return 0 if those passes succeeded and -1 if one failed or did not finish in time.
+ */
+static int actr_mbox_wait(uint32_t const seq, uint64_t const timeout_ns)
+{
+    uint64_t const deadline = timeout_ns > 0 ? actr_now_ns() + timeout_ns : 0;
+    int status = 0;
+    for (uint8_t bus_i = 0; bus_i < bus_num; bus_i++)
+    {
+        actr_bus_t *const bus = &(buses[bus_i]);
+        __atomic_store_n(&(bus->flush_wait), 1, __ATOMIC_SEQ_CST);
+        uint32_t done;
+        uint8_t late = 0;
+        while (!late && (int32_t)((done = __atomic_load_n(&(bus->done_seq), __ATOMIC_SEQ_CST)) - seq) < 0)
+        {
+            if (deadline == 0)
+            {
+                syscall(SYS_futex, &(bus->done_seq), FUTEX_WAIT_PRIVATE, done, NULL, NULL, 0);
+                continue;
+            }
+            uint64_t const now = actr_now_ns();
+            late = now >= deadline;
+            if (!late)
+            {
+                struct timespec const timeout = {.tv_sec = (deadline - now) / 1000000000U, .tv_nsec = (deadline - now) % 1000000000U};
+                syscall(SYS_futex, &(bus->done_seq), FUTEX_WAIT_PRIVATE, done, &timeout, NULL, 0);
+            }
+        }
+        __atomic_store_n(&(bus->flush_wait), 0, __ATOMIC_RELEASE);
+        if (late || bus->status != 0)
+        {
+            status = -1;
+        }
+    }
+    return status;
+}
+
+/**
+ * @brief Get the bus for an adapter, opening it if no chip used it yet.
+ * @return Pointer to the bus or NULL on failure.
+ */
+static actr_bus_t *actr_bus_open(actr_cfg_t const *const cfg, uint8_t const adapter)
+{
+    for (uint8_t bus_i = 0; bus_i < bus_num; bus_i++)
+    {
+        if (buses[bus_i].adapter == adapter)
+        {
+            return &(buses[bus_i]);
+        }
+    }
+    actr_bus_t *const bus = &(buses[bus_num]);
+    memset(bus, 0, sizeof(actr_bus_t));
+    bus->adapter = adapter;
+    if (cfg->sim)
+    {
+        bus_sim_cfg_t const sim_cfg = {.clock_hz = cfg->sim_clock_hz, .realtime = !cfg->sim_fast};
+        if (bus_sim_open(&sim_cfg, &(bus->bus)) != ERR_OK)
+        {
+            log_error("Failed to create a simulated bus for adapter %u", adapter);
+            return NULL;
+        }
+    }
+    else if (bus_i2c_open(adapter, &(bus->bus)) != ERR_OK)
+    {
+        log_error("Failed to open I2C adapter with ID %u", adapter);
+        return NULL;
+    }
+    bus_num++;
+    return bus;
+}
+
+/**
+ * @brief Undo what a failed "actr_init" got to: stop the writers that were started and close the
+ * buses, the kernel PWM channels and the eventfd. Chips are left as they are.
+ */
+static void actr_init_unwind(void)
+{
+    __atomic_store_n(&mbox_stop, 1, __ATOMIC_RELEASE);
+    actr_mbox_begin();
+    actr_mbox_post();
+    for (uint8_t bus_i = 0; bus_i < bus_num; bus_i++)
+    {
+        if (buses[bus_i].writer_started)
+        {
+            pthread_join(buses[bus_i].writer, NULL);
+            buses[bus_i].writer_started = 0;
+        }
+        bus_close(&(buses[bus_i].bus));
+    }
+    for (uint8_t pwm_i = 0; pwm_i < pwm_num; pwm_i++)
+    {
+        pwm_sysfs_close(&(pwms[pwm_i]), !warm);
+    }
+    bus_num = 0;
+    chip_num = 0;
+    pwm_num = 0;
+    ch_num = 0;
+    if (sync_fd != -1)
+    {
+        close(sync_fd);
+        sync_fd = -1;
+    }
+}
+
+/**
+ * @brief Body of "actr_init", which unwinds what this set up if it fails.
+ */
+static int actr_init_setup(actr_cfg_t const *const cfg)
+{
+    uint64_t const init_start = actr_now_ns();
+    actr_chip_cfg_t const chip_default = {.adapter = PCA9685_I2C_ADAPTER_ID, .addr = PCA9685_ADDR};
+    actr_chip_cfg_t const *const chip_cfg = cfg->chip_num > 0 ? cfg->chip : &chip_default;
+    uint8_t const chip_cfg_num = cfg->chip_num > 0 ? cfg->chip_num : 1;
+    if (chip_cfg_num > ACTR_CHIP_MAX)
+    {
+        log_error("At most %u chips are supported", ACTR_CHIP_MAX);
+        return -1;
+    }
+
+    if (cfg->pwm_hz != 0 && (cfg->pwm_hz < PCA9685_PWM_FREQ_MIN || cfg->pwm_hz > PCA9685_PWM_FREQ_MAX))
+    {
+        log_error("PWM frequency must be between %u and %u Hz", PCA9685_PWM_FREQ_MIN, PCA9685_PWM_FREQ_MAX);
+        return -1;
+    }
+    if (cfg->pwm_num > ACTR_PWM_MAX)
+    {
+        log_error("At most %u kernel PWM channels are supported", ACTR_PWM_MAX);
+        return -1;
+    }
+
+    /* Threads setting frames inherit the priority of an e-stop waiting for them. */
+    pthread_mutexattr_t lock_attr;
+    pthread_mutexattr_init(&lock_attr);
+    pthread_mutexattr_setprotocol(&lock_attr, PTHREAD_PRIO_INHERIT);
+    pthread_mutex_init(&ingest_lock, &lock_attr);
+    pthread_mutexattr_destroy(&lock_attr);
+
+    chip_num = 0;
+    bus_num = 0;
+    pwm_num = 0;
+    memset(ch_pwm, 0, sizeof(ch_pwm));
+    memset(mbox, 0, sizeof(mbox));
+    memset(applied, 0, sizeof(applied));
+    memset(override_on, 0, sizeof(override_on));
+    ch_cfg_t const *const ch_cfg = ch_cfg_get();
+    for (uint16_t ch_i = 0; ch_i < ACTR_CH_MAX; ch_i++)
+    {
+        actr_ch_sched_set(ch_cfg, ch_i);
+    }
+    ch_cfg_quiesce();
+    __atomic_store_n(&mbox_stop, 0, __ATOMIC_RELEASE);
+    estop_off = cfg->estop_off;
+    __atomic_store_n(&estop_req_time, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&sleep_req, 0, __ATOMIC_RELEASE);
+    memset(&sleep_stats, 0, sizeof(sleep_stats));
+    pwm_sync = cfg->pwm_sync;
+    sync_guard_ns = (uint64_t)cfg->sync_guard_us * 1000U;
+    check_period_ns = (uint64_t)cfg->check_ms * 1000000U;
+    warm = cfg->warm;
+    memset(&start_stats, 0, sizeof(start_stats));
+    if (warm && pwm_sync)
+    {
+        log_info("Chips get reset anyway, PWM synchronized writes need to know when periods start");
+    }
+    if (pwm_sync && (sync_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1)
+    {
+        log_error("eventfd: %s", strerror(errno));
+        return -1;
+    }
+    for (uint8_t chip_i = 0; chip_i < chip_cfg_num; chip_i++)
+    {
+        uint8_t const addr = chip_cfg[chip_i].addr;
+        /* General call, all-call and group addresses can not be used by a single chip. */
+        if (addr == PCA9685_RESET_ADDR || addr > 0x7fU || addr == PCA9685_ALLCALL_ADDR || addr == ACTR_GROUP_ADDR)
+        {
+            log_error("Address 0x%02x can not be used for a chip", addr);
+            return -1;
+        }
+        for (uint8_t other_i = 0; other_i < chip_i; other_i++)
+        {
+            if (chip_cfg[other_i].adapter == chip_cfg[chip_i].adapter && chip_cfg[other_i].addr == addr)
+            {
+                log_error("Chip 0x%02x on adapter %u is configured twice", addr, chip_cfg[chip_i].adapter);
+                return -1;
+            }
+        }
+
+        actr_bus_t *const bus = actr_bus_open(cfg, chip_cfg[chip_i].adapter);
+        if (bus == NULL)
+        {
+            return -1;
+        }
+        if (cfg->sim && bus_sim_chip_add(&(bus->bus), addr) != ERR_OK)
+        {
+            log_error("Failed to create a simulated PCA9685");
+            return -1;
+        }
+        pca9685_handle_t *const chip = &(chips[chip_num]);
+        memset(chip, 0, sizeof(pca9685_handle_t));
+        chip->bus = bus->bus;
+        chip->addr = addr;
+        chip->pwm_hz = cfg->pwm_hz;
+        chip->osc_hz = cfg->osc_hz;
+        chip->retry_max = ACTR_XFER_RETRY_MAX;
+        chip->retry_backoff_us = ACTR_XFER_BACKOFF_US;
+        bus->chip[bus->chip_num] = chip;
+        bus->chip_ch[bus->chip_num] = chip_num * PCA9685_REG_CH_NUM;
+        bus->chip_num++;
+        chip_num++;
+    }
+    if (cfg->sim)
+    {
+        log_info("Using %u simulated PCA9685 on %u buses clocked at %u Hz", chip_num, bus_num, cfg->sim_clock_hz);
+    }
+    ch_num = chip_num * PCA9685_REG_CH_NUM;
+
+    /* Same period as the chips, so counts of the channel calibration are the same length. */
+    pwm_count_ps = pca9685_count_ps(cfg->osc_hz, pca9685_prescale_calc(cfg->osc_hz, cfg->pwm_hz));
+    char const *const pwm_root = cfg->pwm_root != NULL ? cfg->pwm_root : PWM_SYSFS_ROOT_DEFAULT;
+    for (uint8_t pwm_i = 0; pwm_i < cfg->pwm_num; pwm_i++)
+    {
+        actr_pwm_cfg_t const *const pwm_cfg = &(cfg->pwm[pwm_i]);
+        if (pwm_cfg->channel >= ACTR_CH_MAX || ch_pwm[pwm_cfg->channel] != 0)
+        {
+            log_error("Channel %u can not be given to pwmchip%u channel %u", pwm_cfg->channel, pwm_cfg->chip, pwm_cfg->pwm);
+            return -1;
+        }
+        if (pwm_sysfs_open(pwm_root, pwm_cfg->chip, pwm_cfg->pwm, (uint32_t)(((uint64_t)pwm_count_ps * 4096U) / 1000U), &(pwms[pwm_num])) != ERR_OK)
+        {
+            log_error("Failed to set up pwmchip%u channel %u for channel %u", pwm_cfg->chip, pwm_cfg->pwm, pwm_cfg->channel);
+            return -1;
+        }
+        pwm_ch[pwm_num] = pwm_cfg->channel;
+        pwm_num++;
+        ch_pwm[pwm_cfg->channel] = pwm_num;
+        if (pwm_cfg->channel >= ch_num)
+        {
+            ch_num = pwm_cfg->channel + 1U;
+        }
+    }
+    if (pwm_num > 0)
+    {
+        log_info("Driving %u channels through the kernel PWM class under %s", pwm_num, pwm_root);
+    }
+
+    run_start_ns = actr_now_ns();
+    for (uint8_t bus_i = 0; bus_i < bus_num; bus_i++)
+    {
+        actr_bus_t *const bus = &(buses[bus_i]);
+        int const adopted = warm && !pwm_sync ? actr_bus_adopt(bus) : 0;
+        if (adopted < 0 || (adopted == 0 && actr_bus_setup(bus) != 0))
+        {
+            return -1;
+        }
+        if (adopted)
+        {
+            start_stats.adopted += bus->chip_num;
+        }
+        else
+        {
+            start_stats.reset += bus->chip_num;
+        }
+        bus->done_seq = mbox_seq;
+        bus->check_next = actr_now_ns() + check_period_ns;
+        if (pthread_create(&(bus->writer), NULL, pwm_sync ? actr_bus_writer_sync : actr_bus_writer, bus) != 0)
+        {
+            log_error("Failed to start the writer for adapter %u", bus->adapter);
+            return -1;
+        }
+        bus->writer_started = 1;
+    }
+
     if (motor_init() != 0)
     {
         log_error("Failed to initialize the motor");
@@ -46,30 +1195,511 @@ int actr_init()
         log_info("Motor was initialized");
         /* If trully initialized, 'motor_init_done' will be set accordingly. */
     }
+    start_stats.init_ns = actr_now_ns() - init_start;
     return 0;
 }
 
-int actr_deinit(void)
+int actr_init(actr_cfg_t const *const cfg)
 {
-    if (pca9685_reset(&pca9685_handle) != ERR_OK)
+    if (actr_init_setup(cfg) != 0)
     {
-        log_error("Failed to deinitialize the PCA9685 board");
+        actr_init_unwind();
         return -1;
     }
     return 0;
 }
 
-int actr_ch_set(uint8_t const channel, float const pulse_frac)
+int actr_deinit(void)
+{
+    /* Let the writers finish what was posted, then wake them one last time to stop. */
+    actr_mbox_wait(mbox_seq, 0);
+    __atomic_store_n(&mbox_stop, 1, __ATOMIC_RELEASE);
+    actr_mbox_begin();
+    actr_mbox_post();
+    for (uint8_t bus_i = 0; bus_i < bus_num; bus_i++)
+    {
+        if (buses[bus_i].writer_started)
+        {
+            pthread_join(buses[bus_i].writer, NULL);
+            buses[bus_i].writer_started = 0;
+        }
+    }
+
+    actr_io_stats_t const *const io_stats = actr_io_stats_get();
+    log_info("Posted %llu frames, %llu channel values overwritten before being written, %llu writer passes "
+             "with %.2f pending channels on average and at most %llu, %llu found no complete frame, %llu failed",
+             (unsigned long long)io_stats->posts, (unsigned long long)io_stats->overwrites, (unsigned long long)io_stats->drains,
+             io_stats->drains > 0 ? (double)io_stats->depth_sum / io_stats->drains : 0.0, (unsigned long long)io_stats->depth_max,
+             (unsigned long long)io_stats->mbox_busy, (unsigned long long)io_stats->errors);
+    if (pwm_sync)
+    {
+        log_info("PWM synchronized passes finished late %llu times", (unsigned long long)io_stats->sync_late);
+    }
+    uint64_t const run_ns = (actr_now_ns() - run_start_ns) * (bus_num > 0 ? bus_num : 1);
+    for (uint8_t prio = 0; prio < ACTR_PRIO_NUM; prio++)
+    {
+        actr_prio_stats_t const *const prio_stats = actr_prio_stats_get(prio);
+        log_info("%s priority channels: %llu values written using %.2f%% of the bus time, %llu held back by their rate "
+                 "limit, %llu passes yielded to a newer frame",
+                 prio == ACTR_PRIO_HIGH ? "High" : "Low", (unsigned long long)prio_stats->ch_written,
+                 run_ns > 0 ? (100.0 * prio_stats->busy_ns) / run_ns : 0.0, (unsigned long long)prio_stats->deferred,
+                 (unsigned long long)prio_stats->yielded);
+    }
+    actr_fault_stats_t const *const fault_stats = actr_fault_stats_get();
+    if (fault_stats->retries > 0 || fault_stats->reopens > 0 || fault_stats->resets > 0 || fault_stats->failed > 0)
+    {
+        log_info("I2C faults: %llu transfers retried, %llu bus reopens, %llu chip resets found, %llu recoveries taking "
+                 "%.1f us at most, %llu failed, %llu checks",
+                 (unsigned long long)fault_stats->retries, (unsigned long long)fault_stats->reopens,
+                 (unsigned long long)fault_stats->resets, (unsigned long long)fault_stats->recoveries,
+                 fault_stats->recover_max_ns / 1000.0, (unsigned long long)fault_stats->failed, (unsigned long long)fault_stats->checks);
+    }
+    for (uint8_t chip_i = 0; chip_i < chip_num; chip_i++)
+    {
+        pca9685_stats_t const *const stats = &(chips[chip_i].stats);
+        log_info("Chip %u channel writes issued %llu, skipped %llu, in %llu transfers of %llu runs and %llu bytes", chip_i,
+                 (unsigned long long)stats->ch_written, (unsigned long long)stats->ch_skipped,
+                 (unsigned long long)stats->xfer, (unsigned long long)stats->msg, (unsigned long long)stats->bytes);
+    }
+
+    actr_sleep_stats_t const *const sleep_stats_now = actr_sleep_stats_get();
+    if (sleep_stats_now->sleeps > 0)
+    {
+        log_info("Chips slept %llu times for %.1f%% of the run, %llu wakes took %.1f us on average and %.1f us at most "
+                 "until the frame was written",
+                 (unsigned long long)sleep_stats_now->sleeps, (100.0 * sleep_stats_now->asleep_ns) / (actr_now_ns() - run_start_ns),
+                 (unsigned long long)sleep_stats_now->wakes,
+                 sleep_stats_now->wake_lat_num > 0 ? (sleep_stats_now->wake_lat_sum_ns / 1000.0) / sleep_stats_now->wake_lat_num : 0.0,
+                 sleep_stats_now->wake_lat_max_ns / 1000.0);
+    }
+
+    int status = 0;
+    if (warm)
+    {
+        log_info("Leaving the chips running for the next start to take over");
+    }
+    for (uint8_t bus_i = 0; bus_i < bus_num; bus_i++)
+    {
+        /* Sleeping chips would not be taken over but reset. */
+        if (warm && buses[bus_i].asleep && actr_bus_wake(&(buses[bus_i])) != 0)
+        {
+            log_error("Failed to wake the PCA9685 boards on adapter %u", buses[bus_i].adapter);
+            status = -1;
+        }
+        if (!warm && pca9685_reset(buses[bus_i].chip[0]) != ERR_OK)
+        {
+            log_error("Failed to deinitialize the PCA9685 boards on adapter %u", buses[bus_i].adapter);
+            status = -1;
+        }
+        bus_close(&(buses[bus_i].bus));
+    }
+    if (pwm_num > 0)
+    {
+        log_info("Kernel PWM channels got %llu writes, %llu failed", (unsigned long long)io_stats->pwm_writes,
+                 (unsigned long long)io_stats->pwm_errors);
+    }
+    for (uint8_t pwm_i = 0; pwm_i < pwm_num; pwm_i++)
+    {
+        pwm_sysfs_close(&(pwms[pwm_i]), !warm);
+    }
+    bus_num = 0;
+    chip_num = 0;
+    pwm_num = 0;
+    ch_num = 0;
+    if (sync_fd != -1)
+    {
+        close(sync_fd);
+        sync_fd = -1;
+    }
+    return status;
+}
+
+/**
+ * @brief Body of "actr_ch_set", called with the ingest lock held.
+ */
+static int actr_ch_ingest(uint8_t const channel, float const pulse_frac)
 {
     if (channel == MOTOR_CH && motor_init_done == 0)
     {
         /* Not critical, can still set the duty cycle but likely without any effect. */
-        log_error("Motor needs to be initialized to control it");
+        alog_error("Motor needs to be initialized to control it");
+    }
+    if (channel >= ch_num)
+    {
+        alog_error("Channel %u does not exist", channel);
+        return -1;
+    }
+    uint16_t duty_cycle;
+    ch_cfg_t const *const cfg = ch_cfg_get();
+    int const conv_status = actr_frac_to_raw(cfg, channel, pulse_frac, &duty_cycle);
+    actr_ch_sched_set(cfg, channel);
+    ch_cfg_quiesce();
+    if (conv_status != 0)
+    {
+        alog_error("Pulse fraction for channel %u is out of range", channel);
+        return -1;
+    }
+    if (override_on[channel])
+    {
+        duty_cycle = override_duty[channel];
+    }
+    actr_wake_req();
+    actr_mbox_begin();
+    int const status = actr_ch_put(channel, duty_cycle);
+    actr_mbox_post();
+    return status;
+}
+
+int actr_ch_set(uint8_t const channel, float const pulse_frac)
+{
+    pthread_mutex_lock(&ingest_lock);
+    int const status = actr_ch_ingest(channel, pulse_frac);
+    pthread_mutex_unlock(&ingest_lock);
+    return status;
+}
+
+/**
+ * @brief Body of "actr_frame_set", called with the ingest lock held.
+ */
+static int actr_frame_ingest(float const *const pulse_frac, uint8_t const ch_count)
+{
+    if (ch_count > ch_num)
+    {
+        alog_error("Frame has %u channels but only %u exist", ch_count, ch_num);
+        return -1;
+    }
+    if (ch_count > MOTOR_CH && motor_init_done == 0)
+    {
+        /* Not critical, can still set the duty cycle but likely without any effect. */
+        alog_error("Motor needs to be initialized to control it");
+    }
+    uint16_t duty_cycle[ACTR_CH_MAX];
+    int status = 0;
+    ch_cfg_t const *const cfg = ch_cfg_get();
+    for (uint8_t ch_i = 0; ch_i < ch_count; ch_i++)
+    {
+        if (actr_frac_to_raw(cfg, ch_i, pulse_frac[ch_i], &(duty_cycle[ch_i])) != 0)
+        {
+            /* Only this channel goes neutral, the rest of the frame still gets applied. */
+            alog_error("Pulse fraction for channel %u is out of range", ch_i);
+            duty_cycle[ch_i] = cfg->ch[ch_i].neutral;
+            status = -1;
+        }
+        actr_ch_sched_set(cfg, ch_i);
+        if (override_on[ch_i])
+        {
+            duty_cycle[ch_i] = override_duty[ch_i];
+        }
+    }
+    ch_cfg_quiesce();
+    actr_wake_req();
+    actr_mbox_begin();
+    for (uint8_t ch_i = 0; ch_i < ch_count; ch_i++)
+    {
+        status |= actr_ch_put(ch_i, duty_cycle[ch_i]);
+    }
+    actr_mbox_post();
+    return status;
+}
+
+int actr_frame_set(float const *const pulse_frac, uint8_t const ch_count)
+{
+    pthread_mutex_lock(&ingest_lock);
+    int const status = actr_frame_ingest(pulse_frac, ch_count);
+    pthread_mutex_unlock(&ingest_lock);
+    return status;
+}
+
+int actr_override_set(uint8_t const channel, int32_t const duty_cycle)
+{
+    if (channel >= ch_num || duty_cycle > 0x0fff)
+    {
+        alog_error("Cannot override channel %u with duty cycle %d", channel, duty_cycle);
+        return -1;
+    }
+    pthread_mutex_lock(&ingest_lock);
+    override_on[channel] = duty_cycle >= 0;
+    override_duty[channel] = duty_cycle >= 0 ? (uint16_t)duty_cycle : 0;
+    pthread_mutex_unlock(&ingest_lock);
+    return 0;
+}
+
+int actr_sleep(void)
+{
+    if (pwm_sync)
+    {
+        alog_error("Chips can not sleep in PWM synchronized mode");
+        return -1;
+    }
+    pthread_mutex_lock(&ingest_lock);
+    if (!sleep_req)
+    {
+        /* Posted like a frame so the writers get to it after what was set before. */
+        actr_mbox_begin();
+        __atomic_store_n(&sleep_req, 1, __ATOMIC_RELAXED);
+        actr_mbox_post();
+        sleep_since_ns = actr_now_ns();
+        sleep_stats.sleeps++;
+    }
+    pthread_mutex_unlock(&ingest_lock);
+    return 0;
+}
+
+actr_sleep_stats_t const *actr_sleep_stats_get(void)
+{
+    static actr_sleep_stats_t stats;
+    pthread_mutex_lock(&ingest_lock);
+    stats = sleep_stats;
+    if (sleep_req)
+    {
+        stats.asleep_ns += actr_now_ns() - sleep_since_ns;
+    }
+    pthread_mutex_unlock(&ingest_lock);
+    for (uint8_t bus_i = 0; bus_i < bus_num; bus_i++)
+    {
+        actr_sleep_stats_t const *const bus_stats = &(buses[bus_i].sleep);
+        stats.wake_lat_num += bus_stats->wake_lat_num;
+        stats.wake_lat_sum_ns += bus_stats->wake_lat_sum_ns;
+        /* A wake is over once the slowest bus is done. */
+        if (bus_stats->wake_lat_last_ns > stats.wake_lat_last_ns)
+        {
+            stats.wake_lat_last_ns = bus_stats->wake_lat_last_ns;
+        }
+        if (bus_stats->wake_lat_max_ns > stats.wake_lat_max_ns)
+        {
+            stats.wake_lat_max_ns = bus_stats->wake_lat_max_ns;
+        }
+    }
+    return &stats;
+}
+
+int actr_flush(void)
+{
+    return actr_mbox_wait(mbox_seq, 0);
+}
+
+void actr_estop_request(void)
+{
+    uint64_t expected = 0;
+    /* Keep the time of the first request so the latency covers the whole wait. */
+    __atomic_compare_exchange_n(&estop_req_time, &expected, actr_now_ns(), 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+void actr_estop_cancel(void)
+{
+    if (actr_estop_pending())
+    {
+        __atomic_store_n(&estop_req_time, 0, __ATOMIC_RELEASE);
+    }
+}
+
+/**
+ * @brief Check if every channel of the chips on a bus has @p neutral as its neutral and none of them
+ * is replaced by a kernel PWM channel, whose PCA9685 channel has to stay low.
+ */
+static uint8_t actr_bus_uniform(actr_bus_t const *const bus, ch_cfg_t const *const cfg, uint16_t const neutral)
+{
+    for (uint8_t chip_i = 0; chip_i < bus->chip_num; chip_i++)
+    {
+        for (uint8_t ch_i = 0; ch_i < PCA9685_REG_CH_NUM; ch_i++)
+        {
+            uint8_t const channel = bus->chip_ch[chip_i] + ch_i;
+            if (ch_pwm[channel] != 0 || cfg->ch[channel].neutral != neutral)
+            {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+/**
+ * @brief Body of "actr_estop", called with the ingest lock held. When every output on a bus shares
+ * one neutral, it is written with a single transfer to the all-call address, like with "estop_off",
+ * and only other buses get a frame per chip.
+ */
+static int actr_estop_ingest(void)
+{
+    uint64_t const req_time = __atomic_exchange_n(&estop_req_time, 0, __ATOMIC_ACQ_REL);
+    uint64_t const start = req_time != 0 ? req_time : actr_now_ns();
+    /* Posting the e-stop frame takes the sequence after the current one. */
+    __atomic_store_n(&estop_seq, mbox_seq + 2U, __ATOMIC_RELEASE);
+    actr_wake_req();
+    actr_mbox_begin();
+    int status = 0;
+    if (estop_off)
+    {
+        for (uint8_t bus_i = 0; bus_i < bus_num; bus_i++)
+        {
+            __atomic_store_n(&(buses[bus_i].all_off), 1, __ATOMIC_RELAXED);
+        }
+        for (uint8_t pwm_i = 0; pwm_i < pwm_num; pwm_i++)
+        {
+            status |= actr_ch_put(pwm_ch[pwm_i], 0);
+        }
+    }
+    else
+    {
+        ch_cfg_t const *const cfg = ch_cfg_get();
+        for (uint16_t ch_i = 0; ch_i < ch_num; ch_i++)
+        {
+            status |= actr_ch_put(ch_i, cfg->ch[ch_i].neutral);
+        }
+        for (uint8_t bus_i = 0; bus_i < bus_num; bus_i++)
+        {
+            actr_bus_t *const bus = &(buses[bus_i]);
+            uint16_t const neutral = cfg->ch[bus->chip_ch[0]].neutral;
+            if (actr_bus_uniform(bus, cfg, neutral))
+            {
+                __atomic_store_n(&(bus->all_duty), neutral | ACTR_MBOX_PENDING, __ATOMIC_RELAXED);
+            }
+        }
+        ch_cfg_quiesce();
     }
-    if (pca9685_ch_frac_set(&pca9685_handle, channel, pulse_frac) != ERR_OK)
+    /* A stalling bus must not hold up the control loop, the caller tries again with its next frame. */
+    status |= actr_mbox_wait(actr_mbox_post(), ACTR_ESTOP_WAIT_MS * 1000000ULL);
+    if (status != 0)
     {
-        log_error("Failed to set a new pulse fraction on channel %u", channel);
+        alog_error("Failed to put outputs in a safe state within %u ms", ACTR_ESTOP_WAIT_MS);
         return -1;
     }
+    uint64_t const lat_ns = actr_now_ns() - start;
+    estop_stats.count++;
+    estop_stats.lat_last_ns = lat_ns;
+    estop_stats.lat_sum_ns += lat_ns;
+    if (lat_ns > estop_stats.lat_max_ns)
+    {
+        estop_stats.lat_max_ns = lat_ns;
+    }
     return 0;
 }
+
+int actr_estop(void)
+{
+    pthread_mutex_lock(&ingest_lock);
+    int const status = actr_estop_ingest();
+    pthread_mutex_unlock(&ingest_lock);
+    return status;
+}
+
+actr_estop_stats_t const *actr_estop_stats_get(void)
+{
+    return &estop_stats;
+}
+
+actr_io_stats_t const *actr_io_stats_get(void)
+{
+    static actr_io_stats_t io_stats;
+    io_stats = ingest_stats;
+    io_stats.drains = io_stats.depth_sum = io_stats.depth_max = io_stats.mbox_busy = io_stats.errors = io_stats.busy_ns = 0;
+    io_stats.sync_late = 0;
+    for (uint8_t bus_i = 0; bus_i < bus_num; bus_i++)
+    {
+        actr_io_stats_t const *const bus_stats = &(buses[bus_i].stats);
+        io_stats.drains += bus_stats->drains;
+        io_stats.depth_sum += bus_stats->depth_sum;
+        io_stats.mbox_busy += bus_stats->mbox_busy;
+        io_stats.errors += bus_stats->errors;
+        io_stats.busy_ns += bus_stats->busy_ns;
+        io_stats.sync_late += bus_stats->sync_late;
+        if (bus_stats->depth_max > io_stats.depth_max)
+        {
+            io_stats.depth_max = bus_stats->depth_max;
+        }
+    }
+    return &io_stats;
+}
+
+actr_prio_stats_t const *actr_prio_stats_get(uint8_t const prio)
+{
+    static actr_prio_stats_t prio_stats;
+    memset(&prio_stats, 0, sizeof(prio_stats));
+    for (uint8_t bus_i = 0; bus_i < bus_num && prio < ACTR_PRIO_NUM; bus_i++)
+    {
+        actr_prio_stats_t const *const bus_stats = &(buses[bus_i].prio[prio]);
+        prio_stats.ch_written += bus_stats->ch_written;
+        prio_stats.deferred += bus_stats->deferred;
+        prio_stats.yielded += bus_stats->yielded;
+        prio_stats.busy_ns += bus_stats->busy_ns;
+    }
+    return &prio_stats;
+}
+
+actr_fault_stats_t const *actr_fault_stats_get(void)
+{
+    static actr_fault_stats_t fault_stats;
+    memset(&fault_stats, 0, sizeof(fault_stats));
+    for (uint8_t bus_i = 0; bus_i < bus_num; bus_i++)
+    {
+        actr_fault_stats_t const *const bus_stats = &(buses[bus_i].fault);
+        fault_stats.checks += bus_stats->checks;
+        fault_stats.reopens += bus_stats->reopens;
+        fault_stats.resets += bus_stats->resets;
+        fault_stats.recoveries += bus_stats->recoveries;
+        fault_stats.failed += bus_stats->failed;
+        if (bus_stats->recover_max_ns > fault_stats.recover_max_ns)
+        {
+            fault_stats.recover_max_ns = bus_stats->recover_max_ns;
+        }
+        if (bus_stats->recover_last_ns != 0)
+        {
+            fault_stats.recover_last_ns = bus_stats->recover_last_ns;
+        }
+    }
+    for (uint8_t chip_i = 0; chip_i < chip_num; chip_i++)
+    {
+        fault_stats.retries += chips[chip_i].stats.retries;
+    }
+    return &fault_stats;
+}
+
+actr_start_stats_t const *actr_start_stats_get(void)
+{
+    start_stats.first_commit_ns = 0;
+    for (uint8_t bus_i = 0; bus_i < bus_num; bus_i++)
+    {
+        uint64_t const first_commit_ns = __atomic_load_n(&(buses[bus_i].first_commit_ns), __ATOMIC_RELAXED);
+        if (first_commit_ns == 0)
+        {
+            start_stats.first_commit_ns = 0;
+            break;
+        }
+        if (first_commit_ns > start_stats.first_commit_ns)
+        {
+            start_stats.first_commit_ns = first_commit_ns;
+        }
+    }
+    return &start_stats;
+}
+
+int actr_sync_fd(void)
+{
+    return sync_fd;
+}
+
+void actr_sync_clear(void)
+{
+    eventfd_t val;
+    eventfd_read(sync_fd, &val);
+}
+
+void actr_applied_get(uint16_t *const duty_cycle, uint8_t const ch_count)
+{
+    for (uint8_t ch_i = 0; ch_i < ch_count && ch_i < ACTR_CH_MAX; ch_i++)
+    {
+        duty_cycle[ch_i] = __atomic_load_n(&(applied[ch_i]), __ATOMIC_RELAXED);
+    }
+}
+
+void actr_frame_get(uint16_t *const duty_cycle, uint8_t const ch_count)
+{
+    for (uint8_t ch_i = 0; ch_i < ch_count && ch_i < ACTR_CH_MAX; ch_i++)
+    {
+        duty_cycle[ch_i] = (uint16_t)__atomic_load_n(&(mbox[ch_i]), __ATOMIC_RELAXED);
+    }
+}
+
+bus_t const *actr_bus_get(uint8_t const bus_i)
+{
+    return bus_i < bus_num ? &(buses[bus_i].bus) : NULL;
+}
@@ -3,13 +3,179 @@
 
 #include <stdint.h>
 
+#include "pca9685.h"
+#include "pwm_sysfs.h"
+
 #define PCA9685_I2C_ADAPTER_ID 2
+#define ACTR_CHIP_MAX 8U
+#define ACTR_CH_MAX (ACTR_CHIP_MAX * PCA9685_REG_CH_NUM) /* Size of the logical channel space. */
+#define ACTR_PWM_MAX 16U                                 /* Channels that can be driven through the kernel PWM class. */
+#define ACTR_GROUP_ADDR PCA9685_SUBADDR1_ADDR /* SUBADDR1 given to every chip on a bus with several chips. */
+#define ACTR_FRAC_NEUTRAL (-1.0f)             /* Pulse fraction that selects the calibrated neutral of a channel. */
+#define ACTR_SYNC_GUARD_US_DEFAULT 500U
+#define ACTR_CHECK_MS_DEFAULT 100U
+#define ACTR_XFER_RETRY_MAX 2U /* Times a failed transfer is repeated before the writer recovers the bus. */
+#define ACTR_XFER_BACKOFF_US 100U /* Wait before the first repeat, doubled for the next. */
+#define ACTR_RECOVER_HOLDOFF_MS 10U /* Wait after a recovery that failed before trying again. */
+#define ACTR_ESTOP_WAIT_MS 50U /* Longest wait of "actr_estop" for the writers before it reports a failure. */
+
+/* Priority classes of channels, see "ch_cfg_ch_t". */
+#define ACTR_PRIO_LOW 0U
+#define ACTR_PRIO_HIGH 1U
+#define ACTR_PRIO_NUM 2U
+
+/*
+Also built as a library (libtco_actuation) so a controller can drive the outputs from its own
+process instead of through the daemon. "actr_ch_set", "actr_frame_set", "actr_override_set",
+"actr_estop" and "actr_sleep" may be called from any thread. They take a lock only for as long as
+it takes to convert and deposit the values, never wait for the bus (except "actr_estop") and never
+allocate, so a frame reaches the bus writers within microseconds of the call.
+*/
+
+/* Location of a PCA9685 chip. */
+typedef struct actr_chip_cfg_t
+{
+    uint8_t adapter; /* I2C adapter ID i.e. N in /dev/i2c-N. */
+    uint8_t addr;    /* 7-bit address of the chip. */
+} actr_chip_cfg_t;
+
+/* Logical channel driven through the kernel PWM class instead of a PCA9685. */
+typedef struct actr_pwm_cfg_t
+{
+    uint8_t channel; /* Logical channel. */
+    uint16_t chip;   /* N in pwmchipN. */
+    uint16_t pwm;    /* Channel of the PWM chip. */
+} actr_pwm_cfg_t;
+
+/* Configuration of the actuator devices. */
+typedef struct actr_cfg_t
+{
+    /*
+    Chip N drives logical channels 16*N to 16*N+15. Chips are grouped per adapter and each adapter
+    gets its own worker thread so buses are written in parallel. If empty, a single chip at
+    PCA9685_ADDR on PCA9685_I2C_ADAPTER_ID is used.
+    */
+    actr_chip_cfg_t chip[ACTR_CHIP_MAX];
+    uint8_t chip_num;
+
+    /*
+    Logical channels listed here are written straight from the control loop, one write per change,
+    with the period of the PCA9685 chips so the channel calibration means the same pulse lengths.
+    They may lie past the channels of the chips. A PCA9685 channel that one of them takes the place
+    of is held low.
+    */
+    actr_pwm_cfg_t pwm[ACTR_PWM_MAX];
+    uint8_t pwm_num;
+    char const *pwm_root; /* Directory holding the pwmchipN directories, NULL for PWM_SYSFS_ROOT_DEFAULT. */
+
+    uint8_t sim;           /* If >0, drive in-process simulated PCA9685 chips instead of I2C hardware. */
+    uint32_t sim_clock_hz; /* I2C clock the simulated bus models. */
+    uint8_t sim_fast;      /* If >0, simulated transfers return at once instead of taking bus time. */
+    uint8_t estop_off;     /* If >0, an e-stop turns all outputs fully off instead of making them neutral. */
+    uint32_t pwm_hz;       /* PWM frequency of the chips, 0 for PCA9685_PWM_FREQ_DEFAULT. */
+    uint32_t osc_hz;       /* Measured oscillator frequency of the chips, 0 for PCA9685_OSC_FREQ. */
+
+    /*
+    If >0, each writer commits once per PWM period of the first chip on its bus, just before the
+    period starts, with the newest values. Period starts are estimated from when the chip was
+    restarted and 'osc_hz'. E-stops are still written right away.
+    */
+    uint8_t pwm_sync;
+    uint32_t sync_guard_us; /* Margin kept before a period starts on top of the expected write time. */
+
+    /*
+    Every 'check_ms' each writer reads back the configuration of its chips to catch a chip that lost
+    power. Failed writes trigger the same check at once. 0 only checks after failures.
+    */
+    uint32_t check_ms;
+
+    /*
+    If >0, chips that already run with this configuration are taken over with the outputs they have
+    instead of being reset, and chips are left running on exit so the next start can do the same.
+    Not used with 'pwm_sync', which needs the PWM phase that only a reset gives.
+    */
+    uint8_t warm;
+} actr_cfg_t;
+
+/* Counters of the hand-off from the control loop to the bus writers. */
+typedef struct actr_io_stats_t
+{
+    uint64_t posts;      /* Frames deposited in the mailbox. */
+    uint64_t overwrites; /* Channel values replaced by a newer one before a writer took them. */
+    uint64_t drains;     /* Writer passes, summed over buses. */
+    uint64_t depth_sum;  /* Channels with a new value found per pass, summed. */
+    uint64_t depth_max;  /* Most channels with a new value found by a single pass. */
+    uint64_t mbox_busy;  /* Passes that ran out of tries while frames kept being deposited during the copy. */
+    uint64_t errors;     /* Passes that failed to write. */
+    uint64_t busy_ns;    /* Time writers spent writing, summed over buses. */
+    uint64_t sync_late;  /* PWM synchronized passes that finished after the period they were meant for started. */
+    uint64_t pwm_writes; /* Duty cycles written to kernel PWM channels. */
+    uint64_t pwm_errors; /* Writes to kernel PWM channels that failed. */
+} actr_io_stats_t;
+
+/* Counters of I2C fault handling. */
+typedef struct actr_fault_stats_t
+{
+    uint64_t retries;         /* Transfers repeated after failing. */
+    uint64_t checks;          /* Readbacks of the chip configuration. */
+    uint64_t reopens;         /* Buses reopened because even the readback failed. */
+    uint64_t resets;          /* Chips found without their configuration, e.g. after a brownout. */
+    uint64_t recoveries;      /* Buses whose chips were initialized again and got their outputs back. */
+    uint64_t failed;          /* Recoveries that did not get the bus working. */
+    uint64_t recover_last_ns; /* Time from finding the fault until outputs were restored. */
+    uint64_t recover_max_ns;
+} actr_fault_stats_t;
+
+/* Counters of putting the chips to sleep. */
+typedef struct actr_sleep_stats_t
+{
+    uint64_t sleeps;          /* Times the chips were put to sleep. */
+    uint64_t wakes;           /* Times a frame woke them again. */
+    uint64_t asleep_ns;       /* Time from each sleep until the next wake, including the current one. */
+    uint64_t wake_lat_num;    /* Wakes finished by a bus writer, summed over buses. */
+    uint64_t wake_lat_last_ns; /* Time from setting the waking frame until a bus wrote it after RESTART. */
+    uint64_t wake_lat_max_ns;
+    uint64_t wake_lat_sum_ns;
+} actr_sleep_stats_t;
+
+/*
+Bus use of one priority class, summed over buses. Every pass writes the high priority channels
+first. Low priority ones follow in the same pass unless a newer frame was posted meanwhile, in which
+case they yield to it. Channels of either class with a rate limit wait until they are due.
+*/
+typedef struct actr_prio_stats_t
+{
+    uint64_t ch_written; /* Channel values written. */
+    uint64_t deferred;   /* Times a changed channel was held back by its rate limit. */
+    uint64_t yielded;    /* Passes that left the channels of this class for the next one. */
+    uint64_t busy_ns;    /* Time writers spent writing this class. */
+} actr_prio_stats_t;
+
+/* How the chips were brought up. */
+typedef struct actr_start_stats_t
+{
+    uint8_t adopted;          /* Chips taken over with their outputs. */
+    uint8_t reset;            /* Chips reset and configured. */
+    uint64_t init_ns;         /* Time "actr_init" took. */
+    uint64_t first_commit_ns; /* CLOCK_MONOTONIC time every bus finished its first successful pass, 0 until then. */
+} actr_start_stats_t;
+
+/* Counters of the emergency stop path. */
+typedef struct actr_estop_stats_t
+{
+    uint64_t count;       /* E-stops executed. */
+    uint64_t preempted;   /* Frames cut short because an e-stop was requested while writing them. */
+    uint64_t lat_last_ns; /* Time from the e-stop request until outputs were written for the last e-stop. */
+    uint64_t lat_max_ns;
+    uint64_t lat_sum_ns;
+} actr_estop_stats_t;
 
 /**
- * @brief Init actuator devices.
+ * @brief Init actuator devices. Signals must already be blocked.
+ * @param cfg Configuration of the devices.
  * @return 0 on success and -1 on failure.
  */
-int actr_init(void);
+int actr_init(actr_cfg_t const *const cfg);
 
 /**
  * @brief Deinit actuator devices.
@@ -18,13 +184,148 @@ int actr_init(void);
 int actr_deinit(void);
 
 /**
- * @brief Control one of the channels on the PCA9685 board. "actr_init" must be called before using
- * this function.
- * @param channel Channel to control.
+ * @brief Control one of the channels on the PCA9685 boards. Like "actr_frame_set", this does not wait
+ * for the bus. "actr_init" must be called before using this function.
+ * @param channel Logical channel to control.
  * @param pulse_frac Any float in range [0,1]. E.g. For a servo: 0 = min angle, 0.5 = center, 1.0 =
- * max angle.
+ * max angle. ACTR_FRAC_NEUTRAL selects the calibrated neutral of the channel.
  * @return 0 on success and -1 on failure.
  */
 int actr_ch_set(uint8_t const channel, float const pulse_frac);
 
+/**
+ * @brief Set a whole frame of channels at once. The duty cycles are handed to the bus writer threads
+ * and this returns without waiting for the bus. A frame that was not written yet is replaced. All
+ * channels of a PCA9685 are written in a single I2C transaction so they change in the same PWM
+ * period, and all buses are written in parallel. "actr_init" must be called before using this
+ * function.
+ * @param pulse_frac Pulse fraction for each channel starting at logical channel 0. Same range as in
+ * "actr_ch_set". A channel whose fraction is out of range is set to its neutral and the rest of
+ * the frame is still applied.
+ * @param ch_count Number of elements in @p pulse_frac. Channels past this count keep their value.
+ * @return 0 on success and -1 on failure, including when a channel was out of range.
+ */
+int actr_frame_set(float const *const pulse_frac, uint8_t const ch_count);
+
+/**
+ * @brief Replace the input of a channel with a raw duty cycle, e.g. while calibrating. Takes effect
+ * with the next "actr_ch_set" or "actr_frame_set" that includes the channel and holds until cleared.
+ * E-stops ignore it.
+ * @param channel Logical channel.
+ * @param duty_cycle Duty cycle in counts up to 4095, or -1 to follow the input again.
+ * @return 0 on success and -1 on failure.
+ */
+int actr_override_set(uint8_t const channel, int32_t const duty_cycle);
+
+/**
+ * @brief Wait until the bus writers wrote everything set so far, except channels held back by their
+ * rate limit, which follow once due.
+ * @return 0 on success and -1 if a write failed.
+ */
+int actr_flush(void);
+
+/**
+ * @brief Get the counters of the hand-off to the bus writers.
+ * @return Pointer to the counters.
+ */
+actr_io_stats_t const *actr_io_stats_get(void);
+
+/**
+ * @brief Get the bus use of a priority class.
+ * @param prio ACTR_PRIO_LOW or ACTR_PRIO_HIGH.
+ * @return Pointer to the counters.
+ */
+actr_prio_stats_t const *actr_prio_stats_get(uint8_t const prio);
+
+/**
+ * @brief Put every chip to sleep once the bus writers wrote what was set before. The oscillators
+ * stop and so do the outputs, while the channel registers keep their values. The next frame, channel
+ * set or e-stop wakes the chips, waits PCA9685_WAKE_US, restarts their PWM and then writes it. Kernel
+ * PWM channels are left alone. Not available in PWM synchronized mode.
+ * @return 0 on success and -1 on failure.
+ */
+int actr_sleep(void);
+
+/**
+ * @brief Get the counters of putting the chips to sleep.
+ * @return Pointer to the counters.
+ */
+actr_sleep_stats_t const *actr_sleep_stats_get(void);
+
+/**
+ * @brief Get the counters of I2C fault handling, summed over buses.
+ * @return Pointer to the counters.
+ */
+actr_fault_stats_t const *actr_fault_stats_get(void);
+
+/**
+ * @brief Get how the chips were brought up and when the first frame was out on every bus.
+ * @return Pointer to the counters.
+ */
+actr_start_stats_t const *actr_start_stats_get(void);
+
+/**
+ * @brief Get an eventfd that becomes readable ahead of every PWM period of chip 0 in time to set a
+ * frame for it. Reading control input then keeps the age of what gets output to a minimum.
+ * @return The file descriptor or -1 if writes are not PWM synchronized.
+ */
+int actr_sync_fd(void);
+
+/**
+ * @brief Reset the eventfd returned by "actr_sync_fd".
+ */
+void actr_sync_clear(void);
+
+/**
+ * @brief Get the duty cycles the bus writers last wrote to the chips. Channels that were turned fully
+ * off read as 0.
+ * @param duty_cycle Where the duty cycles get written.
+ * @param ch_count Number of channels to get, starting at channel 0.
+ */
+void actr_applied_get(uint16_t *const duty_cycle, uint8_t const ch_count);
+
+/**
+ * @brief Get the duty cycles of the last frame handed to the bus writers, whether or not they were
+ * written yet. Unlike "actr_applied_get" this does not depend on bus timing.
+ * @param duty_cycle Where the duty cycles get written.
+ * @param ch_count Number of channels to get, starting at channel 0.
+ */
+void actr_frame_get(uint16_t *const duty_cycle, uint8_t const ch_count);
+
+/**
+ * @brief Ask for an emergency stop. Any frame being written stops before its next transfer so the
+ * e-stop does not wait for the rest of it. Safe to call from any thread.
+ */
+void actr_estop_request(void);
+
+/**
+ * @brief Drop an e-stop request that turned out to be spurious, e.g. the emergency flag was cleared
+ * again before the control loop read it.
+ */
+void actr_estop_cancel(void);
+
+/**
+ * @brief Put all outputs in a safe state right away and wait until they are. A bus whose outputs
+ * share one neutral gets it in a single ALL_LED write to the all-call address, other buses get their
+ * neutral values in a single transfer per chip, buses in parallel. With "estop_off" every bus gets
+ * one ALL_LED full-off write. Other threads setting frames wait for it. Gives up waiting after
+ * ACTR_ESTOP_WAIT_MS, e.g. while a bus stalls, and fails so the caller can try again.
+ * @return 0 on success and -1 on failure.
+ */
+int actr_estop(void);
+
+/**
+ * @brief Get the e-stop counters.
+ * @return Pointer to the counters.
+ */
+actr_estop_stats_t const *actr_estop_stats_get(void);
+
+/**
+ * @brief Get one of the buses the PCA9685 chips are on, e.g. to inspect a simulated chip. Bus 0 is
+ * the one chip 0 is on.
+ * @param bus_i Index of the bus in order of first use by the configured chips.
+ * @return Pointer to the bus or NULL if there are not that many buses.
+ */
+bus_t const *actr_bus_get(uint8_t const bus_i);
+
 #endif /* _ACTUATOR_H_ */
@@ -0,0 +1,505 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+#include "tco_libd.h"
+
+#include "alog.h"
+
+/* Argument a conversion takes. */
+typedef enum
+{
+    ALOG_ARG_NONE = 0, /* "%%". */
+    ALOG_ARG_INT,
+    ALOG_ARG_UINT,
+    ALOG_ARG_CHAR,
+    ALOG_ARG_DOUBLE,
+    ALOG_ARG_STR, /* Stored as the offset of the copy in 'str'. */
+    ALOG_ARG_PTR,
+    ALOG_ARG_BAD, /* Not supported, the rest of the format is written as is. */
+} alog_arg_kind_t;
+
+/* Raw argument of a conversion. */
+typedef union
+{
+    long long i;
+    unsigned long long u;
+    double d;
+    void const *p;
+    uint32_t str_off;
+} alog_arg_t;
+
+/* One message in the ring. 'seq' is the ring position the slot can be claimed at, or that plus one
+once the message in it is complete. */
+typedef struct
+{
+    uint32_t seq;
+    uint8_t level;
+    uint8_t arg_num; /* Conversions with an argument in 'arg', from the start of 'fmt'. */
+    char const *fmt;
+    alog_arg_t arg[ALOG_ARG_MAX];
+    char str[ALOG_STR_LEN];
+} alog_rec_t;
+
+/* Rate limiting state of one call site. */
+typedef struct
+{
+    char const *fmt; /* NULL while the entry is free. */
+    uint8_t level;
+    uint64_t window_start_ns;
+    uint32_t window_count; /* Messages in the current window. */
+    uint32_t suppressed;   /* Messages suppressed and not reported yet. */
+} alog_site_t;
+
+static alog_rec_t ring[ALOG_RING_LEN];
+static uint32_t ring_tail = 0; /* Next position producers claim. */
+static uint32_t ring_head = 0; /* Next position the flush thread reads. */
+static alog_site_t sites[ALOG_SITE_MAX];
+static alog_cfg_t alog_cfg = {0};
+static alog_stats_t stats = {0};
+static uint8_t active = 0;
+static uint32_t pushing = 0; /* Producers between checking 'active' and completing their slot. */
+static uint8_t stop = 0;
+static pthread_t flush_thread;
+
+static uint64_t alog_now_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((uint64_t)now.tv_sec * 1000000000U) + now.tv_nsec;
+}
+
+static void alog_write(uint8_t const level, char const *const msg)
+{
+    if (level == ALOG_LEVEL_ERROR)
+    {
+        log_error("%s", msg);
+    }
+    else
+    {
+        log_info("%s", msg);
+    }
+}
+
+/**
+ * @brief Parse the conversion at the '%' @p spec points to.
+ * @param spec Conversion in a format string.
+ * @param len Where the length of the whole conversion gets written.
+ * @param prefix_len Where the length up to the length modifier (flags, width and precision) gets
+ * written.
+ * @param size Where the length modifier gets written, 'H' for "hh", 'q' for "ll" and 0 for none.
+ * @return Argument the conversion takes.
+ */
+static alog_arg_kind_t alog_spec_parse(char const *const spec, uint32_t *const len, uint32_t *const prefix_len, char *const size)
+{
+    uint32_t pos = 1;
+    while (spec[pos] != '\0' && strchr("-+ #0123456789.", spec[pos]) != NULL)
+    {
+        pos++;
+    }
+    *prefix_len = pos;
+    *size = 0;
+    if (spec[pos] != '\0' && strchr("hlzjt", spec[pos]) != NULL)
+    {
+        *size = spec[pos++];
+        if ((*size == 'h' || *size == 'l') && spec[pos] == *size)
+        {
+            *size = *size == 'h' ? 'H' : 'q';
+            pos++;
+        }
+    }
+    char const conv = spec[pos];
+    *len = conv == '\0' ? pos : pos + 1;
+    switch (conv)
+    {
+    case '%':
+        return ALOG_ARG_NONE;
+    case 'd':
+    case 'i':
+        return ALOG_ARG_INT;
+    case 'u':
+    case 'o':
+    case 'x':
+    case 'X':
+        return ALOG_ARG_UINT;
+    case 'c':
+        return *size == 0 ? ALOG_ARG_CHAR : ALOG_ARG_BAD;
+    case 'f':
+    case 'F':
+    case 'e':
+    case 'E':
+    case 'g':
+    case 'G':
+    case 'a':
+    case 'A':
+        return *size == 0 || *size == 'l' ? ALOG_ARG_DOUBLE : ALOG_ARG_BAD;
+    case 's':
+        return *size == 0 ? ALOG_ARG_STR : ALOG_ARG_BAD;
+    case 'p':
+        return ALOG_ARG_PTR;
+    default:
+        return ALOG_ARG_BAD;
+    }
+}
+
+/**
+ * @brief Store the arguments of a message in its slot, copying strings into the slot.
+ */
+static void alog_args_store(alog_rec_t *const rec, char const *const fmt, va_list args)
+{
+    uint32_t str_len = 0;
+    rec->arg_num = 0;
+    for (char const *spec = strchr(fmt, '%'); spec != NULL && rec->arg_num < ALOG_ARG_MAX; spec = strchr(spec, '%'))
+    {
+        uint32_t len, prefix_len;
+        char size;
+        alog_arg_kind_t const kind = alog_spec_parse(spec, &len, &prefix_len, &size);
+        alog_arg_t *const arg = &(rec->arg[rec->arg_num]);
+        char const *str;
+        uint32_t copy_len;
+        spec += len;
+        switch (kind)
+        {
+        case ALOG_ARG_NONE:
+            continue;
+        case ALOG_ARG_INT:
+            arg->i = size == 'q' ? va_arg(args, long long) : size == 'l' ? va_arg(args, long) : size == 'z' ? (long long)va_arg(args, size_t) :
+                     size == 'j' ? va_arg(args, intmax_t) : size == 't' ? va_arg(args, ptrdiff_t) : va_arg(args, int);
+            arg->i = size == 'H' ? (signed char)arg->i : size == 'h' ? (short)arg->i : arg->i;
+            break;
+        case ALOG_ARG_UINT:
+            arg->u = size == 'q' ? va_arg(args, unsigned long long) : size == 'l' ? va_arg(args, unsigned long) : size == 'z' ? va_arg(args, size_t) :
+                     size == 'j' ? va_arg(args, uintmax_t) : size == 't' ? (unsigned long long)va_arg(args, ptrdiff_t) : va_arg(args, unsigned int);
+            arg->u = size == 'H' ? (unsigned char)arg->u : size == 'h' ? (unsigned short)arg->u : arg->u;
+            break;
+        case ALOG_ARG_CHAR:
+            arg->u = (unsigned char)va_arg(args, int);
+            break;
+        case ALOG_ARG_DOUBLE:
+            arg->d = va_arg(args, double);
+            break;
+        case ALOG_ARG_STR:
+            /* Strings that do not fit in what is left of 'str' are cut short. */
+            str = va_arg(args, char const *);
+            str = str != NULL ? str : "(null)";
+            copy_len = strnlen(str, ALOG_STR_LEN - 1U - str_len);
+            memcpy(&(rec->str[str_len]), str, copy_len);
+            rec->str[str_len + copy_len] = '\0';
+            arg->str_off = str_len;
+            str_len += str_len + copy_len + 1U < ALOG_STR_LEN ? copy_len + 1U : copy_len;
+            break;
+        case ALOG_ARG_PTR:
+            arg->p = va_arg(args, void const *);
+            break;
+        case ALOG_ARG_BAD:
+            return;
+        }
+        rec->arg_num++;
+    }
+}
+
+/**
+ * @brief Format a message from the format string and arguments stored in its slot.
+ * @param rec Slot of the message.
+ * @param msg Where the message gets written, ALOG_MSG_LEN bytes.
+ */
+static void alog_format(alog_rec_t const *const rec, char *const msg)
+{
+    uint32_t msg_len = 0;
+    uint8_t arg_i = 0;
+    char const *text = rec->fmt;
+    char const *spec;
+    while ((spec = strchr(text, '%')) != NULL && msg_len < ALOG_MSG_LEN - 1U)
+    {
+        uint32_t len, prefix_len;
+        char size;
+        alog_arg_kind_t const kind = alog_spec_parse(spec, &len, &prefix_len, &size);
+        if (kind == ALOG_ARG_BAD || (kind != ALOG_ARG_NONE && arg_i >= rec->arg_num))
+        {
+            break;
+        }
+        /* The stored argument is as wide as the widest of its kind, so the modifier becomes "ll". */
+        char conv[24];
+        if (prefix_len + 4U > sizeof(conv))
+        {
+            break;
+        }
+        memcpy(conv, spec, prefix_len);
+        uint32_t conv_len = prefix_len;
+        if (kind == ALOG_ARG_INT || kind == ALOG_ARG_UINT)
+        {
+            conv[conv_len++] = 'l';
+            conv[conv_len++] = 'l';
+        }
+        conv[conv_len++] = spec[len - 1];
+        conv[conv_len] = '\0';
+
+        int const text_len = snprintf(&(msg[msg_len]), ALOG_MSG_LEN - msg_len, "%.*s", (int)(spec - text), text);
+        msg_len = msg_len + text_len < ALOG_MSG_LEN ? msg_len + text_len : ALOG_MSG_LEN - 1U;
+        alog_arg_t const *const arg = &(rec->arg[arg_i]);
+        int conv_out = 0;
+        switch (kind)
+        {
+        case ALOG_ARG_NONE:
+            conv_out = snprintf(&(msg[msg_len]), ALOG_MSG_LEN - msg_len, "%%");
+            break;
+        case ALOG_ARG_INT:
+            conv_out = snprintf(&(msg[msg_len]), ALOG_MSG_LEN - msg_len, conv, arg->i);
+            break;
+        case ALOG_ARG_UINT:
+            conv_out = snprintf(&(msg[msg_len]), ALOG_MSG_LEN - msg_len, conv, arg->u);
+            break;
+        case ALOG_ARG_CHAR:
+            conv_out = snprintf(&(msg[msg_len]), ALOG_MSG_LEN - msg_len, conv, (int)arg->u);
+            break;
+        case ALOG_ARG_DOUBLE:
+            conv_out = snprintf(&(msg[msg_len]), ALOG_MSG_LEN - msg_len, conv, arg->d);
+            break;
+        case ALOG_ARG_STR:
+            conv_out = snprintf(&(msg[msg_len]), ALOG_MSG_LEN - msg_len, conv, &(rec->str[arg->str_off]));
+            break;
+        case ALOG_ARG_PTR:
+            conv_out = snprintf(&(msg[msg_len]), ALOG_MSG_LEN - msg_len, conv, arg->p);
+            break;
+        case ALOG_ARG_BAD:
+            break;
+        }
+        msg_len = msg_len + conv_out < ALOG_MSG_LEN ? msg_len + conv_out : ALOG_MSG_LEN - 1U;
+        arg_i += kind != ALOG_ARG_NONE;
+        text = spec + len;
+    }
+    snprintf(&(msg[msg_len]), ALOG_MSG_LEN - msg_len, "%s", text);
+}
+
+/**
+ * @brief Find the entry of a call site, claiming a free one the first time it logs.
+ * @return Pointer to the entry or NULL if the table is full.
+ */
+static alog_site_t *alog_site_get(char const *const fmt, alog_level_t const level)
+{
+    uint32_t const hash = (uint32_t)(((uintptr_t)fmt >> 3) * 2654435761U);
+    for (uint32_t probe_i = 0; probe_i < ALOG_SITE_MAX; probe_i++)
+    {
+        alog_site_t *const site = &(sites[(hash + probe_i) % ALOG_SITE_MAX]);
+        char const *site_fmt = __atomic_load_n(&(site->fmt), __ATOMIC_ACQUIRE);
+        if (site_fmt == NULL && __atomic_compare_exchange_n(&(site->fmt), &site_fmt, fmt, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        {
+            site->level = level;
+            return site;
+        }
+        if (site_fmt == fmt)
+        {
+            return site;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Count a message against the limit of its call site.
+ * @return 1 if the message may be logged and 0 if it is suppressed.
+ */
+static uint8_t alog_site_admit(char const *const fmt, alog_level_t const level)
+{
+    if (alog_cfg.burst == 0)
+    {
+        return 1;
+    }
+    alog_site_t *const site = alog_site_get(fmt, level);
+    if (site == NULL)
+    {
+        return 1; /* Too many call sites, only the ring bounds these. */
+    }
+    uint64_t const now = alog_now_ns();
+    uint64_t window_start = __atomic_load_n(&(site->window_start_ns), __ATOMIC_RELAXED);
+    if (now - window_start >= alog_cfg.window_ms * 1000000ULL &&
+        __atomic_compare_exchange_n(&(site->window_start_ns), &window_start, now, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    {
+        __atomic_store_n(&(site->window_count), 0, __ATOMIC_RELAXED);
+    }
+    if (__atomic_fetch_add(&(site->window_count), 1, __ATOMIC_RELAXED) < alog_cfg.burst)
+    {
+        return 1;
+    }
+    __atomic_add_fetch(&(site->suppressed), 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&(stats.suppressed), 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+/**
+ * @brief Claim the next free slot of the ring.
+ * @return Pointer to the slot or NULL if the ring is full.
+ */
+static alog_rec_t *alog_ring_claim(uint32_t *const pos)
+{
+    uint32_t tail = __atomic_load_n(&ring_tail, __ATOMIC_RELAXED);
+    while (1)
+    {
+        alog_rec_t *const rec = &(ring[tail & (ALOG_RING_LEN - 1)]);
+        int32_t const diff = (int32_t)(__atomic_load_n(&(rec->seq), __ATOMIC_ACQUIRE) - tail);
+        if (diff == 0)
+        {
+            if (__atomic_compare_exchange_n(&ring_tail, &tail, tail + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            {
+                *pos = tail;
+                return rec;
+            }
+        }
+        else if (diff < 0)
+        {
+            return NULL; /* Slot still holds a message the flush thread did not get to. */
+        }
+        else
+        {
+            tail = __atomic_load_n(&ring_tail, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+/**
+ * @brief Write out every complete message in the ring.
+ */
+static void alog_ring_drain(void)
+{
+    while (1)
+    {
+        alog_rec_t *const rec = &(ring[ring_head & (ALOG_RING_LEN - 1)]);
+        if (__atomic_load_n(&(rec->seq), __ATOMIC_ACQUIRE) != ring_head + 1)
+        {
+            return;
+        }
+        char msg[ALOG_MSG_LEN];
+        alog_format(rec, msg);
+        alog_write(rec->level, msg);
+        __atomic_store_n(&(rec->seq), ring_head + ALOG_RING_LEN, __ATOMIC_RELEASE);
+        ring_head++;
+    }
+}
+
+/**
+ * @brief Report how many messages call sites had suppressed.
+ * @param all If 0, only sites whose window ended are reported, otherwise all of them.
+ */
+static void alog_sites_report(uint8_t const all)
+{
+    uint64_t const now = alog_now_ns();
+    for (uint32_t site_i = 0; site_i < ALOG_SITE_MAX; site_i++)
+    {
+        alog_site_t *const site = &(sites[site_i]);
+        char const *const fmt = __atomic_load_n(&(site->fmt), __ATOMIC_ACQUIRE);
+        if (fmt == NULL || __atomic_load_n(&(site->suppressed), __ATOMIC_RELAXED) == 0 ||
+            (!all && now - __atomic_load_n(&(site->window_start_ns), __ATOMIC_RELAXED) < alog_cfg.window_ms * 1000000ULL))
+        {
+            continue;
+        }
+        uint32_t const suppressed = __atomic_exchange_n(&(site->suppressed), 0, __ATOMIC_RELAXED);
+        char msg[ALOG_MSG_LEN];
+        snprintf(msg, sizeof(msg), "Suppressed %u more messages like: %s", suppressed, fmt);
+        alog_write(site->level, msg);
+    }
+}
+
+static void *alog_flush(void *arg)
+{
+    (void)arg;
+    struct timespec const period = {.tv_sec = 0, .tv_nsec = ALOG_FLUSH_MS * 1000000L};
+    while (!__atomic_load_n(&stop, __ATOMIC_ACQUIRE))
+    {
+        alog_ring_drain();
+        alog_sites_report(0);
+        nanosleep(&period, NULL);
+    }
+    alog_ring_drain();
+    alog_sites_report(1);
+    return NULL;
+}
+
+int alog_init(alog_cfg_t const *const cfg)
+{
+    if (cfg->burst > 0 && cfg->window_ms == 0)
+    {
+        log_error("Rate limiting needs a non-zero window");
+        return -1;
+    }
+    alog_cfg = *cfg;
+    for (uint32_t rec_i = 0; rec_i < ALOG_RING_LEN; rec_i++)
+    {
+        ring[rec_i].seq = rec_i;
+    }
+    ring_tail = ring_head = 0;
+    memset(sites, 0, sizeof(sites));
+    memset(&stats, 0, sizeof(stats));
+    __atomic_store_n(&stop, 0, __ATOMIC_RELEASE);
+    int const err = pthread_create(&flush_thread, NULL, alog_flush, NULL);
+    if (err != 0)
+    {
+        log_error("pthread_create: %s", strerror(err));
+        return -1;
+    }
+    __atomic_store_n(&active, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+void alog_deinit(void)
+{
+    if (!__atomic_load_n(&active, __ATOMIC_ACQUIRE))
+    {
+        return;
+    }
+    /* Late messages go to the regular logger while the ring is drained. Producers that saw it active
+    still complete their slot before the last drain. */
+    __atomic_store_n(&active, 0, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&pushing, __ATOMIC_SEQ_CST) > 0)
+    {
+        sched_yield();
+    }
+    __atomic_store_n(&stop, 1, __ATOMIC_RELEASE);
+    pthread_join(flush_thread, NULL);
+    if (stats.suppressed > 0 || stats.dropped > 0)
+    {
+        log_info("Logged %llu messages asynchronously, %llu suppressed as repeats, %llu dropped with the ring full",
+                 (unsigned long long)stats.queued, (unsigned long long)stats.suppressed, (unsigned long long)stats.dropped);
+    }
+}
+
+void alog_push(alog_level_t const level, char const *const fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    __atomic_add_fetch(&pushing, 1, __ATOMIC_SEQ_CST);
+    if (!__atomic_load_n(&active, __ATOMIC_SEQ_CST))
+    {
+        __atomic_sub_fetch(&pushing, 1, __ATOMIC_RELEASE);
+        char msg[ALOG_MSG_LEN];
+        vsnprintf(msg, sizeof(msg), fmt, args);
+        va_end(args);
+        alog_write(level, msg);
+        return;
+    }
+    uint32_t pos;
+    uint8_t const admitted = alog_site_admit(fmt, level);
+    alog_rec_t *const rec = admitted ? alog_ring_claim(&pos) : NULL;
+    if (rec != NULL)
+    {
+        rec->level = level;
+        rec->fmt = fmt;
+        alog_args_store(rec, fmt, args);
+        __atomic_store_n(&(rec->seq), pos + 1, __ATOMIC_RELEASE);
+        __atomic_add_fetch(&(stats.queued), 1, __ATOMIC_RELAXED);
+    }
+    else if (admitted)
+    {
+        __atomic_add_fetch(&(stats.dropped), 1, __ATOMIC_RELAXED);
+    }
+    __atomic_sub_fetch(&pushing, 1, __ATOMIC_RELEASE);
+    va_end(args);
+}
+
+alog_stats_t const *alog_stats_get(void)
+{
+    return &stats;
+}
@@ -0,0 +1,78 @@
+#ifndef _ALOG_H_
+#define _ALOG_H_
+
+#include <stdint.h>
+
+#include "tco_libd.h"
+
+/*
+Logging for paths that must not block, such as the control loop and the bus writers. The call site
+only puts the format string and the raw arguments in a fixed-size slot of a bounded ring, copying
+strings (arguments like strerror or stack buffers would not outlive it), and a flush thread formats
+them and hands them to the regular logger. Formats may have up to ALOG_ARG_MAX conversions without
+'*' widths, long doubles or %n, the text from the first one past that is written as is. Each call
+site, told apart by its format string, may log 'burst' messages per window and further ones are
+only counted and summarized by the flush thread. Until "alog_init" (or after "alog_deinit") messages
+go straight to the regular logger.
+*/
+#define ALOG_RING_LEN 256U /* Power of two. */
+#define ALOG_MSG_LEN 160U  /* Longest formatted message. */
+#define ALOG_ARG_MAX 8U    /* Conversions of a message that get their argument stored. */
+#define ALOG_STR_LEN 96U   /* Bytes for the copies of string arguments of a message. */
+#define ALOG_SITE_MAX 64U
+#define ALOG_FLUSH_MS 10U
+#define ALOG_BURST_DEFAULT 5U
+#define ALOG_WINDOW_MS_DEFAULT 1000U
+
+#define alog_error(...) alog_push(ALOG_LEVEL_ERROR, __VA_ARGS__)
+#define alog_info(...) alog_push(ALOG_LEVEL_INFO, __VA_ARGS__)
+
+typedef enum alog_level_t
+{
+    ALOG_LEVEL_ERROR = 0,
+    ALOG_LEVEL_INFO,
+} alog_level_t;
+
+/* Configuration of asynchronous logging. */
+typedef struct alog_cfg_t
+{
+    uint32_t burst;     /* Messages a call site may log per window, 0 for no limit. */
+    uint32_t window_ms; /* Length of the rate limiting window. */
+} alog_cfg_t;
+
+/* Counters of asynchronous logging. */
+typedef struct alog_stats_t
+{
+    uint64_t queued;     /* Messages put in the ring. */
+    uint64_t suppressed; /* Messages only counted because their call site was over its limit. */
+    uint64_t dropped;    /* Messages lost because the ring was full. */
+} alog_stats_t;
+
+/**
+ * @brief Start the flush thread and route messages through the ring. The thread keeps the
+ * scheduling policy of the caller so call this before "rt_init", and after signals are blocked.
+ * @param cfg Configuration.
+ * @return 0 on success and -1 on failure.
+ */
+int alog_init(alog_cfg_t const *const cfg);
+
+/**
+ * @brief Write out what is left in the ring and the pending suppression counts, then stop the
+ * flush thread.
+ */
+void alog_deinit(void);
+
+/**
+ * @brief Log a message without blocking. Use through "alog_error" and "alog_info".
+ * @param level Level of the message.
+ * @param fmt printf format, also identifies the call site so it must be a string literal.
+ */
+void alog_push(alog_level_t const level, char const *const fmt, ...) __attribute__((format(printf, 2, 3)));
+
+/**
+ * @brief Get the counters of asynchronous logging.
+ * @return Pointer to the counters.
+ */
+alog_stats_t const *alog_stats_get(void);
+
+#endif /* _ALOG_H_ */
@@ -0,0 +1,89 @@
+#ifndef _BUS_H_
+#define _BUS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <linux/i2c.h>
+
+#include "tco_libd.h"
+
+/* Operations every bus backend implements. */
+typedef struct bus_ops_t
+{
+    /**
+     * @brief Run all messages as one combined transfer, i.e. with repeated START conditions between
+     * messages and a single STOP at the end. Semantics match the I2C_RDWR ioctl.
+     * @param ctx Backend specific state.
+     * @param msgs Messages to transfer. Buffers of read messages get filled.
+     * @param msg_num Number of messages.
+     * @return Status code.
+     */
+    error_t (*xfer)(void *const ctx, struct i2c_msg *const msgs, uint8_t const msg_num);
+
+    /**
+     * @brief Get a bus working again after transfers kept failing, without touching the chips on it.
+     * NULL if the backend has nothing to do.
+     * @param ctx Backend specific state.
+     * @return Status code.
+     */
+    error_t (*recover)(void *const ctx);
+
+    /**
+     * @brief Release everything held by the backend.
+     * @param ctx Backend specific state.
+     */
+    void (*close)(void *const ctx);
+} bus_ops_t;
+
+/* A bus together with the state of its backend. */
+typedef struct bus_t
+{
+    bus_ops_t const *ops;
+    void *ctx;
+} bus_t;
+
+/**
+ * @brief Run a combined transfer on a bus.
+ * @param bus The bus.
+ * @param msgs Messages to transfer.
+ * @param msg_num Number of messages.
+ * @return Status code.
+ */
+static inline error_t bus_xfer(bus_t const *const bus, struct i2c_msg *const msgs, uint8_t const msg_num)
+{
+    return bus->ops->xfer(bus->ctx, msgs, msg_num);
+}
+
+/**
+ * @brief Try to get a bus working again after transfers kept failing.
+ * @param bus The bus.
+ * @return Status code.
+ */
+static inline error_t bus_recover(bus_t const *const bus)
+{
+    return bus->ops->recover != NULL ? bus->ops->recover(bus->ctx) : ERR_OK;
+}
+
+/**
+ * @brief Release a bus. Safe to call on a bus that was never opened.
+ * @param bus The bus.
+ */
+static inline void bus_close(bus_t *const bus)
+{
+    if (bus->ops != NULL)
+    {
+        bus->ops->close(bus->ctx);
+        bus->ops = NULL;
+        bus->ctx = NULL;
+    }
+}
+
+/**
+ * @brief Open a Linux I2C adapter (/dev/i2c-N) as a bus.
+ * @param adapter_id Number of the adapter.
+ * @param bus Where the opened bus gets written.
+ * @return Status code.
+ */
+error_t bus_i2c_open(uint8_t const adapter_id, bus_t *const bus);
+
+#endif /* _BUS_H_ */
@@ -0,0 +1,80 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <sys/ioctl.h>
+#include <linux/i2c-dev.h>
+
+#include "bus.h"
+#include "alog.h"
+
+typedef struct
+{
+    int fd;
+    uint8_t adapter_id;
+} bus_i2c_t;
+
+static error_t bus_i2c_xfer(void *const ctx, struct i2c_msg *const msgs, uint8_t const msg_num)
+{
+    bus_i2c_t *const i2c = ctx;
+    struct i2c_rdwr_ioctl_data rdwr = {.msgs = msgs, .nmsgs = msg_num};
+    if (ioctl(i2c->fd, I2C_RDWR, &rdwr) < 0)
+    {
+        alog_error("I2C_RDWR: %s", strerror(errno));
+        return ERR_I2C_WRITE;
+    }
+    return ERR_OK;
+}
+
+/**
+ * @brief Reopen the adapter. A slave holding SDA low is cleared by the adapter driver, which clocks
+ * SCL until it lets go when a transfer finds the bus stuck, so all that is left here is to drop the
+ * file descriptor along with whatever state the kernel kept for it.
+ */
+static error_t bus_i2c_recover(void *const ctx)
+{
+    bus_i2c_t *const i2c = ctx;
+    int fd;
+    if (i2c_port_open(i2c->adapter_id, &fd) != ERR_OK)
+    {
+        alog_error("Failed to reopen I2C adapter with ID %u", i2c->adapter_id);
+        return ERR_CRIT;
+    }
+    close(i2c->fd);
+    i2c->fd = fd;
+    return ERR_OK;
+}
+
+static void bus_i2c_close(void *const ctx)
+{
+    bus_i2c_t *const i2c = ctx;
+    close(i2c->fd);
+    free(i2c);
+}
+
+static bus_ops_t const bus_i2c_ops = {
+    .xfer = bus_i2c_xfer,
+    .recover = bus_i2c_recover,
+    .close = bus_i2c_close,
+};
+
+error_t bus_i2c_open(uint8_t const adapter_id, bus_t *const bus)
+{
+    bus_i2c_t *const i2c = calloc(1, sizeof(bus_i2c_t));
+    if (i2c == NULL)
+    {
+        log_error("Failed to allocate I2C bus state");
+        return ERR_CRIT;
+    }
+    if (i2c_port_open(adapter_id, &(i2c->fd)) != ERR_OK)
+    {
+        log_error("Failed to open I2C adapter with ID %u", adapter_id);
+        free(i2c);
+        return ERR_CRIT;
+    }
+    i2c->adapter_id = adapter_id;
+    bus->ops = &bus_i2c_ops;
+    bus->ctx = i2c;
+    return ERR_OK;
+}
@@ -0,0 +1,532 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "bus_sim.h"
+#include "pca9685.h"
+
+#define SIM_REG_LED_LAST 0x45U
+#define SIM_REG_ALL_LED 0xfaU
+#define SIM_GENERAL_CALL_ADDR 0x00U
+#define SIM_SWRST_BYTE 0x06U
+
+typedef struct
+{
+    uint8_t addr;
+    uint8_t reg[256];
+    uint8_t ptr;         /* Control register i.e. register the next byte goes to. */
+    uint8_t selected;    /* Addressed in the current transfer. */
+    uint8_t latch_dirty; /* LED registers changed since the last latch. */
+    uint64_t wake_time;  /* When SLEEP was last cleared. */
+    uint64_t pwm_start;  /* When the PWM counter last started from 0. */
+    uint8_t restarted;   /* RESTART was written in the current transfer. */
+    bus_sim_out_t out;
+} sim_chip_t;
+
+typedef struct
+{
+    pthread_mutex_t lock;
+    bus_sim_cfg_t cfg;
+    sim_chip_t chip[BUS_SIM_CHIP_MAX];
+    uint8_t chip_num;
+    uint64_t free_time; /* When the transfer in progress leaves the bus idle. */
+    uint32_t fail_ppm;  /* Transfers out of a million that fail. */
+    uint32_t stall_ppm; /* Transfers out of a million that get stretched by 'stall_ns'. */
+    uint64_t stall_ns;
+    uint64_t rng;       /* State of the generator that picks failing transfers. */
+    bus_sim_stats_t stats;
+} bus_sim_t;
+
+static bus_ops_t const bus_sim_ops;
+
+static uint64_t sim_now_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((uint64_t)now.tv_sec * 1000000000U) + now.tv_nsec;
+}
+
+static bus_sim_t *sim_get(bus_t const *const bus)
+{
+    if (bus->ops != &bus_sim_ops)
+    {
+        log_error("Bus is not simulated");
+        return NULL;
+    }
+    return bus->ctx;
+}
+
+/**
+ * @brief Get the next number of a xorshift generator, good enough to spread faults.
+ */
+static uint64_t sim_rand(bus_sim_t *const sim)
+{
+    sim->rng ^= sim->rng << 13;
+    sim->rng ^= sim->rng >> 7;
+    sim->rng ^= sim->rng << 17;
+    return sim->rng;
+}
+
+static sim_chip_t *sim_chip_find(bus_sim_t *const sim, uint8_t const addr)
+{
+    for (uint8_t chip_i = 0; chip_i < sim->chip_num; chip_i++)
+    {
+        if (sim->chip[chip_i].addr == addr)
+        {
+            return &(sim->chip[chip_i]);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Load power-on register values as documented in the PCA9685 datasheet.
+ */
+static void sim_chip_reset(sim_chip_t *const chip)
+{
+    memset(chip->reg, 0, sizeof(chip->reg));
+    chip->reg[PCA9685_REG_MODE1] = PCA9685_REG_MODE1_SLEEP | PCA9685_REG_MODE1_ALLCALL;
+    chip->reg[PCA9685_REG_MODE2] = PCA9685_REG_MODE2_OUTDRV;
+    chip->reg[PCA9685_REG_SUBADDR1] = 0xe2U;
+    chip->reg[PCA9685_REG_SUBADDR2] = 0xe4U;
+    chip->reg[PCA9685_REG_SUBADDR3] = 0xe8U;
+    chip->reg[PCA9685_REG_ALLCALLADDR] = 0xe0U;
+    for (uint8_t ch_i = 0; ch_i < PCA9685_REG_CH_NUM; ch_i++)
+    {
+        chip->reg[PCA9685_REG_LED0 + (ch_i * PCA9685_REG_CH_LEN) + 3] = 0x10U; /* Full OFF. */
+    }
+    chip->reg[SIM_REG_ALL_LED + 3] = 0x10U;
+    chip->reg[PCA9685_REG_PRESCALE] = 0x1eU;
+    chip->ptr = 0;
+    chip->latch_dirty = 1;
+}
+
+/**
+ * @brief Check if a chip responds to an address given its MODE1 and sub/all-call registers.
+ */
+static uint8_t sim_chip_match(sim_chip_t const *const chip, uint8_t const addr, uint8_t *const group)
+{
+    uint8_t const mode1 = chip->reg[PCA9685_REG_MODE1];
+    *group = 1;
+    if ((mode1 & PCA9685_REG_MODE1_ALLCALL) && addr == (chip->reg[PCA9685_REG_ALLCALLADDR] >> 1))
+    {
+        return 1;
+    }
+    if (((mode1 & PCA9685_REG_MODE1_SUB1) && addr == (chip->reg[PCA9685_REG_SUBADDR1] >> 1)) ||
+        ((mode1 & PCA9685_REG_MODE1_SUB2) && addr == (chip->reg[PCA9685_REG_SUBADDR2] >> 1)) ||
+        ((mode1 & PCA9685_REG_MODE1_SUB3) && addr == (chip->reg[PCA9685_REG_SUBADDR3] >> 1)))
+    {
+        return 1;
+    }
+    *group = 0;
+    return chip->addr == addr;
+}
+
+static void sim_ptr_advance(sim_chip_t *const chip)
+{
+    if ((chip->reg[PCA9685_REG_MODE1] & PCA9685_REG_MODE1_AUTOINC) == 0)
+    {
+        return;
+    }
+    /* The control register rolls over to MODE1 after the last LED register and after TESTMODE. */
+    if (chip->ptr == SIM_REG_LED_LAST)
+    {
+        chip->ptr = 0;
+    }
+    else
+    {
+        chip->ptr++;
+    }
+}
+
+/**
+ * @brief Get the start of the first PWM period after @p now, from the nominal oscillator frequency.
+ */
+static uint64_t sim_period_next(sim_chip_t const *const chip, uint64_t const now)
+{
+    if (now < chip->pwm_start)
+    {
+        return chip->pwm_start;
+    }
+    uint64_t const period_ps = (((uint64_t)chip->reg[PCA9685_REG_PRESCALE] + 1U) * 4096U * 1000000000000ULL) / PCA9685_OSC_FREQ;
+    uint64_t const periods = (((now - chip->pwm_start) * 1000U) / period_ps) + 1;
+    return chip->pwm_start + ((periods * period_ps) / 1000U);
+}
+
+static void sim_chip_latch(sim_chip_t *const chip, uint64_t const now)
+{
+    uint8_t const running = (chip->reg[PCA9685_REG_MODE1] & PCA9685_REG_MODE1_SLEEP) == 0 &&
+                            now >= chip->wake_time + BUS_SIM_RESTART_DELAY_NS;
+    if (!chip->latch_dirty && running == chip->out.running)
+    {
+        return;
+    }
+    memcpy(chip->out.led, &(chip->reg[PCA9685_REG_LED0]), sizeof(chip->out.led));
+    chip->out.running = running;
+    chip->out.latch_seq++;
+    chip->out.latch_time = now;
+    chip->out.pulse_time = running ? sim_period_next(chip, now) : 0;
+    chip->latch_dirty = 0;
+}
+
+static void sim_reg_write(bus_sim_t *const sim, sim_chip_t *const chip, uint8_t const val, uint64_t const now)
+{
+    uint8_t const reg = chip->ptr;
+    if (reg == PCA9685_REG_MODE1)
+    {
+        uint8_t const old = chip->reg[PCA9685_REG_MODE1];
+        uint8_t mode1 = val & ~PCA9685_REG_MODE1_RESTART;
+        if ((old & PCA9685_REG_MODE1_SLEEP) && !(val & PCA9685_REG_MODE1_SLEEP))
+        {
+            chip->wake_time = now;
+            chip->pwm_start = now + BUS_SIM_RESTART_DELAY_NS; /* Counter runs once the oscillator settled. */
+        }
+        else if (!(old & PCA9685_REG_MODE1_SLEEP) && (val & PCA9685_REG_MODE1_SLEEP))
+        {
+            mode1 |= PCA9685_REG_MODE1_RESTART; /* PWM was running so a restart is possible later. */
+        }
+        else if ((old & PCA9685_REG_MODE1_RESTART) && !(val & PCA9685_REG_MODE1_RESTART))
+        {
+            mode1 |= PCA9685_REG_MODE1_RESTART; /* Writing 0 has no effect on RESTART. */
+        }
+        if ((val & PCA9685_REG_MODE1_RESTART) && !(val & PCA9685_REG_MODE1_SLEEP))
+        {
+            if (now < chip->wake_time + BUS_SIM_RESTART_DELAY_NS)
+            {
+                sim->stats.restart_early++;
+            }
+            chip->restarted = 1;
+        }
+        chip->reg[PCA9685_REG_MODE1] = mode1;
+    }
+    else if (reg == PCA9685_REG_PRESCALE)
+    {
+        if (chip->reg[PCA9685_REG_MODE1] & PCA9685_REG_MODE1_SLEEP)
+        {
+            chip->reg[PCA9685_REG_PRESCALE] = val < 3 ? 3 : val;
+        }
+        else
+        {
+            sim->stats.prescale_ignored++;
+        }
+    }
+    else if (reg >= SIM_REG_ALL_LED && reg < PCA9685_REG_PRESCALE)
+    {
+        /* ALL_LED registers fan out to the same register of every channel. */
+        for (uint8_t ch_i = 0; ch_i < PCA9685_REG_CH_NUM; ch_i++)
+        {
+            chip->reg[PCA9685_REG_LED0 + (ch_i * PCA9685_REG_CH_LEN) + (reg - SIM_REG_ALL_LED)] = val;
+        }
+        chip->latch_dirty = 1;
+    }
+    else if (reg <= SIM_REG_LED_LAST || reg == PCA9685_REG_TESTMODE)
+    {
+        chip->reg[reg] = val;
+        if (reg >= PCA9685_REG_LED0)
+        {
+            chip->latch_dirty = 1;
+        }
+    }
+    /* Writes to reserved registers are acknowledged and dropped. */
+    sim_ptr_advance(chip);
+}
+
+static uint8_t sim_reg_read(sim_chip_t *const chip)
+{
+    uint8_t const reg = chip->ptr;
+    uint8_t val = 0; /* ALL_LED and reserved registers read as 0. */
+    if (reg <= SIM_REG_LED_LAST || reg == PCA9685_REG_PRESCALE || reg == PCA9685_REG_TESTMODE)
+    {
+        val = chip->reg[reg];
+    }
+    sim_ptr_advance(chip);
+    return val;
+}
+
+static error_t bus_sim_xfer(void *const ctx, struct i2c_msg *const msgs, uint8_t const msg_num)
+{
+    bus_sim_t *const sim = ctx;
+    error_t err = ERR_OK;
+    uint64_t bits = 1; /* STOP. */
+
+    pthread_mutex_lock(&(sim->lock));
+    uint64_t start = sim_now_ns();
+    if (start < sim->free_time)
+    {
+        start = sim->free_time; /* Bus is serial, wait for the previous transfer to finish. */
+    }
+    /* A faulty transfer gets as far as a random message, which is not acknowledged. */
+    uint8_t msg_fail = msg_num;
+    if (sim->fail_ppm > 0 && msg_num > 0 && (sim_rand(sim) % 1000000U) < sim->fail_ppm)
+    {
+        msg_fail = sim_rand(sim) % msg_num;
+    }
+    for (uint8_t msg_i = 0; msg_i < msg_num && err == ERR_OK; msg_i++)
+    {
+        struct i2c_msg *const msg = &(msgs[msg_i]);
+        if (msg_i == msg_fail)
+        {
+            bits += 1 + 9;
+            sim->stats.fault++;
+            err = ERR_I2C_WRITE;
+            break;
+        }
+        uint8_t const addr = msg->addr & 0x7fU;
+        uint8_t const read = (msg->flags & I2C_M_RD) != 0;
+        bits += 1 + 9; /* (Repeated) START and the address byte. */
+        sim->stats.msg++;
+        sim->stats.bytes++;
+
+        if (addr == SIM_GENERAL_CALL_ADDR)
+        {
+            bits += 9U * msg->len;
+            sim->stats.bytes += msg->len;
+            if (!read && msg->len == 1 && msg->buf[0] == SIM_SWRST_BYTE)
+            {
+                for (uint8_t chip_i = 0; chip_i < sim->chip_num; chip_i++)
+                {
+                    sim_chip_reset(&(sim->chip[chip_i]));
+                }
+                sim->stats.swrst++;
+            }
+            continue;
+        }
+
+        uint8_t matched = 0, group_any = 0;
+        for (uint8_t chip_i = 0; chip_i < sim->chip_num; chip_i++)
+        {
+            uint8_t group = 0;
+            sim->chip[chip_i].selected = sim_chip_match(&(sim->chip[chip_i]), addr, &group);
+            matched += sim->chip[chip_i].selected;
+            group_any |= group & sim->chip[chip_i].selected;
+        }
+        if (matched == 0 || (read && group_any))
+        {
+            sim->stats.nack++;
+            err = ERR_I2C_WRITE;
+            break;
+        }
+
+        bits += 9U * msg->len;
+        sim->stats.bytes += msg->len;
+        for (uint8_t chip_i = 0; chip_i < sim->chip_num; chip_i++)
+        {
+            sim_chip_t *const chip = &(sim->chip[chip_i]);
+            if (!chip->selected)
+            {
+                continue;
+            }
+            if (read)
+            {
+                for (uint16_t byte_i = 0; byte_i < msg->len; byte_i++)
+                {
+                    msg->buf[byte_i] = sim_reg_read(chip);
+                }
+            }
+            else if (msg->len > 0)
+            {
+                chip->ptr = msg->buf[0];
+                for (uint16_t byte_i = 1; byte_i < msg->len; byte_i++)
+                {
+                    sim_reg_write(sim, chip, msg->buf[byte_i], start);
+                    if (chip->reg[PCA9685_REG_MODE2] & PCA9685_REG_MODE2_OCH)
+                    {
+                        sim_chip_latch(chip, start); /* Outputs change on ACK. */
+                    }
+                }
+            }
+        }
+    }
+
+    uint64_t busy_ns = (bits * 1000000000U) / sim->cfg.clock_hz;
+    if (sim->stall_ppm > 0 && (sim_rand(sim) % 1000000U) < sim->stall_ppm)
+    {
+        busy_ns += sim->stall_ns; /* A device holds SCL low, the outputs still latch at STOP. */
+        sim->stats.stall++;
+    }
+    uint64_t const stop = start + busy_ns;
+    for (uint8_t chip_i = 0; chip_i < sim->chip_num; chip_i++)
+    {
+        sim_chip_t *const chip = &(sim->chip[chip_i]);
+        if (chip->restarted)
+        {
+            chip->pwm_start = stop; /* Counter starts over from 0. */
+            chip->restarted = 0;
+        }
+        sim_chip_latch(chip, stop); /* Outputs change on STOP. */
+    }
+    sim->free_time = stop;
+    sim->stats.xfer++;
+    sim->stats.busy_ns += busy_ns;
+    pthread_mutex_unlock(&(sim->lock));
+
+    if (sim->cfg.realtime)
+    {
+        struct timespec const until = {.tv_sec = stop / 1000000000U, .tv_nsec = stop % 1000000000U};
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL) != 0)
+        {
+        }
+    }
+    return err;
+}
+
+static error_t bus_sim_recover(void *const ctx)
+{
+    bus_sim_t *const sim = ctx;
+    pthread_mutex_lock(&(sim->lock));
+    sim->stats.recover++;
+    pthread_mutex_unlock(&(sim->lock));
+    return ERR_OK;
+}
+
+static void bus_sim_close(void *const ctx)
+{
+    bus_sim_t *const sim = ctx;
+    pthread_mutex_destroy(&(sim->lock));
+    free(sim);
+}
+
+static bus_ops_t const bus_sim_ops = {
+    .xfer = bus_sim_xfer,
+    .recover = bus_sim_recover,
+    .close = bus_sim_close,
+};
+
+error_t bus_sim_open(bus_sim_cfg_t const *const cfg, bus_t *const bus)
+{
+    if (cfg->clock_hz == 0)
+    {
+        log_error("Simulated bus needs a non-zero clock");
+        return ERR_CRIT;
+    }
+    bus_sim_t *const sim = calloc(1, sizeof(bus_sim_t));
+    if (sim == NULL)
+    {
+        log_error("Failed to allocate simulated bus state");
+        return ERR_CRIT;
+    }
+    pthread_mutex_init(&(sim->lock), NULL);
+    sim->cfg = *cfg;
+    sim->rng = 0x9e3779b97f4a7c15ULL;
+    bus->ops = &bus_sim_ops;
+    bus->ctx = sim;
+    return ERR_OK;
+}
+
+error_t bus_sim_chip_add(bus_t const *const bus, uint8_t const addr)
+{
+    bus_sim_t *const sim = sim_get(bus);
+    if (sim == NULL)
+    {
+        return ERR_CRIT;
+    }
+    pthread_mutex_lock(&(sim->lock));
+    if (sim->chip_num >= BUS_SIM_CHIP_MAX || sim_chip_find(sim, addr) != NULL)
+    {
+        pthread_mutex_unlock(&(sim->lock));
+        log_error("Can not add simulated chip at 0x%02x", addr);
+        return ERR_CRIT;
+    }
+    sim_chip_t *const chip = &(sim->chip[sim->chip_num]);
+    memset(chip, 0, sizeof(sim_chip_t));
+    chip->addr = addr;
+    sim_chip_reset(chip);
+    sim->chip_num++;
+    pthread_mutex_unlock(&(sim->lock));
+    return ERR_OK;
+}
+
+error_t bus_sim_reg_get(bus_t const *const bus, uint8_t const addr, uint8_t const reg, uint8_t *const val)
+{
+    bus_sim_t *const sim = sim_get(bus);
+    if (sim == NULL)
+    {
+        return ERR_CRIT;
+    }
+    pthread_mutex_lock(&(sim->lock));
+    sim_chip_t const *const chip = sim_chip_find(sim, addr);
+    if (chip != NULL)
+    {
+        *val = chip->reg[reg];
+    }
+    pthread_mutex_unlock(&(sim->lock));
+    return chip != NULL ? ERR_OK : ERR_CRIT;
+}
+
+error_t bus_sim_out_get(bus_t const *const bus, uint8_t const addr, bus_sim_out_t *const out)
+{
+    bus_sim_t *const sim = sim_get(bus);
+    if (sim == NULL)
+    {
+        return ERR_CRIT;
+    }
+    pthread_mutex_lock(&(sim->lock));
+    sim_chip_t *const chip = sim_chip_find(sim, addr);
+    if (chip != NULL)
+    {
+        sim_chip_latch(chip, sim_now_ns()); /* Pick up an oscillator that settled since. */
+        *out = chip->out;
+    }
+    pthread_mutex_unlock(&(sim->lock));
+    return chip != NULL ? ERR_OK : ERR_CRIT;
+}
+
+error_t bus_sim_fault_set(bus_t const *const bus, uint32_t const fail_ppm)
+{
+    bus_sim_t *const sim = sim_get(bus);
+    if (sim == NULL)
+    {
+        return ERR_CRIT;
+    }
+    pthread_mutex_lock(&(sim->lock));
+    sim->fail_ppm = fail_ppm;
+    pthread_mutex_unlock(&(sim->lock));
+    return ERR_OK;
+}
+
+error_t bus_sim_stall_set(bus_t const *const bus, uint32_t const stall_ppm, uint32_t const stall_us)
+{
+    bus_sim_t *const sim = sim_get(bus);
+    if (sim == NULL)
+    {
+        return ERR_CRIT;
+    }
+    pthread_mutex_lock(&(sim->lock));
+    sim->stall_ppm = stall_ppm;
+    sim->stall_ns = (uint64_t)stall_us * 1000U;
+    pthread_mutex_unlock(&(sim->lock));
+    return ERR_OK;
+}
+
+error_t bus_sim_chip_power_cycle(bus_t const *const bus, uint8_t const addr)
+{
+    bus_sim_t *const sim = sim_get(bus);
+    if (sim == NULL)
+    {
+        return ERR_CRIT;
+    }
+    pthread_mutex_lock(&(sim->lock));
+    sim_chip_t *const chip = sim_chip_find(sim, addr);
+    if (chip != NULL)
+    {
+        sim_chip_reset(chip);
+        sim_chip_latch(chip, sim_now_ns());
+        sim->stats.power_cycle++;
+    }
+    pthread_mutex_unlock(&(sim->lock));
+    return chip != NULL ? ERR_OK : ERR_CRIT;
+}
+
+error_t bus_sim_stats_get(bus_t const *const bus, bus_sim_stats_t *const stats)
+{
+    bus_sim_t *const sim = sim_get(bus);
+    if (sim == NULL)
+    {
+        return ERR_CRIT;
+    }
+    pthread_mutex_lock(&(sim->lock));
+    *stats = sim->stats;
+    pthread_mutex_unlock(&(sim->lock));
+    return ERR_OK;
+}
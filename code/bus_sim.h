@@ -0,0 +1,117 @@
+#ifndef _BUS_SIM_H_
+#define _BUS_SIM_H_
+
+#include <stdint.h>
+
+#include "bus.h"
+
+#define BUS_SIM_CHIP_MAX 8U
+#define BUS_SIM_CLOCK_HZ_DEFAULT 100000U
+#define BUS_SIM_RESTART_DELAY_NS 500000U /* Oscillator settle time after leaving SLEEP. */
+
+/* Configuration of a simulated bus. */
+typedef struct bus_sim_cfg_t
+{
+    uint32_t clock_hz; /* SCL frequency the transfer timing is modeled at. */
+    uint8_t realtime;  /* If >0, a transfer takes as long as it would on a real bus. */
+} bus_sim_cfg_t;
+
+/* Counters kept by a simulated bus. */
+typedef struct bus_sim_stats_t
+{
+    uint64_t xfer;             /* Combined transfers (one STOP each). */
+    uint64_t msg;              /* Messages (START or repeated START each). */
+    uint64_t bytes;            /* Bytes on the wire including address bytes. */
+    uint64_t nack;             /* Messages no chip acknowledged. */
+    uint64_t busy_ns;          /* Total modeled bus time. */
+    uint64_t swrst;            /* Software resets received. */
+    uint64_t restart_early;    /* RESTART written before the oscillator settled. */
+    uint64_t prescale_ignored; /* PRESCALE writes dropped because the chip was not in SLEEP. */
+    uint64_t fault;            /* Transfers failed on purpose, see "bus_sim_fault_set". */
+    uint64_t stall;            /* Transfers stretched on purpose, see "bus_sim_stall_set". */
+    uint64_t power_cycle;      /* Chips that lost power, see "bus_sim_chip_power_cycle". */
+    uint64_t recover;          /* Times the bus was asked to recover. */
+} bus_sim_stats_t;
+
+/* Snapshot of what a simulated chip is outputting. */
+typedef struct bus_sim_out_t
+{
+    uint8_t led[16][4];  /* Latched LEDn ON_L, ON_H, OFF_L, OFF_H. */
+    uint8_t running;     /* 1 if the oscillator is on and settled. */
+    uint64_t latch_seq;  /* Incremented every time outputs change. */
+    uint64_t latch_time; /* CLOCK_MONOTONIC time in ns of the last output change. */
+    uint64_t pulse_time; /* Start of the first PWM period that outputs the latched values, 0 if not running. */
+} bus_sim_out_t;
+
+/**
+ * @brief Create an in-process simulated bus with no chips on it.
+ * @param cfg Configuration of the bus.
+ * @param bus Where the opened bus gets written.
+ * @return Status code.
+ */
+error_t bus_sim_open(bus_sim_cfg_t const *const cfg, bus_t *const bus);
+
+/**
+ * @brief Put a simulated PCA9685 with power-on register values on the bus.
+ * @param bus A bus opened with "bus_sim_open".
+ * @param addr 7-bit address of the chip as set by its address pins.
+ * @return Status code.
+ */
+error_t bus_sim_chip_add(bus_t const *const bus, uint8_t const addr);
+
+/**
+ * @brief Read a register of a simulated chip without going through the bus.
+ * @param bus A bus opened with "bus_sim_open".
+ * @param addr Address of the chip.
+ * @param reg Register to read.
+ * @param val Where the register value gets written.
+ * @return Status code.
+ */
+error_t bus_sim_reg_get(bus_t const *const bus, uint8_t const addr, uint8_t const reg, uint8_t *const val);
+
+/**
+ * @brief Get what a simulated chip is currently outputting.
+ * @param bus A bus opened with "bus_sim_open".
+ * @param addr Address of the chip.
+ * @param out Where the snapshot gets written.
+ * @return Status code.
+ */
+error_t bus_sim_out_get(bus_t const *const bus, uint8_t const addr, bus_sim_out_t *const out);
+
+/**
+ * @brief Make transfers fail at random like on a noisy bus. A failing transfer stops at a random
+ * message, the messages before it still reach the chips.
+ * @param bus A bus opened with "bus_sim_open".
+ * @param fail_ppm Transfers out of a million that fail, 0 to turn faults off.
+ * @return Status code.
+ */
+error_t bus_sim_fault_set(bus_t const *const bus, uint32_t const fail_ppm);
+
+/**
+ * @brief Make transfers stall at random like when a device on the bus stretches the clock. A
+ * stalled transfer goes through but keeps the bus for @p stall_us longer.
+ * @param bus A bus opened with "bus_sim_open".
+ * @param stall_ppm Transfers out of a million that stall, 0 to turn stalls off.
+ * @param stall_us How long each stall lasts.
+ * @return Status code.
+ */
+error_t bus_sim_stall_set(bus_t const *const bus, uint32_t const stall_ppm, uint32_t const stall_us);
+
+/**
+ * @brief Make a simulated chip lose power for a moment, like in a brownout. It comes back with
+ * power-on register values i.e. asleep, outputs off and the default prescale.
+ * @param bus A bus opened with "bus_sim_open".
+ * @param addr Address of the chip.
+ * @return Status code.
+ */
+error_t bus_sim_chip_power_cycle(bus_t const *const bus, uint8_t const addr);
+
+/**
+ * @brief Get the counters of a simulated bus.
+ * @param bus A bus opened with "bus_sim_open".
+ * @param stats Where the counters get written.
+ * @return Status code.
+ */
+error_t bus_sim_stats_get(bus_t const *const bus, bus_sim_stats_t *const stats);
+
+#endif /* _BUS_SIM_H_ */
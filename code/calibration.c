@@ -3,14 +3,19 @@
 
 #include <curses.h>
 #include <string.h>
+#include <time.h>
+#include <errno.h>
 
 #include "calibration.h"
 #include "pca9685.h"
 #include "actuator.h"
+#include "ch_cfg.h"
+#include "override.h"
 
 #define CH_NUM 16U
 #define CH_WIN_WIDTH 13
-#define CH_WIN_HEIGHT 5
+#define CH_WIN_HEIGHT 6
+#define CAL_REFRESH_MS 20U /* Keys are gathered this long before the chip and the screen get updated. */
 
 enum ch_val_t
 {
@@ -26,10 +31,30 @@ enum mode_t
     MODE_EDIT
 };
 
+/* Everything a channel window shows, compared with what was drawn last to find damaged windows. */
+typedef struct
+{
+    uint16_t min;
+    uint16_t max;
+    int32_t out;            /* Duty cycle the chip was last given or -1 if none. */
+    enum ch_val_t selected; /* CH_VAL_NUM if the channel is not selected. */
+    enum mode_t mode;
+} cal_cell_t;
+
 typedef struct
 {
     WINDOW *ch_win[CH_NUM];
+    cal_cell_t ch_drawn[CH_NUM]; /* What each window shows right now. */
+    uint16_t ch_damaged;         /* Bit per window that has to be redrawn regardless. */
     uint16_t ch_info[CH_NUM][2];
+    uint16_t duty[CH_NUM];       /* Duty cycle to output on edited channels. */
+    uint16_t duty_mask;          /* Bit per channel that was edited and is output. */
+    uint16_t duty_pending;       /* Bit per channel whose duty cycle changed since the last commit. */
+    uint64_t edits;              /* Changes of the output duty cycles. */
+    uint64_t commits;            /* Transfers that wrote them. */
+    uint8_t commit_failed;       /* Set while the last commit failed. */
+    uint8_t live;                /* Set if edits go through a running daemon instead of the chip. */
+    ch_cfg_t ch_cfg; /* Loaded configuration, min and max get replaced by 'ch_info' on save. */
 } cal_info_t;
 
 static int term_width, term_height;
@@ -37,6 +62,7 @@ static uint8_t ch_selected = 0; /* 0 to (CH_NUM - 1)*/
 static enum ch_val_t ch_val_selected = CH_VAL_WIN;
 static enum mode_t mode = MODE_VISUAL;
 static uint8_t incr_step = 1; /* Step size for the edits */
+static uint8_t status_damaged = 1;
 
 #define border_simple(win) wborder(win, '|', '|', '-', '-', '+', '+', '+', '+')
 
@@ -58,67 +84,112 @@ static int32_t clamp_delta(int32_t val, const int32_t min, const int32_t max, co
     return val;
 }
 
-static void draw_ch_win(cal_info_t *cal_info)
+static uint64_t cal_now_ms(void)
 {
-    WINDOW *win; /* macro for clarity */
-    for (size_t win_i = 0, win_y = 1, win_x = 0; win_i < CH_NUM; win_i++)
-    {
-        win = cal_info->ch_win[win_i];
-        if (win != NULL)
-        {
-            delwin(win);
-        }
-        /* TODO: Move windows to the right position instead of recreating them. */
-        win = newwin(CH_WIN_HEIGHT, CH_WIN_WIDTH, win_y, win_x);
-        border_simple(win);
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((uint64_t)now.tv_sec * 1000U) + ((uint64_t)now.tv_nsec / 1000000U);
+}
 
-        win_x += CH_WIN_WIDTH - 1;
-        if (win_x + CH_WIN_WIDTH - 1 >= term_width)
+/**
+ * @brief Place the channel windows to fit the terminal, creating them the first time. Windows are
+ * moved instead of recreated and only get marked for a redraw.
+ */
+static void layout_ch_win(cal_info_t *const cal_info)
+{
+    for (int win_i = 0, win_y = 1, win_x = 0; win_i < (int)CH_NUM; win_i++)
+    {
+        if (win_x > 0 && win_x + CH_WIN_WIDTH > term_width)
         {
             win_x = 0;
             win_y += CH_WIN_HEIGHT - 1;
         }
-        wrefresh(win);
-        cal_info->ch_win[win_i] = win;
+        if (cal_info->ch_win[win_i] == NULL)
+        {
+            cal_info->ch_win[win_i] = newwin(CH_WIN_HEIGHT, CH_WIN_WIDTH, win_y, win_x);
+        }
+        else if (mvwin(cal_info->ch_win[win_i], win_y, win_x) == ERR)
+        {
+            /* Does not fit the terminal anymore, park it until the terminal grows again. */
+            mvwin(cal_info->ch_win[win_i], 0, 0);
+        }
+        win_x += CH_WIN_WIDTH - 1;
     }
+    cal_info->ch_damaged = (1U << CH_NUM) - 1U;
+    status_damaged = 1;
+}
 
-    for (size_t win_i = 0; win_i < CH_NUM; win_i++)
+static void draw_ch_val(WINDOW *const win, int const row, char const *const name, uint16_t const val, uint8_t const selected, enum mode_t const ch_mode)
+{
+    if (selected)
     {
-        win = cal_info->ch_win[win_i];
-        if (win_i == ch_selected)
+        wattron(win, A_STANDOUT);
+        if (ch_mode == MODE_EDIT)
         {
-            wattron(win, A_STANDOUT);
+            wattron(win, COLOR_PAIR(2));
         }
+    }
+    mvwprintw(win, row, 2, "%s: %u", name, val);
+    wattrset(win, 0);
+}
 
-        mvwprintw(win, 1, 2, "Ch %u", win_i + 1, mode);
-        wattrset(win, 0);
-        if (win_i == ch_selected && ch_val_selected == CH_VAL_MIN)
+/**
+ * @brief Redraw the channel windows whose content changed since they were last drawn.
+ * @return 1 if any window was drawn and 0 otherwise.
+ */
+static uint8_t draw_ch_win(cal_info_t *const cal_info, pca9685_handle_t const *const handle)
+{
+    uint8_t drawn = 0;
+    for (uint8_t win_i = 0; win_i < CH_NUM; win_i++)
+    {
+        uint16_t out;
+        cal_cell_t cell;
+        memset(&cell, 0, sizeof(cell)); /* Padding takes part in the comparison. */
+        cell.min = cal_info->ch_info[win_i][0];
+        cell.max = cal_info->ch_info[win_i][1];
+        if (cal_info->live)
         {
-            wattron(win, A_STANDOUT);
-            if (mode == MODE_EDIT)
-            {
-                wattron(win, COLOR_PAIR(2));
-            }
+            cell.out = override_client_out_get(win_i);
+        }
+        else
+        {
+            cell.out = pca9685_ch_committed_get(handle, win_i, &out) == 0 ? out : -1;
+        }
+        cell.selected = win_i == ch_selected ? ch_val_selected : CH_VAL_NUM;
+        cell.mode = win_i == ch_selected ? mode : MODE_VISUAL;
+        if (!(cal_info->ch_damaged & (1U << win_i)) && memcmp(&cell, &(cal_info->ch_drawn[win_i]), sizeof(cell)) == 0)
+        {
+            continue;
         }
-        mvwprintw(win, 2, 2, "Min: %u", cal_info->ch_info[win_i][0]);
-        wattrset(win, 0);
 
-        if (win_i == ch_selected && ch_val_selected == CH_VAL_MAX)
+        WINDOW *const win = cal_info->ch_win[win_i];
+        werase(win);
+        border_simple(win);
+        if (cell.selected == CH_VAL_WIN)
         {
             wattron(win, A_STANDOUT);
-            if (mode == MODE_EDIT)
-            {
-                wattron(win, COLOR_PAIR(2));
-            }
         }
-        mvwprintw(win, 3, 2, "Max: %u", cal_info->ch_info[win_i][1]);
+        mvwprintw(win, 1, 2, "Ch %u", win_i + 1U);
         wattrset(win, 0);
-
-        wrefresh(win);
+        draw_ch_val(win, 2, "Min", cell.min, cell.selected == CH_VAL_MIN, cell.mode);
+        draw_ch_val(win, 3, "Max", cell.max, cell.selected == CH_VAL_MAX, cell.mode);
+        if (cell.out >= 0)
+        {
+            mvwprintw(win, 4, 2, "Out: %d", cell.out);
+        }
+        else
+        {
+            mvwprintw(win, 4, 2, "Out: -");
+        }
+        wnoutrefresh(win);
+        cal_info->ch_drawn[win_i] = cell;
+        drawn = 1;
     }
+    cal_info->ch_damaged = 0;
+    return drawn;
 }
 
-static void draw_status(WINDOW *win_status)
+static void draw_status(WINDOW *win_status, cal_info_t const *const cal_info)
 {
     wresize(win_status, 1, term_width);
     werase(win_status);
@@ -132,24 +203,181 @@ static void draw_status(WINDOW *win_status)
         mode_text = "edit";
         break;
     case MODE_VISUAL:
+    default:
         mode_text = "visual";
         break;
     }
 
-    mvwprintw(win_status, 0, 0, "MODE: %s\tIncrement step %u\tSelected %u\tSelected val %u", mode_text, incr_step, ch_selected + 1, ch_val_selected);
+    uint16_t const val = ch_val_selected > CH_VAL_WIN ? cal_info->ch_info[ch_selected][ch_val_selected - 1] : 0;
+    mvwprintw(win_status, 0, 0, "MODE: %s%s\tIncrement step %u\tSelected %u\tSelected val %u (%u us)\tEdits %llu, writes %llu%s",
+              mode_text, cal_info->live ? " (live)" : "", incr_step, ch_selected + 1U, ch_val_selected, (unsigned)ch_cfg_count_to_us(val),
+              (unsigned long long)cal_info->edits, (unsigned long long)cal_info->commits,
+              cal_info->commit_failed ? "\tWRITE FAILED" : "");
     wattroff(win_status, 0);
-    wrefresh(win_status);
+    wnoutrefresh(win_status);
 }
 
-void cal_main()
+/**
+ * @brief Write the edited limits to the channel configuration file.
+ * @return 0 on success and -1 on failure.
+ */
+static int cal_save(cal_info_t *const cal_info, char const *const ch_cfg_path)
 {
-    pca9685_handle_t handle = {0};
-    if (i2c_port_open(PCA9685_I2C_ADAPTER_ID, &(handle.fd)) != ERR_OK)
+    for (uint8_t ch_i = 0; ch_i < CH_NUM; ch_i++)
+    {
+        ch_cfg_ch_t *const ch = &(cal_info->ch_cfg.ch[ch_i]);
+        /* Limits given in microseconds stay that way unless they were edited. */
+        if (ch->min != cal_info->ch_info[ch_i][0])
+        {
+            ch->min = cal_info->ch_info[ch_i][0];
+            ch->min_us = ch->min_us > 0 ? ch_cfg_count_to_us(ch->min) : 0;
+        }
+        if (ch->max != cal_info->ch_info[ch_i][1])
+        {
+            ch->max = cal_info->ch_info[ch_i][1];
+            ch->max_us = ch->max_us > 0 ? ch_cfg_count_to_us(ch->max) : 0;
+        }
+        ch_cfg_ch_update(ch);
+    }
+    return ch_cfg_save(ch_cfg_path, &(cal_info->ch_cfg));
+}
+
+/**
+ * @brief Write every duty cycle changed since the last commit in a single transfer. Failed writes
+ * are retried on the next refresh. Through a running daemon, the edited channels are published on
+ * every refresh instead, which keeps their lease.
+ */
+static void cal_commit(cal_info_t *const cal_info, pca9685_handle_t *const handle)
+{
+    if (cal_info->live)
+    {
+        override_client_publish(cal_info->duty, cal_info->duty_mask);
+        cal_info->commits += cal_info->duty_pending != 0;
+        cal_info->duty_pending = 0;
+        return;
+    }
+    if (cal_info->duty_pending == 0)
+    {
+        return;
+    }
+    uint8_t const failed = pca9685_frame_commit_mask(handle, cal_info->duty, cal_info->duty_pending) != ERR_OK;
+    if (failed != cal_info->commit_failed)
+    {
+        cal_info->commit_failed = failed;
+        status_damaged = 1;
+    }
+    if (!failed)
+    {
+        cal_info->duty_pending = 0;
+    }
+    cal_info->commits++;
+}
+
+/**
+ * @brief Apply a key press. Edits only change what the next commit writes.
+ * @return 1 if the key quits and 0 otherwise.
+ */
+static uint8_t cal_key(cal_info_t *const cal_info, char const *const ch_cfg_path, int const ch)
+{
+    if (ch == 'q')
+    {
+        return 1;
+    }
+    status_damaged = 1;
+
+    if (mode == MODE_EDIT)
+    {
+        uint16_t *val_edit = &cal_info->ch_info[ch_selected][ch_val_selected - 1];
+        switch (ch)
+        {
+        case 'e':
+            mode = MODE_VISUAL;
+            break;
+        case KEY_LEFT:
+        case KEY_DOWN:
+            *val_edit = clamp_delta(*val_edit, 0, CH_CFG_COUNT_MAX, -incr_step);
+            break;
+        case KEY_RIGHT:
+        case KEY_UP:
+            *val_edit = clamp_delta(*val_edit, 0, CH_CFG_COUNT_MAX, incr_step);
+            break;
+        case '.':
+            incr_step = clamp_delta(incr_step, 0, UINT8_MAX, 1);
+            break;
+        case ',':
+            incr_step = clamp_delta(incr_step, 0, UINT8_MAX, -1);
+            break;
+        case ' ':
+            if (*val_edit == 0)
+            {
+                *val_edit = CH_CFG_COUNT_MAX;
+            }
+            else
+            {
+                *val_edit = 0;
+            }
+            break;
+        }
+        if (cal_info->duty[ch_selected] != *val_edit || !(cal_info->duty_mask & (1U << ch_selected)))
+        {
+            cal_info->duty[ch_selected] = *val_edit;
+            cal_info->duty_mask |= 1U << ch_selected;
+            cal_info->duty_pending |= 1U << ch_selected;
+            cal_info->edits++;
+        }
+        return 0;
+    }
+
+    switch (ch)
+    {
+    case KEY_LEFT:
+        ch_selected = clamp_delta(ch_selected, 0, CH_NUM - 1, -1);
+        break;
+    case KEY_RIGHT:
+        ch_selected = clamp_delta(ch_selected, 0, CH_NUM - 1, 1);
+        break;
+    case KEY_UP:
+        ch_val_selected = clamp_delta(ch_val_selected, 0, CH_VAL_NUM - 1, -1);
+        break;
+    case KEY_DOWN:
+        ch_val_selected = clamp_delta(ch_val_selected, 0, CH_VAL_NUM - 1, 1);
+        break;
+    case 'e':
+        if (ch_val_selected > CH_VAL_WIN)
+        {
+            mode = MODE_EDIT;
+        }
+        break;
+    case 's':
+        if (cal_save(cal_info, ch_cfg_path) != 0)
+        {
+            log_error("Failed to save calibration to %s", ch_cfg_path);
+        }
+        break;
+    case 'r':
+        cal_info->duty_mask = 0;
+        cal_info->duty_pending = 0;
+        break;
+    }
+    return 0;
+}
+
+void cal_main(char const *const ch_cfg_path, uint32_t const pwm_hz, uint32_t const osc_hz)
+{
+    /* A running daemon owns the bus, so edits go through it and its chips are left running. */
+    pca9685_handle_t handle = {.addr = PCA9685_ADDR, .pwm_hz = pwm_hz, .osc_hz = osc_hz};
+    uint8_t const live = override_client_open() == 0;
+    if (!live && errno != ENOENT)
+    {
+        log_error("Failed to attach to the running daemon");
+        exit(EXIT_FAILURE);
+    }
+    if (!live && bus_i2c_open(PCA9685_I2C_ADAPTER_ID, &(handle.bus)) != ERR_OK)
     {
         log_error("Failed to open I2C adapter connected to PCA9685");
         exit(EXIT_FAILURE);
     }
-    if (pca9685_init(&handle) != ERR_OK)
+    if (!live && pca9685_init(&handle) != ERR_OK)
     {
         log_error("Failed to initialize PCA9685");
         exit(EXIT_FAILURE);
@@ -160,6 +388,7 @@ void cal_main()
     cbreak();             /* Remove input delays */
     noecho();             /* Don't echo keyboard input */
     keypad(stdscr, TRUE); /* For special key support (e.g. arrows) */
+    curs_set(0);
     getmaxyx(stdscr, term_height, term_width);
     refresh();
     start_color(); /* Enable color support */
@@ -168,87 +397,64 @@ void cal_main()
 
     /* Draw windows per channel and keep track of calibration data */
     cal_info_t cal_info = {};
+    cal_info.live = live;
+    if (ch_cfg_load(ch_cfg_path, &(cal_info.ch_cfg)) != 0)
+    {
+        ch_cfg_default(&(cal_info.ch_cfg));
+    }
+    for (uint8_t ch_i = 0; ch_i < CH_NUM; ch_i++)
+    {
+        cal_info.ch_info[ch_i][0] = cal_info.ch_cfg.ch[ch_i].min;
+        cal_info.ch_info[ch_i][1] = cal_info.ch_cfg.ch[ch_i].max;
+    }
 
     /* Status bar window */
     WINDOW *win_status = newwin(1, term_width, 0, 0);
+    layout_ch_win(&cal_info);
 
-    /* Update loop */
-    int ch = 0;
-    do
+    /*
+    Update loop. Keys are applied as they arrive while the chip and the screen are updated once per
+    refresh, so a held key costs one transfer and one redraw per refresh instead of one per repeat.
+    */
+    uint64_t refresh_next = 0;
+    uint8_t quit = 0;
+    while (!quit)
     {
-        int old_term_width = term_width, old_term_height = term_height;
-        getmaxyx(stdscr, term_height, term_width);
-        if (old_term_width != term_width || old_term_height != term_height)
+        uint64_t const now = cal_now_ms();
+        if (now >= refresh_next)
         {
-            erase();
-        }
-
-        if (mode == MODE_EDIT)
-        {
-            uint16_t *val_edit = &cal_info.ch_info[ch_selected][ch_val_selected - 1];
-            switch (ch)
+            cal_commit(&cal_info, &handle);
+            uint8_t drawn = draw_ch_win(&cal_info, &handle);
+            if (status_damaged)
             {
-            case 'e':
-                mode = MODE_VISUAL;
-                break;
-            case KEY_LEFT:
-            case KEY_DOWN:
-                *val_edit = clamp_delta(*val_edit, 0, (1 << 12), -incr_step);
-                break;
-            case KEY_RIGHT:
-            case KEY_UP:
-                *val_edit = clamp_delta(*val_edit, 0, (1 << 12), incr_step);
-                break;
-            case '.':
-                incr_step = clamp_delta(incr_step, 0, INT32_MAX, 1);
-                break;
-            case ',':
-                incr_step = clamp_delta(incr_step, 0, INT32_MAX, -1);
-                break;
-            case ' ':
-                if (*val_edit == 0)
-                {
-                    *val_edit = (1 << 12);
-                }
-                else
-                {
-                    *val_edit = 0;
-                }
-                break;
+                draw_status(win_status, &cal_info);
+                status_damaged = 0;
+                drawn = 1;
             }
-            if (pca9685_ch_raw_set(&handle, ch_selected, *val_edit) != ERR_OK)
+            if (drawn)
             {
-                exit(EXIT_FAILURE);
+                doupdate();
             }
+            refresh_next = now + CAL_REFRESH_MS;
+            continue;
         }
-        else
+
+        timeout((int)(refresh_next - now));
+        int const ch = getch();
+        if (ch == ERR)
         {
-            switch (ch)
-            {
-            case KEY_LEFT:
-                ch_selected = clamp_delta(ch_selected, 0, CH_NUM - 1, -1);
-                break;
-            case KEY_RIGHT:
-                ch_selected = clamp_delta(ch_selected, 0, CH_NUM - 1, 1);
-                break;
-            case KEY_UP:
-                ch_val_selected = clamp_delta(ch_val_selected, 0, CH_VAL_NUM - 1, -1);
-                break;
-            case KEY_DOWN:
-                ch_val_selected = clamp_delta(ch_val_selected, 0, CH_VAL_NUM - 1, 1);
-                break;
-            case 'e':
-                if (mode == MODE_VISUAL && ch_val_selected > CH_VAL_WIN)
-                {
-                    mode = MODE_EDIT;
-                }
-                break;
-            }
+            continue;
         }
-
-        draw_ch_win(&cal_info);
-        draw_status(win_status);
-    } while ((ch = getch()) != 'q');
+        if (ch == KEY_RESIZE)
+        {
+            getmaxyx(stdscr, term_height, term_width);
+            erase();
+            wnoutrefresh(stdscr);
+            layout_ch_win(&cal_info);
+            continue;
+        }
+        quit = cal_key(&cal_info, ch_cfg_path, ch);
+    }
 
     /* Deinit ncurses resources and exit */
     delwin(win_status);
@@ -257,6 +463,7 @@ void cal_main()
         delwin(cal_info.ch_win[win_i]);
     }
     endwin();
+    override_client_close();
     exit(EXIT_SUCCESS);
 }
 
@@ -266,9 +473,17 @@ void cal_usage(void)
            "'e': To enter/leave edit mode.\n"
            "',': In edit mode this decreases the increment step (-1) for changing values.\n"
            "'.': In edit mode this increases the increment step (+1) for changing values.\n"
+           "'s': In visual mode this saves the limits to the channel configuration file which a\n"
+           "     running daemon reloads right away.\n"
+           "'r': In visual mode this hands the edited channels back to the control input.\n"
            "'q': Quit the calibration app.\n"
            "'Up' and 'Right' arrow keys increment the selected value in edit mode.\n"
            "'Down' and 'Left' arrow keys decrement the selected value in edit mode.\n"
            "'Left' and 'Right' arrow keys can be used to select the channel in visual mode.\n"
-           "'Space' bar in edit mode will zero-out the edited value when its current value is >0 and otherwise will set it to max i.e. 4096.\n");
+           "'Space' bar in edit mode will zero-out the edited value when its current value is >0 and otherwise will set it to max i.e. %u.\n"
+           "Edits are written to the chip every %u ms at most, 'Out' shows what the chip was last given.\n"
+           "With the daemon running, edits override its outputs without touching the bus. Quitting or 'r'\n"
+           "hands the channels back on the daemon's next pass, and if this app dies they lapse after %u ms.\n"
+           "Otherwise the chip is opened and reset directly.\n",
+           CH_CFG_COUNT_MAX, CAL_REFRESH_MS, OVERRIDE_LEASE_MS);
 }
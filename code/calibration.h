@@ -1,11 +1,16 @@
 #ifndef _CALIBRATION_H_
 #define _CALIBRATION_H_
 
+#include <stdint.h>
+
 /**
  * @brief Main function for calibration mode. Once called, runs an interactive TUI to help in
  * calibrating pulse lengths for each channel. 
+ * @param ch_cfg_path Channel configuration file the limits are loaded from and saved to.
+ * @param pwm_hz PWM frequency to calibrate at, 0 for PCA9685_PWM_FREQ_DEFAULT.
+ * @param osc_hz Measured oscillator frequency of the chip, 0 for PCA9685_OSC_FREQ.
  */
-void cal_main(void);
+void cal_main(char const *const ch_cfg_path, uint32_t const pwm_hz, uint32_t const osc_hz);
 
 /**
  * @brief Print out a usage message for the calibration mode.
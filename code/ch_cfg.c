@@ -0,0 +1,490 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+
+#include <sys/inotify.h>
+
+#include "tco_libd.h"
+
+#include "ch_cfg.h"
+
+#define CH_CFG_LINE_MAX 256U
+
+/* Pulse lengths are in microseconds so they hold at any PWM frequency. */
+#define PULSE_LEN_MIN_DEFUALT 488
+#define PULSE_LEN_MAX_DEFUALT 976
+#define PULSE_LEN_INVERT_DEFUALT 0
+
+/* Motor and steering, the rest are auxiliaries written in the bus time they leave. */
+#define PRIO_HIGH_CH_NUM 2U
+
+/* Used when no configuration file exists. Channels of other chips get the defaults. */
+static const uint16_t CH_PULSE_LENGTH[PCA9685_REG_CH_NUM][3] = {
+    {1025, 2148, 0},
+    {927, 2197, 1},
+    {PULSE_LEN_MIN_DEFUALT, PULSE_LEN_MAX_DEFUALT, PULSE_LEN_INVERT_DEFUALT},
+    {PULSE_LEN_MIN_DEFUALT, PULSE_LEN_MAX_DEFUALT, PULSE_LEN_INVERT_DEFUALT},
+    {PULSE_LEN_MIN_DEFUALT, PULSE_LEN_MAX_DEFUALT, PULSE_LEN_INVERT_DEFUALT},
+    {PULSE_LEN_MIN_DEFUALT, PULSE_LEN_MAX_DEFUALT, PULSE_LEN_INVERT_DEFUALT},
+    {PULSE_LEN_MIN_DEFUALT, PULSE_LEN_MAX_DEFUALT, PULSE_LEN_INVERT_DEFUALT},
+    {PULSE_LEN_MIN_DEFUALT, PULSE_LEN_MAX_DEFUALT, PULSE_LEN_INVERT_DEFUALT},
+    {PULSE_LEN_MIN_DEFUALT, PULSE_LEN_MAX_DEFUALT, PULSE_LEN_INVERT_DEFUALT},
+    {PULSE_LEN_MIN_DEFUALT, PULSE_LEN_MAX_DEFUALT, PULSE_LEN_INVERT_DEFUALT},
+    {PULSE_LEN_MIN_DEFUALT, PULSE_LEN_MAX_DEFUALT, PULSE_LEN_INVERT_DEFUALT},
+    {PULSE_LEN_MIN_DEFUALT, PULSE_LEN_MAX_DEFUALT, PULSE_LEN_INVERT_DEFUALT},
+    {PULSE_LEN_MIN_DEFUALT, PULSE_LEN_MAX_DEFUALT, PULSE_LEN_INVERT_DEFUALT},
+    {PULSE_LEN_MIN_DEFUALT, PULSE_LEN_MAX_DEFUALT, PULSE_LEN_INVERT_DEFUALT},
+    {PULSE_LEN_MIN_DEFUALT, PULSE_LEN_MAX_DEFUALT, PULSE_LEN_INVERT_DEFUALT},
+    {PULSE_LEN_MIN_DEFUALT, PULSE_LEN_MAX_DEFUALT, PULSE_LEN_INVERT_DEFUALT},
+};
+
+static uint32_t count_ps = 0; /* Length of a PWM count, 0 until "ch_cfg_timebase_set". */
+static ch_cfg_t table_default; /* Active until "ch_cfg_init" publishes a table. */
+static pthread_once_t table_default_once = PTHREAD_ONCE_INIT;
+static ch_cfg_t const *table = NULL;
+static uint64_t quiesce_count = 0; /* Incremented by the control loop after each use of a table. */
+
+/* Allocation of a loaded table, which is kept around for a while once it gets replaced. */
+typedef struct ch_cfg_block_t
+{
+    ch_cfg_t cfg;             /* First, so a pointer to the table is one to the block. */
+    uint64_t quiesce_count;   /* "quiesce_count" when the table was replaced. */
+    struct ch_cfg_block_t *next;
+} ch_cfg_block_t;
+
+static ch_cfg_block_t *retired = NULL; /* Replaced tables the control loop may still read, only touched by the reload thread. */
+
+static char watch_path[PATH_MAX];
+static char const *watch_name = NULL; /* File name part of 'watch_path'. */
+static int watch_fd = -1;
+static pthread_t watch_thread;
+
+void ch_cfg_timebase_set(uint32_t const count_len_ps)
+{
+    count_ps = count_len_ps;
+}
+
+/**
+ * @brief Get the length of a PWM count, that of the default frequency if none was set.
+ */
+static uint32_t ch_cfg_count_ps(void)
+{
+    if (count_ps == 0)
+    {
+        count_ps = pca9685_count_ps(PCA9685_OSC_FREQ, pca9685_prescale_calc(PCA9685_OSC_FREQ, PCA9685_PWM_FREQ_DEFAULT));
+    }
+    return count_ps;
+}
+
+uint16_t ch_cfg_us_to_count(uint32_t const pulse_us)
+{
+    uint32_t const len_ps = ch_cfg_count_ps();
+    uint64_t const count = (((uint64_t)pulse_us * 1000000U) + (len_ps / 2)) / len_ps;
+    return count > CH_CFG_COUNT_MAX ? CH_CFG_COUNT_MAX : count;
+}
+
+uint16_t ch_cfg_count_to_us(uint16_t const count)
+{
+    return (((uint64_t)count * ch_cfg_count_ps()) + 500000U) / 1000000U;
+}
+
+void ch_cfg_ch_update(ch_cfg_ch_t *const ch)
+{
+    if (ch->min_us > 0)
+    {
+        ch->min = ch_cfg_us_to_count(ch->min_us);
+    }
+    if (ch->max_us > 0)
+    {
+        ch->max = ch_cfg_us_to_count(ch->max_us);
+    }
+    if (ch->neutral_set && ch->neutral_us > 0)
+    {
+        ch->neutral = ch_cfg_us_to_count(ch->neutral_us);
+    }
+    if (ch->invert)
+    {
+        ch->base = ch->max;
+        ch->span = (int32_t)ch->min - (int32_t)ch->max;
+    }
+    else
+    {
+        ch->base = ch->min;
+        ch->span = (int32_t)ch->max - (int32_t)ch->min;
+    }
+    if (!ch->neutral_set)
+    {
+        /* Same rounding as mapping a pulse fraction of 0.5. */
+        ch->neutral = ch->base + (ch->span >= 0 ? (ch->span + 1) / 2 : -((-ch->span + 1) / 2));
+    }
+}
+
+void ch_cfg_default(ch_cfg_t *const cfg)
+{
+    memset(cfg, 0, sizeof(ch_cfg_t));
+    for (uint8_t ch_i = 0; ch_i < CH_CFG_CH_NUM; ch_i++)
+    {
+        if (ch_i < PCA9685_REG_CH_NUM)
+        {
+            cfg->ch[ch_i].min_us = CH_PULSE_LENGTH[ch_i][0];
+            cfg->ch[ch_i].max_us = CH_PULSE_LENGTH[ch_i][1];
+            cfg->ch[ch_i].invert = CH_PULSE_LENGTH[ch_i][2];
+        }
+        else
+        {
+            cfg->ch[ch_i].min_us = PULSE_LEN_MIN_DEFUALT;
+            cfg->ch[ch_i].max_us = PULSE_LEN_MAX_DEFUALT;
+            cfg->ch[ch_i].invert = PULSE_LEN_INVERT_DEFUALT;
+        }
+        cfg->ch[ch_i].prio = ch_i < PRIO_HIGH_CH_NUM ? ACTR_PRIO_HIGH : ACTR_PRIO_LOW;
+        ch_cfg_ch_update(&(cfg->ch[ch_i]));
+    }
+}
+
+/**
+ * @brief Apply one "key=value" pair to a channel.
+ * @return 0 on success and -1 on failure.
+ */
+static int ch_cfg_key_set(ch_cfg_ch_t *const ch, char const *const key, long const val)
+{
+    if (strcmp(key, "min") == 0 || strcmp(key, "max") == 0)
+    {
+        /* 4096 would end up as OFF = 0, i.e. no pulse at all, in the channel registers. */
+        if (val < 0 || val > CH_CFG_COUNT_MAX)
+        {
+            return -1;
+        }
+        uint8_t const is_min = strcmp(key, "min") == 0;
+        *(is_min ? &(ch->min) : &(ch->max)) = val;
+        *(is_min ? &(ch->min_us) : &(ch->max_us)) = 0;
+    }
+    else if (strcmp(key, "min_us") == 0 || strcmp(key, "max_us") == 0 || strcmp(key, "neutral_us") == 0)
+    {
+        /* Has to fit in the period, which also keeps it clear of the full ON bit. */
+        if (val <= 0 || val > UINT16_MAX || ch_cfg_us_to_count(val) >= CH_CFG_COUNT_MAX)
+        {
+            return -1;
+        }
+        if (strcmp(key, "neutral_us") == 0)
+        {
+            ch->neutral_us = val;
+            ch->neutral_set = 1;
+        }
+        else
+        {
+            *(strcmp(key, "min_us") == 0 ? &(ch->min_us) : &(ch->max_us)) = val;
+        }
+    }
+    else if (strcmp(key, "invert") == 0)
+    {
+        ch->invert = val != 0;
+    }
+    else if (strcmp(key, "neutral") == 0)
+    {
+        if (val < 0 || val > CH_CFG_COUNT_MAX)
+        {
+            return -1;
+        }
+        ch->neutral = val;
+        ch->neutral_us = 0;
+        ch->neutral_set = 1;
+    }
+    else if (strcmp(key, "prio") == 0)
+    {
+        if (val != ACTR_PRIO_LOW && val != ACTR_PRIO_HIGH)
+        {
+            return -1;
+        }
+        ch->prio = val;
+    }
+    else if (strcmp(key, "rate_hz") == 0)
+    {
+        if (val < 0 || val > UINT16_MAX)
+        {
+            return -1;
+        }
+        ch->rate_hz = val;
+    }
+    else
+    {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Report a channel whose limits are so close at the active PWM frequency that it moves in
+ * coarse steps.
+ */
+static void ch_cfg_span_check(char const *const path, uint32_t const line_num, uint8_t const ch_num, ch_cfg_ch_t const *const ch)
+{
+    uint32_t const span = ch->span >= 0 ? ch->span : -ch->span;
+    if (span < CH_CFG_SPAN_MIN)
+    {
+        log_error("%s:%u: Channel %u only has %u counts between its limits, %.2f us each", path, line_num, ch_num, span,
+                  ch_cfg_count_ps() / 1000000.0);
+    }
+}
+
+int ch_cfg_load(char const *const path, ch_cfg_t *const cfg)
+{
+    FILE *const file = fopen(path, "r");
+    if (file == NULL)
+    {
+        log_error("Failed to open channel configuration %s: %s", path, strerror(errno));
+        return -1;
+    }
+    ch_cfg_default(cfg);
+
+    char line[CH_CFG_LINE_MAX];
+    uint32_t line_num = 0;
+    int status = 0;
+    while (status == 0 && fgets(line, sizeof(line), file) != NULL)
+    {
+        line_num++;
+        char *save = NULL;
+        char *tok = strtok_r(line, " \t\r\n", &save);
+        if (tok == NULL || tok[0] == '#')
+        {
+            continue;
+        }
+        char *end = NULL;
+        long ch_num = -1;
+        if (strcmp(tok, "ch") == 0 && (tok = strtok_r(NULL, " \t\r\n", &save)) != NULL)
+        {
+            ch_num = strtol(tok, &end, 10);
+        }
+        if (ch_num < 0 || ch_num >= CH_CFG_CH_NUM || end == NULL || *end != '\0')
+        {
+            log_error("%s:%u: Expected \"ch N\" with N below %u", path, line_num, CH_CFG_CH_NUM);
+            status = -1;
+            break;
+        }
+        ch_cfg_ch_t *const ch = &(cfg->ch[ch_num]);
+        while ((tok = strtok_r(NULL, " \t\r\n", &save)) != NULL)
+        {
+            char *const eq = strchr(tok, '=');
+            long val = 0;
+            if (eq != NULL)
+            {
+                *eq = '\0';
+                val = strtol(eq + 1, &end, 10);
+            }
+            if (eq == NULL || *end != '\0' || ch_cfg_key_set(ch, tok, val) != 0)
+            {
+                log_error("%s:%u: Invalid setting \"%s\"", path, line_num, tok);
+                status = -1;
+                break;
+            }
+        }
+        ch_cfg_ch_update(ch);
+        if (status == 0)
+        {
+            ch_cfg_span_check(path, line_num, ch_num, ch);
+        }
+    }
+    fclose(file);
+    return status;
+}
+
+int ch_cfg_save(char const *const path, ch_cfg_t const *const cfg)
+{
+    char tmp_path[PATH_MAX];
+    if (snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path) >= (int)sizeof(tmp_path))
+    {
+        log_error("Channel configuration path is too long");
+        return -1;
+    }
+    FILE *const file = fopen(tmp_path, "w");
+    if (file == NULL)
+    {
+        log_error("Failed to open %s: %s", tmp_path, strerror(errno));
+        return -1;
+    }
+    fprintf(file, "# Channel configuration of tco_actuationd. Reloaded while running.\n");
+    fprintf(file, "# ch N min=COUNT|min_us=US max=COUNT|max_us=US invert=0|1 [neutral=COUNT|neutral_us=US] prio=0|1 rate_hz=HZ\n");
+    for (uint8_t ch_i = 0; ch_i < CH_CFG_CH_NUM; ch_i++)
+    {
+        ch_cfg_ch_t const *const ch = &(cfg->ch[ch_i]);
+        fprintf(file, "ch %u", ch_i);
+        fprintf(file, ch->min_us > 0 ? " min_us=%u" : " min=%u", ch->min_us > 0 ? ch->min_us : ch->min);
+        fprintf(file, ch->max_us > 0 ? " max_us=%u" : " max=%u", ch->max_us > 0 ? ch->max_us : ch->max);
+        fprintf(file, " invert=%u", ch->invert);
+        if (ch->neutral_set)
+        {
+            fprintf(file, ch->neutral_us > 0 ? " neutral_us=%u" : " neutral=%u", ch->neutral_us > 0 ? ch->neutral_us : ch->neutral);
+        }
+        fprintf(file, " prio=%u rate_hz=%u\n", ch->prio, ch->rate_hz);
+    }
+    if (fclose(file) != 0 || rename(tmp_path, path) != 0)
+    {
+        log_error("Failed to write %s: %s", path, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+static void ch_cfg_default_init(void)
+{
+    ch_cfg_default(&table_default);
+}
+
+ch_cfg_t const *ch_cfg_get(void)
+{
+    ch_cfg_t const *const cur = __atomic_load_n(&table, __ATOMIC_ACQUIRE);
+    if (cur != NULL)
+    {
+        return cur;
+    }
+    pthread_once(&table_default_once, ch_cfg_default_init);
+    return &table_default;
+}
+
+void ch_cfg_quiesce(void)
+{
+    __atomic_add_fetch(&quiesce_count, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Publish a new table. The one it replaces is retired and freed by a later publish once the
+ * control loop quiesced, so neither this thread nor the loop ever waits on the other.
+ * @param next Table to publish. Ownership moves to this module.
+ */
+static void ch_cfg_publish(ch_cfg_block_t *const next)
+{
+    ch_cfg_t const *const prev = __atomic_exchange_n(&table, &(next->cfg), __ATOMIC_ACQ_REL);
+    uint64_t const count = __atomic_load_n(&quiesce_count, __ATOMIC_ACQUIRE);
+    /* A loop pass that started before a swap may still read the table it replaced until it quiesces. */
+    for (ch_cfg_block_t **block = &retired; *block != NULL;)
+    {
+        if ((*block)->quiesce_count != count)
+        {
+            ch_cfg_block_t *const done = *block;
+            *block = done->next;
+            free(done);
+        }
+        else
+        {
+            block = &((*block)->next);
+        }
+    }
+    if (prev != NULL)
+    {
+        ch_cfg_block_t *const block = (ch_cfg_block_t *)prev;
+        block->quiesce_count = count;
+        block->next = retired;
+        retired = block;
+    }
+}
+
+/**
+ * @brief Load the file into a new table and publish it.
+ * @return 0 on success and -1 on failure in which case the active table is kept.
+ */
+static int ch_cfg_reload(void)
+{
+    ch_cfg_block_t *const next = malloc(sizeof(ch_cfg_block_t));
+    if (next == NULL)
+    {
+        log_error("Failed to allocate a channel configuration table");
+        return -1;
+    }
+    if (ch_cfg_load(watch_path, &(next->cfg)) != 0)
+    {
+        free(next);
+        return -1;
+    }
+    ch_cfg_publish(next);
+    return 0;
+}
+
+/**
+ * @brief Wait for the configuration file to be written or replaced and reload it.
+ */
+static void *ch_cfg_watch(void *arg)
+{
+    (void)arg;
+    /* Aligned as required for struct inotify_event. */
+    uint8_t buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    while (1)
+    {
+        ssize_t const len = read(watch_fd, buf, sizeof(buf));
+        if (len <= 0)
+        {
+            if (len == -1 && errno == EINTR)
+            {
+                continue;
+            }
+            log_error("Stopped watching channel configuration: %s", strerror(errno));
+            return NULL;
+        }
+        uint8_t changed = 0;
+        for (ssize_t off = 0; off < len;)
+        {
+            struct inotify_event const *const ev = (struct inotify_event const *)&(buf[off]);
+            if (ev->len > 0 && strcmp(ev->name, watch_name) == 0)
+            {
+                changed = 1;
+            }
+            off += sizeof(struct inotify_event) + ev->len;
+        }
+        if (changed && ch_cfg_reload() == 0)
+        {
+            log_info("Reloaded channel configuration from %s", watch_path);
+        }
+    }
+    return NULL;
+}
+
+int ch_cfg_init(char const *const path)
+{
+    if (snprintf(watch_path, sizeof(watch_path), "%s", path) >= (int)sizeof(watch_path))
+    {
+        log_error("Channel configuration path is too long");
+        return -1;
+    }
+    if (access(watch_path, F_OK) == 0)
+    {
+        if (ch_cfg_reload() != 0)
+        {
+            return -1;
+        }
+        log_info("Loaded channel configuration from %s", watch_path);
+    }
+    else
+    {
+        log_info("No channel configuration at %s, using built-in one until it appears", watch_path);
+    }
+
+    /* Watch the directory since editors and "ch_cfg_save" replace the file instead of writing it. */
+    char dir[PATH_MAX];
+    char *const slash = strrchr(watch_path, '/');
+    if (slash == NULL)
+    {
+        snprintf(dir, sizeof(dir), ".");
+        watch_name = watch_path;
+    }
+    else
+    {
+        snprintf(dir, sizeof(dir), "%.*s", (int)(slash - watch_path) > 0 ? (int)(slash - watch_path) : 1, watch_path);
+        watch_name = slash + 1;
+    }
+    if ((watch_fd = inotify_init1(IN_CLOEXEC)) == -1 ||
+        inotify_add_watch(watch_fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO) == -1)
+    {
+        log_error("Failed to watch %s: %s", dir, strerror(errno));
+        return -1;
+    }
+    int const err = pthread_create(&watch_thread, NULL, ch_cfg_watch, NULL);
+    if (err != 0)
+    {
+        log_error("pthread_create: %s", strerror(err));
+        return -1;
+    }
+    pthread_detach(watch_thread);
+    return 0;
+}
@@ -0,0 +1,167 @@
+#ifndef _CH_CFG_H_
+#define _CH_CFG_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#include "actuator.h"
+
+#define CH_CFG_PATH_DEFAULT "./channels.conf"
+#define CH_CFG_CH_NUM ACTR_CH_MAX
+#define CH_CFG_FRAC_SHIFT 16U
+#define CH_CFG_FRAC_ONE (1 << CH_CFG_FRAC_SHIFT) /* Pulse fraction of 1 in fixed-point. */
+#define CH_CFG_COUNT_MAX 4095U /* Longest pulse in counts that is not the full ON bit. */
+#define CH_CFG_SPAN_MIN 100U   /* Counts between the limits below which a channel gets reported as coarse. */
+
+/*
+Configuration of one channel and the integer mapping precomputed from it. Limits given in
+microseconds are converted to counts for the active PWM frequency, see "ch_cfg_timebase_set".
+*/
+typedef struct ch_cfg_ch_t
+{
+    uint16_t min;        /* Duty cycle count at pulse fraction 0 (or 1 if inverted). */
+    uint16_t max;        /* Duty cycle count at pulse fraction 1 (or 0 if inverted). */
+    uint8_t invert;      /* If >0, pulse fraction 0 maps to max and 1 maps to min. */
+    uint16_t neutral;    /* Duty cycle count of the safe position e.g. steering straight, motor off. */
+    uint8_t neutral_set; /* If 0, 'neutral' follows the limits and is the same as pulse fraction 0.5. */
+    uint16_t min_us;     /* If >0, 'min' is derived from this pulse length. */
+    uint16_t max_us;     /* If >0, 'max' is derived from this pulse length. */
+    uint16_t neutral_us; /* If >0 and 'neutral_set', 'neutral' is derived from this pulse length. */
+    uint8_t prio;        /* ACTR_PRIO_HIGH channels are written first, ACTR_PRIO_LOW ones in the bus time left. */
+    uint16_t rate_hz;    /* Most writes a second, 0 for no limit. */
+    int32_t base;        /* Duty cycle at fraction 0. */
+    int32_t span;        /* Duty cycle change from fraction 0 to 1, negative if inverted. */
+} ch_cfg_ch_t;
+
+/* Configuration of all channels. Published tables are never modified. */
+typedef struct ch_cfg_t
+{
+    ch_cfg_ch_t ch[CH_CFG_CH_NUM];
+} ch_cfg_t;
+
+/**
+ * @brief Convert a pulse fraction to fixed-point using only integer operations on its bits.
+ * @param pulse_frac Pulse fraction in the range [0,1].
+ * @return Fraction scaled by CH_CFG_FRAC_ONE or -1 if out of range or not a number.
+ */
+static inline int32_t ch_cfg_frac_fixed(float const pulse_frac)
+{
+    uint32_t bits;
+    memcpy(&bits, &pulse_frac, sizeof(bits));
+    if (bits & 0x80000000U)
+    {
+        return bits == 0x80000000U ? 0 : -1; /* Only -0 is allowed. */
+    }
+    uint32_t const exp = (bits >> 23) & 0xffU;
+    if (exp >= 127U)
+    {
+        return bits == 0x3f800000U ? CH_CFG_FRAC_ONE : -1; /* Exactly 1.0 or too large, inf, NaN. */
+    }
+    /* value = mant * 2^(exp - 150) so value * 2^16 = mant >> (134 - exp). */
+    uint32_t const shift = 134U - exp;
+    if (exp == 0 || shift >= 32U)
+    {
+        return 0;
+    }
+    uint32_t const mant = (bits & 0x7fffffU) | 0x800000U;
+    return (int32_t)((mant + (1U << (shift - 1))) >> shift);
+}
+
+/**
+ * @brief Map a pulse fraction to a duty cycle count with the precomputed mapping of a channel.
+ * @param cfg Configuration table.
+ * @param channel Channel the pulse fraction is meant for.
+ * @param pulse_frac Pulse fraction in the range [0,1].
+ * @param duty_cycle Where the duty cycle gets written.
+ * @return 0 on success and -1 if the channel or fraction is out of range.
+ */
+static inline int ch_cfg_frac_to_raw(ch_cfg_t const *const cfg, uint8_t const channel, float const pulse_frac, uint16_t *const duty_cycle)
+{
+    int32_t const frac = ch_cfg_frac_fixed(pulse_frac);
+    if (channel >= CH_CFG_CH_NUM || frac < 0)
+    {
+        return -1;
+    }
+    ch_cfg_ch_t const *const ch = &(cfg->ch[channel]);
+    int32_t const off = ch->span * frac;
+    int32_t const half = 1 << (CH_CFG_FRAC_SHIFT - 1);
+    *duty_cycle = ch->base + (off >= 0 ? (off + half) >> CH_CFG_FRAC_SHIFT : -((-off + half) >> CH_CFG_FRAC_SHIFT));
+    return 0;
+}
+
+/**
+ * @brief Set the length of a PWM count that pulse lengths in microseconds get converted with. Must
+ * be called before any table is loaded, by default it is that of PCA9685_PWM_FREQ_DEFAULT.
+ * @param count_len_ps Length of a count in picoseconds, see "pca9685_count_ps".
+ */
+void ch_cfg_timebase_set(uint32_t const count_len_ps);
+
+/**
+ * @brief Convert a pulse length to the nearest count of the active PWM frequency.
+ * @param pulse_us Pulse length in microseconds.
+ * @return Count, at most CH_CFG_COUNT_MAX.
+ */
+uint16_t ch_cfg_us_to_count(uint32_t const pulse_us);
+
+/**
+ * @brief Convert a count of the active PWM frequency to the nearest pulse length.
+ * @param count Count.
+ * @return Pulse length in microseconds.
+ */
+uint16_t ch_cfg_count_to_us(uint16_t const count);
+
+/**
+ * @brief Fill a table with the built-in channel configuration.
+ * @param cfg Table to fill.
+ */
+void ch_cfg_default(ch_cfg_t *const cfg);
+
+/**
+ * @brief Parse a channel configuration file on top of the built-in configuration. Each line is
+ * "ch N key=value..." with keys min, max, invert and neutral in counts, or min_us, max_us and
+ * neutral_us in microseconds, and the scheduling keys prio (0 low, 1 high) and rate_hz. Empty lines and lines starting with '#' are skipped. Channels whose
+ * limits leave fewer than CH_CFG_SPAN_MIN counts at the active PWM frequency get reported.
+ * @param path Path of the file.
+ * @param cfg Table to fill.
+ * @return 0 on success and -1 on failure.
+ */
+int ch_cfg_load(char const *const path, ch_cfg_t *const cfg);
+
+/**
+ * @brief Write a table to a channel configuration file. The file is replaced atomically.
+ * @param path Path of the file.
+ * @param cfg Table to write.
+ * @return 0 on success and -1 on failure.
+ */
+int ch_cfg_save(char const *const path, ch_cfg_t const *const cfg);
+
+/**
+ * @brief Recompute the integer mapping (and the neutral if not set explicitly) of a channel after
+ * its limits changed.
+ * @param ch Channel configuration.
+ */
+void ch_cfg_ch_update(ch_cfg_ch_t *const ch);
+
+/**
+ * @brief Load the configuration file (or use the built-in one if it does not exist) and start a
+ * thread that reloads it whenever it changes. A new table is swapped in atomically so the control
+ * loop never stops. Signals must already be blocked.
+ * @param path Path of the file.
+ * @return 0 on success and -1 on failure.
+ */
+int ch_cfg_init(char const *const path);
+
+/**
+ * @brief Get the active table. Valid until the caller's next "ch_cfg_quiesce".
+ * @return Pointer to the table.
+ */
+ch_cfg_t const *ch_cfg_get(void);
+
+/**
+ * @brief Tell the reload thread the control loop no longer references any table it got before. Must
+ * be called after each use of "ch_cfg_get", by one thread at a time. The actuator API serializes the
+ * threads setting frames, so it can be called from any of them.
+ */
+void ch_cfg_quiesce(void);
+
+#endif /* _CH_CFG_H_ */
@@ -0,0 +1,614 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <semaphore.h>
+#include <pthread.h>
+#include <time.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "tco_libd.h"
+
+#include "ctrl.h"
+#include "alog.h"
+
+static struct tco_shmem_data_control *control_data = NULL;
+static sem_t *control_data_sem = NULL;
+static struct ctrl_shmem_bell *bell = NULL;
+static uint32_t *wake_word = NULL; /* Futex word producers wake us on, each source has its own in seqlock mode. */
+static int wake_fd = -1;
+static pthread_t bell_thread;
+
+static ctrl_mode_t ctrl_mode = CTRL_MODE_SEM;
+static uint32_t stale_timeout_ms = 0;
+
+/* A sequence counted segment read in seqlock mode. */
+typedef struct
+{
+    ctrl_source_cfg_t cfg;
+    struct ctrl_shmem_seq *seg;
+    struct tco_shmem_data_control last_frame; /* Last untorn copy. */
+    uint32_t seq_last;
+    struct timespec seq_last_time;
+    uint8_t stale;
+} ctrl_source_t;
+
+static ctrl_source_t sources[CTRL_SOURCE_MAX]; /* Highest priority first once initialized. */
+static uint8_t source_num = 0;
+static struct tco_shmem_data_control sem_last_frame = {0}; /* Last frame read in semaphore mode. */
+static struct timespec sem_last_time = {0};               /* When the semaphore was last taken. */
+static uint8_t sem_stale = 0;
+static ctrl_stats_t stats = {0};
+static ctrl_emergency_cb_t emergency_cb = NULL;
+
+static struct ctrl_shmem_traj *control_traj = NULL;
+static int deadline_fd = -1;
+static uint64_t traj_tail = 0;                          /* Points read out of the ring. */
+static struct ctrl_traj_point traj_queue[CTRL_TRAJ_LEN]; /* Points not due yet, in time order. */
+static uint32_t traj_first = 0;                          /* Queued points are 'traj_queue[traj_first..traj_num)'. */
+static uint32_t traj_num = 0;
+static struct ctrl_traj_point traj_cur = {0}; /* Point that came due last. */
+static uint8_t traj_cur_valid = 0;
+static uint8_t traj_stale = 0;
+static uint64_t traj_armed_ns = 0; /* Deadline the timer is armed for, 0 if disarmed. */
+
+/**
+ * @brief Open (creating if needed) and map a shared memory segment for reading and writing.
+ * @param name Name of the segment.
+ * @param size Size of the segment.
+ * @return Pointer to the mapping or NULL on failure.
+ */
+static void *ctrl_shmem_open(char const *const name, size_t const size)
+{
+    int const fd = shm_open(name, O_RDWR | O_CREAT, 0666);
+    if (fd == -1)
+    {
+        log_error("shm_open %s: %s", name, strerror(errno));
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1 || ((size_t)st.st_size < size && ftruncate(fd, size) == -1))
+    {
+        log_error("Failed to size shared memory %s: %s", name, strerror(errno));
+        close(fd);
+        return NULL;
+    }
+    void *const shmem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (shmem == MAP_FAILED)
+    {
+        log_error("mmap %s: %s", name, strerror(errno));
+        return NULL;
+    }
+    return shmem;
+}
+
+/**
+ * @brief Look at the emergency flag of the frame in shared memory without taking the semaphore or
+ * checking the sequence. A single byte can not tear and the event loop reads the frame properly.
+ */
+static uint8_t ctrl_emergency_peek(void)
+{
+    if (ctrl_mode == CTRL_MODE_TRAJ)
+    {
+        return __atomic_load_n(&(control_traj->emergency), __ATOMIC_RELAXED) != 0;
+    }
+    if (ctrl_mode == CTRL_MODE_SEQLOCK)
+    {
+        uint8_t emergency = 0;
+        for (uint8_t src_i = 0; src_i < source_num; src_i++)
+        {
+            emergency |= __atomic_load_n(&(sources[src_i].seg->data.emergency), __ATOMIC_RELAXED) != 0;
+        }
+        return emergency;
+    }
+    return __atomic_load_n(&(control_data->emergency), __ATOMIC_RELAXED) != 0;
+}
+
+/**
+ * @brief Sleep on the doorbell futex and forward every ring to the eventfd. Emergency frames also
+ * trigger the emergency callback right away.
+ * @param arg The futex word to sleep on.
+ */
+static void *ctrl_bell_watch(void *arg)
+{
+    uint32_t *const wake_word = arg;
+    uint32_t wake_last = __atomic_load_n(wake_word, __ATOMIC_ACQUIRE);
+    while (1)
+    {
+        /* Not FUTEX_PRIVATE since the word is shared with other processes. */
+        syscall(SYS_futex, wake_word, FUTEX_WAIT, wake_last, NULL, NULL, 0);
+        uint32_t const wake = __atomic_load_n(wake_word, __ATOMIC_ACQUIRE);
+        if (wake != wake_last)
+        {
+            wake_last = wake;
+            if (emergency_cb != NULL && ctrl_emergency_peek())
+            {
+                emergency_cb();
+            }
+            eventfd_write(wake_fd, 1);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Start a thread forwarding rings of the doorbell at @p word to the eventfd.
+ * @return 0 on success and -1 on failure.
+ */
+static int ctrl_bell_start(uint32_t *const word)
+{
+    int const err = pthread_create(&bell_thread, NULL, ctrl_bell_watch, word);
+    if (err != 0)
+    {
+        log_error("pthread_create: %s", strerror(err));
+        return -1;
+    }
+    pthread_detach(bell_thread);
+    return 0;
+}
+
+void ctrl_emergency_cb_set(ctrl_emergency_cb_t const cb)
+{
+    emergency_cb = cb;
+}
+
+int ctrl_source_add(ctrl_source_cfg_t const *const src)
+{
+    if (source_num >= CTRL_SOURCE_MAX)
+    {
+        log_error("At most %u control sources are supported", CTRL_SOURCE_MAX);
+        return -1;
+    }
+    memset(&(sources[source_num]), 0, sizeof(ctrl_source_t));
+    sources[source_num].cfg = *src;
+    sources[source_num].cfg.name[CTRL_SOURCE_NAME_LEN - 1] = '\0';
+    source_num++;
+    return 0;
+}
+
+int ctrl_init(ctrl_mode_t const mode, uint32_t const stale_ms)
+{
+    ctrl_mode = mode;
+    stale_timeout_ms = stale_ms;
+    if (ctrl_mode == CTRL_MODE_SEQLOCK)
+    {
+        if (source_num == 0)
+        {
+            ctrl_source_cfg_t const src = {.name = CTRL_SHMEM_NAME_SEQ, .prio = 0, .stale_ms = CTRL_SOURCE_STALE_DEFAULT};
+            ctrl_source_add(&src);
+        }
+        /* Stable insertion sort so ties keep the order the sources were added in. */
+        for (uint8_t src_i = 1; src_i < source_num; src_i++)
+        {
+            ctrl_source_t const src = sources[src_i];
+            uint8_t pos = src_i;
+            while (pos > 0 && sources[pos - 1].cfg.prio < src.cfg.prio)
+            {
+                sources[pos] = sources[pos - 1];
+                pos--;
+            }
+            sources[pos] = src;
+        }
+        for (uint8_t src_i = 0; src_i < source_num; src_i++)
+        {
+            ctrl_source_t *const src = &(sources[src_i]);
+            if ((src->seg = ctrl_shmem_open(src->cfg.name, CTRL_SHMEM_SIZE_SEQ)) == NULL)
+            {
+                log_error("Failed to map the sequence counted control segment %s", src->cfg.name);
+                return -1;
+            }
+            src->cfg.stale_ms = src->cfg.stale_ms == CTRL_SOURCE_STALE_DEFAULT ? stale_ms : src->cfg.stale_ms;
+            src->seq_last = __atomic_load_n(&(src->seg->seq), __ATOMIC_ACQUIRE);
+            clock_gettime(CLOCK_MONOTONIC, &(src->seq_last_time));
+            if (source_num > 1)
+            {
+                log_info("Reading control source %s with priority %u, stale after %u ms", src->cfg.name, src->cfg.prio, src->cfg.stale_ms);
+            }
+        }
+    }
+    else if (ctrl_mode == CTRL_MODE_TRAJ)
+    {
+        if ((control_traj = ctrl_shmem_open(CTRL_SHMEM_NAME_TRAJ, CTRL_SHMEM_SIZE_TRAJ)) == NULL)
+        {
+            log_error("Failed to map the trajectory segment");
+            return -1;
+        }
+        if ((deadline_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK)) == -1)
+        {
+            log_error("timerfd_create: %s", strerror(errno));
+            return -1;
+        }
+        wake_word = &(control_traj->seq);
+        /* Points left from an earlier run are history. */
+        traj_tail = __atomic_load_n(&(control_traj->head), __ATOMIC_ACQUIRE);
+    }
+    else
+    {
+        if (shmem_map(TCO_SHMEM_NAME_CONTROL, TCO_SHMEM_SIZE_CONTROL, TCO_SHMEM_NAME_SEM_CONTROL, O_RDONLY, (void **)&control_data, &control_data_sem) != 0)
+        {
+            log_error("Failed to map shared memory and associated semaphore");
+            return -1;
+        }
+        if ((bell = ctrl_shmem_open(CTRL_SHMEM_NAME_BELL, CTRL_SHMEM_SIZE_BELL)) == NULL)
+        {
+            log_error("Failed to map the control doorbell");
+            return -1;
+        }
+        wake_word = &(bell->seq);
+        clock_gettime(CLOCK_MONOTONIC, &sem_last_time);
+    }
+    if ((wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1)
+    {
+        log_error("eventfd: %s", strerror(errno));
+        return -1;
+    }
+    if (ctrl_mode != CTRL_MODE_SEQLOCK)
+    {
+        return ctrl_bell_start(wake_word);
+    }
+    for (uint8_t src_i = 0; src_i < source_num; src_i++)
+    {
+        if (ctrl_bell_start(&(sources[src_i].seg->seq)) != 0)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int ctrl_wake_fd(void)
+{
+    return wake_fd;
+}
+
+void ctrl_wake_clear(void)
+{
+    eventfd_t val;
+    eventfd_read(wake_fd, &val);
+}
+
+/**
+ * @brief Copy the control frame out of a sequence counted segment without ever blocking.
+ * @param src Source to read.
+ * @param dst Where the frame gets copied to.
+ * @param stale Set to 1 if the sequence stopped advancing and to 0 otherwise.
+ */
+static void ctrl_read_seqlock(ctrl_source_t *const src, struct tco_shmem_data_control *const dst, uint8_t *const stale)
+{
+    uint32_t seq_begin = 0;
+    uint8_t copied = 0;
+    for (uint8_t retry_i = 0; retry_i < CTRL_SEQ_RETRY_MAX; retry_i++)
+    {
+        seq_begin = __atomic_load_n(&(src->seg->seq), __ATOMIC_ACQUIRE);
+        if (seq_begin & 1U)
+        {
+            stats.torn++; /* Producer is mid-write. */
+            continue;
+        }
+        memcpy(dst, &(src->seg->data), TCO_SHMEM_SIZE_CONTROL);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&(src->seg->seq), __ATOMIC_RELAXED) == seq_begin)
+        {
+            copied = 1;
+            break;
+        }
+        stats.torn++;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (copied)
+    {
+        memcpy(&(src->last_frame), dst, TCO_SHMEM_SIZE_CONTROL);
+        stats.reads++;
+    }
+    else
+    {
+        /* Producer kept writing for the whole retry budget, reuse what was read last time. */
+        memcpy(dst, &(src->last_frame), TCO_SHMEM_SIZE_CONTROL);
+        stats.busy++;
+    }
+
+    if (copied && seq_begin != src->seq_last)
+    {
+        src->seq_last = seq_begin;
+        src->seq_last_time = now;
+        if (src->stale)
+        {
+            alog_info("Control source %s is advancing again at sequence %u", src->cfg.name, seq_begin);
+        }
+        src->stale = 0;
+    }
+    else if (src->cfg.stale_ms > 0 && !src->stale)
+    {
+        int64_t const age_ms = ((now.tv_sec - src->seq_last_time.tv_sec) * 1000) + ((now.tv_nsec - src->seq_last_time.tv_nsec) / 1000000);
+        if (age_ms >= src->cfg.stale_ms)
+        {
+            src->stale = 1;
+            stats.stale++;
+            alog_error("Control source %s stuck at sequence %u for %lld ms", src->cfg.name, src->seq_last, (long long)age_ms);
+        }
+    }
+    *stale = src->stale;
+}
+
+/**
+ * @brief Read every source and take each channel from the highest priority one that is not stale
+ * and has the channel active. Emergency is taken from all of them.
+ * @param dst Where the merged frame gets written, the frame of the top source if all are stale.
+ * @param stale Set to 1 if every source is stale and to 0 otherwise.
+ */
+static void ctrl_read_sources(struct tco_shmem_data_control *const dst, uint8_t *const stale)
+{
+    uint8_t const ch_num = sizeof(dst->ch) / sizeof(dst->ch[0]);
+    struct tco_shmem_data_control frame;
+    uint8_t fresh = 0;
+    uint8_t emergency = 0;
+    for (uint8_t src_i = 0; src_i < source_num; src_i++)
+    {
+        uint8_t src_stale;
+        ctrl_read_seqlock(&(sources[src_i]), &frame, &src_stale);
+        emergency |= frame.emergency != 0;
+        if (!fresh && (!src_stale || src_i == 0))
+        {
+            memcpy(dst, &frame, TCO_SHMEM_SIZE_CONTROL);
+            stats.seq = sources[src_i].seq_last;
+            fresh = !src_stale;
+            continue;
+        }
+        if (src_stale)
+        {
+            continue;
+        }
+        for (uint8_t ch_i = 0; ch_i < ch_num; ch_i++)
+        {
+            if (dst->ch[ch_i].active == 0 && frame.ch[ch_i].active > 0)
+            {
+                dst->ch[ch_i] = frame.ch[ch_i];
+            }
+        }
+    }
+    dst->emergency = emergency;
+    *stale = !fresh;
+}
+
+int ctrl_deadline_fd(void)
+{
+    return deadline_fd;
+}
+
+void ctrl_deadline_clear(void)
+{
+    uint64_t expirations;
+    if (read(deadline_fd, &expirations, sizeof(expirations)) == -1 && errno != EAGAIN)
+    {
+        alog_error("Failed to read the deadline timer: %s", strerror(errno));
+    }
+    traj_armed_ns = 0; /* One-shot, so it is disarmed now. */
+}
+
+/**
+ * @brief Queue a point read out of the ring, replacing queued points that are not due before it.
+ */
+static void ctrl_traj_queue(struct ctrl_traj_point const *const pt)
+{
+    while (traj_num > traj_first && traj_queue[traj_num - 1].time_ns >= pt->time_ns)
+    {
+        traj_num--;
+        stats.replaced++;
+    }
+    if (traj_num == CTRL_TRAJ_LEN && traj_first > 0)
+    {
+        memmove(&(traj_queue[0]), &(traj_queue[traj_first]), (traj_num - traj_first) * sizeof(traj_queue[0]));
+        traj_num -= traj_first;
+        traj_first = 0;
+    }
+    if (traj_num == CTRL_TRAJ_LEN)
+    {
+        stats.lost++;
+        return;
+    }
+    traj_queue[traj_num++] = *pt;
+}
+
+/**
+ * @brief Read the points published since the last call out of the ring.
+ */
+static void ctrl_traj_take(void)
+{
+    uint64_t const head = __atomic_load_n(&(control_traj->head), __ATOMIC_ACQUIRE);
+    if (head - traj_tail > CTRL_TRAJ_LEN)
+    {
+        stats.lost += head - traj_tail - CTRL_TRAJ_LEN;
+        traj_tail = head - CTRL_TRAJ_LEN;
+    }
+    for (; traj_tail < head; traj_tail++)
+    {
+        struct ctrl_traj_point pt;
+        memcpy(&pt, &(control_traj->pt[traj_tail % CTRL_TRAJ_LEN]), sizeof(pt));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        /* Once 'head' gets to 'traj_tail' + CTRL_TRAJ_LEN the producer may be writing over the slot. */
+        if (__atomic_load_n(&(control_traj->head), __ATOMIC_RELAXED) - traj_tail >= CTRL_TRAJ_LEN)
+        {
+            stats.lost++;
+            continue;
+        }
+        ctrl_traj_queue(&pt);
+    }
+}
+
+/**
+ * @brief Give the frame of the trajectory at this moment.
+ * @param dst Where the frame gets written to.
+ * @param stale Set to 1 if the trajectory ran out more than the stale timeout ago and to 0 otherwise.
+ */
+static void ctrl_read_traj(struct tco_shmem_data_control *const dst, uint8_t *const stale)
+{
+    stats.seq = __atomic_load_n(&(control_traj->seq), __ATOMIC_ACQUIRE);
+    ctrl_traj_take();
+    struct timespec now_ts;
+    clock_gettime(CLOCK_MONOTONIC, &now_ts);
+    uint64_t const now = ((uint64_t)now_ts.tv_sec * 1000000000U) + now_ts.tv_nsec;
+    while (traj_first < traj_num && traj_queue[traj_first].time_ns <= now)
+    {
+        uint64_t const late = now - traj_queue[traj_first].time_ns;
+        stats.late_sum_ns += late;
+        if (late > stats.late_max_ns)
+        {
+            stats.late_max_ns = late;
+        }
+        stats.points++;
+        traj_cur = traj_queue[traj_first++];
+        traj_cur_valid = 1;
+    }
+    if (traj_first == traj_num)
+    {
+        traj_first = 0;
+        traj_num = 0;
+    }
+
+    if (!traj_cur_valid)
+    {
+        memset(dst, 0, TCO_SHMEM_SIZE_CONTROL); /* Nothing came due yet, every channel is inactive. */
+    }
+    else
+    {
+        memcpy(dst, &(traj_cur.data), TCO_SHMEM_SIZE_CONTROL);
+    }
+    if (traj_cur_valid && traj_num > 0 && traj_queue[traj_first].ramp)
+    {
+        struct ctrl_traj_point const *const next = &(traj_queue[traj_first]);
+        float const pos = (float)(now - traj_cur.time_ns) / (float)(next->time_ns - traj_cur.time_ns);
+        for (uint8_t ch_i = 0; ch_i < sizeof(dst->ch) / sizeof(dst->ch[0]); ch_i++)
+        {
+            if (dst->ch[ch_i].active && next->data.ch[ch_i].active)
+            {
+                dst->ch[ch_i].pulse_frac += (next->data.ch[ch_i].pulse_frac - dst->ch[ch_i].pulse_frac) * pos;
+            }
+        }
+    }
+    dst->emergency = dst->emergency || __atomic_load_n(&(control_traj->emergency), __ATOMIC_RELAXED);
+    stats.reads++;
+
+    uint8_t const ran_out = traj_cur_valid && traj_num == 0 && stale_timeout_ms > 0 &&
+                            now - traj_cur.time_ns >= (uint64_t)stale_timeout_ms * 1000000U;
+    if (ran_out && !traj_stale)
+    {
+        stats.stale++;
+        alog_error("Trajectory ran out %llu ms ago", (unsigned long long)((now - traj_cur.time_ns) / 1000000U));
+    }
+    else if (!ran_out && traj_stale)
+    {
+        alog_info("Trajectory points are coming in again");
+    }
+    traj_stale = ran_out;
+    *stale = traj_stale;
+
+    uint64_t const deadline = traj_num > 0 ? traj_queue[traj_first].time_ns : 0;
+    if (deadline != traj_armed_ns)
+    {
+        struct itimerspec spec = {0};
+        spec.it_value.tv_sec = deadline / 1000000000U;
+        spec.it_value.tv_nsec = deadline % 1000000000U;
+        if (timerfd_settime(deadline_fd, TFD_TIMER_ABSTIME, &spec, NULL) == -1)
+        {
+            alog_error("timerfd_settime: %s", strerror(errno));
+        }
+        traj_armed_ns = deadline;
+    }
+}
+
+/**
+ * @brief Copy the control frame out of the semaphore protected segment. A producer that holds the
+ * semaphore longer than CTRL_SEM_WAIT_US gets the last frame reused, so it can not stall the loop.
+ * @param dst Where the frame gets copied to.
+ * @param stale Set to 1 if the semaphore could not be taken for the stale timeout and to 0 otherwise.
+ * @return 0 on success and -1 on failure.
+ */
+static int ctrl_read_sem(struct tco_shmem_data_control *const dst, uint8_t *const stale)
+{
+    stats.seq = __atomic_load_n(&(bell->seq), __ATOMIC_ACQUIRE);
+    /* sem_timedwait only takes CLOCK_REALTIME, a clock step merely shortens or stretches one wait. */
+    struct timespec until;
+    clock_gettime(CLOCK_REALTIME, &until);
+    until.tv_nsec += CTRL_SEM_WAIT_US * 1000U;
+    if (until.tv_nsec >= 1000000000L)
+    {
+        until.tv_sec++;
+        until.tv_nsec -= 1000000000L;
+    }
+    int status;
+    while ((status = sem_timedwait(control_data_sem, &until)) == -1 && errno == EINTR)
+    {
+    }
+    if (status == -1 && errno != ETIMEDOUT)
+    {
+        alog_error("sem_timedwait: %s", strerror(errno));
+        return -1;
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (status == 0)
+    {
+        /* START: Critical section */
+        memcpy(dst, control_data, TCO_SHMEM_SIZE_CONTROL);
+        /* END: Critical section */
+        if (sem_post(control_data_sem) == -1)
+        {
+            alog_error("sem_post: %s", strerror(errno));
+            return -1;
+        }
+        memcpy(&sem_last_frame, dst, TCO_SHMEM_SIZE_CONTROL);
+        stats.reads++;
+        sem_last_time = now;
+        if (sem_stale)
+        {
+            alog_info("Control semaphore is free again");
+        }
+        sem_stale = 0;
+    }
+    else
+    {
+        memcpy(dst, &sem_last_frame, TCO_SHMEM_SIZE_CONTROL);
+        stats.busy++;
+        int64_t const age_ms = ((now.tv_sec - sem_last_time.tv_sec) * 1000) + ((now.tv_nsec - sem_last_time.tv_nsec) / 1000000);
+        if (stale_timeout_ms > 0 && !sem_stale && age_ms >= stale_timeout_ms)
+        {
+            sem_stale = 1;
+            stats.stale++;
+            alog_error("Control semaphore held by the producer for %lld ms", (long long)age_ms);
+        }
+    }
+    *stale = sem_stale;
+    return 0;
+}
+
+int ctrl_read(struct tco_shmem_data_control *const dst, uint8_t *const stale)
+{
+    if (ctrl_mode == CTRL_MODE_SEQLOCK)
+    {
+        ctrl_read_sources(dst, stale);
+        return 0;
+    }
+    if (ctrl_mode == CTRL_MODE_TRAJ)
+    {
+        ctrl_read_traj(dst, stale);
+        return 0;
+    }
+    return ctrl_read_sem(dst, stale);
+}
+
+ctrl_stats_t const *ctrl_stats_get(void)
+{
+    return &stats;
+}
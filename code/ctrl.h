@@ -0,0 +1,195 @@
+#ifndef _CTRL_H_
+#define _CTRL_H_
+
+#include <stdint.h>
+
+#include "tco_shmem.h"
+
+/*
+Optional doorbell next to the control segment. After publishing a frame (i.e. after sem_post), a
+producer increments 'seq' and does a FUTEX_WAKE on it for all waiters (INT_MAX). The daemon then
+applies the frame right away instead of on its next tick. Producers that do not ring the bell are
+still picked up every tick.
+*/
+#define CTRL_SHMEM_NAME_BELL "tco_shmem_control_bell"
+
+/* Layout of the doorbell shared memory segment. */
+struct ctrl_shmem_bell
+{
+    uint32_t seq; /* Incremented by producers after each frame. Also used as a futex word. */
+};
+
+#define CTRL_SHMEM_SIZE_BELL sizeof(struct ctrl_shmem_bell)
+#define CTRL_SEM_WAIT_US 500U /* Longest wait for the semaphore of the control segment before reusing the last frame. */
+
+/*
+Lock-free alternative to the semaphore protected control segment. A producer publishes a frame by
+making 'seq' odd, writing 'data' and making 'seq' even again (release ordering), followed by a
+FUTEX_WAKE of all waiters (INT_MAX) on 'seq'. The daemon copies optimistically and retries when
+'seq' changed under it so a slow or stalled producer can never block actuation.
+*/
+#define CTRL_SHMEM_NAME_SEQ "tco_shmem_control_seq"
+#define CTRL_SEQ_RETRY_MAX 16U
+#define CTRL_STALE_MS_DEFAULT 250U
+
+/* Layout of the sequence counted control segment. */
+struct ctrl_shmem_seq
+{
+    uint32_t seq; /* Odd while a write is in progress. Also used as a futex word. */
+    uint32_t reserved;
+    struct tco_shmem_data_control data;
+};
+
+#define CTRL_SHMEM_SIZE_SEQ sizeof(struct ctrl_shmem_seq)
+
+/*
+Seqlock mode can read several such segments, one per producer e.g. a planner, a teleop override and a
+safety supervisor, so none of them ever waits on another. Each source has a priority and a stale
+timeout of its own. Every channel is taken from the highest priority source that is not stale and
+has the channel active, an emergency in the last frame of any source stops everything. Without
+sources configured, 'tco_shmem_control_seq' is the only one.
+*/
+#define CTRL_SOURCE_MAX 8U
+#define CTRL_SOURCE_NAME_LEN 64U
+#define CTRL_SOURCE_STALE_DEFAULT UINT32_MAX /* Take the stale timeout given to "ctrl_init". */
+
+/* A sequence counted segment to read control frames from. */
+typedef struct ctrl_source_cfg_t
+{
+    char name[CTRL_SOURCE_NAME_LEN]; /* Shared memory segment, created if missing. */
+    uint8_t prio;                    /* Sources with a higher one win, ties go to the one added first. */
+    uint32_t stale_ms;               /* Frames are stale once the sequence did not advance this long, 0 for never. */
+} ctrl_source_cfg_t;
+
+/*
+Ring of setpoints with the CLOCK_MONOTONIC time each is to be output at, so a planner can hand over
+a whole trajectory segment at once and its own scheduling jitter does not reach the outputs. A
+producer publishes point n by writing 'pt[n % CTRL_TRAJ_LEN]', setting 'head' to n+1 (release
+ordering), then incrementing 'seq' and doing a FUTEX_WAKE of all waiters (INT_MAX) on it. Points are
+published in time order. One due no later than a point published before it replaces that point and
+all after it, which is how a planner revises the part of a trajectory that has not run yet. The
+daemon applies each point when it comes due and, for points with 'ramp' set, moves the outputs
+linearly from the previous point on every tick in between. Points more than CTRL_TRAJ_LEN - 1 ahead
+of the daemon get overwritten and are lost. 'emergency' in the header acts right away, whatever is
+queued.
+*/
+#define CTRL_SHMEM_NAME_TRAJ "tco_shmem_control_traj"
+#define CTRL_TRAJ_LEN 64U /* Power of two. */
+
+/* One setpoint of a trajectory. */
+struct ctrl_traj_point
+{
+    uint64_t time_ns; /* CLOCK_MONOTONIC time the point is to be output at. */
+    uint8_t ramp;     /* 1 to move linearly from the previous point, 0 to step at 'time_ns'. */
+    uint8_t reserved[7];
+    struct tco_shmem_data_control data;
+};
+
+/* Layout of the trajectory segment. */
+struct ctrl_shmem_traj
+{
+    uint32_t seq;      /* Incremented by producers after publishing points. Also used as a futex word. */
+    uint8_t emergency; /* Applies right away instead of when a point comes due. */
+    uint8_t reserved[3];
+    uint64_t head; /* Points published. */
+    struct ctrl_traj_point pt[CTRL_TRAJ_LEN];
+};
+
+#define CTRL_SHMEM_SIZE_TRAJ sizeof(struct ctrl_shmem_traj)
+
+/* How control frames are read from shared memory. */
+typedef enum ctrl_mode_t
+{
+    CTRL_MODE_SEM = 0, /* Semaphore protected tco_shmem segment. */
+    CTRL_MODE_SEQLOCK, /* Sequence counted segment, never blocks on the producer. */
+    CTRL_MODE_TRAJ     /* Trajectory segment, points are applied at their time. */
+} ctrl_mode_t;
+
+/* Counters kept while reading control frames. */
+typedef struct ctrl_stats_t
+{
+    uint64_t reads; /* Frames copied out of shared memory. */
+    uint64_t torn;  /* Copies discarded because the producer wrote during them. */
+    uint64_t busy;  /* Reads that gave up and reused the previous frame. */
+    uint64_t stale; /* Transitions into the stale state. */
+    uint32_t seq;   /* Sequence of the last frame read from the top source not stale, the doorbell count in semaphore and trajectory mode. */
+
+    /* Trajectory mode only. */
+    uint64_t points;      /* Points that came due. */
+    uint64_t replaced;    /* Points replaced by an earlier one before they came due. */
+    uint64_t lost;        /* Points overwritten in the ring or dropped from a full queue before being read. */
+    uint64_t late_max_ns; /* How long after its time a point was handed to the actuators. */
+    uint64_t late_sum_ns;
+} ctrl_stats_t;
+
+/**
+ * @brief Callback run by the doorbell thread when a producer rings with the emergency flag set,
+ * before the event loop gets to the frame.
+ */
+typedef void (*ctrl_emergency_cb_t)(void);
+
+/**
+ * @brief Set the callback run on emergency frames. Must be called before "ctrl_init".
+ * @param cb Callback, must be safe to call from another thread.
+ */
+void ctrl_emergency_cb_set(ctrl_emergency_cb_t const cb);
+
+/**
+ * @brief Read seqlock mode frames from @p src instead of 'tco_shmem_control_seq'. Call once for
+ * each source before "ctrl_init".
+ * @param src Source to add.
+ * @return 0 on success and -1 if there are too many sources.
+ */
+int ctrl_source_add(ctrl_source_cfg_t const *const src);
+
+/**
+ * @brief Map the control segments (with the semaphore and doorbell in semaphore mode), then start a
+ * thread per segment that turns producer wakeups into events on an eventfd. Signals must already be
+ * blocked.
+ * @param mode How control frames are read.
+ * @param stale_ms In seqlock mode, frames are stale once the sequence did not advance for this many
+ * milliseconds, unless the source gives its own timeout. In trajectory mode, once this long passed since the last queued point came due. In
+ * semaphore mode, once the semaphore could not be taken for this long. 0 disables the check.
+ * @return 0 on success and -1 on failure.
+ */
+int ctrl_init(ctrl_mode_t const mode, uint32_t const stale_ms);
+
+/**
+ * @brief Get the eventfd which becomes readable when a producer rings the doorbell.
+ * @return The file descriptor.
+ */
+int ctrl_wake_fd(void);
+
+/**
+ * @brief Reset the eventfd returned by "ctrl_wake_fd".
+ */
+void ctrl_wake_clear(void);
+
+/**
+ * @brief Get the timer that becomes readable when the next trajectory point comes due.
+ * @return The file descriptor or -1 if not in trajectory mode.
+ */
+int ctrl_deadline_fd(void);
+
+/**
+ * @brief Reset the timer returned by "ctrl_deadline_fd".
+ */
+void ctrl_deadline_clear(void);
+
+/**
+ * @brief Copy the latest control frame out of shared memory. In trajectory mode, take the points
+ * published since the last call, then give the frame of the last point that came due, ramped
+ * towards the next one if that one asks for it, and arm the deadline timer for the next point.
+ * @param dst Where the frame gets copied to.
+ * @param stale Set to 1 if the producer stopped publishing frames and to 0 otherwise.
+ * @return 0 on success and -1 on failure.
+ */
+int ctrl_read(struct tco_shmem_data_control *const dst, uint8_t *const stale);
+
+/**
+ * @brief Get the control input counters.
+ * @return Pointer to the counters.
+ */
+ctrl_stats_t const *ctrl_stats_get(void);
+
+#endif /* _CTRL_H_ */
@@ -0,0 +1,304 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <math.h>
+
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+
+#include "tco_libd.h"
+
+#include "loop.h"
+#include "alog.h"
+
+/* Values of epoll_event.data.u32 for the fds owned by the loop. Registered fds use their index. */
+#define LOOP_ID_TIMER (LOOP_FD_MAX + 0U)
+#define LOOP_ID_SIGNAL (LOOP_FD_MAX + 1U)
+
+typedef struct
+{
+    int fd;
+    loop_cb_t cb;
+    void *arg;
+} loop_fd_t;
+
+static int epoll_fd = -1;
+static int timer_fd = -1;
+static int signal_fd = -1;
+static uint32_t tick_period_ns = 0;  /* Configured tick period. */
+static uint32_t tick_running_ns = 0; /* Period the timer runs with right now, 0 while stopped. */
+static uint64_t tick_deadline = 0;   /* Next tick deadline. */
+static uint8_t quiet = 0;
+static loop_fd_t fds[LOOP_FD_MAX];
+static uint8_t fd_num = 0;
+static uint8_t stop = 0;
+static loop_stats_t stats = {0};
+
+static int loop_epoll_add(int const fd, uint32_t const id)
+{
+    struct epoll_event ev = {.events = EPOLLIN, .data.u32 = id};
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1)
+    {
+        log_error("epoll_ctl: %s", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+static uint64_t loop_now_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((uint64_t)now.tv_sec * 1000000000U) + now.tv_nsec;
+}
+
+/**
+ * @brief Account for how late the loop woke up for a tick deadline.
+ */
+static void loop_wake_lat_add(uint64_t const lat_ns)
+{
+    uint64_t const lat_us = lat_ns / 1000U;
+    stats.wake_lat_last_ns = lat_ns;
+    stats.wake_lat_sum_ns += lat_ns;
+    stats.wake_lat_sq_sum_us += lat_us * lat_us;
+    if (lat_ns > stats.wake_lat_max_ns)
+    {
+        stats.wake_lat_max_ns = lat_ns;
+    }
+    stats.wake_lat_hist[lat_us < LOOP_WAKE_HIST_LEN ? lat_us : LOOP_WAKE_HIST_LEN - 1]++;
+}
+
+/**
+ * @brief Get a wake-up latency percentile from the histogram.
+ * @return Latency in microseconds, the upper edge of the bucket the percentile falls in or the
+ * maximum if it falls in the overflow bucket.
+ */
+static uint32_t loop_wake_lat_pct(double const pct)
+{
+    uint64_t const target = (uint64_t)ceil((pct / 100.0) * stats.ticks);
+    uint64_t count = 0;
+    for (uint32_t bucket_i = 0; bucket_i < LOOP_WAKE_HIST_LEN; bucket_i++)
+    {
+        count += stats.wake_lat_hist[bucket_i];
+        if (count >= target && count > 0 && bucket_i < LOOP_WAKE_HIST_LEN - 1)
+        {
+            return bucket_i + 1;
+        }
+    }
+    return (stats.wake_lat_max_ns / 1000U) + 1;
+}
+
+int loop_init(loop_cfg_t const *const cfg)
+{
+    if (cfg->tick_hz == 0 || cfg->tick_hz > LOOP_TICK_HZ_MAX)
+    {
+        log_error("Tick rate of %u Hz is not supported", cfg->tick_hz);
+        return -1;
+    }
+    tick_period_ns = 1000000000U / cfg->tick_hz;
+    quiet = cfg->quiet;
+
+    /* Signals are consumed through signalfd so they must not be delivered the usual way. */
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) == -1)
+    {
+        log_error("sigprocmask: %s", strerror(errno));
+        return -1;
+    }
+    if ((signal_fd = signalfd(-1, &mask, SFD_CLOEXEC)) == -1)
+    {
+        log_error("signalfd: %s", strerror(errno));
+        return -1;
+    }
+    /* Non-blocking since rearming from a callback can clear an expiration epoll already reported. */
+    if ((timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK)) == -1)
+    {
+        log_error("timerfd_create: %s", strerror(errno));
+        return -1;
+    }
+    if ((epoll_fd = epoll_create1(EPOLL_CLOEXEC)) == -1)
+    {
+        log_error("epoll_create1: %s", strerror(errno));
+        return -1;
+    }
+    if (loop_epoll_add(timer_fd, LOOP_ID_TIMER) != 0 || loop_epoll_add(signal_fd, LOOP_ID_SIGNAL) != 0)
+    {
+        return -1;
+    }
+    return 0;
+}
+
+void loop_deinit(void)
+{
+    if (epoll_fd != -1)
+    {
+        close(epoll_fd);
+        epoll_fd = -1;
+    }
+    if (timer_fd != -1)
+    {
+        close(timer_fd);
+        timer_fd = -1;
+    }
+    if (signal_fd != -1)
+    {
+        close(signal_fd);
+        signal_fd = -1;
+    }
+    fd_num = 0;
+}
+
+int loop_fd_add(int const fd, loop_cb_t const cb, void *const arg)
+{
+    if (fd_num >= LOOP_FD_MAX)
+    {
+        log_error("Can not watch more than %u file descriptors", LOOP_FD_MAX);
+        return -1;
+    }
+    if (loop_epoll_add(fd, fd_num) != 0)
+    {
+        return -1;
+    }
+    fds[fd_num] = (loop_fd_t){.fd = fd, .cb = cb, .arg = arg};
+    fd_num++;
+    return 0;
+}
+
+/**
+ * @brief Start ticking every @p period_ns on absolute deadlines, first one period from now, or stop
+ * ticking if 0.
+ * @return 0 on success and -1 on failure.
+ */
+static int loop_tick_arm(uint32_t const period_ns)
+{
+    struct itimerspec spec = {0};
+    if (period_ns > 0)
+    {
+        tick_deadline = loop_now_ns() + period_ns;
+        spec.it_value.tv_sec = tick_deadline / 1000000000U;
+        spec.it_value.tv_nsec = tick_deadline % 1000000000U;
+        spec.it_interval.tv_sec = period_ns / 1000000000U;
+        spec.it_interval.tv_nsec = period_ns % 1000000000U;
+    }
+    if (timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &spec, NULL) == -1)
+    {
+        log_error("timerfd_settime: %s", strerror(errno));
+        return -1;
+    }
+    tick_running_ns = period_ns;
+    return 0;
+}
+
+int loop_tick_idle(uint32_t const period_ns)
+{
+    return period_ns == tick_running_ns ? 0 : loop_tick_arm(period_ns);
+}
+
+int loop_tick_resume(void)
+{
+    return tick_running_ns == tick_period_ns ? 0 : loop_tick_arm(tick_period_ns);
+}
+
+int loop_run(loop_cb_t const tick, void *const arg)
+{
+    if (loop_tick_arm(tick_period_ns) != 0)
+    {
+        return -1;
+    }
+
+    struct epoll_event events[LOOP_FD_MAX + 2];
+    stop = 0;
+    while (!stop)
+    {
+        int const event_num = epoll_wait(epoll_fd, events, sizeof(events) / sizeof(events[0]), -1);
+        if (event_num == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            log_error("epoll_wait: %s", strerror(errno));
+            return -1;
+        }
+        for (int event_i = 0; event_i < event_num && !stop; event_i++)
+        {
+            uint32_t const id = events[event_i].data.u32;
+            if (id == LOOP_ID_SIGNAL)
+            {
+                struct signalfd_siginfo info;
+                if (read(signal_fd, &info, sizeof(info)) == sizeof(info))
+                {
+                    log_info("Received signal %u, stopping", info.ssi_signo);
+                }
+                return 0;
+            }
+            else if (id == LOOP_ID_TIMER)
+            {
+                uint64_t expirations = 0;
+                if (read(timer_fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+                {
+                    continue;
+                }
+                /* Latency is measured against the most recent deadline that expired. */
+                tick_deadline += (expirations - 1) * tick_running_ns;
+                uint64_t const now = loop_now_ns();
+                loop_wake_lat_add(now > tick_deadline ? now - tick_deadline : 0);
+                tick_deadline += tick_running_ns;
+                if (expirations > 1)
+                {
+                    stats.overruns += expirations - 1;
+                    if (!quiet)
+                    {
+                        alog_error("Tick overran its deadline by %llu periods (%llu total)", (unsigned long long)(expirations - 1), (unsigned long long)stats.overruns);
+                    }
+                }
+                stats.ticks++;
+                if (tick(arg) != 0)
+                {
+                    return -1;
+                }
+            }
+            else if (id < fd_num)
+            {
+                stats.events++;
+                if (fds[id].cb(fds[id].arg) != 0)
+                {
+                    return -1;
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+void loop_stop(void)
+{
+    stop = 1;
+}
+
+loop_stats_t const *loop_stats_get(void)
+{
+    return &stats;
+}
+
+void loop_stats_log(void)
+{
+    log_info("Ran %llu ticks with %llu overruns and %llu fd events",
+             (unsigned long long)stats.ticks, (unsigned long long)stats.overruns, (unsigned long long)stats.events);
+    if (stats.ticks == 0)
+    {
+        return;
+    }
+    double const mean_us = (stats.wake_lat_sum_ns / 1000.0) / stats.ticks;
+    double const var_us = ((double)stats.wake_lat_sq_sum_us / stats.ticks) - (mean_us * mean_us);
+    log_info("Wake-up latency us: mean %.1f, p50 %u, p99 %u, p99.9 %u, max %.1f, jitter (stddev) %.1f",
+             mean_us, loop_wake_lat_pct(50), loop_wake_lat_pct(99), loop_wake_lat_pct(99.9),
+             stats.wake_lat_max_ns / 1000.0, var_us > 0 ? sqrt(var_us) : 0.0);
+}
@@ -0,0 +1,104 @@
+#ifndef _LOOP_H_
+#define _LOOP_H_
+
+#include <stdint.h>
+
+#define LOOP_FD_MAX 8U
+#define LOOP_TICK_HZ_DEFAULT 100U
+#define LOOP_TICK_HZ_MAX 1000000000U /* One tick per nanosecond. */
+#define LOOP_WAKE_HIST_LEN 2048U /* Wake-up latency buckets of 1 microsecond. */
+
+/**
+ * @brief Callback invoked by the event loop.
+ * @param arg Argument given when registering the callback.
+ * @return 0 on success and -1 on failure. A failure stops the loop.
+ */
+typedef int (*loop_cb_t)(void *arg);
+
+/* Configuration of the event loop. */
+typedef struct loop_cfg_t
+{
+    uint32_t tick_hz; /* Rate at which the tick callback is invoked. */
+    uint8_t quiet;    /* If >0, nothing is logged from inside the loop, only counted. */
+} loop_cfg_t;
+
+/* Counters kept by the event loop. */
+typedef struct loop_stats_t
+{
+    uint64_t ticks;    /* Timer expirations handled. */
+    uint64_t overruns; /* Timer expirations that were missed because a tick ran late. */
+    uint64_t events;   /* Readiness events on registered file descriptors. */
+
+    /* Time from a tick deadline until the loop got to run. */
+    uint64_t wake_lat_sum_ns;
+    uint64_t wake_lat_sq_sum_us; /* Sum of squares in microseconds for the standard deviation. */
+    uint64_t wake_lat_max_ns;
+    uint64_t wake_lat_last_ns;
+    uint32_t wake_lat_hist[LOOP_WAKE_HIST_LEN]; /* Last bucket also counts everything larger. */
+} loop_stats_t;
+
+/**
+ * @brief Create the epoll instance, the tick timer and the signalfd for SIGINT and SIGTERM. The
+ * signals get blocked so this must be called before any threads are started.
+ * @param cfg Configuration of the loop.
+ * @return 0 on success and -1 on failure.
+ */
+int loop_init(loop_cfg_t const *const cfg);
+
+/**
+ * @brief Close all file descriptors owned by the loop.
+ */
+void loop_deinit(void);
+
+/**
+ * @brief Call @p cb whenever @p fd becomes readable. The callback is responsible for draining @p fd.
+ * @param fd File descriptor to watch.
+ * @param cb Callback to invoke.
+ * @param arg Argument passed to @p cb.
+ * @return 0 on success and -1 on failure.
+ */
+int loop_fd_add(int const fd, loop_cb_t const cb, void *const arg);
+
+/**
+ * @brief Run the loop until a termination signal arrives or "loop_stop" is called. Ticks are
+ * scheduled on absolute deadlines so time spent in callbacks does not add to the period.
+ * @param tick Callback invoked on every tick.
+ * @param arg Argument passed to @p tick.
+ * @return 0 if stopped by a signal or "loop_stop" and -1 on failure.
+ */
+int loop_run(loop_cb_t const tick, void *const arg);
+
+/**
+ * @brief Tick every @p period_ns instead of at the configured rate, or not at all if 0, until
+ * "loop_tick_resume". Events on registered file descriptors are handled as usual. Only to be called
+ * from loop callbacks.
+ * @param period_ns Tick period while idle, 0 to stop ticking.
+ * @return 0 on success and -1 on failure.
+ */
+int loop_tick_idle(uint32_t const period_ns);
+
+/**
+ * @brief Tick at the configured rate again, the first tick one period from now. Does nothing if the
+ * loop already does. Only to be called from loop callbacks.
+ * @return 0 on success and -1 on failure.
+ */
+int loop_tick_resume(void);
+
+/**
+ * @brief Make "loop_run" return 0 once the callback that is running returns. Only to be called
+ * from loop callbacks.
+ */
+void loop_stop(void);
+
+/**
+ * @brief Get the loop counters.
+ * @return Pointer to the counters.
+ */
+loop_stats_t const *loop_stats_get(void);
+
+/**
+ * @brief Log a summary of the loop counters including wake-up latency percentiles and jitter.
+ */
+void loop_stats_log(void);
+
+#endif /* _LOOP_H_ */
@@ -1,103 +1,666 @@
 #include <stdio.h>
 #include <stdlib.h>
-
-#include <sys/mman.h>
+#include <errno.h>
 
 #include <string.h>
 #include <unistd.h>
-#include <fcntl.h>
-#include <semaphore.h>
-#include <errno.h>
-#include <signal.h>
+#include <getopt.h>
+#include <time.h>
 
 #include "actuator.h"
 #include "pca9685.h"
 #include "calibration.h"
+#include "ctrl.h"
+#include "loop.h"
+#include "pipeline.h"
+#include "bus_sim.h"
+#include "rt.h"
+#include "ch_cfg.h"
+#include "telem.h"
+#include "alog.h"
+#include "trace.h"
+#include "override.h"
 
 #include "tco_shmem.h"
 #include "tco_libd.h"
 
 int log_level = LOG_INFO | LOG_DEBUG | LOG_ERROR;
 
-/* Handle ctrl-c */
-void handle_sigint(int sig)
+static struct option const long_opts[] = {
+    {"help", no_argument, NULL, 'h'},
+    {"calibrate", no_argument, NULL, 'c'},
+    {"rate", required_argument, NULL, 'r'},
+    {"seqlock", no_argument, NULL, 's'},
+    {"traj", no_argument, NULL, 'J'},
+    {"stale-ms", required_argument, NULL, 't'},
+    {"sim", optional_argument, NULL, 'S'},
+    {"channels", required_argument, NULL, 'f'},
+    {"chip", required_argument, NULL, 'K'},
+    {"estop-off", no_argument, NULL, 'E'},
+    {"warm", no_argument, NULL, 'A'},
+    {"rt", no_argument, NULL, 'R'},
+    {"rt-prio", required_argument, NULL, 'P'},
+    {"rt-cpu", required_argument, NULL, 'C'},
+    {"pwm-sync", optional_argument, NULL, 'Y'},
+    {"pwm-hz", required_argument, NULL, 'W'},
+    {"osc-hz", required_argument, NULL, 'O'},
+    {"stats", optional_argument, NULL, 'T'},
+    {"log-async", optional_argument, NULL, 'L'},
+    {"record", required_argument, NULL, 'D'},
+    {"replay", required_argument, NULL, 'U'},
+    {"replay-speed", required_argument, NULL, 'V'},
+    {"check-ms", required_argument, NULL, 'H'},
+    {"pwm", required_argument, NULL, 'N'},
+    {"pwm-root", required_argument, NULL, 'X'},
+    {"idle-ms", required_argument, NULL, 'I'},
+    {"source", required_argument, NULL, 'Q'},
+    {NULL, 0, NULL, 0},
+};
+
+/**
+ * @brief Parse a whole decimal option value and check its range.
+ * @return 0 on success and -1 if @p arg is not a number or out of range.
+ */
+static int num_parse(char const *const arg, long long const min, long long const max, long long *const val)
 {
-    if (actr_deinit() == 0)
+    char *end = NULL;
+    errno = 0;
+    long long const num = strtoll(arg, &end, 10);
+    if (end == arg || *end != '\0' || errno != 0 || num < min || num > max)
     {
-        exit(EXIT_FAILURE);
+        return -1;
     }
-    exit(EXIT_SUCCESS);
+    *val = num;
+    return 0;
 }
 
-int main(int argc, const char *argv[])
+/**
+ * @brief Parse a chip location given as "ADAPTER:ADDR".
+ * @return 0 on success and -1 on failure.
+ */
+static int chip_parse(char const *const arg, actr_chip_cfg_t *const chip)
 {
-    signal(SIGINT, handle_sigint);
-    if (argc == 2 && (strcmp(argv[1], "--help") == 0 || strcmp(argv[1], "-h") == 0))
+    char *end = NULL;
+    unsigned long const adapter = strtoul(arg, &end, 10);
+    if (end == arg || *end != ':' || adapter > UINT8_MAX)
     {
-        cal_usage();
-        printf("\n=================\n\n");
-        return EXIT_SUCCESS;
+        return -1;
     }
+    char const *const addr_str = end + 1;
+    unsigned long const addr = strtoul(addr_str, &end, 0);
+    if (end == addr_str || *end != '\0' || addr > 0x7fU)
+    {
+        return -1;
+    }
+    chip->adapter = adapter;
+    chip->addr = addr;
+    return 0;
+}
 
-    if (log_init("actuationd", "./log.txt") != 0)
+/**
+ * @brief Parse a kernel PWM channel given as "CH=CHIP:N".
+ * @return 0 on success and -1 on failure.
+ */
+static int pwm_parse(char const *const arg, actr_pwm_cfg_t *const pwm)
+{
+    char *end = NULL;
+    unsigned long const channel = strtoul(arg, &end, 10);
+    if (end == arg || *end != '=' || channel >= ACTR_CH_MAX)
     {
-        printf("Failed to initialize the logger\n");
+        return -1;
+    }
+    char const *const chip_str = end + 1;
+    unsigned long const chip = strtoul(chip_str, &end, 10);
+    if (end == chip_str || *end != ':' || chip > UINT16_MAX)
+    {
+        return -1;
+    }
+    char const *const pwm_str = end + 1;
+    unsigned long const pwm_n = strtoul(pwm_str, &end, 10);
+    if (end == pwm_str || *end != '\0' || pwm_n > UINT16_MAX)
+    {
+        return -1;
+    }
+    pwm->channel = channel;
+    pwm->chip = chip;
+    pwm->pwm = pwm_n;
+    return 0;
+}
+
+/**
+ * @brief Parse a control source given as "NAME:PRIO[:STALE_MS]".
+ * @return 0 on success and -1 on failure.
+ */
+static int source_parse(char const *const arg, ctrl_source_cfg_t *const src)
+{
+    char const *const colon = strchr(arg, ':');
+    if (colon == NULL || colon == arg || (size_t)(colon - arg) >= sizeof(src->name))
+    {
+        return -1;
+    }
+    char *end = NULL;
+    unsigned long const prio = strtoul(colon + 1, &end, 10);
+    if (end == colon + 1 || prio > UINT8_MAX)
+    {
+        return -1;
+    }
+    src->stale_ms = CTRL_SOURCE_STALE_DEFAULT;
+    if (*end == ':')
+    {
+        char const *const stale_str = end + 1;
+        unsigned long const stale_ms = strtoul(stale_str, &end, 10);
+        if (end == stale_str || stale_ms >= CTRL_SOURCE_STALE_DEFAULT)
+        {
+            return -1;
+        }
+        src->stale_ms = stale_ms;
+    }
+    if (*end != '\0')
+    {
+        return -1;
+    }
+    memcpy(src->name, arg, colon - arg);
+    src->name[colon - arg] = '\0';
+    src->prio = prio;
+    return 0;
+}
+
+/**
+ * @brief Log what the modules counted while running.
+ * @param actr_cfg Configuration the actuators were initialized with.
+ * @param replay Nonzero if a trace was replayed instead of reading control input.
+ * @param ctrl_mode Mode control input was read in.
+ * @param start_ns Monotonic time the daemon started at.
+ */
+static void stats_log(actr_cfg_t const *const actr_cfg, uint8_t const replay, ctrl_mode_t const ctrl_mode, uint64_t const start_ns)
+{
+    loop_stats_log();
+    ctrl_stats_t const *const ctrl_stats = ctrl_stats_get();
+    log_info("Read %llu control frames, %llu torn copies retried, %llu reads gave up, %llu stale periods",
+             (unsigned long long)ctrl_stats->reads, (unsigned long long)ctrl_stats->torn,
+             (unsigned long long)ctrl_stats->busy, (unsigned long long)ctrl_stats->stale);
+    if (!replay && ctrl_mode == CTRL_MODE_TRAJ)
+    {
+        log_info("Applied %llu trajectory points, %llu replaced, %llu lost, late us: mean %.1f, max %.1f",
+                 (unsigned long long)ctrl_stats->points, (unsigned long long)ctrl_stats->replaced, (unsigned long long)ctrl_stats->lost,
+                 ctrl_stats->points > 0 ? (ctrl_stats->late_sum_ns / 1000.0) / ctrl_stats->points : 0.0, ctrl_stats->late_max_ns / 1000.0);
+    }
+    actr_start_stats_t const *const start_stats = actr_start_stats_get();
+    if (start_stats->first_commit_ns != 0)
+    {
+        log_info("First frame was out on every bus %.1f ms after start, %u chips taken over running and %u reset in %.1f ms",
+                 (start_stats->first_commit_ns - start_ns) / 1000000.0, start_stats->adopted, start_stats->reset,
+                 start_stats->init_ns / 1000000.0);
+    }
+    actr_estop_stats_t const *const estop_stats = actr_estop_stats_get();
+    log_info("Ran %llu e-stops, preempting %llu frames, latency us: last %.1f, mean %.1f, max %.1f",
+             (unsigned long long)estop_stats->count, (unsigned long long)estop_stats->preempted,
+             estop_stats->lat_last_ns / 1000.0, estop_stats->count > 0 ? (estop_stats->lat_sum_ns / 1000.0) / estop_stats->count : 0.0,
+             estop_stats->lat_max_ns / 1000.0);
+    if (actr_cfg->sim)
+    {
+        bus_t const *bus;
+        for (uint8_t bus_i = 0; (bus = actr_bus_get(bus_i)) != NULL; bus_i++)
+        {
+            bus_sim_stats_t sim_stats;
+            if (bus_sim_stats_get(bus, &sim_stats) == ERR_OK)
+            {
+                log_info("Simulated bus %u saw %llu transfers, %llu bytes, %llu us busy, %llu NACKs", bus_i,
+                         (unsigned long long)sim_stats.xfer, (unsigned long long)sim_stats.bytes,
+                         (unsigned long long)(sim_stats.busy_ns / 1000U), (unsigned long long)sim_stats.nack);
+            }
+        }
+    }
+}
+
+/**
+ * @brief Tick callback while replaying, frames come from the replay timer instead.
+ */
+static int replay_tick(void *arg)
+{
+    (void)arg;
+    return 0;
+}
+
+static void usage(void)
+{
+    printf("Usage: tco_actuationd.bin [options]\n"
+           "-h, --help         Print this message.\n"
+           "-c, --calibrate    Run the interactive calibration mode.\n"
+           "-r, --rate HZ      Rate at which actuators get updated when no producer wakes us (default %u).\n"
+           "-s, --seqlock      Read control frames from the lock-free '%s' segment instead of\n"
+           "                   the semaphore protected one.\n"
+           "--traj             Read timestamped setpoints from the '%s' segment and apply each\n"
+           "                   at its time, ramping between points that ask for it.\n"
+           "-t, --stale-ms MS  In seqlock mode, go neutral once the producer stops publishing for MS\n"
+           "                   milliseconds, in trajectory mode once the last point is MS old, and\n"
+           "                   otherwise once the producer holds the semaphore for MS milliseconds, 0\n"
+           "                   disables (default %u).\n"
+           "--source NAME:PRIO[:STALE_MS]\n"
+           "                   Read seqlock frames from the segment NAME, laid out like the one of --seqlock,\n"
+           "                   instead of that one. Repeat for up to %u producers, every channel comes from\n"
+           "                   the highest PRIO one that has it active and published within STALE_MS\n"
+           "                   (default --stale-ms).\n"
+           "--sim[=HZ]         Drive a simulated PCA9685 on a bus clocked at HZ (default %u) instead\n"
+           "                   of I2C hardware.\n"
+           "-f, --channels PATH\n"
+           "                   Channel calibration file, reloaded whenever it changes (default %s).\n"
+           "--chip ADAPTER:ADDR\n"
+           "                   Drive the PCA9685 at ADDR on /dev/i2c-ADAPTER, e.g. 2:0x41. Repeat for up\n"
+           "                   to %u chips, chip N drives channels 16*N to 16*N+15 (default %u:0x%02x).\n"
+           "--estop-off        On emergency, turn all outputs fully off with one all-call write per bus\n"
+           "                   instead of writing the neutral value of every channel.\n"
+           "--warm             Take over chips that already run with this configuration without resetting\n"
+           "                   them, so outputs hold through a restart, and leave them running on exit.\n"
+           "--rt               Run the loop with SCHED_FIFO and locked, prefaulted memory. Nothing is\n"
+           "                   logged from inside the loop in this mode.\n"
+           "--rt-prio PRIO     SCHED_FIFO priority in real-time mode (default %d).\n"
+           "--rt-cpu CPU       Pin the loop to this core in real-time mode.\n"
+           "--pwm-sync[=US]    Write each bus once per PWM period, US microseconds (default %u) plus the\n"
+           "                   expected write time before the period starts, and read control input\n"
+           "                   right before that. Cuts the age of the output values.\n"
+           "--pwm-hz HZ        PWM frequency of the PCA9685, %u to %u (default %u). Digital servos and\n"
+           "                   ESCs that take 200-333 Hz get new values that much sooner.\n"
+           "--osc-hz HZ        Measured PCA9685 oscillator frequency, used to pick the prescale and to\n"
+           "                   predict PWM periods (default %u).\n"
+           "--log-async[=N]    Log from the control loop and bus writers without blocking on the log file,\n"
+           "                   letting each message through at most N times a second, 0 for no limit\n"
+           "                   (default %u). Repeats are counted and summarized.\n"
+           "--stats[=MS]       Attach to the '%s' segment of a running daemon and print\n"
+           "                   latency, jitter and I2C time percentiles every MS milliseconds (default %u).\n"
+           "--record PATH      Record every applied control frame and the duty cycles it gave to PATH.\n"
+           "--replay PATH      Apply the control frames recorded in PATH with their original timing instead\n"
+           "                   of reading control input, then exit. Fails if a frame gives other duty\n"
+           "                   cycles than recorded. Combine with --sim to replay without hardware.\n"
+           "--replay-speed X   Replay X times faster than recorded, 0 for as fast as possible (default 1).\n"
+           "--check-ms MS      Read back the configuration of every chip each MS milliseconds to catch chips\n"
+           "                   that lost power or were reset, 0 to only check after failed writes (default %u).\n"
+           "--pwm CH=CHIP:N    Drive channel CH with channel N of pwmchipCHIP of the kernel PWM class, written\n"
+           "                   directly from the control loop, instead of a PCA9685 channel. Repeat for up to\n"
+           "                   %u channels.\n"
+           "--pwm-root DIR     Directory holding the pwmchipN directories (default %s).\n"
+           "--idle-ms MS       Put the chips to sleep once every channel stayed inactive for MS milliseconds\n"
+           "                   and tick only every %u ms, besides producer wakeups, until a frame is active\n"
+           "                   again or channels are overridden. 0 disables (default 0).\n",
+           LOOP_TICK_HZ_DEFAULT, CTRL_SHMEM_NAME_SEQ, CTRL_SHMEM_NAME_TRAJ, CTRL_STALE_MS_DEFAULT, CTRL_SOURCE_MAX, BUS_SIM_CLOCK_HZ_DEFAULT, CH_CFG_PATH_DEFAULT,
+           ACTR_CHIP_MAX, PCA9685_I2C_ADAPTER_ID, PCA9685_ADDR, RT_PRIO_DEFAULT, ACTR_SYNC_GUARD_US_DEFAULT, PCA9685_PWM_FREQ_MIN,
+           PCA9685_PWM_FREQ_MAX, PCA9685_PWM_FREQ_DEFAULT, PCA9685_OSC_FREQ, ALOG_BURST_DEFAULT, TELEM_SHMEM_NAME,
+           TELEM_STATS_INTERVAL_MS_DEFAULT, ACTR_CHECK_MS_DEFAULT, ACTR_PWM_MAX, PWM_SYSFS_ROOT_DEFAULT, PIPELINE_IDLE_POLL_MS);
+}
+
+/**
+ * @brief Report an option value that did not parse and print the usage.
+ * @param opt Option as returned by "getopt_long".
+ * @param arg Value given for it.
+ * @return EXIT_FAILURE.
+ */
+static int opt_invalid(int const opt, char const *const arg)
+{
+    char const *name = "";
+    for (uint8_t opt_i = 0; long_opts[opt_i].name != NULL; opt_i++)
+    {
+        if (long_opts[opt_i].val == opt)
+        {
+            name = long_opts[opt_i].name;
+            break;
+        }
+    }
+    printf("Invalid value '%s' for --%s\n\n", arg, name);
+    usage();
+    return EXIT_FAILURE;
+}
+
+int main(int argc, char *const argv[])
+{
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    uint64_t const start_ns = ((uint64_t)start.tv_sec * 1000000000U) + start.tv_nsec;
+    uint8_t calibrate = 0;
+    uint32_t stats_interval_ms = 0;
+    loop_cfg_t loop_cfg = {.tick_hz = LOOP_TICK_HZ_DEFAULT, .quiet = 0};
+    rt_cfg_t rt_cfg = {.enable = 0, .prio = RT_PRIO_DEFAULT, .cpu = -1};
+    uint8_t log_async = 0;
+    alog_cfg_t alog_cfg = {.burst = ALOG_BURST_DEFAULT, .window_ms = ALOG_WINDOW_MS_DEFAULT};
+    ctrl_mode_t ctrl_mode = CTRL_MODE_SEM;
+    uint32_t stale_ms = CTRL_STALE_MS_DEFAULT;
+    actr_cfg_t actr_cfg = {.sim = 0, .sim_clock_hz = BUS_SIM_CLOCK_HZ_DEFAULT, .sync_guard_us = ACTR_SYNC_GUARD_US_DEFAULT,
+                          .check_ms = ACTR_CHECK_MS_DEFAULT};
+    char const *ch_cfg_path = CH_CFG_PATH_DEFAULT;
+    char const *record_path = NULL;
+    char const *replay_path = NULL;
+    double replay_speed = 1.0;
+    uint32_t idle_ms = 0;
+    ctrl_source_cfg_t source_cfg;
+    uint8_t source_num = 0;
+    long long num;
+    char *end = NULL;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "hcr:st:f:", long_opts, NULL)) != -1)
+    {
+        switch (opt)
+        {
+        case 'c':
+            calibrate = 1;
+            break;
+        case 'r':
+            if (num_parse(optarg, 1, LOOP_TICK_HZ_MAX, &num) != 0)
+            {
+                return opt_invalid(opt, optarg);
+            }
+            loop_cfg.tick_hz = num;
+            break;
+        case 's':
+            ctrl_mode = CTRL_MODE_SEQLOCK;
+            break;
+        case 'J':
+            ctrl_mode = CTRL_MODE_TRAJ;
+            break;
+        case 't':
+            if (num_parse(optarg, 0, UINT32_MAX, &num) != 0)
+            {
+                return opt_invalid(opt, optarg);
+            }
+            stale_ms = num;
+            break;
+        case 'S':
+            actr_cfg.sim = 1;
+            if (optarg != NULL)
+            {
+                if (num_parse(optarg, 1, UINT32_MAX, &num) != 0)
+                {
+                    return opt_invalid(opt, optarg);
+                }
+                actr_cfg.sim_clock_hz = num;
+            }
+            break;
+        case 'f':
+            ch_cfg_path = optarg;
+            break;
+        case 'K':
+            if (actr_cfg.chip_num >= ACTR_CHIP_MAX || chip_parse(optarg, &(actr_cfg.chip[actr_cfg.chip_num])) != 0)
+            {
+                printf("Invalid chip '%s', expected ADAPTER:ADDR for at most %u chips\n", optarg, ACTR_CHIP_MAX);
+                return EXIT_FAILURE;
+            }
+            actr_cfg.chip_num++;
+            break;
+        case 'E':
+            actr_cfg.estop_off = 1;
+            break;
+        case 'A':
+            actr_cfg.warm = 1;
+            break;
+        case 'N':
+            if (actr_cfg.pwm_num >= ACTR_PWM_MAX || pwm_parse(optarg, &(actr_cfg.pwm[actr_cfg.pwm_num])) != 0)
+            {
+                printf("Invalid PWM channel '%s', expected CH=CHIP:N for at most %u channels\n", optarg, ACTR_PWM_MAX);
+                return EXIT_FAILURE;
+            }
+            actr_cfg.pwm_num++;
+            break;
+        case 'X':
+            actr_cfg.pwm_root = optarg;
+            break;
+        case 'R':
+            rt_cfg.enable = 1;
+            loop_cfg.quiet = 1;
+            break;
+        case 'P':
+            if (num_parse(optarg, RT_PRIO_MIN, RT_PRIO_MAX, &num) != 0)
+            {
+                return opt_invalid(opt, optarg);
+            }
+            rt_cfg.prio = num;
+            break;
+        case 'C':
+            if (num_parse(optarg, -1, RT_CPU_MAX, &num) != 0)
+            {
+                return opt_invalid(opt, optarg);
+            }
+            rt_cfg.cpu = num;
+            break;
+        case 'Y':
+            actr_cfg.pwm_sync = 1;
+            if (optarg != NULL)
+            {
+                if (num_parse(optarg, 0, UINT32_MAX, &num) != 0)
+                {
+                    return opt_invalid(opt, optarg);
+                }
+                actr_cfg.sync_guard_us = num;
+            }
+            break;
+        case 'W':
+            if (num_parse(optarg, PCA9685_PWM_FREQ_MIN, PCA9685_PWM_FREQ_MAX, &num) != 0)
+            {
+                printf("Invalid PWM frequency '%s', expected %u to %u Hz\n", optarg, PCA9685_PWM_FREQ_MIN, PCA9685_PWM_FREQ_MAX);
+                return EXIT_FAILURE;
+            }
+            actr_cfg.pwm_hz = num;
+            break;
+        case 'O':
+            if (num_parse(optarg, 0, PCA9685_OSC_FREQ_MAX, &num) != 0)
+            {
+                return opt_invalid(opt, optarg);
+            }
+            actr_cfg.osc_hz = num;
+            break;
+        case 'L':
+            log_async = 1;
+            if (optarg != NULL)
+            {
+                if (num_parse(optarg, 0, UINT32_MAX, &num) != 0)
+                {
+                    return opt_invalid(opt, optarg);
+                }
+                alog_cfg.burst = num;
+            }
+            break;
+        case 'T':
+            stats_interval_ms = TELEM_STATS_INTERVAL_MS_DEFAULT;
+            if (optarg != NULL)
+            {
+                if (num_parse(optarg, 1, UINT32_MAX, &num) != 0)
+                {
+                    return opt_invalid(opt, optarg);
+                }
+                stats_interval_ms = num;
+            }
+            break;
+        case 'D':
+            record_path = optarg;
+            break;
+        case 'U':
+            replay_path = optarg;
+            break;
+        case 'V':
+            errno = 0;
+            replay_speed = strtod(optarg, &end);
+            if (end == optarg || *end != '\0' || errno != 0 || !(replay_speed >= 0.0))
+            {
+                return opt_invalid(opt, optarg);
+            }
+            break;
+        case 'H':
+            if (num_parse(optarg, 0, UINT32_MAX, &num) != 0)
+            {
+                return opt_invalid(opt, optarg);
+            }
+            actr_cfg.check_ms = num;
+            break;
+        case 'I':
+            if (num_parse(optarg, 0, UINT32_MAX, &num) != 0)
+            {
+                return opt_invalid(opt, optarg);
+            }
+            idle_ms = num;
+            break;
+        case 'Q':
+            if (source_parse(optarg, &source_cfg) != 0 || ctrl_source_add(&source_cfg) != 0)
+            {
+                printf("Invalid control source '%s', expected NAME:PRIO[:STALE_MS] for at most %u sources\n", optarg, CTRL_SOURCE_MAX);
+                return EXIT_FAILURE;
+            }
+            source_num++;
+            break;
+        case 'h':
+        default:
+            usage();
+            printf("\n");
+            cal_usage();
+            printf("\n=================\n\n");
+            return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+
+    if (source_num > 0 && ctrl_mode == CTRL_MODE_TRAJ)
+    {
+        printf("--source does not work with --traj\n");
+        return EXIT_FAILURE;
+    }
+    if (source_num > 0)
+    {
+        ctrl_mode = CTRL_MODE_SEQLOCK;
+    }
+    if (idle_ms > 0 && actr_cfg.pwm_sync)
+    {
+        printf("--idle-ms does not work with --pwm-sync, which needs the chips to keep their PWM phase\n");
         return EXIT_FAILURE;
     }
 
-    struct tco_shmem_data_control *control_data;
-    sem_t *control_data_sem;
-    if (shmem_map(TCO_SHMEM_NAME_CONTROL, TCO_SHMEM_SIZE_CONTROL, TCO_SHMEM_NAME_SEM_CONTROL, O_RDONLY, (void **)&control_data, &control_data_sem) != 0)
+    if (log_init("actuationd", "./log.txt") != 0)
     {
-        log_error("Failed to map shared memory and associated semaphore");
+        printf("Failed to initialize the logger\n");
         return EXIT_FAILURE;
     }
 
-    if (argc == 2 && (strcmp(argv[1], "--calibrate") == 0 || strcmp(argv[1], "-c") == 0))
+    /* Pulse lengths in microseconds get converted to counts of the period the chips will run at. */
+    ch_cfg_timebase_set(pca9685_count_ps(actr_cfg.osc_hz, pca9685_prescale_calc(actr_cfg.osc_hz, actr_cfg.pwm_hz)));
+    if (calibrate)
     {
-        cal_main();
+        cal_main(ch_cfg_path, actr_cfg.pwm_hz, actr_cfg.osc_hz);
         return EXIT_SUCCESS;
     }
+    if (stats_interval_ms > 0)
+    {
+        return telem_stats_main(stats_interval_ms) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
 
-    if (actr_init() != 0)
+    /* Must come before any thread gets started so they all inherit the blocked signals. */
+    if (loop_init(&loop_cfg) != 0)
     {
-        log_error("Failed to initialize IO hardware");
+        log_error("Failed to initialize the event loop");
         return EXIT_FAILURE;
     }
-
-    struct tco_shmem_data_control ctrl_cpy = {0};
-    while (1)
+    /* Before entering real-time mode so the flush thread does not compete with the loop. */
+    if (log_async && alog_init(&alog_cfg) != 0)
+    {
+        log_error("Failed to start asynchronous logging");
+        return EXIT_FAILURE;
+    }
+    /* Before other threads get started so they inherit the scheduling policy and affinity. */
+    if (rt_init(&rt_cfg) != 0)
+    {
+        log_error("Failed to enter real-time mode");
+        return EXIT_FAILURE;
+    }
+    if (ch_cfg_init(ch_cfg_path) != 0)
     {
-        if (sem_wait(control_data_sem) == -1)
+        log_error("Failed to load the channel configuration");
+        return EXIT_FAILURE;
+    }
+    if (replay_path != NULL)
+    {
+        if (trace_replay_open(replay_path, replay_speed) != 0)
         {
-            log_error("sem_wait: %s", strerror(errno));
+            log_error("Failed to open the trace to replay");
             return EXIT_FAILURE;
         }
-        /* START: Critical section */
-        memcpy(&ctrl_cpy, control_data, TCO_SHMEM_SIZE_CONTROL);
-        /* END: Critical section */
-        if (sem_post(control_data_sem) == -1)
+        /* Nothing to wait for on a simulated bus when time does not matter. */
+        actr_cfg.sim_fast = actr_cfg.sim && replay_speed == 0.0;
+    }
+    else
+    {
+        ctrl_emergency_cb_set(actr_estop_request);
+        if (ctrl_init(ctrl_mode, stale_ms) != 0)
         {
-            log_error("sem_post: %s", strerror(errno));
+            log_error("Failed to initialize control input");
             return EXIT_FAILURE;
         }
-
-        /* Update actuators */
-        uint8_t ctrl_ch_count = sizeof(ctrl_cpy.ch) / sizeof(ctrl_cpy.ch[0]);
-        for (uint8_t ch_i = 0; ch_i < ctrl_ch_count; ch_i++)
+    }
+    if (actr_init(&actr_cfg) != 0)
+    {
+        log_error("Failed to initialize IO hardware");
+        return EXIT_FAILURE;
+    }
+    /* From here on every failure unwinds through the same path as a normal exit, which puts the
+    outputs in their safe state and releases what was set up so far. */
+    int run_status = -1;
+    uint64_t replay_mismatches = 0;
+    if (telem_init(1000000000U / loop_cfg.tick_hz, (actr_cfg.chip_num > 0 ? actr_cfg.chip_num : 1) * PCA9685_REG_CH_NUM) != 0)
+    {
+        log_error("Failed to initialize telemetry");
+        goto cleanup;
+    }
+    /* Keep ticking slowly while asleep. The doorbell is optional in semaphore mode, and overrides and
+    calibration reloads have no doorbell at all, so they are only noticed by ticking. */
+    if (replay_path == NULL)
+    {
+        pipeline_idle_set(idle_ms, PIPELINE_IDLE_POLL_MS);
+    }
+    /* Replayed frames must give the recorded outputs, so nothing may override them. */
+    if (replay_path == NULL && override_init() != 0)
+    {
+        log_error("Failed to initialize output overrides");
+        goto cleanup;
+    }
+    if (record_path != NULL && trace_record_open(record_path) != 0)
+    {
+        log_error("Failed to start recording");
+        goto cleanup;
+    }
+    if (replay_path != NULL)
+    {
+        if (loop_fd_add(trace_replay_fd(), pipeline_replay, NULL) != 0)
         {
-            if (ctrl_cpy.ch[ch_i].active > 0 && ctrl_cpy.emergency == 0)
-            {
-                actr_ch_set(ch_i, ctrl_cpy.ch[ch_i].pulse_frac);
-            }
-            else
-            {
-                /* TODO: Check if some devices need a signal other than 0.5 as a neutral position. */
-                actr_ch_set(ch_i, 0.5f);
-            }
+            log_error("Failed to watch the replay timer");
+            goto cleanup;
         }
-        usleep(10000); /* Update actuator state every ~0.01 seconds (a little more than that actually). */
+    }
+    else if (loop_fd_add(ctrl_wake_fd(), pipeline_wake, NULL) != 0)
+    {
+        log_error("Failed to watch for producer wakeups");
+        goto cleanup;
+    }
+    if (replay_path == NULL && ctrl_deadline_fd() != -1 && loop_fd_add(ctrl_deadline_fd(), pipeline_deadline, NULL) != 0)
+    {
+        log_error("Failed to watch for trajectory deadlines");
+        goto cleanup;
+    }
+    /* Replayed frames keep their recorded timing, there is no input to read ahead of a period. */
+    if (replay_path == NULL && actr_sync_fd() != -1 && loop_fd_add(actr_sync_fd(), pipeline_sync, NULL) != 0)
+    {
+        log_error("Failed to watch for PWM periods");
+        goto cleanup;
     }
 
+    run_status = loop_run(replay_path != NULL ? replay_tick : pipeline_tick, NULL);
+    if (replay_path != NULL)
+    {
+        replay_mismatches = trace_replay_stats_get()->mismatches;
+    }
+    stats_log(&actr_cfg, replay_path != NULL, ctrl_mode, start_ns);
+
+cleanup:
+    override_deinit();
+    trace_record_close();
+    trace_replay_close();
+    loop_deinit();
+    int const deinit_status = actr_deinit();
+    alog_deinit();
+    if (deinit_status != 0 || run_status != 0 || replay_mismatches > 0)
+    {
+        return EXIT_FAILURE;
+    }
     return EXIT_SUCCESS;
 }
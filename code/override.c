@@ -0,0 +1,229 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stddef.h>
+#include <time.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "tco_libd.h"
+
+#include "override.h"
+#include "actuator.h"
+#include "alog.h"
+
+static struct override_shmem *override = NULL;
+static uint16_t override_mask = 0;                   /* Channels the daemon overrides right now. */
+static uint16_t override_duty[OVERRIDE_CH_NUM] = {0}; /* What it overrides them with. */
+static struct override_shmem read_last = {0};         /* Last untorn copy of what the client published. */
+static struct override_shmem *client = NULL;
+
+static uint64_t override_now_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((uint64_t)now.tv_sec * 1000000000U) + now.tv_nsec;
+}
+
+int override_init(void)
+{
+    /* Only the daemon and the user it runs as get to override outputs. */
+    int const fd = shm_open(OVERRIDE_SHMEM_NAME, O_RDWR | O_CREAT, 0600);
+    if (fd == -1)
+    {
+        log_error("shm_open %s: %s", OVERRIDE_SHMEM_NAME, strerror(errno));
+        return -1;
+    }
+    if (ftruncate(fd, OVERRIDE_SHMEM_SIZE) == -1)
+    {
+        log_error("Failed to size shared memory %s: %s", OVERRIDE_SHMEM_NAME, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    void *const shmem = mmap(NULL, OVERRIDE_SHMEM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (shmem == MAP_FAILED)
+    {
+        log_error("mmap %s: %s", OVERRIDE_SHMEM_NAME, strerror(errno));
+        return -1;
+    }
+
+    /* Whatever a client of a previous run left behind does not carry over. */
+    override = shmem;
+    memset(override, 0, OVERRIDE_SHMEM_SIZE);
+    __atomic_store_n(&(override->version), OVERRIDE_VERSION, __ATOMIC_RELEASE);
+    override_mask = 0;
+    memset(&read_last, 0, sizeof(read_last));
+    return 0;
+}
+
+uint8_t override_poll(void)
+{
+    if (override == NULL)
+    {
+        return 0;
+    }
+
+    /* A client that keeps writing for the whole retry budget keeps what it published last. */
+    for (uint8_t retry_i = 0; retry_i < OVERRIDE_RETRY_MAX; retry_i++)
+    {
+        uint32_t const seq_begin = __atomic_load_n(&(override->seq), __ATOMIC_ACQUIRE);
+        if (seq_begin & 1U)
+        {
+            continue; /* Client is mid-write. */
+        }
+        struct override_shmem cpy;
+        memcpy(&cpy, override, offsetof(struct override_shmem, out));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&(override->seq), __ATOMIC_RELAXED) == seq_begin)
+        {
+            memcpy(&read_last, &cpy, offsetof(struct override_shmem, out));
+            break;
+        }
+    }
+    uint16_t mask = read_last.mask;
+    int32_t const owner = __atomic_load_n(&(override->owner), __ATOMIC_RELAXED);
+    if (owner == 0 || override_now_ns() >= read_last.lease_ns)
+    {
+        mask = 0;
+    }
+
+    if (mask != override_mask)
+    {
+        if (override_mask == 0)
+        {
+            alog_info("Process %d overrides channels 0x%04x", owner, mask);
+        }
+        else if (mask == 0)
+        {
+            alog_info("Overrides %s", owner == 0 ? "released" : "lapsed");
+        }
+    }
+    for (uint8_t ch_i = 0; ch_i < OVERRIDE_CH_NUM; ch_i++)
+    {
+        uint16_t const bit = 1U << ch_i;
+        uint16_t const duty_ch = read_last.duty[ch_i] > 0x0fffU ? 0x0fffU : read_last.duty[ch_i];
+        if ((mask & bit) != (override_mask & bit) || ((mask & bit) && duty_ch != override_duty[ch_i]))
+        {
+            actr_override_set(ch_i, (mask & bit) ? (int32_t)duty_ch : -1);
+            override_duty[ch_i] = duty_ch;
+        }
+    }
+    override_mask = mask;
+
+    uint16_t out[OVERRIDE_CH_NUM];
+    actr_applied_get(out, OVERRIDE_CH_NUM);
+    for (uint8_t ch_i = 0; ch_i < OVERRIDE_CH_NUM; ch_i++)
+    {
+        __atomic_store_n(&(override->out[ch_i]), out[ch_i], __ATOMIC_RELAXED);
+    }
+    return override_mask != 0;
+}
+
+void override_deinit(void)
+{
+    if (override == NULL)
+    {
+        return;
+    }
+    munmap(override, OVERRIDE_SHMEM_SIZE);
+    override = NULL;
+    if (shm_unlink(OVERRIDE_SHMEM_NAME) == -1)
+    {
+        log_error("shm_unlink %s: %s", OVERRIDE_SHMEM_NAME, strerror(errno));
+    }
+}
+
+int override_client_open(void)
+{
+    int const fd = shm_open(OVERRIDE_SHMEM_NAME, O_RDWR, 0);
+    if (fd == -1)
+    {
+        if (errno != ENOENT)
+        {
+            int const err = errno;
+            log_error("shm_open %s: %s", OVERRIDE_SHMEM_NAME, strerror(err));
+            errno = err;
+        }
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1 || (size_t)st.st_size < OVERRIDE_SHMEM_SIZE)
+    {
+        log_error("Shared memory %s is too small", OVERRIDE_SHMEM_NAME);
+        close(fd);
+        errno = EPROTO;
+        return -1;
+    }
+    void *const shmem = mmap(NULL, OVERRIDE_SHMEM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (shmem == MAP_FAILED)
+    {
+        int const err = errno;
+        log_error("mmap %s: %s", OVERRIDE_SHMEM_NAME, strerror(err));
+        errno = err;
+        return -1;
+    }
+    struct override_shmem *const shm = shmem;
+    if (__atomic_load_n(&(shm->version), __ATOMIC_ACQUIRE) != OVERRIDE_VERSION)
+    {
+        log_error("Override segment has version %u but %u is expected", shm->version, OVERRIDE_VERSION);
+        munmap(shmem, OVERRIDE_SHMEM_SIZE);
+        errno = EPROTO;
+        return -1;
+    }
+
+    /* Only the owner writes 'lease_ns', so a stale read can only make the claim fail. */
+    int32_t owner = __atomic_load_n(&(shm->owner), __ATOMIC_ACQUIRE);
+    if (owner != 0 && override_now_ns() < __atomic_load_n(&(shm->lease_ns), __ATOMIC_ACQUIRE))
+    {
+        log_error("Overrides are held by process %d", owner);
+        munmap(shmem, OVERRIDE_SHMEM_SIZE);
+        errno = EBUSY;
+        return -1;
+    }
+    if (!__atomic_compare_exchange_n(&(shm->owner), &owner, (int32_t)getpid(), 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+    {
+        log_error("Overrides were just claimed by process %d", owner);
+        munmap(shmem, OVERRIDE_SHMEM_SIZE);
+        errno = EBUSY;
+        return -1;
+    }
+    client = shm;
+    uint16_t const duty[OVERRIDE_CH_NUM] = {0};
+    override_client_publish(duty, 0);
+    return 0;
+}
+
+void override_client_publish(uint16_t const duty[OVERRIDE_CH_NUM], uint16_t const mask)
+{
+    uint32_t const seq = __atomic_load_n(&(client->seq), __ATOMIC_RELAXED);
+    __atomic_store_n(&(client->seq), seq + 1U, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    client->mask = mask;
+    memcpy(client->duty, duty, sizeof(client->duty));
+    __atomic_store_n(&(client->lease_ns), override_now_ns() + (OVERRIDE_LEASE_MS * 1000000ULL), __ATOMIC_RELAXED);
+    __atomic_store_n(&(client->seq), seq + 2U, __ATOMIC_RELEASE);
+}
+
+uint16_t override_client_out_get(uint8_t const channel)
+{
+    return __atomic_load_n(&(client->out[channel]), __ATOMIC_RELAXED);
+}
+
+void override_client_close(void)
+{
+    if (client == NULL)
+    {
+        return;
+    }
+    uint16_t const duty[OVERRIDE_CH_NUM] = {0};
+    override_client_publish(duty, 0);
+    __atomic_store_n(&(client->owner), 0, __ATOMIC_RELEASE);
+    munmap(client, OVERRIDE_SHMEM_SIZE);
+    client = NULL;
+}
@@ -0,0 +1,83 @@
+#ifndef _OVERRIDE_H_
+#define _OVERRIDE_H_
+
+#include <stdint.h>
+
+/*
+Lets a client such as "--calibrate" drive channels of the running daemon with raw duty cycles, so
+the daemon stays the only one on the bus and nothing gets reset. The daemon creates the segment. A
+client claims it by swapping its process ID into 'owner', from 0 or from an owner whose lease ran
+out. It then publishes like a seqlock producer: make 'seq' odd, write 'lease_ns', 'mask' and
+'duty', make 'seq' even (release ordering). The daemon picks the overrides up on its next pass and
+holds them until 'lease_ns', so they lapse on their own if the client dies. An e-stop still takes
+every channel to its safe state. New limits are committed by saving the channel configuration
+file, which the daemon reloads.
+*/
+#define OVERRIDE_SHMEM_NAME "tco_shmem_actuation_override"
+#define OVERRIDE_VERSION 1U
+#define OVERRIDE_CH_NUM 16U     /* Channels of a control frame. */
+#define OVERRIDE_LEASE_MS 500U  /* How long published overrides hold without being published again. */
+#define OVERRIDE_RETRY_MAX 16U
+
+/* Layout of the override segment. */
+struct override_shmem
+{
+    uint32_t version;
+    uint32_t seq;     /* Odd while the owner writes. */
+    int32_t owner;    /* Process ID of the client holding the segment, 0 if none does. */
+    uint16_t mask;    /* Bit per channel that is overridden. */
+    uint16_t reserved;
+    uint64_t lease_ns; /* CLOCK_MONOTONIC time the overrides lapse at. */
+    uint16_t duty[OVERRIDE_CH_NUM]; /* Raw duty cycle of each overridden channel. */
+    uint16_t out[OVERRIDE_CH_NUM];  /* Written by the daemon: duty cycle each channel was last written with. */
+};
+
+#define OVERRIDE_SHMEM_SIZE sizeof(struct override_shmem)
+
+/**
+ * @brief Create the override segment of the daemon.
+ * @return 0 on success and -1 on failure.
+ */
+int override_init(void);
+
+/**
+ * @brief Read the overrides published by the client, hand them to the actuators and publish what
+ * the channels were last written with. Does nothing if "override_init" was not called. Never
+ * blocks, so it is safe to use from the control loop.
+ * @return 1 if any channel is overridden and 0 otherwise.
+ */
+uint8_t override_poll(void);
+
+/**
+ * @brief Remove the override segment so clients see no daemon is running.
+ */
+void override_deinit(void);
+
+/**
+ * @brief Attach to the override segment of a running daemon and claim it.
+ * @return 0 on success and -1 on failure with errno set to ENOENT if no daemon runs and to EBUSY if
+ * another client holds the segment.
+ */
+int override_client_open(void);
+
+/**
+ * @brief Publish overrides and renew the lease. Must be called more often than OVERRIDE_LEASE_MS
+ * for overrides to hold.
+ * @param duty Raw duty cycle for each of OVERRIDE_CH_NUM channels, only those in @p mask are used.
+ * @param mask Bit per channel to override, the others follow the control input again.
+ */
+void override_client_publish(uint16_t const duty[OVERRIDE_CH_NUM], uint16_t const mask);
+
+/**
+ * @brief Get the duty cycle the daemon last wrote to a channel.
+ * @param channel Channel below OVERRIDE_CH_NUM.
+ * @return The duty cycle.
+ */
+uint16_t override_client_out_get(uint8_t const channel);
+
+/**
+ * @brief Drop all overrides and release the segment.
+ */
+void override_client_close(void);
+
+#endif /* _OVERRIDE_H_ */
@@ -1,6 +1,9 @@
 #include <unistd.h>
+#include <string.h>
+#include <time.h>
 
 #include "pca9685.h"
+#include "alog.h"
 
 /*
 For all channels, the ON and OFF registers must never have the same value. ON count = counts before
@@ -11,39 +14,203 @@ HIGH registers, then always ON (if in HIGH ON register) or always OFF (if in HIG
 #define PCA9685_REG_CH(ch_num, on_off, low_high) (((ch_num * 4U) + 0x06U + low_high) + (2U * on_off))
 #define PCA9685_REG_ALL(on_off, low_high) ((0xfaU + low_high) + (2U * on_off))
 
-#define PCA9685_REG_PRESCALE_MIN 3
-#define PCA9685_REG_PRESCALE_MAX 255
-#define PCA9685_OSC_FREQ 25000000 /* 25 MHz */
-#define PCA9685_PWM_FREQ 50       /* Hz */
+#define PCA9685_FREQ_TOLERANCE_PCT 1U /* Deviation of the PWM frequency worth telling about. */
 
 /* Register defaults. */
 #define PCA9685_REG_MODE1_DEFAULT PCA9685_REG_MODE1_SLEEP | PCA9685_REG_MODE1_ALLCALL
 #define PCA9685_REG_MODE2_DEFAULT PCA9685_REG_MODE2_OUTDRV
+/* Outputs change on STOP (OCH = 0) so a multi-channel write takes effect all at once. */
+#define PCA9685_REG_MODE2_RUN PCA9685_REG_MODE2_OUTDRV
+#define PCA9685_REG_MODE1_RUN (PCA9685_REG_MODE1_AUTOINC | PCA9685_REG_MODE1_ALLCALL)
 #define PCA9685_REG_PRESCALE_DEFAULT 30U /* Default PWM freq is 200Hz  */
 
-#define PULSE_LEN_MIN_DEFUALT 100
-#define PULSE_LEN_MAX_DEFUALT 200
-#define PULSE_LEN_INVERT_DEFUALT 0
-
-/* XXX: Pulse length min and max are handled internally here and nowhere else! */
-uint16_t static const CH_PULSE_LENGTH[PCA9685_REG_CH_NUM][3] = {
-    {210, 440, 0},
-    {190, 450, 1},
-    {PULSE_LEN_MIN_DEFUALT, PULSE_LEN_MAX_DEFUALT, PULSE_LEN_INVERT_DEFUALT},
-    {PULSE_LEN_MIN_DEFUALT, PULSE_LEN_MAX_DEFUALT, PULSE_LEN_INVERT_DEFUALT},
-    {PULSE_LEN_MIN_DEFUALT, PULSE_LEN_MAX_DEFUALT, PULSE_LEN_INVERT_DEFUALT},
-    {PULSE_LEN_MIN_DEFUALT, PULSE_LEN_MAX_DEFUALT, PULSE_LEN_INVERT_DEFUALT},
-    {PULSE_LEN_MIN_DEFUALT, PULSE_LEN_MAX_DEFUALT, PULSE_LEN_INVERT_DEFUALT},
-    {PULSE_LEN_MIN_DEFUALT, PULSE_LEN_MAX_DEFUALT, PULSE_LEN_INVERT_DEFUALT},
-    {PULSE_LEN_MIN_DEFUALT, PULSE_LEN_MAX_DEFUALT, PULSE_LEN_INVERT_DEFUALT},
-    {PULSE_LEN_MIN_DEFUALT, PULSE_LEN_MAX_DEFUALT, PULSE_LEN_INVERT_DEFUALT},
-    {PULSE_LEN_MIN_DEFUALT, PULSE_LEN_MAX_DEFUALT, PULSE_LEN_INVERT_DEFUALT},
-    {PULSE_LEN_MIN_DEFUALT, PULSE_LEN_MAX_DEFUALT, PULSE_LEN_INVERT_DEFUALT},
-    {PULSE_LEN_MIN_DEFUALT, PULSE_LEN_MAX_DEFUALT, PULSE_LEN_INVERT_DEFUALT},
-    {PULSE_LEN_MIN_DEFUALT, PULSE_LEN_MAX_DEFUALT, PULSE_LEN_INVERT_DEFUALT},
-    {PULSE_LEN_MIN_DEFUALT, PULSE_LEN_MAX_DEFUALT, PULSE_LEN_INVERT_DEFUALT},
-    {PULSE_LEN_MIN_DEFUALT, PULSE_LEN_MAX_DEFUALT, PULSE_LEN_INVERT_DEFUALT},
-};
+static uint64_t pca9685_now_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((uint64_t)now.tv_sec * 1000000000U) + now.tv_nsec;
+}
+
+/**
+ * @brief Run a transfer, repeating it with growing waits in between while it fails. Everything the
+ * driver sends sets registers to absolute values so a partly done transfer is safe to repeat.
+ * @param handle Chip whose retry settings and counters are used.
+ * @param msgs Messages to transfer.
+ * @param msg_num Number of messages.
+ * @return Status code.
+ */
+static error_t pca9685_xfer(pca9685_handle_t *const handle, struct i2c_msg *const msgs, uint8_t const msg_num)
+{
+    uint32_t backoff_us = handle->retry_backoff_us;
+    for (uint8_t try_i = 0;; try_i++)
+    {
+        if (bus_xfer(&(handle->bus), msgs, msg_num) == ERR_OK)
+        {
+            return ERR_OK;
+        }
+        if (try_i >= handle->retry_max)
+        {
+            handle->stats.failures++;
+            return ERR_I2C_WRITE;
+        }
+        handle->stats.retries++;
+        if (backoff_us > 0)
+        {
+            usleep(backoff_us);
+            backoff_us *= 2U;
+        }
+    }
+}
+
+/**
+ * @brief Write the channel registers of all channels in @p dirty. Channels are grouped into
+ * contiguous register runs and each run becomes one auto-increment message. All messages go out in
+ * a single I2C_RDWR transfer (repeated START between them) so outputs still change together on the
+ * final STOP.
+ * @param handle Chip that does the transfer, its counters are updated.
+ * @param addr Address of the chip or of a group of chips.
+ * @param regs Register values for every channel.
+ * @param dirty Bit per channel selecting which channels of @p regs to write.
+ * @return Status code.
+ */
+static error_t pca9685_ch_runs_write(pca9685_handle_t *const handle, uint8_t const addr, uint8_t const regs[PCA9685_REG_CH_NUM][PCA9685_REG_CH_LEN], uint16_t const dirty)
+{
+    /* At most every other channel is dirty which gives the upper bound on the number of runs. */
+    uint8_t buf[PCA9685_REG_CH_NUM / 2][1 + (PCA9685_REG_CH_NUM * PCA9685_REG_CH_LEN)];
+    struct i2c_msg msgs[PCA9685_REG_CH_NUM / 2];
+    uint8_t msg_num = 0;
+    uint16_t byte_num = 0;
+    for (uint8_t ch_i = 0; ch_i < PCA9685_REG_CH_NUM;)
+    {
+        if ((dirty & (1U << ch_i)) == 0)
+        {
+            ch_i++;
+            continue;
+        }
+        uint8_t *const run = buf[msg_num];
+        uint16_t run_len = 1;
+        run[0] = PCA9685_REG_LED0 + (ch_i * PCA9685_REG_CH_LEN);
+        for (; ch_i < PCA9685_REG_CH_NUM && (dirty & (1U << ch_i)); ch_i++)
+        {
+            memcpy(&(run[run_len]), regs[ch_i], PCA9685_REG_CH_LEN);
+            run_len += PCA9685_REG_CH_LEN;
+        }
+        msgs[msg_num] = (struct i2c_msg){.addr = addr, .flags = 0, .len = run_len, .buf = run};
+        msg_num++;
+        byte_num += run_len;
+    }
+
+    if (pca9685_xfer(handle, msgs, msg_num) != ERR_OK)
+    {
+        return ERR_I2C_WRITE;
+    }
+    handle->stats.xfer++;
+    handle->stats.msg += msg_num;
+    handle->stats.bytes += byte_num;
+    return ERR_OK;
+}
+
+/**
+ * @brief Find the channels in @p ch_mask whose registers differ from the shadow copy of a chip.
+ * @param handle Pointer to the interface handle struct.
+ * @param regs Register values for every channel.
+ * @param ch_mask Bit per channel selecting which channels of @p regs to consider.
+ * @return Bit per channel that needs to be written.
+ */
+static uint16_t pca9685_ch_dirty_get(pca9685_handle_t *const handle, uint8_t const regs[PCA9685_REG_CH_NUM][PCA9685_REG_CH_LEN], uint16_t const ch_mask)
+{
+    uint16_t dirty = 0;
+    for (uint8_t ch_i = 0; ch_i < PCA9685_REG_CH_NUM; ch_i++)
+    {
+        if ((ch_mask & (1U << ch_i)) == 0)
+        {
+            continue;
+        }
+        if ((handle->shadow_valid & (1U << ch_i)) && memcmp(handle->shadow[ch_i], regs[ch_i], PCA9685_REG_CH_LEN) == 0)
+        {
+            continue;
+        }
+        dirty |= 1U << ch_i;
+    }
+    return dirty;
+}
+
+/**
+ * @brief Record in the shadow copy of a chip that the channels in @p ch_mask were considered for a
+ * write and that those in @p dirty now hold @p regs.
+ */
+static void pca9685_shadow_update(pca9685_handle_t *const handle, uint8_t const regs[PCA9685_REG_CH_NUM][PCA9685_REG_CH_LEN], uint16_t const ch_mask, uint16_t const dirty)
+{
+    for (uint8_t ch_i = 0; ch_i < PCA9685_REG_CH_NUM; ch_i++)
+    {
+        if (dirty & (1U << ch_i))
+        {
+            memcpy(handle->shadow[ch_i], regs[ch_i], PCA9685_REG_CH_LEN);
+            handle->stats.ch_written++;
+        }
+        else if (ch_mask & (1U << ch_i))
+        {
+            handle->stats.ch_skipped++;
+        }
+    }
+    handle->shadow_valid |= dirty;
+}
+
+/**
+ * @brief Write the channel registers of all channels in @p ch_mask whose value differs from the
+ * shadow copy.
+ * @param handle Pointer to the interface handle struct.
+ * @param regs Register values for every channel.
+ * @param ch_mask Bit per channel selecting which channels of @p regs to consider.
+ * @return Status code.
+ */
+static error_t pca9685_ch_regs_commit(pca9685_handle_t *const handle, uint8_t const regs[PCA9685_REG_CH_NUM][PCA9685_REG_CH_LEN], uint16_t const ch_mask)
+{
+    uint16_t const dirty = pca9685_ch_dirty_get(handle, regs, ch_mask);
+    if (dirty != 0 && pca9685_ch_runs_write(handle, handle->addr, regs, dirty) != ERR_OK)
+    {
+        handle->shadow_valid &= ~dirty; /* Chip state is unknown after a failed transfer. */
+        return ERR_I2C_WRITE;
+    }
+    pca9685_shadow_update(handle, regs, ch_mask, dirty);
+    return ERR_OK;
+}
+
+/**
+ * @brief Fill the 4 channel registers (ON_L, ON_H, OFF_L, OFF_H) for a duty cycle.
+ * @param regs Where the 4 register values get written.
+ * @param duty_cycle Duty cycle of the channel.
+ */
+static void pca9685_ch_regs_fill(uint8_t *const regs, uint16_t const duty_cycle)
+{
+    /*
+    1. No need for delay so ON_HIGH and ON_LOW for the channel are zero'd out.
+    2. Write duty_cycle as is since there are 4095 counts in a PWM signal where 4th bit in HIGH
+       means 'always on' so its safe to write the entire 16 bit parameter.
+
+    Keep the 4 MSBs 0 as they are reserved anyways and 4th bit is used for the always-off bit. This
+    leaves 12 bits i.e. a range of 0 to 4095.
+    */
+    regs[0] = 0;
+    regs[1] = 0;
+    regs[2] = duty_cycle & 0x00ff;
+    regs[3] = (duty_cycle & 0x0f00) >> 8;
+}
+
+/**
+ * @brief Write a single register.
+ * @param handle Pointer to the interface handle struct.
+ * @param addr Address of the chip.
+ * @param reg Register to write.
+ * @param val Value to write.
+ * @return Status code.
+ */
+static error_t pca9685_reg_write(pca9685_handle_t *const handle, uint8_t const addr, uint8_t const reg, uint8_t const val)
+{
+    uint8_t buf[2] = {reg, val};
+    struct i2c_msg msg = {.addr = addr, .flags = 0, .len = sizeof(buf), .buf = buf};
+    return pca9685_xfer(handle, &msg, 1);
+}
 
 error_t pca9685_init(pca9685_handle_t *const handle)
 {
@@ -52,12 +219,38 @@ error_t pca9685_init(pca9685_handle_t *const handle)
         log_error("Failed to reset the PCA9685 chip");
         return ERR_CRIT;
     }
+    return pca9685_configure(handle);
+}
+
+/**
+ * @brief Fill in the defaults for settings the user left at 0.
+ */
+static void pca9685_defaults_set(pca9685_handle_t *const handle)
+{
+    if (handle->pwm_hz == 0)
+    {
+        handle->pwm_hz = PCA9685_PWM_FREQ_DEFAULT;
+    }
+    if (handle->osc_hz == 0)
+    {
+        handle->osc_hz = PCA9685_OSC_FREQ;
+    }
+}
 
+error_t pca9685_configure(pca9685_handle_t *const handle)
+{
+    pca9685_defaults_set(handle);
     /* Data for all subsequent I2C writes. */
-    uint8_t data[4] = {(PCA9685_OSC_FREQ / (4096 * PCA9685_PWM_FREQ)) - 1, 0U, (PCA9685_REG_MODE1_RESTART | PCA9685_REG_MODE1_ALLCALL), PCA9685_REG_MODE2_OUTDRV};
+    uint8_t data[4] = {pca9685_prescale_calc(handle->osc_hz, handle->pwm_hz), PCA9685_REG_MODE1_RUN, (PCA9685_REG_MODE1_RESTART | PCA9685_REG_MODE1_RUN), PCA9685_REG_MODE2_RUN};
+    /* The prescale is an integer so the frequency we get is only close to the one asked for. */
+    uint32_t const actual_hz = handle->osc_hz / (4096U * (data[0] + 1U));
+    if ((actual_hz > handle->pwm_hz ? actual_hz - handle->pwm_hz : handle->pwm_hz - actual_hz) * 100U > handle->pwm_hz * PCA9685_FREQ_TOLERANCE_PCT)
+    {
+        log_info("PWM of PCA9685 at 0x%02x runs at %u Hz instead of %u Hz", handle->addr, actual_hz, handle->pwm_hz);
+    }
 
     /* Chip should be in sleep mode here so it's safe to set the prescale value. */
-    if (i2c_cmd_write(handle->fd, PCA9685_ADDR, PCA9685_REG_PRESCALE, &(data[0]), 1) != ERR_OK)
+    if (pca9685_reg_write(handle, handle->addr, PCA9685_REG_PRESCALE, data[0]) != ERR_OK)
     {
         log_error("Failed to set the prescale value");
         return ERR_CRIT;
@@ -65,79 +258,340 @@ error_t pca9685_init(pca9685_handle_t *const handle)
     handle->prescale = data[0];
 
     /* Config the chip using mode registers. */
-    if (i2c_cmd_write(handle->fd, PCA9685_ADDR, PCA9685_REG_MODE1, &(data[1]), 1) != ERR_OK)
+    if (pca9685_reg_write(handle, handle->addr, PCA9685_REG_MODE1, data[1]) != ERR_OK)
     {
         log_error("Failed to wake up PCA9685 from SLEEP mode");
         return ERR_I2C_WRITE;
     }
 
     usleep(1000); /* Need to wait at least 500 microseconds before writing to the RESTART bit. */
-    if (i2c_cmd_write(handle->fd, PCA9685_ADDR, PCA9685_REG_MODE1, &(data[2]), 1) != ERR_OK ||
-        i2c_cmd_write(handle->fd, PCA9685_ADDR, PCA9685_REG_MODE2, &(data[3]), 1) != ERR_OK)
+    if (pca9685_reg_write(handle, handle->addr, PCA9685_REG_MODE1, data[2]) != ERR_OK)
+    {
+        log_error("Failed to set mode registers");
+        return ERR_I2C_WRITE;
+    }
+    handle->restart_ns = pca9685_now_ns(); /* Counter restarted on the STOP of the RESTART write. */
+    if (pca9685_reg_write(handle, handle->addr, PCA9685_REG_MODE2, data[3]) != ERR_OK)
     {
         log_error("Failed to set mode registers");
         return ERR_I2C_WRITE;
     }
+    handle->mode1 = PCA9685_REG_MODE1_RUN;
 
     return ERR_OK;
 }
 
+error_t pca9685_sleep(pca9685_handle_t *const handle)
+{
+    uint8_t const mode1 = handle->mode1 | PCA9685_REG_MODE1_SLEEP;
+    if (pca9685_reg_write(handle, handle->addr, PCA9685_REG_MODE1, mode1) != ERR_OK)
+    {
+        return ERR_I2C_WRITE;
+    }
+    handle->mode1 = mode1; /* So a configuration check does not take the sleep for a reset. */
+    handle->restart_ns = 0;
+    return ERR_OK;
+}
+
+error_t pca9685_wake(pca9685_handle_t *const handle)
+{
+    /* Writing 0 to RESTART does nothing, it stays set until written with 1 after the wait. */
+    uint8_t const mode1 = handle->mode1 & ~PCA9685_REG_MODE1_SLEEP;
+    if (pca9685_reg_write(handle, handle->addr, PCA9685_REG_MODE1, mode1) != ERR_OK)
+    {
+        return ERR_I2C_WRITE;
+    }
+    handle->mode1 = mode1;
+    return ERR_OK;
+}
+
+error_t pca9685_restart(pca9685_handle_t *const handle)
+{
+    if (pca9685_reg_write(handle, handle->addr, PCA9685_REG_MODE1, handle->mode1 | PCA9685_REG_MODE1_RESTART) != ERR_OK)
+    {
+        return ERR_I2C_WRITE;
+    }
+    handle->restart_ns = pca9685_now_ns();
+    return ERR_OK;
+}
+
+error_t pca9685_config_check(pca9685_handle_t *const handle, uint8_t *const lost)
+{
+    /* Registers are not next to each other so each gets its own pointer write and read. */
+    uint8_t reg[2] = {PCA9685_REG_MODE1, PCA9685_REG_PRESCALE};
+    uint8_t val[2] = {0};
+    struct i2c_msg msgs[4] = {
+        {.addr = handle->addr, .flags = 0, .len = 1, .buf = &(reg[0])},
+        {.addr = handle->addr, .flags = I2C_M_RD, .len = 1, .buf = &(val[0])},
+        {.addr = handle->addr, .flags = 0, .len = 1, .buf = &(reg[1])},
+        {.addr = handle->addr, .flags = I2C_M_RD, .len = 1, .buf = &(val[1])},
+    };
+    if (pca9685_xfer(handle, msgs, sizeof(msgs) / sizeof(msgs[0])) != ERR_OK)
+    {
+        return ERR_I2C_WRITE;
+    }
+    /* RESTART reads as set after the chip was put to sleep while running, it is not configuration. */
+    *lost = (val[0] & ~PCA9685_REG_MODE1_RESTART) != handle->mode1 || val[1] != handle->prescale;
+    return ERR_OK;
+}
+
+error_t pca9685_adopt(pca9685_handle_t *const handle, uint8_t *const adopted)
+{
+    pca9685_defaults_set(handle);
+    *adopted = 0;
+    /* MODE2 follows MODE1 only with auto-increment on, without it the check fails as it should. */
+    uint8_t reg[2] = {PCA9685_REG_MODE1, PCA9685_REG_PRESCALE};
+    uint8_t mode[2] = {0};
+    uint8_t prescale = 0;
+    struct i2c_msg msgs[4] = {
+        {.addr = handle->addr, .flags = 0, .len = 1, .buf = &(reg[0])},
+        {.addr = handle->addr, .flags = I2C_M_RD, .len = sizeof(mode), .buf = mode},
+        {.addr = handle->addr, .flags = 0, .len = 1, .buf = &(reg[1])},
+        {.addr = handle->addr, .flags = I2C_M_RD, .len = 1, .buf = &prescale},
+    };
+    if (pca9685_xfer(handle, msgs, sizeof(msgs) / sizeof(msgs[0])) != ERR_OK)
+    {
+        return ERR_I2C_WRITE;
+    }
+    /* Group membership is set up again by the user, it does not change outputs. */
+    uint8_t const mode1 = mode[0] & ~(PCA9685_REG_MODE1_RESTART | PCA9685_REG_MODE1_SUB1 | PCA9685_REG_MODE1_SUB2 | PCA9685_REG_MODE1_SUB3);
+    if (mode1 != PCA9685_REG_MODE1_RUN || mode[1] != PCA9685_REG_MODE2_RUN || prescale != pca9685_prescale_calc(handle->osc_hz, handle->pwm_hz))
+    {
+        return ERR_OK;
+    }
+
+    uint8_t led = PCA9685_REG_LED0;
+    struct i2c_msg led_msgs[2] = {
+        {.addr = handle->addr, .flags = 0, .len = 1, .buf = &led},
+        {.addr = handle->addr, .flags = I2C_M_RD, .len = sizeof(handle->shadow), .buf = &(handle->shadow[0][0])},
+    };
+    if (pca9685_xfer(handle, led_msgs, sizeof(led_msgs) / sizeof(led_msgs[0])) != ERR_OK)
+    {
+        handle->shadow_valid = 0;
+        return ERR_I2C_WRITE;
+    }
+    handle->shadow_valid = PCA9685_REG_CH_MASK_ALL;
+    handle->mode1 = mode[0] & ~PCA9685_REG_MODE1_RESTART;
+    handle->prescale = prescale;
+    handle->restart_ns = 0; /* Counter has been running since before we got here. */
+    *adopted = 1;
+    return ERR_OK;
+}
+
+uint8_t pca9685_prescale_calc(uint32_t const osc_hz, uint32_t const pwm_hz)
+{
+    uint64_t const osc = osc_hz > 0 ? osc_hz : PCA9685_OSC_FREQ;
+    uint64_t const div = 4096ULL * (pwm_hz > 0 ? pwm_hz : PCA9685_PWM_FREQ_DEFAULT);
+    uint64_t const prescale = (osc + (div / 2)) / div;
+    if (prescale < PCA9685_PRESCALE_MIN + 1U)
+    {
+        return PCA9685_PRESCALE_MIN;
+    }
+    return prescale - 1U > PCA9685_PRESCALE_MAX ? PCA9685_PRESCALE_MAX : prescale - 1U;
+}
+
+uint32_t pca9685_count_ps(uint32_t const osc_hz, uint8_t const prescale)
+{
+    return (((uint64_t)prescale + 1U) * 1000000000000ULL) / (osc_hz > 0 ? osc_hz : PCA9685_OSC_FREQ);
+}
+
+uint64_t pca9685_period_next(pca9685_handle_t const *const handle, uint64_t const after_ns)
+{
+    if (handle->restart_ns == 0 || handle->osc_hz == 0)
+    {
+        return 0;
+    }
+    if (after_ns <= handle->restart_ns)
+    {
+        return handle->restart_ns;
+    }
+    /* In picoseconds so the rounding of the period does not add up over many periods. */
+    uint64_t const period_ps = (((uint64_t)handle->prescale + 1U) * 4096U * 1000000000000ULL) / handle->osc_hz;
+    uint64_t const periods = (((after_ns - handle->restart_ns) * 1000U) + period_ps - 1) / period_ps;
+    return handle->restart_ns + ((periods * period_ps) / 1000U);
+}
+
 error_t pca9685_reset(pca9685_handle_t *const handle)
 {
     /* 0x06 is special and the exact value expected by the chip after receiving a reset address. */
-    if (i2c_cmd_write(handle->fd, PCA9685_RESET_ADDR, 0x06U, NULL, 0) != 0)
+    uint8_t swrst = 0x06U;
+    struct i2c_msg msg = {.addr = PCA9685_RESET_ADDR, .flags = 0, .len = 1, .buf = &swrst};
+    if (pca9685_xfer(handle, &msg, 1) != ERR_OK)
     {
         log_error("Failed to send SWRST data byte");
         return ERR_I2C_WRITE;
     }
+    handle->shadow_valid = 0; /* All channel registers are back to their power-on values. */
+    handle->restart_ns = 0;
     usleep(10); /* Reset time is 4.2 microseconds. */
     /* Chip should be in sleep more right now. */
     return ERR_OK;
 }
 
-error_t pca9685_ch_frac_set(pca9685_handle_t *const handle, uint8_t const channel, float const pulse_frac)
+error_t pca9685_ch_raw_set(pca9685_handle_t *const handle, uint8_t const channel, uint16_t const duty_cycle)
 {
-    /*
-    1. No need for delay so ON_HIGH and ON_LOW for the channel are zero'd out.
-    2. Write duty_cycle as is since there are 4095 counts in a PWM signal where 4th bit in HIGH
-       means 'always on' so its safe to write the entire 16 bit parameter.
-
-    Keep the 4 MSBs 0 as they are reserved anyways and 4th bit is used for the always-off bit. This
-    leaves 12 bits i.e. a range of 0 to 4095.
-    */
-    if (channel > PCA9685_REG_CH_NUM)
+    if (channel >= PCA9685_REG_CH_NUM)
+    {
+        alog_error("Channel %u does not exist", channel);
+        return ERR_CRIT;
+    }
+    uint8_t regs[PCA9685_REG_CH_NUM][PCA9685_REG_CH_LEN];
+    pca9685_ch_regs_fill(regs[channel], duty_cycle);
+    if (pca9685_ch_regs_commit(handle, regs, 1U << channel) != ERR_OK)
     {
-        log_error("Channel %u does not exist", channel);
+        alog_error("Failed to write duty cycle to the channel registers");
         return ERR_CRIT;
     }
-    if (pulse_frac < 0 || pulse_frac > 1)
+    return ERR_OK;
+}
+
+error_t pca9685_frame_commit(pca9685_handle_t *const handle, uint16_t const duty_cycle[PCA9685_REG_CH_NUM])
+{
+    return pca9685_frame_commit_mask(handle, duty_cycle, PCA9685_REG_CH_MASK_ALL);
+}
+
+error_t pca9685_frame_commit_mask(pca9685_handle_t *const handle, uint16_t const duty_cycle[PCA9685_REG_CH_NUM], uint16_t const ch_mask)
+{
+    uint8_t regs[PCA9685_REG_CH_NUM][PCA9685_REG_CH_LEN];
+    for (uint8_t ch_i = 0; ch_i < PCA9685_REG_CH_NUM; ch_i++)
+    {
+        pca9685_ch_regs_fill(regs[ch_i], duty_cycle[ch_i]);
+    }
+    if (pca9685_ch_regs_commit(handle, regs, ch_mask) != ERR_OK)
     {
-        log_error("Pulse fraction is not in the range 0 to 1");
+        alog_error("Failed to write the channel registers");
         return ERR_CRIT;
     }
-    float real_pulse_frac = 0.0f;
-    if (CH_PULSE_LENGTH[channel][2])
+    return ERR_OK;
+}
+
+int pca9685_ch_committed_get(pca9685_handle_t const *const handle, uint8_t const channel, uint16_t *const duty_cycle)
+{
+    if (channel >= PCA9685_REG_CH_NUM || (handle->shadow_valid & (1U << channel)) == 0)
     {
-        real_pulse_frac = 1.0 - pulse_frac;
+        return -1;
     }
-    else
+    uint8_t const *const regs = handle->shadow[channel];
+    *duty_cycle = regs[2] | ((regs[3] & 0x1fU) << 8);
+    return 0;
+}
+
+error_t pca9685_group_join(pca9685_handle_t *const handle, pca9685_reg_t const subaddr_reg, uint8_t const group_addr)
+{
+    uint8_t sub_bit;
+    switch (subaddr_reg)
     {
-        real_pulse_frac = pulse_frac;
+    case PCA9685_REG_SUBADDR1:
+        sub_bit = PCA9685_REG_MODE1_SUB1;
+        break;
+    case PCA9685_REG_SUBADDR2:
+        sub_bit = PCA9685_REG_MODE1_SUB2;
+        break;
+    case PCA9685_REG_SUBADDR3:
+        sub_bit = PCA9685_REG_MODE1_SUB3;
+        break;
+    default:
+        log_error("Register 0x%02x is not a sub-address register", subaddr_reg);
+        return ERR_CRIT;
     }
-    uint16_t const duty_cycle = CH_PULSE_LENGTH[channel][0] + ((CH_PULSE_LENGTH[channel][1] - CH_PULSE_LENGTH[channel][0]) * real_pulse_frac);
-    return pca9685_ch_raw_set(handle, channel, duty_cycle);
+    /* Sub-address registers hold the address in their upper 7 bits. */
+    if (pca9685_reg_write(handle, handle->addr, subaddr_reg, group_addr << 1) != ERR_OK ||
+        pca9685_reg_write(handle, handle->addr, PCA9685_REG_MODE1, handle->mode1 | sub_bit) != ERR_OK)
+    {
+        log_error("Failed to join group address 0x%02x", group_addr);
+        return ERR_I2C_WRITE;
+    }
+    handle->mode1 |= sub_bit;
+    return ERR_OK;
 }
 
-error_t pca9685_ch_raw_set(pca9685_handle_t *const handle, uint8_t const channel, uint16_t const duty_cycle)
+error_t pca9685_group_frame_commit(pca9685_handle_t *const *const members, uint8_t const member_num, uint8_t const group_addr, uint16_t const duty_cycle[PCA9685_REG_CH_NUM])
 {
-    uint8_t data[4] = {0, 0, duty_cycle & 0x00ff, (duty_cycle & 0x0f00) >> 8};
-    if (i2c_cmd_write(handle->fd, PCA9685_ADDR, PCA9685_REG_CH(channel, PCA9685_REG_CH_ON, PCA9685_REG_CH_LOW), &(data[0]), 1) != ERR_OK ||
-        i2c_cmd_write(handle->fd, PCA9685_ADDR, PCA9685_REG_CH(channel, PCA9685_REG_CH_ON, PCA9685_REG_CH_HIGH), &(data[1]), 1) != ERR_OK ||
-        i2c_cmd_write(handle->fd, PCA9685_ADDR, PCA9685_REG_CH(channel, PCA9685_REG_CH_OFF, PCA9685_REG_CH_LOW), &(data[2]), 1) != ERR_OK ||
-        i2c_cmd_write(handle->fd, PCA9685_ADDR, PCA9685_REG_CH(channel, PCA9685_REG_CH_OFF, PCA9685_REG_CH_HIGH), &(data[3]), 1) != ERR_OK)
+    return pca9685_group_frame_commit_mask(members, member_num, group_addr, duty_cycle, PCA9685_REG_CH_MASK_ALL);
+}
+
+error_t pca9685_group_frame_commit_mask(pca9685_handle_t *const *const members, uint8_t const member_num, uint8_t const group_addr,
+                                        uint16_t const duty_cycle[PCA9685_REG_CH_NUM], uint16_t const ch_mask)
+{
+    if (member_num == 0)
     {
-        log_error("Failed to write duty cycle to the channel registers");
+        return ERR_OK;
+    }
+    uint8_t regs[PCA9685_REG_CH_NUM][PCA9685_REG_CH_LEN];
+    for (uint8_t ch_i = 0; ch_i < PCA9685_REG_CH_NUM; ch_i++)
+    {
+        pca9685_ch_regs_fill(regs[ch_i], duty_cycle[ch_i]);
+    }
+    uint16_t dirty = 0;
+    for (uint8_t member_i = 0; member_i < member_num; member_i++)
+    {
+        dirty |= pca9685_ch_dirty_get(members[member_i], regs, ch_mask);
+    }
+    if (dirty != 0 && pca9685_ch_runs_write(members[0], group_addr, regs, dirty) != ERR_OK)
+    {
+        for (uint8_t member_i = 0; member_i < member_num; member_i++)
+        {
+            members[member_i]->shadow_valid &= ~dirty;
+        }
+        alog_error("Failed to write the channel registers of group 0x%02x", group_addr);
         return ERR_CRIT;
     }
+    for (uint8_t member_i = 0; member_i < member_num; member_i++)
+    {
+        pca9685_shadow_update(members[member_i], regs, ch_mask, dirty);
+    }
+    return ERR_OK;
+}
+
+/**
+ * @brief Write the ALL_LED registers of several chips with a single transfer to their group address
+ * and note the result in the shadow copy of every channel.
+ * @return Status code.
+ */
+static error_t pca9685_group_all_write(pca9685_handle_t *const *const members, uint8_t const member_num, uint8_t const group_addr,
+                                       uint8_t const regs[PCA9685_REG_CH_LEN])
+{
+    if (member_num == 0)
+    {
+        return ERR_OK;
+    }
+    uint8_t buf[1 + PCA9685_REG_CH_LEN] = {PCA9685_REG_ALL(PCA9685_REG_CH_ON, PCA9685_REG_CH_LOW)};
+    memcpy(&(buf[1]), regs, PCA9685_REG_CH_LEN);
+    struct i2c_msg msg = {.addr = group_addr, .flags = 0, .len = sizeof(buf), .buf = buf};
+    if (pca9685_xfer(members[0], &msg, 1) != ERR_OK)
+    {
+        for (uint8_t member_i = 0; member_i < member_num; member_i++)
+        {
+            members[member_i]->shadow_valid = 0;
+        }
+        alog_error("Failed to write the outputs of group 0x%02x", group_addr);
+        return ERR_I2C_WRITE;
+    }
+    for (uint8_t member_i = 0; member_i < member_num; member_i++)
+    {
+        pca9685_handle_t *const member = members[member_i];
+        for (uint8_t ch_i = 0; ch_i < PCA9685_REG_CH_NUM; ch_i++)
+        {
+            memcpy(member->shadow[ch_i], regs, PCA9685_REG_CH_LEN);
+        }
+        member->shadow_valid = PCA9685_REG_CH_MASK_ALL;
+    }
+    members[0]->stats.xfer++;
+    members[0]->stats.msg++;
+    members[0]->stats.bytes += sizeof(buf);
     return ERR_OK;
 }
+
+error_t pca9685_group_all_set(pca9685_handle_t *const *const members, uint8_t const member_num, uint8_t const group_addr, uint16_t const duty_cycle)
+{
+    uint8_t regs[PCA9685_REG_CH_LEN];
+    pca9685_ch_regs_fill(regs, duty_cycle);
+    return pca9685_group_all_write(members, member_num, group_addr, regs);
+}
+
+error_t pca9685_group_all_off(pca9685_handle_t *const *const members, uint8_t const member_num, uint8_t const group_addr)
+{
+    /* Full OFF bit of OFF_H takes precedence over everything else. */
+    uint8_t const regs[PCA9685_REG_CH_LEN] = {0, 0, 0, 0x10U};
+    return pca9685_group_all_write(members, member_num, group_addr, regs);
+}
@@ -4,9 +4,24 @@
 #include <stdint.h>
 #include "tco_libd.h"
 
+#include "bus.h"
+
 #define PCA9685_ADDR 0x40
+#define PCA9685_OSC_FREQ 25000000 /* 25 MHz */
+#define PCA9685_OSC_FREQ_MAX 50000000U /* Fastest clock EXTCLK takes. */
+#define PCA9685_PWM_FREQ_DEFAULT 50U /* Hz */
+#define PCA9685_PWM_FREQ_MIN 24U     /* Slowest PWM the prescale allows with the internal oscillator. */
+#define PCA9685_PWM_FREQ_MAX 1526U   /* Fastest PWM the prescale allows with the internal oscillator. */
+#define PCA9685_PRESCALE_MIN 3U
+#define PCA9685_PRESCALE_MAX 255U
+#define PCA9685_ALLCALL_ADDR 0x70 /* Power-on value of ALLCALLADDR. */
+#define PCA9685_SUBADDR1_ADDR 0x71 /* Power-on value of SUBADDR1. */
 #define PCA9685_RESET_ADDR 0x0
 #define PCA9685_REG_CH_NUM 16U
+#define PCA9685_REG_CH_LEN 4U /* ON_L, ON_H, OFF_L, OFF_H. */
+#define PCA9685_REG_LED0 0x06U
+#define PCA9685_REG_CH_MASK_ALL 0xffffU
+#define PCA9685_WAKE_US 500U /* Oscillator start-up time after SLEEP is cleared, before RESTART may be set. */
 
 /* PCA9685 hardware definition. */
 typedef enum pca9685_reg_off_t
@@ -40,7 +55,7 @@ typedef enum pca9685_reg_mode1_t
     PCA9685_REG_MODE1_AUTOINC = 0x20U, /* Autoincrement address in control register after each access (1). */
     PCA9685_REG_MODE1_EXTCLK = 0x40U,  /* Use internal(0) or external(1) clock for PWM. */
     PCA9685_REG_MODE1_RESTART = 0x80U, /* Used to restart PWM channels after SLEEP (1). */
-    PCA9685_REG_PRESCALE = 0xfeU,      /* prescale = (PCA9685_OSC_FREQ/(4096 * desired_freq)) - 1. */
+    PCA9685_REG_PRESCALE = 0xfeU,      /* prescale = round(osc_freq/(4096 * desired_freq)) - 1. */
     PCA9685_REG_TESTMODE = 0xffU
 } pca9685_reg_mode1_t;
 
@@ -55,11 +70,33 @@ typedef enum pca9685_reg_mode2_t
     PCA9685_REG_MODE2_INVRT = 0x10U   /* Use inverted channel register bits to determine duty cycle (1). */
 } pca9685_reg_mode2_t;
 
+/* Bus usage counters of a PCA9685 interface. */
+typedef struct pca9685_stats_t
+{
+    uint64_t ch_written; /* Channels whose registers were sent to the chip. */
+    uint64_t ch_skipped; /* Channel writes dropped because the chip already had those values. */
+    uint64_t xfer;       /* I2C_RDWR transfers issued for channel writes. */
+    uint64_t msg;        /* Register runs (one I2C message each) across all transfers. */
+    uint64_t bytes;      /* Bytes written including register address bytes. */
+    uint64_t retries;    /* Transfers repeated because they failed. */
+    uint64_t failures;   /* Transfers that still failed after all retries. */
+} pca9685_stats_t;
+
 /* This holds state of the PCA9685 interface. */
 typedef struct pca9685_handle_t
 {
-    int fd;
+    bus_t bus;       /* Opened by the user before "pca9685_init". */
+    uint8_t addr;    /* Set by the user before "pca9685_init". */
+    uint32_t pwm_hz; /* Set by the user before "pca9685_init", 0 for PCA9685_PWM_FREQ_DEFAULT. */
+    uint32_t osc_hz; /* Set by the user before "pca9685_init" if measured, 0 for PCA9685_OSC_FREQ. */
+    uint8_t retry_max;         /* Times a failed transfer is repeated, 0 to give up right away. */
+    uint32_t retry_backoff_us; /* Wait before the first repeat, doubled for every further one. */
+    uint8_t mode1;
     uint8_t prescale;
+    uint64_t restart_ns; /* CLOCK_MONOTONIC time the PWM counter was last restarted, 0 if unknown. */
+    uint8_t shadow[PCA9685_REG_CH_NUM][PCA9685_REG_CH_LEN]; /* Last ON/OFF register values written. */
+    uint16_t shadow_valid;                                  /* Bit per channel, set if shadow matches the chip. */
+    pca9685_stats_t stats;
 } pca9685_handle_t;
 
 /**
@@ -70,20 +107,90 @@ typedef struct pca9685_handle_t
 error_t pca9685_init(pca9685_handle_t *const handle);
 
 /**
- * @brief Resets the chip and put it into sleep mode.
+ * @brief Configures a chip that was reset. Unlike "pca9685_init", other chips on the bus are not
+ * touched which allows setting up several chips after a single "pca9685_reset".
+ * @param handle Pointer to the interface handle struct.
+ * @return Status code.
+ */
+error_t pca9685_configure(pca9685_handle_t *const handle);
+
+/**
+ * @brief Resets the chip and put it into sleep mode. The reset goes to the general call address so
+ * every PCA9685 on the bus gets reset.
  * @param handle Pointer to the interface handle struct.
  * @return Status code.
  */
 error_t pca9685_reset(pca9685_handle_t *const handle);
 
 /**
- * @brief A simple interface function to set the duty cycle for a specified channel by specifying a pulse fraction.
+ * @brief Take over a chip that already runs with the configuration "pca9685_configure" would give
+ * it, leaving its outputs alone. MODE1, MODE2 and PRESCALE are read back in one transfer and, if
+ * they match, the channel registers are read into the shadow copy with a second one. The PWM phase
+ * stays unknown.
+ * @param handle Pointer to the interface handle struct, set up as for "pca9685_init".
+ * @param adopted Set to 1 if the chip was taken over and to 0 if it needs "pca9685_init".
+ * @return Status code.
+ */
+error_t pca9685_adopt(pca9685_handle_t *const handle, uint8_t *const adopted);
+
+/**
+ * @brief Stop the oscillator of a running chip to save power. The channel registers keep their
+ * values and the outputs stop until "pca9685_wake" and "pca9685_restart". The PWM phase is lost.
  * @param handle Pointer to the interface handle struct.
- * @param num_ch Number of the channel to modify.
- * @param pulse_frac Pulse fraction of the desired signal. 0:0%, 1:100.
- * @return 0 on success, -1 on failure.
+ * @return Status code.
+ */
+error_t pca9685_sleep(pca9685_handle_t *const handle);
+
+/**
+ * @brief Start the oscillator of a chip put to sleep by "pca9685_sleep". "pca9685_restart" may only
+ * follow PCA9685_WAKE_US later, which lets the wait cover several chips.
+ * @param handle Pointer to the interface handle struct.
+ * @return Status code.
+ */
+error_t pca9685_wake(pca9685_handle_t *const handle);
+
+/**
+ * @brief Restart the PWM channels of a chip woken by "pca9685_wake" with the values they had
+ * before it slept.
+ * @param handle Pointer to the interface handle struct.
+ * @return Status code.
  */
-error_t pca9685_ch_frac_set(pca9685_handle_t *const handle, uint8_t const num_ch, float const pulse_frac);
+error_t pca9685_restart(pca9685_handle_t *const handle);
+
+/**
+ * @brief Check if the chip still has the configuration it was given, by reading back MODE1 and
+ * PRESCALE in a single transfer. A chip that browned out comes back asleep with the default prescale.
+ * @param handle Pointer to the interface handle struct.
+ * @param lost Set to 1 if the configuration was lost and to 0 otherwise.
+ * @return Status code.
+ */
+error_t pca9685_config_check(pca9685_handle_t *const handle, uint8_t *const lost);
+
+/**
+ * @brief Get the prescale that comes closest to a PWM frequency. Passing the measured oscillator
+ * frequency corrects for the drift of the chip's oscillator.
+ * @param osc_hz Frequency of the chip oscillator, measured or PCA9685_OSC_FREQ.
+ * @param pwm_hz Desired PWM frequency.
+ * @return Prescale, clamped to what the chip accepts.
+ */
+uint8_t pca9685_prescale_calc(uint32_t const osc_hz, uint32_t const pwm_hz);
+
+/**
+ * @brief Get the length of one of the 4096 counts of a PWM period.
+ * @param osc_hz Frequency of the chip oscillator, measured or PCA9685_OSC_FREQ.
+ * @param prescale Prescale of the chip.
+ * @return Length of a count in picoseconds.
+ */
+uint32_t pca9685_count_ps(uint32_t const osc_hz, uint8_t const prescale);
+
+/**
+ * @brief Estimate when a PWM period of the chip starts, counting whole periods from the time its
+ * counter was restarted.
+ * @param handle Pointer to the interface handle struct.
+ * @param after_ns CLOCK_MONOTONIC time in ns.
+ * @return Start of the first period at or after @p after_ns or 0 if the phase is unknown.
+ */
+uint64_t pca9685_period_next(pca9685_handle_t const *const handle, uint64_t const after_ns);
 
 /**
  * @brief A simple interface function to set the duty cycle for a specified channel.
@@ -94,4 +201,88 @@ error_t pca9685_ch_frac_set(pca9685_handle_t *const handle, uint8_t const num_ch
  */
 error_t pca9685_ch_raw_set(pca9685_handle_t *const handle, uint8_t const channel, uint16_t const duty_cycle);
 
+/**
+ * @brief Make the chip also respond to a group address so several chips on the same bus can be
+ * written at once with "pca9685_group_frame_commit".
+ * @param handle Pointer to the interface handle struct.
+ * @param subaddr_reg One of PCA9685_REG_SUBADDR1, PCA9685_REG_SUBADDR2 or PCA9685_REG_SUBADDR3.
+ * @param group_addr 7-bit group address.
+ * @return Status code.
+ */
+error_t pca9685_group_join(pca9685_handle_t *const handle, pca9685_reg_t const subaddr_reg, uint8_t const group_addr);
+
+/**
+ * @brief Write the duty cycles of all channels in a single I2C transfer. Only channels that differ
+ * from what was last written are sent, grouped into contiguous auto-increment register runs. Since
+ * outputs are configured to change on STOP, all channels switch to the new values in the same PWM
+ * period.
+ * @param handle Pointer to the interface handle struct.
+ * @param duty_cycle Duty cycle for each channel. 0:0%, >=(2^12)-1:100%.
+ * @return Status code.
+ */
+error_t pca9685_frame_commit(pca9685_handle_t *const handle, uint16_t const duty_cycle[PCA9685_REG_CH_NUM]);
+
+/**
+ * @brief Like "pca9685_frame_commit" but channels outside @p ch_mask are left alone.
+ * @param handle Pointer to the interface handle struct.
+ * @param duty_cycle Duty cycle for each channel, only those in @p ch_mask are used.
+ * @param ch_mask Bit per channel selecting which channels to write.
+ * @return Status code.
+ */
+error_t pca9685_frame_commit_mask(pca9685_handle_t *const handle, uint16_t const duty_cycle[PCA9685_REG_CH_NUM], uint16_t const ch_mask);
+
+/**
+ * @brief Get the duty cycle last committed to a channel, from the shadow copy of the chip.
+ * @param handle Pointer to the interface handle struct.
+ * @param channel Channel of the chip.
+ * @param duty_cycle Where the duty cycle gets written.
+ * @return 0 on success and -1 if nothing was committed to the channel since the chip was reset.
+ */
+int pca9685_ch_committed_get(pca9685_handle_t const *const handle, uint8_t const channel, uint16_t *const duty_cycle);
+
+/**
+ * @brief Write the same duty cycles to several chips in a single I2C transfer to their group
+ * address. Channels that any member is missing are sent, the rest are skipped like in
+ * "pca9685_frame_commit". Transfer counters are kept on the first member.
+ * @param members Chips that joined @p group_addr, all on the same bus.
+ * @param member_num Number of elements in @p members.
+ * @param group_addr 7-bit group address the members joined with "pca9685_group_join".
+ * @param duty_cycle Duty cycle for each channel. 0:0%, >=(2^12)-1:100%.
+ * @return Status code.
+ */
+error_t pca9685_group_frame_commit(pca9685_handle_t *const *const members, uint8_t const member_num, uint8_t const group_addr, uint16_t const duty_cycle[PCA9685_REG_CH_NUM]);
+
+/**
+ * @brief Like "pca9685_group_frame_commit" but channels outside @p ch_mask are left alone.
+ * @param members Chips that joined @p group_addr, all on the same bus.
+ * @param member_num Number of elements in @p members.
+ * @param group_addr 7-bit group address the members joined with "pca9685_group_join".
+ * @param duty_cycle Duty cycle for each channel, only those in @p ch_mask are used.
+ * @param ch_mask Bit per channel selecting which channels to write.
+ * @return Status code.
+ */
+error_t pca9685_group_frame_commit_mask(pca9685_handle_t *const *const members, uint8_t const member_num, uint8_t const group_addr,
+                                        uint16_t const duty_cycle[PCA9685_REG_CH_NUM], uint16_t const ch_mask);
+
+/**
+ * @brief Write the same duty cycle to every channel of several chips with a single write of the
+ * ALL_LED registers to their group address.
+ * @param members Chips that respond to @p group_addr, all on the same bus.
+ * @param member_num Number of elements in @p members.
+ * @param group_addr 7-bit group address e.g. PCA9685_ALLCALL_ADDR.
+ * @param duty_cycle Duty cycle for every channel.
+ * @return Status code.
+ */
+error_t pca9685_group_all_set(pca9685_handle_t *const *const members, uint8_t const member_num, uint8_t const group_addr, uint16_t const duty_cycle);
+
+/**
+ * @brief Turn every channel of several chips fully off with a single write of the ALL_LED registers
+ * to their group address. This is the shortest transfer that makes all outputs safe.
+ * @param members Chips that respond to @p group_addr, all on the same bus.
+ * @param member_num Number of elements in @p members.
+ * @param group_addr 7-bit group address e.g. PCA9685_ALLCALL_ADDR.
+ * @return Status code.
+ */
+error_t pca9685_group_all_off(pca9685_handle_t *const *const members, uint8_t const member_num, uint8_t const group_addr);
+
 #endif /* _PCA9685_H_ */
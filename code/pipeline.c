@@ -0,0 +1,193 @@
+#include <time.h>
+
+#include "pipeline.h"
+#include "actuator.h"
+#include "ctrl.h"
+#include "telem.h"
+#include "trace.h"
+#include "loop.h"
+#include "override.h"
+#include "alog.h"
+#include "ch_cfg.h"
+
+static uint8_t estop_done = 0; /* Set once the e-stop for the current emergency succeeded. */
+static uint64_t idle_after_ns = 0;     /* Inactivity before the chips are put to sleep, 0 if never. */
+static uint32_t idle_poll_ns = 0;      /* Tick period while asleep, 0 for none. */
+static uint64_t inactive_since_ns = 0; /* When the first of the current run of inactive frames came. */
+static uint8_t idle = 0;               /* Set while the chips sleep. */
+
+static uint64_t pipeline_now_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((uint64_t)now.tv_sec * 1000000000U) + now.tv_nsec;
+}
+
+void pipeline_idle_set(uint32_t const idle_ms, uint32_t const poll_ms)
+{
+    idle_after_ns = (uint64_t)idle_ms * 1000000U;
+    idle_poll_ns = poll_ms * 1000000U;
+    inactive_since_ns = 0;
+    idle = 0;
+}
+
+/**
+ * @brief Put the chips to sleep and slow down or stop the ticks once frames stayed inactive long
+ * enough, and go back to ticking on the first active frame. Applying that frame wakes the chips.
+ * @param ctrl Control frame about to be applied.
+ * @param stale 1 if the frame is stale, which leaves its channels neutral.
+ * @param overridden 1 if channels are overridden, which counts as activity.
+ * @return 1 if the chips sleep and the frame must not be applied and 0 otherwise.
+ */
+static uint8_t pipeline_idle(struct tco_shmem_data_control const *const ctrl, uint8_t const stale, uint8_t const overridden)
+{
+    if (idle_after_ns == 0)
+    {
+        return 0;
+    }
+    uint8_t active = ctrl->emergency || overridden;
+    for (uint8_t ch_i = 0; ch_i < sizeof(ctrl->ch) / sizeof(ctrl->ch[0]) && !active && !stale; ch_i++)
+    {
+        active = ctrl->ch[ch_i].active > 0;
+    }
+    if (active)
+    {
+        inactive_since_ns = 0;
+        if (idle)
+        {
+            idle = 0;
+            loop_tick_resume();
+            alog_info("Control input is active again, waking up");
+        }
+        return 0;
+    }
+    if (idle)
+    {
+        return 1;
+    }
+    uint64_t const now = pipeline_now_ns();
+    if (inactive_since_ns == 0)
+    {
+        inactive_since_ns = now;
+    }
+    /* The frame that was applied last already put every output in neutral. */
+    if (now - inactive_since_ns < idle_after_ns || actr_sleep() != 0)
+    {
+        return 0;
+    }
+    idle = 1;
+    loop_tick_idle(idle_poll_ns);
+    alog_info("Control input was inactive for %llu ms, putting the chips to sleep", (unsigned long long)(idle_after_ns / 1000000U));
+    return 1;
+}
+
+int pipeline_apply(struct tco_shmem_data_control const *const ctrl, uint8_t const stale)
+{
+    if (ctrl->emergency)
+    {
+        if (!estop_done)
+        {
+            estop_done = actr_estop() == 0; /* Retried on the next frame if it failed. */
+        }
+        return 0;
+    }
+    estop_done = 0;
+    actr_estop_cancel();
+
+    uint8_t const ctrl_ch_count = sizeof(ctrl->ch) / sizeof(ctrl->ch[0]);
+    float frame[sizeof(ctrl->ch) / sizeof(ctrl->ch[0])];
+    for (uint8_t ch_i = 0; ch_i < ctrl_ch_count; ch_i++)
+    {
+        if (ctrl->ch[ch_i].active > 0 && stale == 0)
+        {
+            frame[ch_i] = ctrl->ch[ch_i].pulse_frac;
+        }
+        else
+        {
+            frame[ch_i] = ACTR_FRAC_NEUTRAL;
+        }
+    }
+    actr_frame_set(frame, ctrl_ch_count);
+    return 0;
+}
+
+int pipeline_process(struct tco_shmem_data_control const *const ctrl, uint8_t const stale, uint32_t const telem_flags)
+{
+    uint8_t const overridden = override_poll();
+    int status = 0;
+    if (pipeline_idle(ctrl, stale, overridden))
+    {
+        ch_cfg_quiesce(); /* No frame gets ingested while asleep, which would otherwise let go of replaced tables. */
+    }
+    else
+    {
+        status = pipeline_apply(ctrl, stale);
+    }
+    uint32_t const flags = telem_flags | (stale ? TELEM_FLAG_STALE : 0) | (ctrl->emergency ? TELEM_FLAG_EMERGENCY : 0) |
+                           (overridden ? TELEM_FLAG_OVERRIDE : 0);
+    telem_record(flags);
+    trace_record(ctrl, flags);
+    return status;
+}
+
+/**
+ * @brief Read the latest control frame and process it.
+ * @param telem_flags Telemetry flags describing why the frame is applied.
+ * @return 0 on success and -1 on failure.
+ */
+static int pipeline_run(uint32_t const telem_flags)
+{
+    struct tco_shmem_data_control ctrl_cpy;
+    uint8_t stale;
+    if (ctrl_read(&ctrl_cpy, &stale) != 0)
+    {
+        return -1;
+    }
+    return pipeline_process(&ctrl_cpy, stale, telem_flags);
+}
+
+int pipeline_tick(void *arg)
+{
+    (void)arg;
+    return pipeline_run(0);
+}
+
+int pipeline_wake(void *arg)
+{
+    (void)arg;
+    ctrl_wake_clear();
+    return pipeline_run(TELEM_FLAG_WAKE);
+}
+
+int pipeline_sync(void *arg)
+{
+    (void)arg;
+    actr_sync_clear();
+    return pipeline_run(TELEM_FLAG_SYNC);
+}
+
+int pipeline_deadline(void *arg)
+{
+    (void)arg;
+    ctrl_deadline_clear();
+    return pipeline_run(TELEM_FLAG_DEADLINE);
+}
+
+int pipeline_replay(void *arg)
+{
+    (void)arg;
+    struct trace_rec const *rec;
+    while ((rec = trace_replay_next()) != NULL)
+    {
+        if (pipeline_process(&(rec->ctrl), (rec->flags & TELEM_FLAG_STALE) != 0, rec->flags & (TELEM_FLAG_WAKE | TELEM_FLAG_SYNC | TELEM_FLAG_DEADLINE)) != 0)
+        {
+            return -1;
+        }
+        trace_replay_verify(rec);
+    }
+    if (trace_replay_done())
+    {
+        loop_stop();
+    }
+    return 0;
+}
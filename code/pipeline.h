@@ -0,0 +1,80 @@
+#ifndef _PIPELINE_H_
+#define _PIPELINE_H_
+
+#include <stdint.h>
+
+#include "tco_shmem.h"
+
+#define PIPELINE_IDLE_POLL_MS 100U /* Tick period while idle for overrides and producers that may not ring the doorbell. */
+
+/**
+ * @brief Turn a control frame into actuator outputs and commit them. Inactive channels and stale
+ * frames put outputs in their calibrated neutral position. The first emergency frame triggers an
+ * e-stop and outputs are left alone until a frame without the emergency flag arrives.
+ * @param ctrl Control frame to apply.
+ * @param stale 1 if the frame is stale and 0 otherwise.
+ * @return 0 on success and -1 on failure.
+ */
+int pipeline_apply(struct tco_shmem_data_control const *const ctrl, uint8_t const stale);
+
+/**
+ * @brief Enable the idle state. Once every channel of the frames read stayed inactive for @p idle_ms
+ * with no emergency and no override, the chips are put to sleep and the loop ticks every @p poll_ms
+ * instead, or not at all if 0 so that only producer wakeups get it going. The first active frame
+ * wakes the chips and brings back the configured tick rate. Inactive frames read while asleep are not
+ * applied, which would wake the chips.
+ * @param idle_ms Inactivity before sleeping, 0 to stay awake.
+ * @param poll_ms Tick period while asleep, 0 for none.
+ */
+void pipeline_idle_set(uint32_t const idle_ms, uint32_t const poll_ms);
+
+/**
+ * @brief Apply a control frame and record it in telemetry and, if recording, in the trace.
+ * @param ctrl Control frame to apply.
+ * @param stale 1 if the frame is stale and 0 otherwise.
+ * @param telem_flags Telemetry flags describing why the frame is applied.
+ * @return 0 on success and -1 on failure.
+ */
+int pipeline_process(struct tco_shmem_data_control const *const ctrl, uint8_t const stale, uint32_t const telem_flags);
+
+/**
+ * @brief Event loop tick callback. Reads the latest control frame, applies it and appends a
+ * telemetry record.
+ * @param arg Unused.
+ * @return 0 on success and -1 on failure.
+ */
+int pipeline_tick(void *arg);
+
+/**
+ * @brief Event loop callback for producer wakeups. Clears the wakeup and applies the latest frame
+ * without waiting for the next tick.
+ * @param arg Unused.
+ * @return 0 on success and -1 on failure.
+ */
+int pipeline_wake(void *arg);
+
+/**
+ * @brief Event loop callback for the PWM period signal of the actuators. Clears the signal and
+ * applies the latest frame so it is written just before the period starts.
+ * @param arg Unused.
+ * @return 0 on success and -1 on failure.
+ */
+int pipeline_sync(void *arg);
+
+/**
+ * @brief Event loop callback for the trajectory deadline timer. Clears the timer and applies the
+ * trajectory point that came due right away instead of on the next tick.
+ * @param arg Unused.
+ * @return 0 on success and -1 on failure.
+ */
+int pipeline_deadline(void *arg);
+
+/**
+ * @brief Event loop callback for the replay timer. Applies every recorded frame that is due, checks
+ * it still gives the recorded outputs and stops the loop after the last one.
+ * @param arg Unused.
+ * @return 0 on success and -1 on failure.
+ */
+int pipeline_replay(void *arg);
+
+#endif /* _PIPELINE_H_ */
@@ -0,0 +1,194 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+
+#include "pwm_sysfs.h"
+#include "alog.h"
+
+/**
+ * @brief Write a whole attribute file.
+ * @return 0 on success and -1 on failure with errno set.
+ */
+static int pwm_sysfs_write(char const *const path, char const *const val)
+{
+    int const fd = open(path, O_WRONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        return -1;
+    }
+    size_t const len = strlen(val);
+    ssize_t const written = write(fd, val, len);
+    int const err = errno;
+    close(fd);
+    errno = err;
+    return written == (ssize_t)len ? 0 : -1;
+}
+
+/**
+ * @brief Unexport a channel that "pwm_sysfs_open" exported.
+ */
+static void pwm_sysfs_unexport(pwm_sysfs_t *const pwm)
+{
+    if (!pwm->exported)
+    {
+        return;
+    }
+    char path[PATH_MAX];
+    char val[16];
+    snprintf(path, sizeof(path), "%s/pwmchip%u/unexport", pwm->root, pwm->chip);
+    snprintf(val, sizeof(val), "%u\n", pwm->channel);
+    if (pwm_sysfs_write(path, val) != 0)
+    {
+        log_error("Failed to unexport channel %u of pwmchip%u: %s", pwm->channel, pwm->chip, strerror(errno));
+    }
+    pwm->exported = 0;
+}
+
+/**
+ * @brief Read a number from an attribute file.
+ * @return 0 on success and -1 on failure.
+ */
+static int pwm_sysfs_read_u32(char const *const path, uint32_t *const val)
+{
+    int const fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        return -1;
+    }
+    char buf[16];
+    ssize_t const len = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (len <= 0)
+    {
+        return -1;
+    }
+    buf[len] = '\0';
+    char *end = NULL;
+    *val = strtoul(buf, &end, 10);
+    return end == buf ? -1 : 0;
+}
+
+error_t pwm_sysfs_open(char const *const root, uint16_t const chip, uint16_t const channel, uint32_t const period_ns, pwm_sysfs_t *const pwm)
+{
+    memset(pwm, 0, sizeof(pwm_sysfs_t));
+    pwm->root = root;
+    pwm->chip = chip;
+    pwm->channel = channel;
+    pwm->duty_fd = -1;
+    pwm->enable_fd = -1;
+    pwm->period_ns = period_ns;
+
+    char dir[PATH_MAX - 16]; /* Leaves room for the attribute names in 'path'. */
+    char path[PATH_MAX];
+    char val[16];
+    snprintf(dir, sizeof(dir), "%s/pwmchip%u/pwm%u", root, chip, channel);
+    if (access(dir, F_OK) != 0)
+    {
+        snprintf(path, sizeof(path), "%s/pwmchip%u/export", root, chip);
+        snprintf(val, sizeof(val), "%u\n", channel);
+        if (pwm_sysfs_write(path, val) != 0)
+        {
+            log_error("Failed to export channel %u of pwmchip%u: %s", channel, chip, strerror(errno));
+            return ERR_CRIT;
+        }
+        pwm->exported = 1;
+        for (uint32_t wait_ms = 0; access(dir, F_OK) != 0; wait_ms++)
+        {
+            if (wait_ms >= PWM_SYSFS_EXPORT_WAIT_MS)
+            {
+                log_error("%s did not appear after exporting it", dir);
+                pwm_sysfs_unexport(pwm);
+                return ERR_CRIT;
+            }
+            usleep(1000);
+        }
+    }
+
+    uint32_t period_now;
+    snprintf(path, sizeof(path), "%s/period", dir);
+    if (pwm_sysfs_read_u32(path, &period_now) != 0 || period_now != period_ns)
+    {
+        snprintf(val, sizeof(val), "%u\n", period_ns);
+        if (pwm_sysfs_write(path, val) != 0)
+        {
+            /* The kernel refuses a period shorter than the duty cycle, so drop that first. */
+            char duty_path[PATH_MAX];
+            snprintf(duty_path, sizeof(duty_path), "%s/duty_cycle", dir);
+            if (pwm_sysfs_write(duty_path, "0\n") != 0 || pwm_sysfs_write(path, val) != 0)
+            {
+                log_error("Failed to set the period of %s to %u ns: %s", dir, period_ns, strerror(errno));
+                pwm_sysfs_unexport(pwm);
+                return ERR_CRIT;
+            }
+        }
+    }
+
+    snprintf(path, sizeof(path), "%s/duty_cycle", dir);
+    if ((pwm->duty_fd = open(path, O_WRONLY | O_CLOEXEC)) == -1)
+    {
+        log_error("Failed to open %s: %s", path, strerror(errno));
+        pwm_sysfs_unexport(pwm);
+        return ERR_CRIT;
+    }
+    snprintf(path, sizeof(path), "%s/enable", dir);
+    if ((pwm->enable_fd = open(path, O_RDWR | O_CLOEXEC)) == -1)
+    {
+        log_error("Failed to open %s: %s", path, strerror(errno));
+        pwm_sysfs_close(pwm, 1);
+        return ERR_CRIT;
+    }
+    char enabled = '0';
+    if ((pread(pwm->enable_fd, &enabled, 1, 0) != 1 || enabled != '1') && pwrite(pwm->enable_fd, "1\n", 2, 0) != 2)
+    {
+        log_error("Failed to enable %s: %s", dir, strerror(errno));
+        pwm_sysfs_close(pwm, 1);
+        return ERR_CRIT;
+    }
+    return ERR_OK;
+}
+
+error_t pwm_sysfs_duty_set(pwm_sysfs_t *const pwm, uint32_t const duty_ns)
+{
+    if (pwm->duty_valid && pwm->duty_ns == duty_ns)
+    {
+        return ERR_OK;
+    }
+    char val[16];
+    int const len = snprintf(val, sizeof(val), "%u\n", duty_ns > pwm->period_ns ? pwm->period_ns : duty_ns);
+    if (pwrite(pwm->duty_fd, val, len, 0) != len)
+    {
+        pwm->duty_valid = 0;
+        alog_error("Failed to write a PWM duty cycle: %s", strerror(errno));
+        return ERR_CRIT;
+    }
+    pwm->duty_ns = duty_ns;
+    pwm->duty_valid = 1;
+    return ERR_OK;
+}
+
+void pwm_sysfs_close(pwm_sysfs_t *const pwm, uint8_t const disable)
+{
+    if (pwm->enable_fd != -1)
+    {
+        if (disable && pwrite(pwm->enable_fd, "0\n", 2, 0) != 2)
+        {
+            log_error("Failed to disable a PWM channel: %s", strerror(errno));
+        }
+        close(pwm->enable_fd);
+        pwm->enable_fd = -1;
+    }
+    if (pwm->duty_fd != -1)
+    {
+        close(pwm->duty_fd);
+        pwm->duty_fd = -1;
+    }
+    if (disable)
+    {
+        pwm_sysfs_unexport(pwm);
+    }
+    pwm->duty_valid = 0;
+}
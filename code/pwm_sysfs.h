@@ -0,0 +1,60 @@
+#ifndef _PWM_SYSFS_H_
+#define _PWM_SYSFS_H_
+
+#include <stdint.h>
+
+#include "tco_libd.h"
+
+/*
+PWM channels of the SoC exposed by the kernel PWM class. Channel N of chip C lives in
+'<root>/pwmchipC/pwmN' once N was written to '<root>/pwmchipC/export'. The duty cycle file stays
+open so an update is a single write, with no I2C in between.
+*/
+#define PWM_SYSFS_ROOT_DEFAULT "/sys/class/pwm"
+#define PWM_SYSFS_EXPORT_WAIT_MS 100U /* How long udev gets to create the channel directory. */
+
+/* This holds state of a kernel PWM channel. */
+typedef struct pwm_sysfs_t
+{
+    char const *root; /* Directory holding the pwmchipN directories. */
+    uint16_t chip;
+    uint16_t channel;
+    uint8_t exported; /* Set if the channel was exported when opening it. */
+    int duty_fd;
+    int enable_fd;
+    uint32_t period_ns;
+    uint32_t duty_ns;   /* Last duty cycle written. */
+    uint8_t duty_valid; /* Set once 'duty_ns' was written. */
+} pwm_sysfs_t;
+
+/**
+ * @brief Export a PWM channel if needed, set its period and enable it. A period or enable state the
+ * channel already has is left alone, so a channel that is running keeps its output. A channel this
+ * exported is unexported again if it fails.
+ * @param root Directory holding the pwmchipN directories, e.g. PWM_SYSFS_ROOT_DEFAULT or a copy of it
+ * made up for testing. Must stay valid until the channel is closed.
+ * @param chip Number of the PWM chip i.e. N in pwmchipN.
+ * @param channel Channel of the chip.
+ * @param period_ns Period of the PWM signal.
+ * @param pwm Where the channel state gets written.
+ * @return Status code.
+ */
+error_t pwm_sysfs_open(char const *const root, uint16_t const chip, uint16_t const channel, uint32_t const period_ns, pwm_sysfs_t *const pwm);
+
+/**
+ * @brief Set the duty cycle with a single write. Does nothing if the channel already has it.
+ * @param pwm Channel state.
+ * @param duty_ns Time the output is high each period, at most the period.
+ * @return Status code.
+ */
+error_t pwm_sysfs_duty_set(pwm_sysfs_t *const pwm, uint32_t const duty_ns);
+
+/**
+ * @brief Close the files of a channel.
+ * @param pwm Channel state.
+ * @param disable If >0, the channel is disabled first and unexported if "pwm_sysfs_open" exported it,
+ * otherwise it keeps its output.
+ */
+void pwm_sysfs_close(pwm_sysfs_t *const pwm, uint8_t const disable);
+
+#endif /* _PWM_SYSFS_H_ */
@@ -0,0 +1,96 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sched.h>
+#include <malloc.h>
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "tco_libd.h"
+
+#include "rt.h"
+
+/**
+ * @brief Touch a chunk of stack so its pages are resident before the loop starts.
+ */
+static void rt_stack_prefault(void)
+{
+    volatile uint8_t stack[RT_STACK_PREFAULT];
+    for (size_t byte_i = 0; byte_i < sizeof(stack); byte_i += 4096U)
+    {
+        stack[byte_i] = 0;
+    }
+}
+
+/**
+ * @brief Grow the heap and keep it so later allocations (e.g. in libraries) do not fault.
+ * @return 0 on success and -1 on failure.
+ */
+static int rt_heap_prefault(void)
+{
+    /* Never give memory back to the kernel and never serve allocations with fresh mmaps. */
+    if (mallopt(M_TRIM_THRESHOLD, -1) == 0 || mallopt(M_MMAP_MAX, 0) == 0)
+    {
+        log_error("Failed to configure malloc for real-time use");
+        return -1;
+    }
+    uint8_t *const heap = malloc(RT_HEAP_PREFAULT);
+    if (heap == NULL)
+    {
+        log_error("Failed to allocate %u bytes to prefault the heap", RT_HEAP_PREFAULT);
+        return -1;
+    }
+    for (size_t byte_i = 0; byte_i < RT_HEAP_PREFAULT; byte_i += 4096U)
+    {
+        heap[byte_i] = 0;
+    }
+    free(heap);
+    return 0;
+}
+
+int rt_init(rt_cfg_t const *const cfg)
+{
+    if (!cfg->enable)
+    {
+        return 0;
+    }
+
+    if (cfg->cpu >= 0)
+    {
+        /* Raw syscall since the glibc wrappers for CPU sets need _GNU_SOURCE. */
+        unsigned long mask[(RT_CPU_MAX + 1) / (8 * sizeof(unsigned long))] = {0};
+        if ((size_t)cfg->cpu >= sizeof(mask) * 8)
+        {
+            log_error("CPU %d is out of range", cfg->cpu);
+            return -1;
+        }
+        mask[cfg->cpu / (8 * sizeof(unsigned long))] |= 1UL << (cfg->cpu % (8 * sizeof(unsigned long)));
+        if (syscall(SYS_sched_setaffinity, 0, sizeof(mask), mask) == -1)
+        {
+            log_error("sched_setaffinity: %s", strerror(errno));
+            return -1;
+        }
+    }
+
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) == -1)
+    {
+        log_error("mlockall: %s", strerror(errno));
+        return -1;
+    }
+    if (rt_heap_prefault() != 0)
+    {
+        return -1;
+    }
+    rt_stack_prefault();
+
+    struct sched_param const param = {.sched_priority = cfg->prio};
+    if (sched_setscheduler(0, SCHED_FIFO, &param) == -1)
+    {
+        log_error("sched_setscheduler: %s", strerror(errno));
+        return -1;
+    }
+    log_info("Real-time mode: SCHED_FIFO priority %d, CPU %d, memory locked", cfg->prio, cfg->cpu);
+    return 0;
+}
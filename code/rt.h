@@ -0,0 +1,30 @@
+#ifndef _RT_H_
+#define _RT_H_
+
+#include <stdint.h>
+
+#define RT_PRIO_DEFAULT 80
+#define RT_PRIO_MIN 1
+#define RT_PRIO_MAX 99
+#define RT_CPU_MAX 1023 /* Highest core the affinity mask covers. */
+#define RT_STACK_PREFAULT (512U * 1024U) /* Bytes of stack touched up front. */
+#define RT_HEAP_PREFAULT (4U * 1024U * 1024U) /* Bytes of heap touched up front and kept. */
+
+/* Configuration of the real-time execution mode. */
+typedef struct rt_cfg_t
+{
+    uint8_t enable; /* If 0, "rt_init" does nothing. */
+    int prio;       /* SCHED_FIFO priority, RT_PRIO_MIN to RT_PRIO_MAX. */
+    int cpu;        /* Core to pin to or -1 to leave affinity alone. */
+} rt_cfg_t;
+
+/**
+ * @brief Switch the calling thread to SCHED_FIFO, pin it to a core, lock all memory and prefault
+ * the stack and heap so the control loop takes no page faults. Threads created afterwards inherit
+ * the policy and affinity.
+ * @param cfg Configuration of the real-time mode.
+ * @return 0 on success and -1 on failure.
+ */
+int rt_init(rt_cfg_t const *const cfg);
+
+#endif /* _RT_H_ */
@@ -0,0 +1,260 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "tco_libd.h"
+
+#include "telem.h"
+#include "actuator.h"
+#include "ctrl.h"
+#include "loop.h"
+
+/* Counters as of the previous record, to tell what happened in between. */
+typedef struct
+{
+    uint64_t ctrl_busy;
+    uint64_t overruns;
+    uint64_t errors;
+    uint64_t overwrites;
+    uint64_t busy_ns;
+} telem_last_t;
+
+static struct telem_shmem *telem = NULL;
+static uint64_t telem_head = 0;
+static uint16_t telem_ch_num = 0;
+static telem_last_t last = {0};
+
+static uint64_t telem_now_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((uint64_t)now.tv_sec * 1000000000U) + now.tv_nsec;
+}
+
+int telem_init(uint32_t const tick_period_ns, uint16_t const ch_num)
+{
+    /* Only the daemon may write, everybody else gets to read. */
+    int const fd = shm_open(TELEM_SHMEM_NAME, O_RDWR | O_CREAT, 0644);
+    if (fd == -1)
+    {
+        log_error("shm_open %s: %s", TELEM_SHMEM_NAME, strerror(errno));
+        return -1;
+    }
+    if (ftruncate(fd, TELEM_SHMEM_SIZE) == -1)
+    {
+        log_error("Failed to size shared memory %s: %s", TELEM_SHMEM_NAME, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    void *const shmem = mmap(NULL, TELEM_SHMEM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (shmem == MAP_FAILED)
+    {
+        log_error("mmap %s: %s", TELEM_SHMEM_NAME, strerror(errno));
+        return -1;
+    }
+
+    /* Readers of a previous run see 'head' go back and start over. Touching the whole ring here also
+    means recording never page faults. */
+    telem = shmem;
+    __atomic_store_n(&(telem->head), 0, __ATOMIC_RELEASE);
+    memset(telem->ring, 0, sizeof(telem->ring));
+    telem->ring_len = TELEM_RING_LEN;
+    telem->ch_num = ch_num < TELEM_CH_NUM ? ch_num : TELEM_CH_NUM;
+    telem->tick_period_ns = tick_period_ns;
+    __atomic_store_n(&(telem->version), TELEM_VERSION, __ATOMIC_RELEASE);
+    telem_ch_num = telem->ch_num;
+    telem_head = 0;
+    return 0;
+}
+
+void telem_record(uint32_t const flags)
+{
+    if (telem == NULL)
+    {
+        return;
+    }
+    ctrl_stats_t const *const ctrl_stats = ctrl_stats_get();
+    loop_stats_t const *const loop_stats = loop_stats_get();
+    actr_io_stats_t const *const io_stats = actr_io_stats_get();
+
+    uint32_t rec_flags = flags;
+    rec_flags |= ctrl_stats->busy != last.ctrl_busy ? TELEM_FLAG_CTRL_BUSY : 0;
+    rec_flags |= loop_stats->overruns != last.overruns ? TELEM_FLAG_OVERRUN : 0;
+    rec_flags |= io_stats->errors != last.errors ? TELEM_FLAG_I2C_ERROR : 0;
+    rec_flags |= io_stats->overwrites != last.overwrites ? TELEM_FLAG_OVERWRITE : 0;
+
+    struct telem_rec *const rec = &(telem->ring[telem_head & (TELEM_RING_LEN - 1)]);
+    uint32_t const seq = (uint32_t)(telem_head * 2U);
+    __atomic_store_n(&(rec->seq), seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    rec->flags = rec_flags;
+    rec->time_ns = telem_now_ns(); /* Served by the vDSO, not a system call. */
+    rec->ctrl_seq = ctrl_stats->seq;
+    rec->wake_lat_ns = (flags & (TELEM_FLAG_WAKE | TELEM_FLAG_SYNC | TELEM_FLAG_DEADLINE)) ? 0 : loop_stats->wake_lat_last_ns;
+    rec->i2c_ns = io_stats->busy_ns - last.busy_ns;
+    actr_applied_get(rec->duty, telem_ch_num);
+    __atomic_store_n(&(rec->seq), seq + 2, __ATOMIC_RELEASE);
+    telem_head++;
+    __atomic_store_n(&(telem->head), telem_head, __ATOMIC_RELEASE);
+
+    last.ctrl_busy = ctrl_stats->busy;
+    last.overruns = loop_stats->overruns;
+    last.errors = io_stats->errors;
+    last.overwrites = io_stats->overwrites;
+    last.busy_ns = io_stats->busy_ns;
+}
+
+/**
+ * @brief Copy record @p n out of the ring.
+ * @return 0 on success and -1 if it was overwritten before or while it was copied.
+ */
+static int telem_rec_read(struct telem_shmem const *const shmem, uint64_t const n, struct telem_rec *const rec)
+{
+    struct telem_rec const *const src = &(shmem->ring[n & (TELEM_RING_LEN - 1)]);
+    uint32_t const seq = (uint32_t)((n * 2U) + 2U);
+    if (__atomic_load_n(&(src->seq), __ATOMIC_ACQUIRE) != seq)
+    {
+        return -1;
+    }
+    memcpy(rec, src, sizeof(*rec));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&(src->seq), __ATOMIC_RELAXED) == seq ? 0 : -1;
+}
+
+static int telem_u32_cmp(void const *a, void const *b)
+{
+    uint32_t const val_a = *(uint32_t const *)a;
+    uint32_t const val_b = *(uint32_t const *)b;
+    return (val_a > val_b) - (val_a < val_b);
+}
+
+/**
+ * @brief Get a percentile of sorted samples.
+ * @return Percentile in microseconds or 0 if there are no samples.
+ */
+static double telem_pct_us(uint32_t const *const sorted, uint32_t const num, double const pct)
+{
+    if (num == 0)
+    {
+        return 0.0;
+    }
+    return sorted[telem_pct_rank(num, pct) - 1] / 1000.0;
+}
+
+/**
+ * @brief Sort samples and print their percentiles.
+ */
+static void telem_pct_print(char const *const name, uint32_t *const samples, uint32_t const num)
+{
+    qsort(samples, num, sizeof(samples[0]), telem_u32_cmp);
+    printf(" | %s us p50 %.1f p99 %.1f p99.9 %.1f max %.1f", name, telem_pct_us(samples, num, 50),
+           telem_pct_us(samples, num, 99), telem_pct_us(samples, num, 99.9), telem_pct_us(samples, num, 100));
+}
+
+uint64_t telem_pct_rank(uint64_t const num, double const pct)
+{
+    uint64_t const rank = (uint64_t)ceil((pct / 100.0) * num);
+    return rank < 1 && num > 0 ? 1 : rank;
+}
+
+int telem_stats_main(uint32_t const interval_ms)
+{
+    int const fd = shm_open(TELEM_SHMEM_NAME, O_RDONLY, 0);
+    if (fd == -1)
+    {
+        log_error("shm_open %s: %s, is the daemon running?", TELEM_SHMEM_NAME, strerror(errno));
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1 || (size_t)st.st_size < TELEM_SHMEM_SIZE)
+    {
+        log_error("Shared memory %s is smaller than expected", TELEM_SHMEM_NAME);
+        close(fd);
+        return -1;
+    }
+    struct telem_shmem const *const shmem = mmap(NULL, TELEM_SHMEM_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (shmem == MAP_FAILED)
+    {
+        log_error("mmap %s: %s", TELEM_SHMEM_NAME, strerror(errno));
+        return -1;
+    }
+    if (__atomic_load_n(&(shmem->version), __ATOMIC_ACQUIRE) != TELEM_VERSION || shmem->ring_len != TELEM_RING_LEN)
+    {
+        log_error("Telemetry segment has version %u, expected %u", shmem->version, TELEM_VERSION);
+        return -1;
+    }
+
+    static uint32_t wake_lat[TELEM_RING_LEN];
+    static uint32_t jitter[TELEM_RING_LEN];
+    static uint32_t i2c[TELEM_RING_LEN];
+    struct timespec const interval = {.tv_sec = interval_ms / 1000U, .tv_nsec = (interval_ms % 1000U) * 1000000L};
+    uint64_t next = __atomic_load_n(&(shmem->head), __ATOMIC_ACQUIRE);
+    uint64_t tick_last_ns = 0;
+    while (1)
+    {
+        nanosleep(&interval, NULL);
+        uint64_t const head = __atomic_load_n(&(shmem->head), __ATOMIC_ACQUIRE);
+        uint64_t lost = 0;
+        if (head < next)
+        {
+            /* Daemon restarted. */
+            next = 0;
+            tick_last_ns = 0;
+        }
+        if (head - next > TELEM_RING_LEN)
+        {
+            lost += head - next - TELEM_RING_LEN;
+            next = head - TELEM_RING_LEN;
+            tick_last_ns = 0;
+        }
+
+        uint32_t rec_num = 0, tick_num = 0, jitter_num = 0;
+        uint32_t flag_num[10] = {0};
+        int64_t const period_ns = shmem->tick_period_ns;
+        for (; next < head; next++)
+        {
+            struct telem_rec rec;
+            if (telem_rec_read(shmem, next, &rec) != 0)
+            {
+                lost++;
+                tick_last_ns = 0;
+                continue;
+            }
+            for (uint8_t flag_i = 0; flag_i < sizeof(flag_num) / sizeof(flag_num[0]); flag_i++)
+            {
+                flag_num[flag_i] += (rec.flags >> flag_i) & 1U;
+            }
+            i2c[rec_num++] = rec.i2c_ns;
+            if (rec.flags & (TELEM_FLAG_WAKE | TELEM_FLAG_SYNC | TELEM_FLAG_DEADLINE))
+            {
+                continue;
+            }
+            wake_lat[tick_num++] = rec.wake_lat_ns;
+            if (tick_last_ns != 0)
+            {
+                int64_t const dev_ns = (int64_t)(rec.time_ns - tick_last_ns) - period_ns;
+                jitter[jitter_num++] = (uint32_t)(dev_ns < 0 ? -dev_ns : dev_ns);
+            }
+            tick_last_ns = rec.time_ns;
+        }
+
+        printf("records %u (doorbell %u, pwm %u, deadline %u, lost %llu)", rec_num, flag_num[0], flag_num[7], flag_num[8], (unsigned long long)lost);
+        telem_pct_print("wake latency", wake_lat, tick_num);
+        telem_pct_print("jitter", jitter, jitter_num);
+        telem_pct_print("i2c", i2c, rec_num);
+        printf(" | stale %u, emergency %u, ctrl busy %u, overrun %u, i2c error %u, overwrite %u, override %u\n",
+               flag_num[1], flag_num[2], flag_num[3], flag_num[4], flag_num[5], flag_num[6], flag_num[9]);
+        fflush(stdout);
+    }
+    return 0;
+}
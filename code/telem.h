@@ -0,0 +1,93 @@
+#ifndef _TELEM_H_
+#define _TELEM_H_
+
+#include <stdint.h>
+
+#include "actuator.h"
+
+/*
+Read-only (for everyone but the daemon) segment with a ring of one record per applied control
+frame. Record n lives in 'ring[n % TELEM_RING_LEN]'. The daemon makes its 'seq' odd (2n+1), writes
+the record, makes 'seq' even (2n+2) with release ordering and then sets 'head' to n+1. A reader
+copies a record and keeps it only if 'seq' was 2n+2 both before and after the copy, otherwise it
+was overwritten by a newer one.
+*/
+#define TELEM_SHMEM_NAME "tco_shmem_actuation_telem"
+#define TELEM_VERSION 1U
+#define TELEM_RING_LEN 1024U /* Power of two. */
+#define TELEM_CH_NUM ACTR_CH_MAX
+#define TELEM_STATS_INTERVAL_MS_DEFAULT 1000U
+
+/* Record flags. */
+#define TELEM_FLAG_WAKE 0x01U      /* Applied because a producer rang the doorbell, not on a tick. */
+#define TELEM_FLAG_STALE 0x02U     /* Control frame was stale. */
+#define TELEM_FLAG_EMERGENCY 0x04U /* Control frame had the emergency flag set. */
+#define TELEM_FLAG_CTRL_BUSY 0x08U /* Control read gave up and the previous frame was reused. */
+#define TELEM_FLAG_OVERRUN 0x10U   /* Loop missed tick deadlines since the previous record. */
+#define TELEM_FLAG_I2C_ERROR 0x20U /* A bus write failed since the previous record. */
+#define TELEM_FLAG_OVERWRITE 0x40U /* Channel values were replaced before a bus writer got to them. */
+#define TELEM_FLAG_SYNC 0x80U      /* Applied ahead of a PWM period, not on a tick. */
+#define TELEM_FLAG_DEADLINE 0x100U /* Applied because a trajectory point came due, not on a tick. */
+#define TELEM_FLAG_OVERRIDE 0x200U /* Some channels were overridden through the override segment. */
+
+/* Actuation state after one control frame was applied. */
+struct telem_rec
+{
+    uint32_t seq;
+    uint32_t flags;
+    uint64_t time_ns;     /* CLOCK_MONOTONIC when the frame was handed to the bus writers. */
+    uint32_t ctrl_seq;    /* Sequence of the control frame, see "ctrl_stats_t.seq". */
+    uint32_t wake_lat_ns; /* How late the loop woke up for the tick, 0 for doorbell and PWM records. */
+    uint32_t i2c_ns;      /* Time the bus writers spent writing since the previous record. */
+    uint32_t reserved;
+    uint16_t duty[TELEM_CH_NUM]; /* Duty cycle last written to each channel, 0 if turned off. */
+};
+
+/* Layout of the telemetry segment. */
+struct telem_shmem
+{
+    uint32_t version;
+    uint32_t ring_len;
+    uint32_t ch_num;         /* Channels with a chip behind them, the rest of 'duty' is unused. */
+    uint32_t tick_period_ns; /* Period of the loop tick. */
+    uint64_t head;           /* Records written so far. */
+    struct telem_rec ring[TELEM_RING_LEN];
+};
+
+#define TELEM_SHMEM_SIZE sizeof(struct telem_shmem)
+
+/**
+ * @brief Create and map the telemetry segment and start a new ring in it.
+ * @param tick_period_ns Period of the loop tick.
+ * @param ch_num Channels with a chip behind them.
+ * @return 0 on success and -1 on failure.
+ */
+int telem_init(uint32_t const tick_period_ns, uint16_t const ch_num);
+
+/**
+ * @brief Append a record for the frame that was just applied. Does nothing if "telem_init" was not
+ * called. Makes no system calls so it is safe to use from the control loop.
+ * @param flags TELEM_FLAG_WAKE, TELEM_FLAG_SYNC, TELEM_FLAG_DEADLINE, TELEM_FLAG_STALE and
+ * TELEM_FLAG_EMERGENCY as they apply to the frame. The other flags are worked out from the counters of the other modules.
+ */
+void telem_record(uint32_t const flags);
+
+/**
+ * @brief Get the nearest rank of a percentile, the one percentiles printed by "telem_stats_main"
+ * and the benchmarks use.
+ * @param num Samples.
+ * @param pct Percentile, 0 to 100.
+ * @return 1-based rank of the smallest sample that at least @p pct percent of the samples do not
+ * exceed, or 0 if there are no samples.
+ */
+uint64_t telem_pct_rank(uint64_t const num, double const pct);
+
+/**
+ * @brief Attach to the telemetry segment of a running daemon and print latency, jitter and I2C time
+ * percentiles of the records written in each interval until interrupted.
+ * @param interval_ms Length of an interval.
+ * @return 0 on success and -1 on failure.
+ */
+int telem_stats_main(uint32_t const interval_ms);
+
+#endif /* _TELEM_H_ */
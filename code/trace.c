@@ -0,0 +1,309 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+
+#include "tco_libd.h"
+
+#include "trace.h"
+#include "actuator.h"
+#include "ctrl.h"
+#include "alog.h"
+
+_Static_assert(sizeof(((struct tco_shmem_data_control *)0)->ch) / sizeof(((struct tco_shmem_data_control *)0)->ch[0]) == TRACE_CH_NUM,
+               "TRACE_CH_NUM must match the channels of a control frame");
+
+#define TRACE_RECS_OFF sizeof(struct trace_hdr)
+
+static int rec_fd = -1;
+static struct trace_hdr *rec_hdr = NULL; /* Start of the mapped file. */
+static uint64_t rec_cap = 0;             /* Records the mapped file has room for. */
+static uint64_t rec_start_ns = 0;
+
+static int replay_fd = -1;
+static struct trace_hdr const *replay_hdr = NULL;
+static size_t replay_len = 0;
+static struct trace_rec const *replay_recs = NULL;
+static uint64_t replay_num = 0;
+static uint64_t replay_next = 0;
+static double replay_speed = 0.0;
+static uint64_t replay_base_ns = 0; /* CLOCK_MONOTONIC time recorded time 0 maps to. */
+static uint32_t replay_batch = 0;
+static trace_replay_stats_t replay_stats = {0};
+
+static uint64_t trace_now_ns(clockid_t const clock)
+{
+    struct timespec now;
+    clock_gettime(clock, &now);
+    return ((uint64_t)now.tv_sec * 1000000000U) + now.tv_nsec;
+}
+
+static size_t trace_file_len(uint64_t const rec_num)
+{
+    return TRACE_RECS_OFF + (rec_num * sizeof(struct trace_rec));
+}
+
+/**
+ * @brief Size the trace file for @p cap records and map it, replacing the previous mapping.
+ * @return 0 on success and -1 on failure.
+ */
+static int trace_record_map(uint64_t const cap)
+{
+    if (rec_hdr != NULL)
+    {
+        munmap(rec_hdr, trace_file_len(rec_cap));
+        rec_hdr = NULL;
+    }
+    if (ftruncate(rec_fd, trace_file_len(cap)) == -1)
+    {
+        return -1;
+    }
+    void *const map = mmap(NULL, trace_file_len(cap), PROT_READ | PROT_WRITE, MAP_SHARED, rec_fd, 0);
+    if (map == MAP_FAILED)
+    {
+        return -1;
+    }
+    rec_hdr = map;
+    rec_cap = cap;
+    return 0;
+}
+
+int trace_record_open(char const *const path)
+{
+    if ((rec_fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) == -1)
+    {
+        log_error("Failed to create trace %s: %s", path, strerror(errno));
+        return -1;
+    }
+    if (trace_record_map(TRACE_GROW_RECS) != 0)
+    {
+        log_error("Failed to map trace %s: %s", path, strerror(errno));
+        close(rec_fd);
+        rec_fd = -1;
+        return -1;
+    }
+    rec_hdr->magic = TRACE_MAGIC;
+    rec_hdr->version = TRACE_VERSION;
+    rec_hdr->rec_size = sizeof(struct trace_rec);
+    rec_hdr->ch_num = TRACE_CH_NUM;
+    rec_hdr->rec_num = 0;
+    rec_hdr->start_ns = trace_now_ns(CLOCK_REALTIME);
+    rec_start_ns = trace_now_ns(CLOCK_MONOTONIC);
+    log_info("Recording control frames to %s", path);
+    return 0;
+}
+
+void trace_record(struct tco_shmem_data_control const *const ctrl, uint32_t const flags)
+{
+    if (rec_hdr == NULL)
+    {
+        return;
+    }
+    uint64_t const rec_num = rec_hdr->rec_num;
+    if (rec_num == rec_cap && trace_record_map(rec_cap + TRACE_GROW_RECS) != 0)
+    {
+        alog_error("Failed to grow the trace to %llu records, recording stopped: %s", (unsigned long long)(rec_cap + TRACE_GROW_RECS), strerror(errno));
+        trace_record_close();
+        return;
+    }
+
+    struct trace_rec *const rec = (struct trace_rec *)((uint8_t *)rec_hdr + trace_file_len(rec_num));
+    rec->time_ns = trace_now_ns(CLOCK_MONOTONIC) - rec_start_ns;
+    rec->ctrl_seq = ctrl_stats_get()->seq;
+    rec->flags = flags;
+    rec->ctrl = *ctrl;
+    actr_frame_get(rec->duty, TRACE_CH_NUM);
+    __atomic_store_n(&(rec_hdr->rec_num), rec_num + 1, __ATOMIC_RELEASE);
+}
+
+void trace_record_close(void)
+{
+    if (rec_fd == -1)
+    {
+        return;
+    }
+    if (rec_hdr != NULL)
+    {
+        uint64_t const rec_num = rec_hdr->rec_num;
+        munmap(rec_hdr, trace_file_len(rec_cap));
+        rec_hdr = NULL;
+        if (ftruncate(rec_fd, trace_file_len(rec_num)) == -1)
+        {
+            log_error("Failed to trim the trace: %s", strerror(errno));
+        }
+        log_info("Recorded %llu control frames", (unsigned long long)rec_num);
+    }
+    close(rec_fd);
+    rec_fd = -1;
+}
+
+/**
+ * @brief Get when a record is due.
+ */
+static uint64_t trace_replay_due_ns(struct trace_rec const *const rec)
+{
+    return replay_base_ns + (uint64_t)(rec->time_ns / replay_speed);
+}
+
+/**
+ * @brief Make the timer fire at @p deadline_ns or disarm it for 0. Either way, expirations that were
+ * not read yet are dropped.
+ */
+static void trace_replay_arm(uint64_t const deadline_ns)
+{
+    struct itimerspec spec = {0};
+    spec.it_value.tv_sec = deadline_ns / 1000000000U;
+    spec.it_value.tv_nsec = deadline_ns % 1000000000U;
+    if (timerfd_settime(replay_fd, TFD_TIMER_ABSTIME, &spec, NULL) == -1)
+    {
+        alog_error("timerfd_settime: %s", strerror(errno));
+    }
+}
+
+int trace_replay_open(char const *const path, double const speed)
+{
+    int const fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        log_error("Failed to open trace %s: %s", path, strerror(errno));
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1 || (size_t)st.st_size < TRACE_RECS_OFF)
+    {
+        log_error("Trace %s is too short", path);
+        close(fd);
+        return -1;
+    }
+    void const *const map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        log_error("mmap %s: %s", path, strerror(errno));
+        return -1;
+    }
+    replay_hdr = map;
+    replay_len = st.st_size;
+    if (replay_hdr->magic != TRACE_MAGIC || replay_hdr->version != TRACE_VERSION ||
+        replay_hdr->rec_size != sizeof(struct trace_rec) || replay_hdr->ch_num != TRACE_CH_NUM)
+    {
+        log_error("%s is not a version %u trace of this build", path, TRACE_VERSION);
+        trace_replay_close();
+        return -1;
+    }
+    /* A recorder that crashed leaves the file longer than its records. */
+    replay_num = (replay_len - TRACE_RECS_OFF) / sizeof(struct trace_rec);
+    if (replay_hdr->rec_num < replay_num)
+    {
+        replay_num = replay_hdr->rec_num;
+    }
+    if ((replay_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK)) == -1)
+    {
+        log_error("timerfd_create: %s", strerror(errno));
+        trace_replay_close();
+        return -1;
+    }
+    replay_recs = (struct trace_rec const *)((uint8_t const *)map + TRACE_RECS_OFF);
+    replay_next = 0;
+    replay_speed = speed;
+    memset(&replay_stats, 0, sizeof(replay_stats));
+
+    /* The first record is due right away. */
+    uint64_t const now = trace_now_ns(CLOCK_MONOTONIC);
+    replay_base_ns = now - (replay_num > 0 && speed > 0.0 ? (uint64_t)(replay_recs[0].time_ns / speed) : 0);
+    trace_replay_arm(now);
+    log_info("Replaying %llu control frames from %s at %s speed", (unsigned long long)replay_num, path, speed > 0.0 ? "scaled" : "full");
+    return 0;
+}
+
+int trace_replay_fd(void)
+{
+    return replay_fd;
+}
+
+struct trace_rec const *trace_replay_next(void)
+{
+    if (replay_next >= replay_num)
+    {
+        trace_replay_arm(0);
+        return NULL;
+    }
+    struct trace_rec const *const rec = &(replay_recs[replay_next]);
+    if (replay_speed > 0.0)
+    {
+        uint64_t const now = trace_now_ns(CLOCK_MONOTONIC);
+        uint64_t const due = trace_replay_due_ns(rec);
+        if (due > now)
+        {
+            trace_replay_arm(due);
+            return NULL;
+        }
+        replay_stats.late_sum_ns += now - due;
+        if (now - due > replay_stats.late_max_ns)
+        {
+            replay_stats.late_max_ns = now - due;
+        }
+    }
+    else if (replay_batch++ >= TRACE_REPLAY_BATCH)
+    {
+        /* Let the loop handle signals and writer wakeups in between batches. */
+        replay_batch = 0;
+        trace_replay_arm(trace_now_ns(CLOCK_MONOTONIC));
+        return NULL;
+    }
+    replay_next++;
+    replay_stats.frames++;
+    return rec;
+}
+
+uint8_t trace_replay_done(void)
+{
+    return replay_next >= replay_num;
+}
+
+int trace_replay_verify(struct trace_rec const *const rec)
+{
+    uint16_t duty[TRACE_CH_NUM];
+    actr_frame_get(duty, TRACE_CH_NUM);
+    for (uint8_t ch_i = 0; ch_i < TRACE_CH_NUM; ch_i++)
+    {
+        if (duty[ch_i] != rec->duty[ch_i])
+        {
+            replay_stats.mismatches++;
+            alog_error("Frame %llu gave duty cycle %u on channel %u, %u when recorded", (unsigned long long)(rec - replay_recs),
+                       duty[ch_i], ch_i, rec->duty[ch_i]);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+trace_replay_stats_t const *trace_replay_stats_get(void)
+{
+    return &replay_stats;
+}
+
+void trace_replay_close(void)
+{
+    if (replay_hdr == NULL)
+    {
+        return;
+    }
+    log_info("Replayed %llu of %llu control frames, %llu gave different outputs, late us: mean %.1f, max %.1f",
+             (unsigned long long)replay_stats.frames, (unsigned long long)replay_num, (unsigned long long)replay_stats.mismatches,
+             replay_stats.frames > 0 ? (replay_stats.late_sum_ns / 1000.0) / replay_stats.frames : 0.0, replay_stats.late_max_ns / 1000.0);
+    munmap((void *)replay_hdr, replay_len);
+    replay_hdr = NULL;
+    replay_recs = NULL;
+    if (replay_fd != -1)
+    {
+        close(replay_fd);
+        replay_fd = -1;
+    }
+}
@@ -0,0 +1,117 @@
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <stdint.h>
+
+#include "tco_shmem.h"
+
+/*
+Binary trace of control frames, written through a shared mapping so records cost a copy and no
+system call. The file is a 'struct trace_hdr' followed by 'rec_num' records of 'rec_size' bytes.
+'rec_num' is updated after every record so a trace cut short by a crash is still readable. Records
+keep the frame as it was read and the duty cycles it turned into, so a replay both reproduces the
+run and checks that the same frames still give the same outputs.
+*/
+#define TRACE_MAGIC 0x54524341U /* "ACRT" read as a little-endian word. */
+#define TRACE_VERSION 1U
+#define TRACE_CH_NUM 16U /* Channels of a control frame. */
+#define TRACE_GROW_RECS 4096U /* Records the file grows by when it is full. */
+#define TRACE_REPLAY_BATCH 256U /* Records replayed per loop wakeup at full speed. */
+
+/* Start of a trace file. */
+struct trace_hdr
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t rec_size; /* Size of 'struct trace_rec' of the writer. */
+    uint32_t ch_num;   /* Elements of 'duty'. */
+    uint64_t rec_num;  /* Records in the file. */
+    uint64_t start_ns; /* CLOCK_REALTIME when recording started. */
+};
+
+/* One applied control frame. */
+struct trace_rec
+{
+    uint64_t time_ns;  /* CLOCK_MONOTONIC time since recording started. */
+    uint32_t ctrl_seq; /* Sequence of the control frame, see "ctrl_stats_t.seq". */
+    uint32_t flags;    /* TELEM_FLAG_* of the telemetry record written for the frame. */
+    struct tco_shmem_data_control ctrl;
+    uint16_t duty[TRACE_CH_NUM]; /* Duty cycles the frame was turned into. */
+};
+
+/* Counters of a replay. */
+typedef struct trace_replay_stats_t
+{
+    uint64_t frames;     /* Records replayed. */
+    uint64_t mismatches; /* Records whose frame gave different duty cycles than when recorded. */
+    uint64_t late_max_ns;
+    uint64_t late_sum_ns; /* How late records were replayed compared with their scaled time. */
+} trace_replay_stats_t;
+
+/**
+ * @brief Create or replace a trace file and start recording to it.
+ * @param path Path of the trace file.
+ * @return 0 on success and -1 on failure.
+ */
+int trace_record_open(char const *const path);
+
+/**
+ * @brief Append a record for the frame that was just applied. Does nothing if not recording. Every
+ * TRACE_GROW_RECS records the file gets extended and mapped again, otherwise no system calls are
+ * made. Recording stops if that fails, actuation goes on.
+ * @param ctrl Control frame that was applied.
+ * @param flags TELEM_FLAG_* of the frame.
+ */
+void trace_record(struct tco_shmem_data_control const *const ctrl, uint32_t const flags);
+
+/**
+ * @brief Cut the trace file to the records written and close it.
+ */
+void trace_record_close(void);
+
+/**
+ * @brief Map a trace file for replay and arm the timer returned by "trace_replay_fd" for its first
+ * record.
+ * @param path Path of the trace file.
+ * @param speed Factor the recorded time gets sped up by, 0 to replay as fast as possible.
+ * @return 0 on success and -1 on failure.
+ */
+int trace_replay_open(char const *const path, double const speed);
+
+/**
+ * @brief Get the timer that becomes readable when records are due.
+ * @return File descriptor or -1 if no trace is open.
+ */
+int trace_replay_fd(void);
+
+/**
+ * @brief Get the next record that is due. Once none is, the timer is reset and armed for the next one.
+ * @return Record or NULL if none is due or the trace ended.
+ */
+struct trace_rec const *trace_replay_next(void);
+
+/**
+ * @brief Check if every record was replayed.
+ * @return 1 if the trace ended and 0 otherwise.
+ */
+uint8_t trace_replay_done(void);
+
+/**
+ * @brief Compare the frame just handed to the actuators with what was recorded for it.
+ * @param rec Record that was replayed.
+ * @return 0 if they match and -1 otherwise.
+ */
+int trace_replay_verify(struct trace_rec const *const rec);
+
+/**
+ * @brief Get the replay counters.
+ * @return Pointer to the counters.
+ */
+trace_replay_stats_t const *trace_replay_stats_get(void);
+
+/**
+ * @brief Log the replay counters, unmap the trace and close the timer.
+ */
+void trace_replay_close(void);
+
+#endif /* _TRACE_H_ */